@@ -172,6 +172,17 @@ __attribute__((packed))
 #endif
 AUTH_HDR;
 
+/* the maximum number of datagrams moved by a single batch call */
+#define RC_BATCH_MAX 32
+
+/* a datagram of a batch given to the sendmmsg and recvmmsg socket functions */
+typedef struct rc_dgram {
+	void *buf;
+	size_t len;			/* on receive the buffer size, set to the octets received */
+	struct sockaddr *addr;
+	socklen_t addrlen;		/* on receive the address size, set to its length */
+} rc_dgram;
+
 typedef struct rc_sockets_override {
 	void *ptr;
 	const char *static_secret;
@@ -183,6 +194,11 @@ typedef struct rc_sockets_override {
 	                    struct sockaddr *src_addr, socklen_t *addrlen);
 	int (*lock)(void *ptr);
 	int (*unlock)(void *ptr);
+	/* optional; return the number of datagrams moved, or -1 on error */
+	int (*sendmmsg)(void *ptr, int sockfd, rc_dgram *msgs, unsigned vlen, int flags);
+	int (*recvmmsg)(void *ptr, int sockfd, rc_dgram *msgs, unsigned vlen, int flags);
+	/* optional; returns 1 when sockfd is readable, 0 on timeout, or -1 on error */
+	int (*wait_fd)(void *ptr, int sockfd, int timeout_ms);
 } rc_sockets_override;
 
 struct rc_conf
@@ -201,9 +217,24 @@ struct rc_conf
 	struct dict_attr	*dictionary_attributes;
 	struct dict_value	*dictionary_values;
 	struct dict_vendor	*dictionary_vendors;
+	struct rc_dict_index	*dictionary_index; /* the lookups of the above; see dictindex.c */
+	struct rc_dict_image	*dictionary_image; /* a binary dictionary; see dictimage.c */
 
 	rc_sockets_override	so;
 	unsigned		so_type; /* rc_socket_type */
+
+	struct rc_sockpool	*sockpool; /* idle UDP sockets; see sockpool.c */
+	struct rc_uring		*uring; /* set when serv-type is udp-uring */
+	struct rc_tcp_mux	*tcpmux; /* persistent connections when serv-type is tcp */
+	struct rc_health	*health; /* the state of the servers; see health.c */
+	struct rc_policy	*auth_policy; /* server selection; see health.c */
+	struct rc_policy	*acct_policy;
+	struct rc_dns_cache	*dnscache; /* resolved server addresses; see dnscache.c */
+	struct rc_servers_file	*servers_file; /* the secrets of the servers file; see srvfile.c */
+	struct rc_srcaddr_cache	*srcaddr; /* our address towards the servers; see srcaddr.c */
+	struct rc_netns		*netns; /* the namespace option; see netns.c */
+	struct rc_key_cache	*keys; /* MD5 states of the secrets; see keycache.c */
+	const struct rc_crypto_provider *crypto; /* the provider of MD5; see crypto.c */
 };
 
 /* older compilers don't like seeing this typedef along with the one in radcli.h */
@@ -466,7 +466,8 @@ typedef enum rc_send_status {
 	OK_RC=0,
 	TIMEOUT_RC=1,
 	REJECT_RC=2,
-	CHALLENGE_RC=3
+	CHALLENGE_RC=3,
+	PENDING_RC=4	//!< The request has not completed; see rc_request_start().
 } rc_send_status;
 
 
@@ -497,6 +498,7 @@ typedef struct send_data /* Used to pass information to sendserver() function */
 	int            retries;
 	VALUE_PAIR     *send_pairs;     //!< More a/v pairs to send.
 	VALUE_PAIR     *receive_pairs;  //!< Where to place received a/v pairs.
+	int            timeout_ms;	//!< Session timeout in milliseconds; overrides timeout if non-zero.
 } SEND_DATA;
 
 #define AUTH_VECTOR_LEN		16
@@ -504,6 +506,21 @@ typedef struct send_data /* Used to pass information to sendserver() function */
 struct rc_aaa_ctx_st;
 typedef struct rc_aaa_ctx_st RC_AAA_CTX;
 
+struct rc_request_st;
+typedef struct rc_request_st RC_REQUEST;
+
+struct rc_engine_st;
+typedef struct rc_engine_st RC_ENGINE;
+
+/** Called by rc_engine_run() when a submitted request completes */
+typedef void (*rc_engine_cb)(RC_ENGINE *engine, SEND_DATA *data, int result, void *usr);
+
+/** The speed of a crypto provider, as measured by rc_crypto_benchmark() */
+typedef struct rc_crypto_bench {
+	char const	*name;		//!< The value of the crypto-provider option selecting it.
+	double		ns;		//!< Nanoseconds to sign and verify a typical request.
+} rc_crypto_bench;
+
 #ifndef RC_MIN
 #define RC_MIN(a, b)     ((a) < (b) ? (a) : (b))
 #endif
@@ -593,6 +610,8 @@ void rc_avpair_get_attr (VALUE_PAIR *vp, unsigned *type, unsigned *id);
 
 void rc_buildreq(rc_handle const *rh, SEND_DATA *data, int code, char *server, unsigned short port,
 		 char *secret, int timeout, int retries);
+void rc_buildreq_ms(rc_handle const *rh, SEND_DATA *data, int code, char *server, unsigned short port,
+		    char *secret, int timeout_ms, int retries);
 int rc_auth(rc_handle *rh, uint32_t client_port, VALUE_PAIR *send,
             VALUE_PAIR **received, char *msg);
 int rc_auth_proxy(rc_handle *rh, VALUE_PAIR *send, VALUE_PAIR **received, char *msg);
@@ -609,6 +628,11 @@ int rc_aaa_ctx_server(rc_handle *rh, RC_AAA_CTX **ctx, SERVER *aaaserver,
                       rc_type type, uint32_t client_port,
                       VALUE_PAIR *send, VALUE_PAIR **received,
                       char *msg, int add_nas_port, rc_standard_codes request_type);
+int rc_aaa_ctx_server_deadline(rc_handle *rh, RC_AAA_CTX **ctx, SERVER *aaaserver,
+                               rc_type type, uint32_t client_port,
+                               VALUE_PAIR *send, VALUE_PAIR **received,
+                               char *msg, int add_nas_port, rc_standard_codes request_type,
+                               int deadline_ms);
 
 /* config.c */
 
@@ -633,6 +657,7 @@ rc_socket_type rc_get_socket_type(rc_handle * rh);
 
 int rc_read_dictionary (rc_handle *rh, char const *filename);
 int rc_read_dictionary_from_buffer (rc_handle *rh, char const *buf, size_t size);
+int rc_write_dictionary(rc_handle const *rh, char const *filename);
 
 DICT_ATTR *rc_dict_addattr(rc_handle *rh, char const * namestr, uint32_t value, int type, uint32_t vendorspec);
 DICT_VALUE *rc_dict_addval(rc_handle *rh, char const * attrstr, char const * namestr, uint32_t value);
@@ -670,12 +695,31 @@ void rc_openlog(char const *ident);
 
 int rc_send_server (rc_handle *rh, SEND_DATA *data, char *msg,
                     rc_type type);
+RC_REQUEST *rc_request_new(rc_handle *rh, SEND_DATA *data, char *msg, rc_type type);
+void rc_request_free(RC_REQUEST *req);
+int rc_request_start(RC_REQUEST *req);
+int rc_request_get_fd(RC_REQUEST *req);
+int rc_request_get_timeout(RC_REQUEST *req);
+int rc_request_on_readable(RC_REQUEST *req);
+int rc_request_on_timeout(RC_REQUEST *req);
+int rc_request_get_result(RC_REQUEST *req);
 
 /* aaa_ctx.c */
 void rc_aaa_ctx_free(RC_AAA_CTX *ctx);
 const char *rc_aaa_ctx_get_secret(RC_AAA_CTX *ctx);
 const void *rc_aaa_ctx_get_vector(RC_AAA_CTX *ctx);
 
+/* engine.c */
+RC_ENGINE *rc_engine_new(rc_handle *rh);
+void rc_engine_free(RC_ENGINE *engine);
+int rc_engine_submit(RC_ENGINE *engine, SEND_DATA *data, rc_type type,
+		     rc_engine_cb cb, void *usr);
+int rc_engine_run(RC_ENGINE *engine, int timeout_ms);
+unsigned rc_engine_pending(RC_ENGINE *engine);
+
+/* crypto.c */
+int rc_crypto_benchmark(rc_crypto_bench *results, unsigned max);
+
 /* obsolete functions */
 #define _RADCLI_GCC_VERSION (__GNUC__ * 10000 + __GNUC_MINOR__ * 100 + __GNUC_PATCHLEVEL__)
 #if !defined RADCLI_INTERNAL_BUILD
@@ -9,7 +9,12 @@
 #include <config.h>
 #include <includes.h>
 #include <radcli/radcli.h>
+#include <pthread.h>
+#include <poll.h>
 #include "util.h"
+#include "rng.h"
+#include "sendserver.h"
+#include "health.h"
 
 /**
  * @defgroup radcli-api Main API
@@ -18,13 +23,28 @@
  * @{
  */
 
-/** Generates a random ID
+static pthread_once_t id_once = PTHREAD_ONCE_INIT;
+static unsigned id_next;
+
+static void id_seed(void)
+{
+	id_next = rc_random_u32();
+}
+
+/** Generates an ID for a request
  *
- * @return the random ID.
+ * IDs are taken from a counter with a random start, so that the requests
+ * of a process do not get the same ID until all 256 were used. The IDs
+ * are not tracked: a request sent with rc_send_server() holds its socket
+ * exclusively, and the asynchronous engine replaces the ID with one
+ * allocated per socket and server.
+ *
+ * @return the ID.
  */
 static unsigned char rc_get_id()
 {
-	return (unsigned char)(random() & UCHAR_MAX);
+	pthread_once(&id_once, id_seed);
+	return (unsigned char)__atomic_fetch_add(&id_next, 1, __ATOMIC_RELAXED);
 }
 
 /** Build a skeleton RADIUS request using information from the config file
@@ -46,10 +66,33 @@ void rc_buildreq(rc_handle const *rh, SEND_DATA * data, int code, char *server,
 	data->svc_port = port;
 	data->seq_nbr = rc_get_id();
 	data->timeout = timeout;
+	data->timeout_ms = 0;
 	data->retries = retries;
 	data->code = code;
 }
 
+/** Build a skeleton RADIUS request with a timeout in milliseconds
+ *
+ * This is rc_buildreq() for timeouts below a second, or which are not
+ * a whole number of seconds.
+ *
+ * @param rh a handle to parsed configuration.
+ * @param data a pointer to a SEND_DATA structure.
+ * @param code one of standard RADIUS codes (e.g., PW_ACCESS_REQUEST).
+ * @param server the name of the server.
+ * @param port the server's port number.
+ * @param secret the secret used by the server.
+ * @param timeout_ms the timeout in milliseconds of a message.
+ * @param retries the number of retries.
+ */
+void rc_buildreq_ms(rc_handle const *rh, SEND_DATA * data, int code, char *server,
+		    unsigned short port, char *secret, int timeout_ms, int retries)
+{
+	rc_buildreq(rh, data, code, server, port, secret,
+		    (timeout_ms + 999) / 1000, retries);
+	data->timeout_ms = timeout_ms;
+}
+
 /** Builds an authentication/accounting request for port id nas_port with the value_pairs send and submits it to a server.
  * This function keeps its state in ctx after a successful operation. It can be deallocated using
  * rc_aaa_ctx_free().
@@ -90,10 +133,337 @@ int rc_aaa_ctx(rc_handle * rh, RC_AAA_CTX ** ctx, uint32_t nas_port,
 				 add_nas_port, request_type);
 }
 
+/*- Returns the time at which a request started now must be given up
+ -*/
+static double deadline_expires(int deadline_ms)
+{
+	if (deadline_ms <= 0)
+		return 0;
+	return rc_getmtime() + deadline_ms / 1000.0;
+}
+
+#define IS_REPLY(r) ((r) == OK_RC || (r) == CHALLENGE_RC || (r) == REJECT_RC)
+#define IS_UNANSWERED(r) ((r) == TIMEOUT_RC || (r) == NETUNREACH_RC)
+
+/* the position in the servers tried by a request */
+typedef struct server_iter {
+	int order[RC_SERVER_MAX];	/* as chosen by the selection policy */
+	int next;
+	unsigned pass;
+	uint32_t skipped;	/* servers known to be dead */
+	int returned;		/* the number of servers tried */
+} server_iter;
+
+/*- Orders the servers of a request by the selection policy of aaaserver
+ -*/
+static void server_iter_init(rc_handle * rh, SERVER * aaaserver,
+			     server_iter * it)
+{
+	rc_policy *policy = NULL;
+	int i;
+
+	memset(it, 0, sizeof(*it));
+
+	if (rh->health != NULL) {
+		if (aaaserver == rc_conf_srv(rh, "authserver"))
+			policy = rh->auth_policy;
+		else if (aaaserver == rc_conf_srv(rh, "acctserver"))
+			policy = rh->acct_policy;
+	}
+
+	if (policy != NULL) {
+		rc_health_order(rh->health, policy, aaaserver, it->order);
+	} else {
+		for (i = 0; i < aaaserver->max; i++)
+			it->order[i] = i;
+	}
+}
+
+/*- Returns the next server a request is sent to
+ *
+ * The servers are returned in the order of the policy, except that those
+ * known to be dead (see health.c) are skipped, and only tried once all
+ * others failed.
+ *
+ * @return the index of the server in aaaserver, or -1 when all were tried.
+ -*/
+static int next_server(rc_handle * rh, SERVER * aaaserver, server_iter * it)
+{
+	int i;
+
+	while (it->pass < 2) {
+		while (it->next < aaaserver->max) {
+			i = it->order[it->next++];
+			if (it->pass == 0) {
+				if (rh->health == NULL ||
+				    rc_health_usable(rh->health, aaaserver->name[i],
+						     aaaserver->port[i])) {
+					it->returned++;
+					return i;
+				}
+				DEBUG(LOG_INFO, "skipping dead server %u", i);
+				it->skipped |= 1 << i;
+			} else if (it->skipped & (1 << i)) {
+				it->returned++;
+				return i;
+			}
+		}
+		it->pass++;
+		it->next = 0;
+	}
+
+	return -1;
+}
+
+/*- Returns the timeout of a request to a server within a deadline
+ *
+ * The time left until expires is shared by the servers which may still
+ * be tried, and the timeout is shortened so that the request and its
+ * retries fit in the share of its server.
+ *
+ * @param timeout_ms the configured timeout in milliseconds.
+ * @param retries the number of retries of the request.
+ * @param expires the deadline as returned by rc_getmtime(), or zero.
+ * @param servers the number of servers left, including this one.
+ * @return the timeout in milliseconds, or zero if the deadline passed.
+ -*/
+static int budget_timeout(int timeout_ms, int retries, double expires,
+			  int servers)
+{
+	double left;
+	int share;
+
+	if (expires == 0)
+		return timeout_ms;
+
+	left = (expires - rc_getmtime()) * 1000;
+	if (left < 1)
+		return 0;
+
+	share = (int)(left / servers / (retries + 1));
+	if (share < 1)
+		share = 1;
+	return share < timeout_ms ? share : timeout_ms;
+}
+
+static void start_server(rc_handle * rh, SERVER * aaaserver, int i)
+{
+	if (rh->health != NULL)
+		rc_health_start(rh->health, aaaserver->name[i],
+				aaaserver->port[i]);
+}
+
+static void report_server(rc_handle * rh, SERVER * aaaserver, int i,
+			  int result, double start)
+{
+	if (rh->health != NULL)
+		rc_health_report(rh->health, aaaserver->name[i],
+				 aaaserver->port[i], result,
+				 rc_getmtime() - start);
+}
+
+/*- Races a request over the servers of aaaserver
+ *
+ * The request is sent to the first server, and also to the next one
+ * whenever hedge_ms milliseconds pass without a reply, or a server did
+ * not answer within its retries. The first reply is taken and the
+ * requests to the other servers are abandoned.
+ *
+ * Only an Access-Request is hedged: an Accounting-Request is not
+ * idempotent, and every server it reached would record it.
+ *
+ * The request to the first server uses data; the others are sent with
+ * copies of its attributes as given, which are taken before the first
+ * request adds those of its own, such as NAS-IP-Address. On return
+ * data->receive_pairs holds the attributes of the reply, if any. If
+ * expires is non-zero, the requests still in flight at that time are
+ * abandoned.
+ *
+ * @return the result of the reply, or that of the last failed request.
+ -*/
+static int rc_aaa_hedged(rc_handle * rh, RC_AAA_CTX ** ctx, SERVER * aaaserver,
+			 rc_type type, SEND_DATA * data, int request_type,
+			 int timeout_ms, int retries, int hedge_ms,
+			 double expires, char *msg)
+{
+	SEND_DATA extra[RC_SERVER_MAX];
+	SEND_DATA *sd[RC_SERVER_MAX];
+	RC_REQUEST *reqs[RC_SERVER_MAX];
+	struct pollfd pfd[RC_SERVER_MAX];
+	int idx[RC_SERVER_MAX];
+	int srv[RC_SERVER_MAX];	/* the server of each request */
+	double sent[RC_SERVER_MAX];
+	server_iter it;
+	VALUE_PAIR *send_pairs;
+	double now, hedge_at = 0;
+	int started = 0, pending = 0, winner = -1, more = 1;
+	int result = TIMEOUT_RC, ret, wait, i, j, n, timeout;
+
+	send_pairs = rc_avpair_copy(data->send_pairs);
+	if (send_pairs == NULL && data->send_pairs != NULL)
+		return ERROR_RC;
+
+	server_iter_init(rh, aaaserver, &it);
+	for (;;) {
+		if (pending == 0 && (!more || !IS_UNANSWERED(result)))
+			break;
+
+		now = rc_getmtime();
+		if (expires > 0 && now >= expires) {
+			rc_log(LOG_ERR, "%s: the request deadline expired", __func__);
+			result = TIMEOUT_RC;
+			break;
+		}
+
+		if (more && (pending == 0 || now >= hedge_at)) {
+			srv[started] = next_server(rh, aaaserver, &it);
+			if (srv[started] < 0) {
+				more = 0;
+				continue;
+			}
+			i = started++;
+			hedge_at = now + hedge_ms / 1000.0;
+
+			if (i == 0) {
+				sd[i] = data;
+			} else {
+				sd[i] = &extra[i];
+				memset(sd[i], 0, sizeof(SEND_DATA));
+				sd[i]->send_pairs = rc_avpair_copy(send_pairs);
+			}
+			/* the servers run in parallel and share no budget */
+			timeout = budget_timeout(timeout_ms, retries, expires, 1);
+			rc_buildreq_ms(rh, sd[i], request_type,
+				       aaaserver->name[srv[i]], aaaserver->port[srv[i]],
+				       aaaserver->secret[srv[i]], timeout, retries);
+
+			reqs[i] = rc_request_new(rh, sd[i], msg, type);
+			if (reqs[i] == NULL) {
+				result = ERROR_RC;
+				continue;
+			}
+			rc_request_set_expiry(reqs[i], expires);
+
+			DEBUG(LOG_INFO, "sending request to server %u (%u pending)",
+			      srv[i], pending);
+			start_server(rh, aaaserver, srv[i]);
+			sent[i] = now;
+			ret = rc_request_start(reqs[i]);
+			if (ret != PENDING_RC)
+				report_server(rh, aaaserver, srv[i], ret, sent[i]);
+			if (ret == PENDING_RC) {
+				pending++;
+			} else if (IS_REPLY(ret)) {
+				result = ret;
+				winner = i;
+				break;
+			} else {
+				result = ret;
+				if (IS_UNANSWERED(ret))
+					hedge_at = now;
+			}
+			continue;
+		}
+
+		/* wait for a reply, a timeout or the next server's turn */
+		wait = -1;
+		if (more)
+			wait = (int)((hedge_at - now) * 1000) + 1;
+		if (expires > 0 && (wait < 0 || expires < hedge_at))
+			wait = (int)((expires - now) * 1000) + 1;
+		for (i = 0, n = 0; i < started; i++) {
+			if (reqs[i] == NULL ||
+			    rc_request_get_result(reqs[i]) != PENDING_RC)
+				continue;
+			ret = rc_request_get_timeout(reqs[i]);
+			if (wait < 0 || ret < wait)
+				wait = ret;
+			pfd[n].fd = rc_request_get_fd(reqs[i]);
+			pfd[n].events = POLLIN;
+			pfd[n].revents = 0;
+			idx[n++] = i;
+		}
+
+		ret = poll(pfd, n, wait);
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			rc_log(LOG_ERR, "%s: poll: %s", __func__, strerror(errno));
+			result = ERROR_RC;
+			break;
+		}
+
+		for (j = 0; j < n && winner < 0; j++) {
+			i = idx[j];
+			if (pfd[j].revents != 0)
+				ret = rc_request_on_readable(reqs[i]);
+			else if (rc_request_get_timeout(reqs[i]) == 0)
+				ret = rc_request_on_timeout(reqs[i]);
+			else
+				continue;
+
+			if (ret == PENDING_RC)
+				continue;
+
+			pending--;
+			result = ret;
+			report_server(rh, aaaserver, srv[i], ret, sent[i]);
+			if (IS_REPLY(ret)) {
+				winner = i;
+			} else {
+				DEBUG(LOG_INFO, "server %u failed (%d)", srv[i], ret);
+				/* its successor need not wait for the delay */
+				if (IS_UNANSWERED(ret))
+					hedge_at = now;
+			}
+		}
+		if (winner >= 0)
+			break;
+	}
+
+	if (winner >= 0) {
+		DEBUG(LOG_INFO, "reply from server %u of %u started",
+		      srv[winner], started);
+		if (rc_request_get_ctx(reqs[winner], ctx) != OK_RC) {
+			result = ERROR_RC;
+			winner = -1;
+		}
+	}
+
+	/* the requests still in flight are abandoned */
+	for (i = 0; i < started; i++) {
+		if (reqs[i] != NULL &&
+		    rc_request_get_result(reqs[i]) == PENDING_RC)
+			report_server(rh, aaaserver, srv[i], PENDING_RC, sent[i]);
+		rc_request_free(reqs[i]);
+		if (i != winner) {
+			rc_avpair_free(sd[i]->receive_pairs);
+			sd[i]->receive_pairs = NULL;
+		}
+	}
+	if (winner > 0)
+		data->receive_pairs = sd[winner]->receive_pairs;
+	for (i = 1; i < started; i++)
+		rc_avpair_free(sd[i]->send_pairs);
+	rc_avpair_free(send_pairs);
+
+	return result;
+}
+
 /** Builds an authentication/accounting request for port id nas_port with the value_pairs send and submits it to a specified server.
  * This function keeps its state in ctx after a successful operation. It can be deallocated using
  * rc_aaa_ctx_free().
  *
+ * The servers are tried in order, moving to the next one after a server
+ * did not reply within its retries. If radius_deadtime is set, a server
+ * which did not reply is tried last for that many seconds. The
+ * authserver-policy and acctserver-policy options select the server
+ * tried first instead of the first one listed. If
+ * radius_hedge_delay is set, an Access-Request is also sent to the next
+ * server whenever that many milliseconds pass without a reply, and the
+ * first reply is taken. If radius_deadline_ms is set, the request is given up
+ * after that many milliseconds; see rc_aaa_ctx_server_deadline().
+ *
  * @param rh a handle to parsed configuration.
  * @param ctx if non-NULL it will contain the context of the request; Its initial value should be NULL and it must be released using rc_aaa_ctx_free().
  * @param aaaserver a non-NULL SERVER to send the message to.
@@ -115,15 +485,54 @@ int rc_aaa_ctx_server(rc_handle * rh, RC_AAA_CTX ** ctx, SERVER * aaaserver,
 		      char *msg, int add_nas_port,
 		      rc_standard_codes request_type)
 {
+	return rc_aaa_ctx_server_deadline(rh, ctx, aaaserver, type, nas_port,
+					  send, received, msg, add_nas_port,
+					  request_type,
+					  rc_conf_int_2(rh, "radius_deadline_ms", 0));
+}
+
+/** Builds a request as rc_aaa_ctx_server(), bounding the time it may take
+ *
+ * The retries and the failover to the next servers stop when deadline_ms
+ * milliseconds passed since the call, and %TIMEOUT_RC is returned. The
+ * time left is shared by the servers which may still be tried: the timeout
+ * of each request is shortened so that its retries fit in its share.
+ *
+ * @param rh a handle to parsed configuration.
+ * @param ctx if non-NULL it will contain the context of the request; Its initial value should be NULL and it must be released using rc_aaa_ctx_free().
+ * @param aaaserver a non-NULL SERVER to send the message to.
+ * @param type must be %AUTH or %ACCT.
+ * @param nas_port the physical NAS port number to use (may be zero).
+ * @param send a VALUE_PAIR array of values (e.g., PW_USER_NAME).
+ * @param received an allocated array of received values.
+ * @param msg must be an array of PW_MAX_MSG_SIZE or NULL; will contain the concatenation of any
+ *	PW_REPLY_MESSAGE received.
+ * @param add_nas_port this should be zero; if non-zero it will include PW_NAS_PORT in sent pairs.
+ * @param request_type one of standard RADIUS codes (e.g., PW_ACCESS_REQUEST).
+ * @param deadline_ms the maximum duration of the call in milliseconds, or
+ *	zero for no limit other than the timeouts and retries.
+ * @return as rc_aaa_ctx_server().
+ */
+int rc_aaa_ctx_server_deadline(rc_handle * rh, RC_AAA_CTX ** ctx,
+			       SERVER * aaaserver, rc_type type,
+			       uint32_t nas_port,
+			       VALUE_PAIR * send, VALUE_PAIR ** received,
+			       char *msg, int add_nas_port,
+			       rc_standard_codes request_type, int deadline_ms)
+{
+	double expires = deadline_expires(deadline_ms);
 	SEND_DATA data;
 	VALUE_PAIR *adt_vp = NULL;
 	int result;
-	int timeout = rc_conf_int(rh, "radius_timeout");
+	int timeout_ms = rc_conf_timeout_ms(rh);
 	int retries = rc_conf_int(rh, "radius_retries");
 	double start_time = 0;
 	double now = 0;
 	time_t dtime;
 	int servernum;
+	server_iter it;
+	int hedge_ms = rc_conf_int_2(rh, "radius_hedge_delay", 0);
+	int timeout;
 
 	data.send_pairs = send;
 	data.receive_pairs = NULL;
@@ -162,18 +571,43 @@ int rc_aaa_ctx_server(rc_handle * rh, RC_AAA_CTX ** ctx, SERVER * aaaserver,
 		data.receive_pairs = NULL;
 	}
 
-	servernum = 0;
-	do {
-		rc_buildreq(rh, &data, request_type, aaaserver->name[servernum],
-			    aaaserver->port[servernum],
-			    aaaserver->secret[servernum], timeout, retries);
+	/* a transport lock is held by a request until it completes */
+	if (hedge_ms > 0 && aaaserver->max > 1 && rh->so.lock == NULL &&
+	    request_type == PW_ACCESS_REQUEST) {
+		result = rc_aaa_hedged(rh, ctx, aaaserver, type, &data,
+				       request_type, timeout_ms, retries,
+				       hedge_ms, expires, msg);
+		if (IS_REPLY(result))
+			*received = data.receive_pairs;
+		else
+			rc_avpair_free(data.receive_pairs);
+		return result;
+	}
+
+	result = ERROR_RC;
+	server_iter_init(rh, aaaserver, &it);
+	while ((servernum = next_server(rh, aaaserver, &it)) >= 0) {
+		timeout = budget_timeout(timeout_ms, retries, expires,
+					 aaaserver->max - it.returned + 1);
+		if (timeout == 0) {
+			rc_log(LOG_ERR, "%s: the request deadline expired", __func__);
+			result = TIMEOUT_RC;
+			break;
+		}
+
+		rc_buildreq_ms(rh, &data, request_type, aaaserver->name[servernum],
+			       aaaserver->port[servernum],
+			       aaaserver->secret[servernum], timeout, retries);
 
 		if (request_type == PW_ACCOUNTING_REQUEST) {
 			dtime = rc_getmtime() - start_time;
 			rc_avpair_assign(adt_vp, &dtime, 0);
 		}
 
-		result = rc_send_server_ctx(rh, ctx, &data, msg, type);
+		start_server(rh, aaaserver, servernum);
+		now = rc_getmtime();
+		result = rc_send_server_until(rh, ctx, &data, msg, type, expires);
+		report_server(rh, aaaserver, servernum, result, now);
 
 		if ((result == OK_RC) || (result == CHALLENGE_RC) || (result == REJECT_RC)) {
 			if (request_type != PW_ACCOUNTING_REQUEST) {
@@ -190,10 +624,11 @@ int rc_aaa_ctx_server(rc_handle * rh, RC_AAA_CTX ** ctx, SERVER * aaaserver,
 		rc_avpair_free(data.receive_pairs);
 		data.receive_pairs = NULL;
 
-		DEBUG(LOG_INFO, "rc_send_server_ctx returned error (%d) for server %u: (remaining: %d)",
-              result, servernum, aaaserver->max-servernum);
-		servernum++;
-	} while (servernum < aaaserver->max && ((result == TIMEOUT_RC) || (result == NETUNREACH_RC)));
+		DEBUG(LOG_INFO, "rc_send_server_ctx returned error (%d) for server %u",
+              result, servernum);
+		if (!IS_UNANSWERED(result))
+			break;
+	}
 
 	return result;
 }
@@ -306,7 +741,7 @@ int rc_check(rc_handle * rh, char *host, char *secret, unsigned short port,
 	SEND_DATA data;
 	int result;
 	uint32_t service_type;
-	int timeout = rc_conf_int(rh, "radius_timeout");
+	int timeout_ms = rc_conf_timeout_ms(rh);
 	int retries = rc_conf_int(rh, "radius_retries");
 	rc_type type;
 
@@ -325,8 +760,8 @@ int rc_check(rc_handle * rh, char *host, char *secret, unsigned short port,
 	rc_avpair_add(rh, &(data.send_pairs), PW_SERVICE_TYPE, &service_type, 0,
 		      0);
 
-	rc_buildreq(rh, &data, PW_STATUS_SERVER, host, port, secret, timeout,
-		    retries);
+	rc_buildreq_ms(rh, &data, PW_STATUS_SERVER, host, port, secret,
+		       timeout_ms, retries);
 	result = rc_send_server(rh, &data, msg, type);
 
 	rc_avpair_free(data.receive_pairs);
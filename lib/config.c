@@ -19,20 +19,29 @@
  * @{
  */
 
+#define _GNU_SOURCE /* for sendmmsg() and recvmmsg() */
 #include <config.h>
 #include <includes.h>
 #include <radcli/radcli.h>
 #include <options.h>
 #include "util.h"
 #include "tls.h"
+#include "sockpool.h"
+#include "tcpmux.h"
+#include "health.h"
+#include "dnscache.h"
+#include "srvfile.h"
+#include "srcaddr.h"
+#include "netns.h"
+#include "keycache.h"
+#include "crypto.h"
+#include "uring.h"
 
 #ifndef TRUE
 #define TRUE  1
 #define FALSE 0
 #endif
 
-static int rc_conf_int_2(rc_handle const *rh, char const *optname, int complain);
-
 /** Find an option in the option list
  *
  * @param rh a handle to parsed configuration.
@@ -395,15 +404,12 @@ static ssize_t plain_sendto(void *ptr, int sockfd,
 	return sendto(sockfd, buf, len, flags, dest_addr, addrlen);
 }
 
+/* the connection is established once, and kept, by tcpmux.c */
 static ssize_t plain_tcp_sendto(void *ptr, int sockfd,
 			    const void *buf, size_t len, int flags,
 			    const struct sockaddr *dest_addr, socklen_t addrlen)
 {
-	if((connect(sockfd, dest_addr, addrlen)) != 0){
-		rc_log(LOG_ERR, "%s: Connect Call Failed : %s", __FUNCTION__, strerror(errno));
-		return -1;
-	}
-	return sendto(sockfd, buf, len, flags, dest_addr, addrlen);
+	return send(sockfd, buf, len, flags);
 }
 
 static ssize_t plain_recvfrom(void *ptr, int sockfd,
@@ -413,6 +419,81 @@ static ssize_t plain_recvfrom(void *ptr, int sockfd,
 	return recvfrom(sockfd, buf, len, flags, src_addr, addrlen);
 }
 
+static int plain_sendmmsg(void *ptr, int sockfd, rc_dgram *msgs,
+			  unsigned vlen, int flags)
+{
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr hdr[RC_BATCH_MAX];
+	struct iovec iov[RC_BATCH_MAX];
+	unsigned i;
+
+	vlen = RC_MIN(vlen, RC_BATCH_MAX);
+	memset(hdr, 0, vlen * sizeof(hdr[0]));
+	for (i = 0; i < vlen; i++) {
+		iov[i].iov_base = msgs[i].buf;
+		iov[i].iov_len = msgs[i].len;
+		hdr[i].msg_hdr.msg_iov = &iov[i];
+		hdr[i].msg_hdr.msg_iovlen = 1;
+		hdr[i].msg_hdr.msg_name = msgs[i].addr;
+		hdr[i].msg_hdr.msg_namelen = msgs[i].addrlen;
+	}
+
+	return sendmmsg(sockfd, hdr, vlen, flags);
+#else
+	unsigned i;
+
+	for (i = 0; i < vlen; i++) {
+		if (sendto(sockfd, msgs[i].buf, msgs[i].len, flags,
+			   msgs[i].addr, msgs[i].addrlen) == -1)
+			return i > 0 ? (int)i : -1;
+	}
+	return vlen;
+#endif
+}
+
+static int plain_recvmmsg(void *ptr, int sockfd, rc_dgram *msgs,
+			  unsigned vlen, int flags)
+{
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr hdr[RC_BATCH_MAX];
+	struct iovec iov[RC_BATCH_MAX];
+	unsigned i;
+	int ret;
+
+	vlen = RC_MIN(vlen, RC_BATCH_MAX);
+	memset(hdr, 0, vlen * sizeof(hdr[0]));
+	for (i = 0; i < vlen; i++) {
+		iov[i].iov_base = msgs[i].buf;
+		iov[i].iov_len = msgs[i].len;
+		hdr[i].msg_hdr.msg_iov = &iov[i];
+		hdr[i].msg_hdr.msg_iovlen = 1;
+		hdr[i].msg_hdr.msg_name = msgs[i].addr;
+		hdr[i].msg_hdr.msg_namelen = msgs[i].addrlen;
+	}
+
+	ret = recvmmsg(sockfd, hdr, vlen, flags, NULL);
+	for (i = 0; ret > 0 && i < (unsigned)ret; i++) {
+		msgs[i].len = hdr[i].msg_len;
+		msgs[i].addrlen = hdr[i].msg_hdr.msg_namelen;
+	}
+	return ret;
+#else
+	unsigned i;
+	ssize_t ret;
+
+	for (i = 0; i < vlen; i++) {
+		/* only the first receive may block */
+		ret = recvfrom(sockfd, msgs[i].buf, msgs[i].len,
+			       i > 0 ? flags | MSG_DONTWAIT : flags,
+			       msgs[i].addr, &msgs[i].addrlen);
+		if (ret == -1)
+			return i > 0 ? (int)i : -1;
+		msgs[i].len = ret;
+	}
+	return vlen;
+#endif
+}
+
 static void plain_close_fd(int fd)
 {
 	close(fd);
@@ -464,7 +545,9 @@ static const rc_sockets_override default_socket_funcs = {
 	.get_fd = plain_get_fd,
 	.close_fd = plain_close_fd,
 	.sendto = plain_sendto,
-	.recvfrom = plain_recvfrom
+	.recvfrom = plain_recvfrom,
+	.sendmmsg = plain_sendmmsg,
+	.recvmmsg = plain_recvmmsg
 };
 
 static const rc_sockets_override default_tcp_socket_funcs = {
@@ -488,6 +571,174 @@ static int set_addr(struct sockaddr_storage *ss, const char *ip)
 	return 0;
 }
 
+/*- Creates the pool of UDP sockets shared by the requests of the handle
+ -*/
+static int init_sockpool(rc_handle *rh)
+{
+	OPTION *option;
+	unsigned size = RC_SOCKPOOL_DEFAULT_SIZE;
+	unsigned do_connect = 0;
+	const char *txt;
+
+	option = find_option(rh, "udp-pool-size", OT_INT);
+	if (option != NULL && option->val != NULL) {
+		if (*((int *)option->val) < 0) {
+			rc_log(LOG_ERR, "udp-pool-size < 0 is illegal");
+			return -1;
+		}
+		size = *((int *)option->val);
+	}
+
+	txt = rc_conf_str(rh, "udp-connect");
+	if (txt != NULL && strcasecmp(txt, "true") == 0)
+		do_connect = 1;
+
+	rh->sockpool = rc_sockpool_new(size, do_connect,
+				       rc_conf_int_2(rh, "udp-rcvbuf", FALSE),
+				       rc_conf_int_2(rh, "udp-sndbuf", FALSE));
+	if (rh->sockpool == NULL)
+		return -1;
+
+	return 0;
+}
+
+/*- Creates the cache of the resolved addresses of the servers, and the
+ * index of the servers file
+ -*/
+static int init_dnscache(rc_handle *rh)
+{
+	OPTION *option;
+	int ttl = RC_DNS_DEFAULT_TTL;
+
+	option = find_option(rh, "dns-cache-ttl", OT_INT);
+	if (option != NULL && option->val != NULL) {
+		ttl = *((int *)option->val);
+		if (ttl < 0) {
+			rc_log(LOG_ERR, "dns-cache-ttl < 0 is illegal");
+			return -1;
+		}
+	}
+
+	/* the names in the servers file are resolved again as often */
+	rh->servers_file = rc_servers_file_new(ttl ? ttl : RC_DNS_DEFAULT_TTL,
+					       rh->netns);
+	if (rh->servers_file == NULL)
+		return -1;
+
+	/* without a cache, the names are still resolved in the namespace */
+	if (ttl == 0 && rh->netns == NULL)
+		return 0;
+
+	rh->dnscache = rc_dns_cache_new(ttl, rh->netns);
+	if (rh->dnscache == NULL)
+		return -1;
+
+	return 0;
+}
+
+/*- Creates the cache of the source addresses towards the servers
+ -*/
+static int init_srcaddr(rc_handle *rh)
+{
+	OPTION *option;
+	int ttl = RC_SRCADDR_DEFAULT_TTL;
+
+	option = find_option(rh, "srcaddr-cache-ttl", OT_INT);
+	if (option != NULL && option->val != NULL) {
+		ttl = *((int *)option->val);
+		if (ttl < 0) {
+			rc_log(LOG_ERR, "srcaddr-cache-ttl < 0 is illegal");
+			return -1;
+		}
+	}
+
+	if (ttl == 0 && rh->netns == NULL)
+		return 0;
+
+	rh->srcaddr = rc_srcaddr_cache_new(ttl, rh->netns);
+	if (rh->srcaddr == NULL)
+		return -1;
+
+	return 0;
+}
+
+/* the maximum retransmission timeout in seconds, from RFC 5080 */
+#define RC_DEFAULT_MRT 16
+
+/*- Initializes the tracker of the servers and the server selection policies
+ *
+ * @param rh a handle to parsed configuration.
+ * @return 0 on success, -1 when failure.
+ -*/
+static int init_health(rc_handle *rh)
+{
+	static const char *names[2] = { "authserver-policy", "acctserver-policy" };
+	rc_policy *policy[2];
+	const char *txt;
+	int deadtime, mrt, mrd, i;
+
+	deadtime = rc_conf_int_2(rh, "radius_deadtime", FALSE);
+	if (deadtime < 0) {
+		rc_log(LOG_ERR, "radius_deadtime < 0 is illegal");
+		return -1;
+	}
+
+	for (i = 0; i < 2; i++) {
+		policy[i] = malloc(sizeof(rc_policy));
+		if (policy[i] == NULL) {
+			rc_log(LOG_CRIT, "out of memory");
+			goto fail;
+		}
+		if (rc_policy_parse(rc_conf_str(rh, names[i]), policy[i]) < 0) {
+			rc_log(LOG_ERR, "invalid %s: %s", names[i],
+			       rc_conf_str(rh, names[i]));
+			i++;
+			goto fail;
+		}
+	}
+
+	rh->health = rc_health_new(deadtime);
+	if (rh->health == NULL)
+		goto fail;
+
+	txt = rc_conf_str(rh, "radius_rto");
+	if (txt != NULL && strcasecmp(txt, "adaptive") == 0) {
+		mrt = rc_conf_int_2(rh, "radius_mrt", FALSE);
+		mrd = rc_conf_int_2(rh, "radius_mrd", FALSE);
+		if (mrt < 0 || mrd < 0) {
+			rc_log(LOG_ERR, "radius_mrt and radius_mrd must not be negative");
+			rc_health_free(rh->health);
+			rh->health = NULL;
+			goto fail;
+		}
+		rc_health_set_rto(rh->health, mrt ? mrt : RC_DEFAULT_MRT, mrd);
+	} else if (txt != NULL && strcasecmp(txt, "fixed") != 0) {
+		rc_log(LOG_ERR, "invalid radius_rto: %s", txt);
+		rc_health_free(rh->health);
+		rh->health = NULL;
+		goto fail;
+	}
+
+	rh->auth_policy = policy[0];
+	rh->acct_policy = policy[1];
+	return 0;
+
+ fail:
+	while (i-- > 0)
+		free(policy[i]);
+	return -1;
+}
+
+static void deinit_health(rc_handle *rh)
+{
+	rc_health_free(rh->health);
+	rh->health = NULL;
+	free(rh->auth_policy);
+	rh->auth_policy = NULL;
+	free(rh->acct_policy);
+	rh->acct_policy = NULL;
+}
+
 /** Applies and initializes any parameters from the radcli configuration
  *
  * When no configuration file is provided and the configuration
@@ -502,6 +753,55 @@ int rc_apply_config(rc_handle *rh)
 	const char *txt;
 	int ret;
 
+	rc_sockpool_free(rh, rh->sockpool);
+	rh->sockpool = NULL;
+	rc_tcp_mux_free(rh, rh->tcpmux);
+	rh->tcpmux = NULL;
+	deinit_health(rh);
+	rc_dns_cache_free(rh->dnscache);
+	rh->dnscache = NULL;
+	rc_servers_file_free(rh->servers_file);
+	rh->servers_file = NULL;
+	rc_srcaddr_cache_free(rh->srcaddr);
+	rh->srcaddr = NULL;
+#ifdef HAVE_IO_URING
+	rc_deinit_uring(rh);
+#endif
+	rc_netns_close(rh->netns);
+	rh->netns = NULL;
+	rc_key_cache_free(rh->keys);
+	rh->keys = NULL;
+
+	txt = rc_conf_str(rh, "crypto-provider");
+	rh->crypto = rc_crypto_find(txt);
+	if (rh->crypto == NULL) {
+		rc_log(LOG_ERR, "crypto-provider %s is not available", txt);
+		return -1;
+	}
+	DEBUG(LOG_INFO, "using the %s crypto provider", rh->crypto->name);
+
+	rh->keys = rc_key_cache_new(rh->crypto);
+	if (rh->keys == NULL)
+		return -1;
+
+	txt = rc_conf_str(rh, "namespace");
+	if (txt != NULL) {
+		rh->netns = rc_netns_open(txt);
+		if (rh->netns == NULL) {
+			rc_log(LOG_ERR, "namespace %s cannot be used", txt);
+			return -1;
+		}
+	}
+
+	if (init_health(rh) < 0)
+		return -1;
+
+	if (init_dnscache(rh) < 0)
+		return -1;
+
+	if (init_srcaddr(rh) < 0)
+		return -1;
+
 	memset(&rh->own_bind_addr, 0, sizeof(rh->own_bind_addr));
 	rh->own_bind_addr_set = 0;
 	rc_own_bind_addr(rh, &rh->own_bind_addr);
@@ -525,12 +825,22 @@ int rc_apply_config(rc_handle *rh)
 		memset(&rh->so, 0, sizeof(rh->so));
 		rh->so_type = RC_SOCKET_UDP;
 		memcpy(&rh->so, &default_socket_funcs, sizeof(rh->so));
-		ret = 0;
+		ret = init_sockpool(rh);
+#ifdef HAVE_IO_URING
+	} else if (strcasecmp(txt, "udp-uring") == 0) {
+		memset(&rh->so, 0, sizeof(rh->so));
+		rh->so_type = RC_SOCKET_UDP;
+		memcpy(&rh->so, &default_socket_funcs, sizeof(rh->so));
+		ret = rc_init_uring(rh);
+		if (ret == 0)
+			ret = init_sockpool(rh);
+#endif
 	} else if (strcasecmp(txt, "tcp") == 0) {
 		memset(&rh->so, 0, sizeof(rh->so));
 		rh->so_type = RC_SOCKET_TCP;
 		memcpy(&rh->so, &default_tcp_socket_funcs, sizeof(rh->so));
-		ret = 0;
+		rh->tcpmux = rc_tcp_mux_new(0);
+		ret = rh->tcpmux != NULL ? 0 : -1;
 #ifdef HAVE_GNUTLS
 	} else if (strcasecmp(txt, "dtls") == 0) {
 		ret = rc_init_tls(rh, SEC_FLAG_DTLS);
@@ -723,9 +1033,10 @@ char *rc_conf_str(rc_handle const *rh, char const *optname)
  *
  * @param rh a handle to parsed configuration.
  * @param optname the name of an option.
- * @return config option value.
+ * @param complain whether to log an unset option.
+ * @return config option value, or 0 if unset.
  */
-static int rc_conf_int_2(rc_handle const *rh, char const *optname, int complain)
+int rc_conf_int_2(rc_handle const *rh, char const *optname, int complain)
 {
 	OPTION *option;
 
@@ -749,6 +1060,20 @@ int rc_conf_int(rc_handle const *rh, char const *optname)
         return rc_conf_int_2(rh, optname, TRUE);
 }
 
+/*- Returns the timeout of a request in milliseconds
+ *
+ * radius_timeout_ms takes precedence over radius_timeout when set.
+ -*/
+int rc_conf_timeout_ms(rc_handle const *rh)
+{
+	int timeout_ms = rc_conf_int_2(rh, "radius_timeout_ms", FALSE);
+
+	if (timeout_ms > 0)
+		return timeout_ms;
+
+	return rc_conf_int(rh, "radius_timeout") * 1000;
+}
+
 /** Get the value of a config option
  *
  * @param rh a handle to parsed configuration.
@@ -799,7 +1124,7 @@ int rc_test_config(rc_handle *rh, char const *filename)
 		return -1;
 	}
 
-	if (rc_conf_int(rh, "radius_timeout") <= 0)
+	if (rc_conf_timeout_ms(rh) <= 0)
 	{
 		rc_log(LOG_ERR,"%s: radius_timeout <= 0 is illegal", filename);
 		return -1;
@@ -817,88 +1142,6 @@ int rc_test_config(rc_handle *rh, char const *filename)
 	return 0;
 }
 
-/** See if info matches hostname
- *
- * @param addr a struct addrinfo
- * @param hostname the name of the host.
- * @return 0 on success, -1 when failure.
- */
-static int find_match (const struct addrinfo* addr, const struct addrinfo *hostname)
-{
-	const struct addrinfo *ptr, *ptr2;
-	unsigned len1, len2;
-
-	ptr = addr;
-	while(ptr) {
-		ptr2 = hostname;
-		while(ptr2) {
-			len1 = SA_GET_INLEN(ptr->ai_addr);
-			len2 = SA_GET_INLEN(ptr2->ai_addr);
-
-			if (len1 > 0 &&
-			    len1 == len2 &&
-			    memcmp(SA_GET_INADDR(ptr->ai_addr), SA_GET_INADDR(ptr2->ai_addr), len1) == 0) {
-				return 0;
-			}
-			ptr2 = ptr2->ai_next;
- 		}
-		ptr = ptr->ai_next;
- 	}
- 	return -1;
-}
-
-/** Checks if provided address is local address
- *
- * @param addr an %AF_INET or %AF_INET6 address
- * @return 0 if local, 1 if not local, -1 on failure.
- */
-static int rc_ipaddr_local(const struct sockaddr *addr)
-{
-	int temp_sock, res, serrno;
-	struct sockaddr_storage tmpaddr;
-
-	memcpy(&tmpaddr, addr, SA_LEN(addr));
-
-	temp_sock = socket(addr->sa_family, SOCK_DGRAM, 0);
-	if (temp_sock == -1)
-		return -1;
-
-	if (addr->sa_family == AF_INET) {
-		((struct sockaddr_in*)&tmpaddr)->sin_port = 0;
-	} else {
-		((struct sockaddr_in6*)&tmpaddr)->sin6_port = 0;
-	}
-	res = bind(temp_sock, SA(&tmpaddr), SS_LEN(&tmpaddr));
-	serrno = errno;
-	close(temp_sock);
-	if (res == 0)
-		return 0;
-	if (serrno == EADDRNOTAVAIL)
-		return 1;
-	return -1;
-}
-
-/** Checks if provided name refers to ourselves
- *
- * @param info an addrinfo of the host to check
- * @return 0 if yes, 1 if no and -1 on failure.
- */
-static int rc_is_myname(const struct addrinfo *info)
-{
-	const struct addrinfo *p;
-	int	res;
-
-	p = info;
-	while(p != NULL) {
-		res = rc_ipaddr_local(p->ai_addr);
-		if (res == 0 || res == -1) {
- 			return res;
-		}
-		p = p->ai_next;
- 	}
- 	return 1;
-}
-
 /** Locate a server in the rh config or if not found, check for a servers file
  *
  * @param rh a handle to parsed configuration.
@@ -912,21 +1155,13 @@ static int rc_is_myname(const struct addrinfo *info)
 int rc_find_server_addr (rc_handle const *rh, char const *server_name,
                          struct addrinfo** info, char *secret, rc_type type)
 {
-	int             result = 0;
-	FILE           *clientfd;
-	char           *h;
-	char           *s;
-	char            buffer[128];
-	char            hostnm[AUTH_ID_LEN + 1];
-	char	       *buffer_save;
-	char	       *hostnm_save;
+	int             result;
 	SERVER	       *servers;
-	struct addrinfo *tmpinfo = NULL;
 	const char      *fservers;
 	char const      *optname;
 
 	/* Lookup the IP address of the radius server */
-	if ((*info = rc_getaddrinfo (server_name, type==AUTH?PW_AI_AUTH:PW_AI_ACCT)) == NULL)
+	if ((*info = rc_dns_lookup (rh->dnscache, server_name, type==AUTH?PW_AI_AUTH:PW_AI_ACCT)) == NULL)
 		return -1;
 
 	switch (type)
@@ -960,93 +1195,18 @@ int rc_find_server_addr (rc_handle const *rh, char const *server_name,
 
 	fservers = rc_conf_str(rh, "servers");
 	if (fservers != NULL) {
-		if ((clientfd = fopen (fservers, "r")) == NULL)
-		{
-			rc_log(LOG_ERR, "rc_find_server: couldn't open file: %s: %s", strerror(errno), rc_conf_str(rh, "servers"));
-			goto fail;
-		}
-
-		while (fgets (buffer, sizeof (buffer), clientfd) != NULL)
-		{
-			if (*buffer == '#')
-				continue;
-
-			if ((h = strtok_r(buffer, " \t\n", &buffer_save)) == NULL) /* first hostname */
-				continue;
-
-			strlcpy (hostnm, h, AUTH_ID_LEN);
-
-			if ((s = strtok_r (NULL, " \t\n", &buffer_save)) == NULL) /* and secret field */
-				continue;
-
-			strlcpy (secret, s, MAX_SECRET_LENGTH);
-
-			if (!strchr (hostnm, '/')) /* If single name form */
-			{
-				tmpinfo = rc_getaddrinfo(hostnm, 0);
-				if (tmpinfo)
-				{
-					result = find_match (*info, tmpinfo);
-					if (result == 0)
-					{
-						result++;
-						break;
-					}
-
-					freeaddrinfo(tmpinfo);
-					tmpinfo = NULL;
-				}
-			}
-			else /* <name1>/<name2> "paired" form */
-			{
-				strtok_r(hostnm, "/", &hostnm_save);
-				tmpinfo = rc_getaddrinfo(hostnm, 0);
-				if (tmpinfo)
- 				{
-					if (rc_is_myname(tmpinfo) == 0)
-					{	     /* If we're the 1st name, target is 2nd */
-						if (find_match (*info, tmpinfo) == 0)
-						{
-							result++;
-							break;
-						}
-					}
-					else	/* If we were 2nd name, target is 1st name */
- 					{
-						if (find_match (*info, tmpinfo) == 0)
-						{
-							result++;
-							break;
-						}
- 					}
-					freeaddrinfo(tmpinfo);
-					tmpinfo = NULL;
- 				}
-			}
-		}
-		fclose (clientfd);
-	}
-	if (result == 0)
-	{
-		memset (buffer, '\0', sizeof (buffer));
-		memset (secret, '\0', MAX_SECRET_LENGTH);
-		rc_log(LOG_ERR, "rc_find_server: couldn't find RADIUS server %s in %s",
-			 server_name, rc_conf_str(rh, "servers"));
-		goto fail;
+		result = rc_servers_file_find(rh->servers_file, fservers, *info,
+					      secret);
+		if (result == 0)
+			return 0;
 	}
 
-	result = 0;
-	goto cleanup;
-
- fail:
- 	freeaddrinfo(*info);
- 	result = -1;
-
- cleanup:
- 	if (tmpinfo)
- 		freeaddrinfo(tmpinfo);
-
-	return result;
+	memset (secret, '\0', MAX_SECRET_LENGTH);
+	rc_log(LOG_ERR, "rc_find_server: couldn't find RADIUS server %s in %s",
+		 server_name, fservers);
+	freeaddrinfo(*info);
+	*info = NULL;
+	return -1;
 }
 
 /**
@@ -1126,6 +1286,17 @@ rc_handle *rc_new(void)
  */
 void rc_destroy(rc_handle *rh)
 {
+	rc_sockpool_free(rh, rh->sockpool);
+	rc_tcp_mux_free(rh, rh->tcpmux);
+	deinit_health(rh);
+	rc_dns_cache_free(rh->dnscache);
+	rc_servers_file_free(rh->servers_file);
+	rc_srcaddr_cache_free(rh->srcaddr);
+#ifdef HAVE_IO_URING
+	rc_deinit_uring(rh);
+#endif
+	rc_netns_close(rh->netns);
+	rc_key_cache_free(rh->keys);
 	rc_dict_free(rh);
 	rc_config_free(rh);
 	free(rh);
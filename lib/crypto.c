@@ -0,0 +1,391 @@
+/*
+ * crypto.c	The providers of MD5, selected at run time.
+ *
+ * MD5 is computed by the implementation built in the library, by nettle
+ * or by gnutls, whichever of them were available at build time. The
+ * handle uses the one set in the crypto-provider option, or, with the
+ * value auto, the one found fastest on this CPU by a benchmark run once
+ * per process. Without the option, nettle is used when available, as
+ * before the providers were selectable.
+ *
+ * A provider is only offered when it hashes a known message correctly,
+ * which excludes, for example, gnutls in FIPS mode. A context gnutls
+ * fails to set up is computed by the builtin implementation instead, and
+ * one it fails to copy is reported to the caller.
+ *
+ * License:	BSD
+ *
+ */
+
+#include <config.h>
+#include <includes.h>
+#include <radcli/radcli.h>
+#include <pthread.h>
+#include "util.h"
+#include "crypto.h"
+#include "md5.h"
+
+#ifdef HAVE_NETTLE
+# include <nettle/md5.h>
+#endif
+
+#ifdef HAVE_GNUTLS
+# include <gnutls/gnutls.h>
+# include <gnutls/crypto.h>
+/* copying a hash context appeared in 3.6.9 */
+# if GNUTLS_VERSION_NUMBER >= 0x030609
+#  define HAVE_GNUTLS_MD5
+# endif
+#endif
+
+/* the time in seconds a provider is measured for, per round */
+#define BENCH_TIME	0.001
+#define BENCH_ROUNDS	3
+
+/* the builtin implementation */
+
+_Static_assert(sizeof(librad_MD5_CTX) <= RC_MD5_CTX_SIZE,
+	       "the MD5 context does not fit");
+
+static void builtin_init(rc_md5_ctx *ctx)
+{
+	MD5Init((MD5_CTX *)ctx);
+}
+
+static void builtin_update(rc_md5_ctx *ctx, uint8_t const *data, size_t len)
+{
+	MD5Update((MD5_CTX *)ctx, data, len);
+}
+
+static void builtin_final(uint8_t digest[RC_MD5_DIGEST_LEN], rc_md5_ctx *ctx)
+{
+	MD5Final(digest, (MD5_CTX *)ctx);
+	memset(ctx, 0, sizeof(MD5_CTX));
+}
+
+static int builtin_copy(rc_md5_ctx *dst, rc_md5_ctx const *src)
+{
+	memcpy(dst, src, sizeof(MD5_CTX));
+	return 0;
+}
+
+static void builtin_release(rc_md5_ctx *ctx)
+{
+	memset(ctx, 0, sizeof(MD5_CTX));
+}
+
+static const rc_crypto_provider builtin_provider = {
+	"builtin", builtin_init, builtin_update, builtin_final,
+	builtin_copy, builtin_release
+};
+
+#ifdef HAVE_NETTLE
+_Static_assert(sizeof(struct md5_ctx) <= RC_MD5_CTX_SIZE,
+	       "the nettle MD5 context does not fit");
+
+static void nettle_init(rc_md5_ctx *ctx)
+{
+	md5_init((struct md5_ctx *)ctx);
+}
+
+static void nettle_update(rc_md5_ctx *ctx, uint8_t const *data, size_t len)
+{
+	md5_update((struct md5_ctx *)ctx, len, data);
+}
+
+static void nettle_final(uint8_t digest[RC_MD5_DIGEST_LEN], rc_md5_ctx *ctx)
+{
+	md5_digest((struct md5_ctx *)ctx, RC_MD5_DIGEST_LEN, digest);
+	memset(ctx, 0, sizeof(struct md5_ctx));
+}
+
+static int nettle_copy(rc_md5_ctx *dst, rc_md5_ctx const *src)
+{
+	memcpy(dst, src, sizeof(struct md5_ctx));
+	return 0;
+}
+
+static void nettle_release(rc_md5_ctx *ctx)
+{
+	memset(ctx, 0, sizeof(struct md5_ctx));
+}
+
+static const rc_crypto_provider nettle_provider = {
+	"nettle", nettle_init, nettle_update, nettle_final,
+	nettle_copy, nettle_release
+};
+#endif
+
+#ifdef HAVE_GNUTLS_MD5
+/* the context holds a handle, or the builtin state when gnutls failed */
+typedef struct gnutls_md5_state {
+	gnutls_hash_hd_t hd;
+	MD5_CTX builtin;
+} gnutls_md5_state;
+
+_Static_assert(sizeof(gnutls_md5_state) <= RC_MD5_CTX_SIZE,
+	       "the gnutls MD5 context does not fit");
+
+#define GNUTLS_STATE(ctx) ((gnutls_md5_state *)(ctx))
+
+static void gnutls_md5_init(rc_md5_ctx *ctx)
+{
+	gnutls_md5_state *st = GNUTLS_STATE(ctx);
+
+	if (gnutls_hash_init(&st->hd, GNUTLS_DIG_MD5) < 0) {
+		st->hd = NULL;
+		MD5Init(&st->builtin);
+	}
+}
+
+static void gnutls_md5_update(rc_md5_ctx *ctx, uint8_t const *data, size_t len)
+{
+	gnutls_md5_state *st = GNUTLS_STATE(ctx);
+
+	if (st->hd != NULL)
+		gnutls_hash(st->hd, data, len);
+	else
+		MD5Update(&st->builtin, data, len);
+}
+
+static void gnutls_md5_final(uint8_t digest[RC_MD5_DIGEST_LEN], rc_md5_ctx *ctx)
+{
+	gnutls_md5_state *st = GNUTLS_STATE(ctx);
+
+	if (st->hd != NULL)
+		gnutls_hash_deinit(st->hd, digest);
+	else
+		MD5Final(digest, &st->builtin);
+	memset(st, 0, sizeof(*st));
+}
+
+static int gnutls_md5_copy(rc_md5_ctx *dst, rc_md5_ctx const *src)
+{
+	const gnutls_md5_state *from = (const gnutls_md5_state *)src;
+	gnutls_md5_state *to = GNUTLS_STATE(dst);
+
+	if (from->hd == NULL) {
+		memcpy(to, from, sizeof(*to));
+		return 0;
+	}
+
+	to->hd = gnutls_hash_copy(from->hd);
+	if (to->hd == NULL) {
+		MD5Init(&to->builtin);
+		return -1;
+	}
+	return 0;
+}
+
+static void gnutls_md5_release(rc_md5_ctx *ctx)
+{
+	gnutls_md5_state *st = GNUTLS_STATE(ctx);
+
+	if (st->hd != NULL)
+		gnutls_hash_deinit(st->hd, NULL);
+	memset(st, 0, sizeof(*st));
+}
+
+static const rc_crypto_provider gnutls_provider = {
+	"gnutls", gnutls_md5_init, gnutls_md5_update, gnutls_md5_final,
+	gnutls_md5_copy, gnutls_md5_release
+};
+#endif
+
+static const rc_crypto_provider *const providers[] = {
+#ifdef HAVE_NETTLE
+	&nettle_provider,
+#endif
+	&builtin_provider,
+#ifdef HAVE_GNUTLS_MD5
+	&gnutls_provider,
+#endif
+};
+
+#define NPROVIDERS (sizeof(providers) / sizeof(providers[0]))
+
+/*- Returns whether a provider hashes a known message correctly, from a
+ * fresh and from a copied context
+ -*/
+static int self_test(const rc_crypto_provider *p)
+{
+	/* MD5("abc"), from RFC 1321 */
+	static const uint8_t expected[RC_MD5_DIGEST_LEN] = {
+		0x90, 0x01, 0x50, 0x98, 0x3c, 0xd2, 0x4f, 0xb0,
+		0xd6, 0x96, 0x3f, 0x7d, 0x28, 0xe1, 0x7f, 0x72
+	};
+	uint8_t digest[RC_MD5_DIGEST_LEN], copied[RC_MD5_DIGEST_LEN];
+	rc_md5_ctx ctx, copy;
+
+	p->init(&ctx);
+	p->update(&ctx, (uint8_t const *)"a", 1);
+	if (p->copy(&copy, &ctx) < 0) {
+		p->release(&ctx);
+		p->release(&copy);
+		return 0;
+	}
+	p->update(&ctx, (uint8_t const *)"bc", 2);
+	p->final(digest, &ctx);
+	p->update(&copy, (uint8_t const *)"bc", 2);
+	p->final(copied, &copy);
+
+	return memcmp(digest, expected, sizeof(expected)) == 0 &&
+	       memcmp(copied, expected, sizeof(expected)) == 0;
+}
+
+static unsigned usable[NPROVIDERS];
+static pthread_once_t usable_once = PTHREAD_ONCE_INIT;
+
+static void test_providers(void)
+{
+	unsigned i;
+
+	for (i = 0; i < NPROVIDERS; i++) {
+		usable[i] = self_test(providers[i]);
+		if (!usable[i])
+			rc_log(LOG_WARNING, "crypto provider %s fails its self-test",
+			       providers[i]->name);
+	}
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*- Returns the nanoseconds a provider takes to sign and verify a typical
+ * request: the HMAC-MD5 of the request from the cached states of the key,
+ * and the MD5 of the reply followed by the secret
+ -*/
+static double measure(const rc_crypto_provider *p)
+{
+	uint8_t packet[128], secret[16], digest[RC_MD5_DIGEST_LEN];
+	rc_md5_ctx inner, outer, ctx;
+	double start, elapsed, best = 0;
+	unsigned round, n, i;
+
+	memset(packet, 0x5a, sizeof(packet));
+	memset(secret, 0xa5, sizeof(secret));
+	p->init(&inner);
+	p->update(&inner, packet, 64);
+	p->init(&outer);
+	p->update(&outer, packet, 64);
+
+	for (round = 0; round < BENCH_ROUNDS; round++) {
+		n = 0;
+		start = now_ns();
+		do {
+			for (i = 0; i < 16; i++) {
+				p->copy(&ctx, &inner);
+				p->update(&ctx, packet, sizeof(packet));
+				p->final(digest, &ctx);
+				p->copy(&ctx, &outer);
+				p->update(&ctx, digest, sizeof(digest));
+				p->final(digest, &ctx);
+
+				p->init(&ctx);
+				p->update(&ctx, packet, sizeof(packet));
+				p->update(&ctx, secret, sizeof(secret));
+				p->final(digest, &ctx);
+				/* the digests depend on each other */
+				packet[i] ^= digest[0];
+			}
+			n += 16;
+			elapsed = now_ns() - start;
+		} while (elapsed < BENCH_TIME * 1e9);
+
+		if (round == 0 || elapsed / n < best)
+			best = elapsed / n;
+	}
+
+	p->release(&inner);
+	p->release(&outer);
+	return best;
+}
+
+static const rc_crypto_provider *fastest;
+static pthread_once_t fastest_once = PTHREAD_ONCE_INIT;
+
+static void find_fastest(void)
+{
+	double ns, best = 0;
+	unsigned i;
+
+	pthread_once(&usable_once, test_providers);
+	for (i = 0; i < NPROVIDERS; i++) {
+		if (!usable[i])
+			continue;
+		ns = measure(providers[i]);
+		DEBUG(LOG_INFO, "crypto provider %s: %.0f ns per request",
+		      providers[i]->name, ns);
+		if (fastest == NULL || ns < best) {
+			fastest = providers[i];
+			best = ns;
+		}
+	}
+}
+
+/*- Returns the provider used without the crypto-provider option
+ *
+ * @return nettle when available, or the builtin implementation.
+ -*/
+const rc_crypto_provider *rc_crypto_default(void)
+{
+	return providers[0];
+}
+
+/*- Returns the provider selected by the crypto-provider option
+ *
+ * @param name the name of the provider, auto for the fastest one, or NULL
+ *	for the default.
+ * @return the provider, or NULL when it is not available.
+ -*/
+const rc_crypto_provider *rc_crypto_find(char const *name)
+{
+	unsigned i;
+
+	if (name == NULL)
+		return rc_crypto_default();
+
+	if (strcasecmp(name, "auto") == 0) {
+		pthread_once(&fastest_once, find_fastest);
+		return fastest != NULL ? fastest : rc_crypto_default();
+	}
+
+	pthread_once(&usable_once, test_providers);
+	for (i = 0; i < NPROVIDERS; i++) {
+		if (usable[i] && strcasecmp(name, providers[i]->name) == 0)
+			return providers[i];
+	}
+
+	return NULL;
+}
+
+/** Measures the crypto providers available on this host
+ *
+ * Each provider which passes its self-test is timed signing and
+ * verifying a typical request. The fastest one is the one selected by
+ * the value auto of the crypto-provider option.
+ *
+ * @param results will hold the providers and their timings.
+ * @param max the number of elements in results.
+ * @return the number of providers measured.
+ */
+int rc_crypto_benchmark(rc_crypto_bench *results, unsigned max)
+{
+	unsigned i, n = 0;
+
+	pthread_once(&usable_once, test_providers);
+	for (i = 0; i < NPROVIDERS && n < max; i++) {
+		if (!usable[i])
+			continue;
+		results[n].name = providers[i]->name;
+		results[n].ns = measure(providers[i]);
+		n++;
+	}
+
+	return n;
+}
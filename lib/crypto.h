@@ -0,0 +1,39 @@
+/*
+ * crypto.h	Internal table of the providers of MD5.
+ *
+ * License:	BSD
+ *
+ */
+#ifndef CRYPTO_H
+# define CRYPTO_H
+
+#include <includes.h>
+
+#define RC_MD5_DIGEST_LEN	16
+
+/* large enough for the MD5 context of any provider */
+#define RC_MD5_CTX_SIZE		128
+
+typedef union rc_md5_ctx {
+	uint8_t opaque[RC_MD5_CTX_SIZE];
+	uint64_t align;
+	void *ptr;
+} rc_md5_ctx;
+
+typedef struct rc_crypto_provider {
+	char const *name;	/* as set in the crypto-provider option */
+	void (*init)(rc_md5_ctx *ctx);
+	void (*update)(rc_md5_ctx *ctx, uint8_t const *data, size_t len);
+	/* also releases the context */
+	void (*final)(uint8_t digest[RC_MD5_DIGEST_LEN], rc_md5_ctx *ctx);
+	/* returns -1 when the context could not be copied; dst is then a
+	 * fresh context */
+	int (*copy)(rc_md5_ctx *dst, rc_md5_ctx const *src);
+	/* releases and erases a context which is not finalized */
+	void (*release)(rc_md5_ctx *ctx);
+} rc_crypto_provider;
+
+const rc_crypto_provider *rc_crypto_find(char const *name);
+const rc_crypto_provider *rc_crypto_default(void);
+
+#endif /* CRYPTO_H */
@@ -23,10 +23,22 @@
 #include <includes.h>
 #include <radcli/radcli.h>
 #include "util.h"
+#include "dictindex.h"
+#include "dictimage.h"
+
+/*- Returns the indexes of the dictionary, created on first use
+ -*/
+static struct rc_dict_index *dict_index(rc_handle *rh)
+{
+	if (rh->dictionary_index == NULL)
+		rh->dictionary_index = rc_dict_index_new();
+	return rh->dictionary_index;
+}
 
 /** Add attribute to dictionary
  *
- * Does not check if such attribute already exists
+ * Does not check if such attribute already exists; the lookups return the
+ * attribute added last.
  *
  * @param rh              a handle to configuration.
  * @param namestr         attribute name
@@ -38,6 +50,7 @@
 DICT_ATTR *rc_dict_addattr(rc_handle *rh, char const * namestr, uint32_t value, int type, uint32_t vendorspec)
 {
 	DICT_ATTR *attr;
+	struct rc_dict_index *idx;
 
 	if (strlen (namestr) > RC_NAME_LENGTH)
 	{
@@ -62,6 +75,13 @@ DICT_ATTR *rc_dict_addattr(rc_handle *rh, char const * namestr, uint32_t value,
 	attr->value = RADCLI_VENDOR_ATTR_SET(value, vendorspec);
 	attr->type = type;
 
+	idx = dict_index(rh);
+	if (idx == NULL || rc_dict_index_attr(idx, attr) < 0)
+	{
+		free(attr);
+		return NULL;
+	}
+
 	/* Insert it into the list */
 	attr->next = rh->dictionary_attributes;
 	rh->dictionary_attributes = attr;
@@ -70,7 +90,8 @@ DICT_ATTR *rc_dict_addattr(rc_handle *rh, char const * namestr, uint32_t value,
 
 /** Add value to dictionary
  *
- * Does not check if such value already exists
+ * Does not check if such value already exists; the lookups return the
+ * value added last.
  *
  * @param rh              a handle to configuration.
  * @param attrstr         attribute name
@@ -81,6 +102,7 @@ DICT_ATTR *rc_dict_addattr(rc_handle *rh, char const * namestr, uint32_t value,
 DICT_VALUE *rc_dict_addval(rc_handle *rh, char const * attrstr, char const * namestr, uint32_t value)
 {
 	DICT_VALUE *dval;
+	struct rc_dict_index *idx;
 
 	if (strlen(attrstr) > RC_NAME_LENGTH)
 	{
@@ -104,6 +126,13 @@ DICT_VALUE *rc_dict_addval(rc_handle *rh, char const * attrstr, char const * nam
 	strlcpy(dval->name, namestr, sizeof(dval->name));
 	dval->value = value;
 
+	idx = dict_index(rh);
+	if (idx == NULL || rc_dict_index_value(idx, dval) < 0)
+	{
+		free(dval);
+		return NULL;
+	}
+
 	/* Insert it into the list */
 	dval->next = rh->dictionary_values;
 	rh->dictionary_values = dval;
@@ -112,7 +141,8 @@ DICT_VALUE *rc_dict_addval(rc_handle *rh, char const * attrstr, char const * nam
 
 /** Add vendor to dictionary
  *
- * Does not check if such vendor already exists
+ * Does not check if such vendor already exists; the lookups return the
+ * vendor added last.
  *
  * @param rh              a handle to configuration.
  * @param namestr         vendor name
@@ -122,6 +152,7 @@ DICT_VALUE *rc_dict_addval(rc_handle *rh, char const * attrstr, char const * nam
 DICT_VENDOR *rc_dict_addvend(rc_handle *rh, char const * namestr, uint32_t vendorspec)
 {
 	DICT_VENDOR *dvend;
+	struct rc_dict_index *idx;
 
 	if (strlen(namestr) > RC_NAME_LENGTH)
 	{
@@ -139,6 +170,13 @@ DICT_VENDOR *rc_dict_addvend(rc_handle *rh, char const * namestr, uint32_t vendo
 	strlcpy(dvend->vendorname, namestr, sizeof(dvend->vendorname));
 	dvend->vendorpec = vendorspec;
 
+	idx = dict_index(rh);
+	if (idx == NULL || rc_dict_index_vendor(idx, dvend) < 0)
+	{
+		free(dvend);
+		return NULL;
+	}
+
 	/* Insert it into the list */
 	dvend->next = rh->dictionary_vendors;
 	rh->dictionary_vendors = dvend;
@@ -166,8 +204,6 @@ static int rc_dict_init(rc_handle *rh, FILE *dictfd, char const *filename)
 	char            ifilename[PATH_MAX] = {0};
 	char            *cp;
 	int             line_no = 0;
-	DICT_ATTR      *attr;
-	DICT_VALUE     *dval;
 	DICT_VENDOR    *dvend;
 	char            buffer[256];
 	uint32_t        value;
@@ -184,6 +220,17 @@ static int rc_dict_init(rc_handle *rh, FILE *dictfd, char const *filename)
 	{
 		line_no++;
 
+		/* A binary dictionary is mapped by rc_read_dictionary(), which
+		 * also reads those named by $INCLUDE; it cannot be parsed */
+		if (line_no == 1 &&
+		    memcmp(buffer, RC_DICT_IMAGE_MAGIC, RC_DICT_IMAGE_MAGIC_LEN) == 0)
+		{
+			rc_log(LOG_ERR,
+				"rc_dict_init: dictionary %s is a binary one; it can "
+				"only be read from a file", pfilename);
+			return -1;
+		}
+
 		/* Skip empty space */
 		if (*buffer == '#' || *buffer == '\0' || *buffer == '\n' || \
 		    *buffer == '\r')
@@ -288,24 +335,13 @@ static int rc_dict_init(rc_handle *rh, FILE *dictfd, char const *filename)
 				}
 			}
 
-			/* Create a new attribute for the list */
-			if ((attr = malloc (sizeof (DICT_ATTR))) == NULL)
+			/* Add it to the list and the indexes */
+			if (rc_dict_addattr(rh, namestr, value, type,
+					    dvend != NULL ? dvend->vendorpec :
+					    attr_vendorspec) == NULL)
 			{
-				rc_log(LOG_CRIT, "rc_dict_init: out of memory");
 				return -1;
 			}
-			strcpy (attr->name, namestr);
-			attr->type = type;
-
-			if (dvend != NULL) {
-				attr->value = RADCLI_VENDOR_ATTR_SET(value, dvend->vendorpec);
-			} else {
-				attr->value = RADCLI_VENDOR_ATTR_SET(value, attr_vendorspec);
-			}
-
-			/* Insert it into the list */
-			attr->next = rh->dictionary_attributes;
-			rh->dictionary_attributes = attr;
 		}
 		else if (strncmp (buffer, "VALUE", 5) == 0)
 		{
@@ -347,19 +383,11 @@ static int rc_dict_init(rc_handle *rh, FILE *dictfd, char const *filename)
 			}
 			value = atoi (valstr);
 
-			/* Create a new VALUE entry for the list */
-			if ((dval = malloc (sizeof (DICT_VALUE))) == NULL)
+			/* Add it to the list and the indexes */
+			if (rc_dict_addval(rh, attrstr, namestr, value) == NULL)
 			{
-				rc_log(LOG_CRIT, "rc_dict_init: out of memory");
 				return -1;
 			}
-			strcpy (dval->attrname, attrstr);
-			strcpy (dval->name, namestr);
-			dval->value = value;
-
-			/* Insert it into the list */
-			dval->next = rh->dictionary_values;
-			rh->dictionary_values = dval;
 		}
 		else if ((filename != NULL) && 
 				(strncmp (buffer, "$INCLUDE", 8) == 0))
@@ -442,29 +470,48 @@ static int rc_dict_init(rc_handle *rh, FILE *dictfd, char const *filename)
 			}
 			value = atoi (valstr);
 
-			/* Create a new VENDOR entry for the list */
-			dvend = malloc(sizeof(DICT_VENDOR));
-			if (dvend == NULL)
+			/* Add it to the list and the indexes */
+			if (rc_dict_addvend(rh, attrstr, value) == NULL)
 			{
-				rc_log(LOG_CRIT, "rc_dict_init: out of memory");
 				return -1;
 			}
-			strcpy (dvend->vendorname, attrstr);
-			dvend->vendorpec = value;
-
-			/* Insert it into the list */
-			dvend->next = rh->dictionary_vendors;
-			rh->dictionary_vendors = dvend;
 		}
 	}
 	return 0;
 }
 
+/*- Maps a binary dictionary written by rc_write_dictionary()
+ *
+ * @param rh a handle to parsed configuration.
+ * @param filename the name of the dictionary file.
+ * @return 0 on success, -1 on failure.
+ -*/
+static int rc_dict_map(rc_handle *rh, char const *filename)
+{
+	if (rh->dictionary_image != NULL)
+	{
+		rc_log(LOG_ERR, "rc_read_dictionary: %s: only one binary dictionary "
+				"can be loaded", filename);
+		return -1;
+	}
+
+	rh->dictionary_image = rc_dict_image_open(filename);
+	if (rh->dictionary_image == NULL)
+		return -1;
+
+	return 0;
+}
+
 /** Initialize the dictionary
  *
  * Read all ATTRIBUTES into the dictionary_attributes list.
  * Read all VALUES into the dictionary_values list.
  *
+ * The file may also be a binary dictionary written by
+ * rc_write_dictionary(), which is mapped in memory instead of being
+ * parsed. Its entries are read-only, and those read from text or added
+ * with rc_dict_addattr() and the like take precedence over them.
+ *
  * @param rh a handle to parsed configuration.
  * @param filename the name of the dictionary file.
  * @return 0 on success, -1 on failure.
@@ -472,6 +519,7 @@ static int rc_dict_init(rc_handle *rh, FILE *dictfd, char const *filename)
 int rc_read_dictionary (rc_handle *rh, char const *filename)
 {
 	FILE    *dictfd;
+	char    magic[RC_DICT_IMAGE_MAGIC_LEN];
 	int     ret_val = 0;
 
 	if (rh->first_dict_read != NULL && strcmp(filename, rh->first_dict_read) == 0)
@@ -484,9 +532,18 @@ int rc_read_dictionary (rc_handle *rh, char const *filename)
 		return -1;
 	}
 
-	ret_val = rc_dict_init(rh, dictfd, filename);
-
-	fclose (dictfd);
+	if (fread(magic, 1, sizeof(magic), dictfd) == sizeof(magic) &&
+	    memcmp(magic, RC_DICT_IMAGE_MAGIC, RC_DICT_IMAGE_MAGIC_LEN) == 0)
+	{
+		fclose (dictfd);
+		ret_val = rc_dict_map(rh, filename);
+	}
+	else
+	{
+		rewind (dictfd);
+		ret_val = rc_dict_init(rh, dictfd, filename);
+		fclose (dictfd);
+	}
 
 	if (rh->first_dict_read == NULL)
 		rh->first_dict_read = strdup(filename);
@@ -531,18 +588,13 @@ int rc_read_dictionary_from_buffer (rc_handle *rh, char const *buf, size_t size)
  */
 DICT_ATTR *rc_dict_getattr(rc_handle const *rh, uint64_t attribute)
 {
-	DICT_ATTR      *attr;
+	DICT_ATTR *attr = NULL;
 
-	attr = rh->dictionary_attributes;
-	while (attr != NULL)
-	{
-		if (attr->value == attribute)
-		{
-			return attr;
-		}
-		attr = attr->next;
-	}
-	return NULL;
+	if (rh->dictionary_index != NULL)
+		attr = rc_dict_index_getattr(rh->dictionary_index, attribute);
+	if (attr == NULL && rh->dictionary_image != NULL)
+		attr = rc_dict_image_getattr(rh->dictionary_image, attribute);
+	return attr;
 }
 
 /** Lookup a DICT_ATTR by its name
@@ -554,18 +606,13 @@ DICT_ATTR *rc_dict_getattr(rc_handle const *rh, uint64_t attribute)
  */
 DICT_ATTR *rc_dict_findattr(rc_handle const *rh, char const *attrname)
 {
-	DICT_ATTR      *attr;
+	DICT_ATTR *attr = NULL;
 
-	attr = rh->dictionary_attributes;
-	while (attr != NULL)
-	{
-		if (strcasecmp (attr->name, attrname) == 0)
-		{
-			return attr;
-		}
-		attr = attr->next;
-	}
-	return NULL;
+	if (rh->dictionary_index != NULL)
+		attr = rc_dict_index_findattr(rh->dictionary_index, attrname);
+	if (attr == NULL && rh->dictionary_image != NULL)
+		attr = rc_dict_image_findattr(rh->dictionary_image, attrname);
+	return attr;
 }
 
 
@@ -577,17 +624,13 @@ DICT_ATTR *rc_dict_findattr(rc_handle const *rh, char const *attrname)
  */
 DICT_VALUE *rc_dict_findval(rc_handle const *rh, char const *valname)
 {
-	DICT_VALUE     *val;
-	val = rh->dictionary_values;
-	while (val != NULL)
-	{
-		if (strcasecmp (val->name, valname) == 0)
-		{
-			return val;
-		}
-		val = val->next;
-	}
-	return NULL;
+	DICT_VALUE *val = NULL;
+
+	if (rh->dictionary_index != NULL)
+		val = rc_dict_index_findval(rh->dictionary_index, valname);
+	if (val == NULL && rh->dictionary_image != NULL)
+		val = rc_dict_image_findval(rh->dictionary_image, valname);
+	return val;
 }
 
 /** Lookup a DICT_VENDOR by its name
@@ -598,12 +641,13 @@ DICT_VALUE *rc_dict_findval(rc_handle const *rh, char const *valname)
  */
 DICT_VENDOR *rc_dict_findvend(rc_handle const *rh, char const *vendorname)
 {
-	DICT_VENDOR	*vend;
+	DICT_VENDOR *vend = NULL;
 
-	for (vend = rh->dictionary_vendors; vend != NULL; vend = vend->next)
-		if (strcasecmp(vend->vendorname, vendorname) == 0)
-			return vend;
-	return NULL;
+	if (rh->dictionary_index != NULL)
+		vend = rc_dict_index_findvend(rh->dictionary_index, vendorname);
+	if (vend == NULL && rh->dictionary_image != NULL)
+		vend = rc_dict_image_findvend(rh->dictionary_image, vendorname);
+	return vend;
 }
 
 /** Lookup a DICT_VENDOR by its IANA number
@@ -614,12 +658,13 @@ DICT_VENDOR *rc_dict_findvend(rc_handle const *rh, char const *vendorname)
  */
 DICT_VENDOR *rc_dict_getvend (rc_handle const *rh, uint32_t vendorspec)
 {
-        DICT_VENDOR      *vend;
+	DICT_VENDOR *vend = NULL;
 
-	for (vend = rh->dictionary_vendors; vend != NULL; vend = vend->next)
-		if (vend->vendorpec == vendorspec)
-			return vend;
-	return NULL;
+	if (rh->dictionary_index != NULL)
+		vend = rc_dict_index_getvend(rh->dictionary_index, vendorspec);
+	if (vend == NULL && rh->dictionary_image != NULL)
+		vend = rc_dict_image_getvend(rh->dictionary_image, vendorspec);
+	return vend;
 }
 
 /** Get DICT_VALUE based on attribute name and integer value number
@@ -631,19 +676,39 @@ DICT_VENDOR *rc_dict_getvend (rc_handle const *rh, uint32_t vendorspec)
  */
 DICT_VALUE *rc_dict_getval(rc_handle const *rh, uint32_t value, char const *attrname)
 {
-	DICT_VALUE     *val;
+	DICT_VALUE *val = NULL;
+
+	if (rh->dictionary_index != NULL)
+		val = rc_dict_index_getval(rh->dictionary_index, value, attrname);
+	if (val == NULL && rh->dictionary_image != NULL)
+		val = rc_dict_image_getval(rh->dictionary_image, value, attrname);
+	return val;
+}
 
-	val = rh->dictionary_values;
-	while (val != NULL)
+/** Save the dictionary in binary form
+ *
+ * Writes the dictionary loaded in the handle as a binary dictionary,
+ * which rc_read_dictionary() maps in memory instead of parsing, with its
+ * indexes built. It is only read by the same version of radcli on the
+ * same architecture, and is otherwise recompiled from the text. The file
+ * is replaced atomically, so the processes which mapped its previous
+ * version are not affected.
+ *
+ * @param rh a handle to parsed configuration.
+ * @param filename the name of the binary dictionary.
+ * @return 0 on success, -1 on failure.
+ */
+int rc_write_dictionary(rc_handle const *rh, char const *filename)
+{
+	if (rh->dictionary_image != NULL)
 	{
-		if (strcmp (val->attrname, attrname) == 0 &&
-				val->value == value)
-		{
-			return val;
-		}
-		val = val->next;
+		rc_log(LOG_ERR, "rc_write_dictionary: the dictionary was read "
+				"from a binary dictionary; compile it from text");
+		return -1;
 	}
-	return NULL;
+
+	return rc_dict_image_write(filename, rh->dictionary_attributes,
+				   rh->dictionary_values, rh->dictionary_vendors);
 }
 
 /** Frees the allocated dictionary
@@ -671,5 +736,9 @@ void rc_dict_free(rc_handle *rh)
 	rh->dictionary_attributes = NULL;
 	rh->dictionary_values = NULL;
 	rh->dictionary_vendors = NULL;
+	rc_dict_index_free(rh->dictionary_index);
+	rh->dictionary_index = NULL;
+	rc_dict_image_close(rh->dictionary_image);
+	rh->dictionary_image = NULL;
 }
 /** @} */
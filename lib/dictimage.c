@@ -0,0 +1,516 @@
+/*
+ * dictimage.c	Binary dictionaries, mapped in memory.
+ *
+ * rc_write_dictionary() saves the dictionary of a handle as an image
+ * holding the entries and their indexes, and rc_read_dictionary()
+ * recognizes such an image by its first octets and maps it read-only
+ * instead of parsing text. Loading it then costs a mmap() and a check of
+ * the header, whatever the number of entries, and the pages are shared
+ * through the page cache by all the processes using the dictionary.
+ *
+ * The image is position independent: the entries are DICT_ATTR,
+ * DICT_VALUE and DICT_VENDOR structures without their next pointers, and
+ * the indexes are the hash tables of dictindex.c holding the numbers of
+ * the entries instead of pointers. Each key maps to the entry defined
+ * last in the text, as in the lists. The structures are those of the
+ * library, so an image is only read by a library of the same version of
+ * the format, byte order and structure sizes, which are in its header;
+ * it is otherwise recompiled from the text.
+ *
+ * License:	BSD
+ *
+ */
+
+#include <config.h>
+#include <includes.h>
+#include <radcli/radcli.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "util.h"
+#include "dictindex.h"
+#include "dictimage.h"
+
+#define IMAGE_VERSION		1
+#define IMAGE_BYTE_ORDER	0x01020304
+/* of every part of the image; DICT_ATTR holds a uint64_t */
+#define IMAGE_ALIGN		8
+#define STD_ATTRS		256
+
+typedef struct image_table {
+	uint32_t off;
+	uint32_t size;		/* the slots; a power of two */
+} image_table;
+
+typedef struct image_slot {
+	uint32_t hash;
+	uint32_t ref;		/* the number of the entry plus one; 0 for unused */
+} image_slot;
+
+typedef struct image_header {
+	char magic[RC_DICT_IMAGE_MAGIC_LEN];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t size;		/* of the image */
+	uint32_t attr_size;	/* of the entries, which depend on the ABI */
+	uint32_t value_size;
+	uint32_t vendor_size;
+	uint32_t nattrs;
+	uint32_t nvalues;
+	uint32_t nvendors;
+	uint32_t attrs;		/* the offsets of the entries */
+	uint32_t values;
+	uint32_t vendors;
+	uint32_t std_attrs;	/* STD_ATTRS references to the standard attributes */
+	image_table attr_by_id;	/* the attributes not in std_attrs */
+	image_table attr_by_name;
+	image_table val_by_attr;
+	image_table val_by_name;
+	image_table vend_by_id;
+	image_table vend_by_name;
+} image_header;
+
+struct rc_dict_image {
+	const uint8_t *base;
+	size_t size;
+	const image_header *hdr;
+	DICT_ATTR *attrs;
+	DICT_VALUE *values;
+	DICT_VENDOR *vendors;
+	const uint32_t *std_attrs;
+};
+
+/*- Returns the offset of a part of the image, and moves past it
+ -*/
+static uint64_t place(uint64_t *off, uint64_t len)
+{
+	uint64_t at = (*off + IMAGE_ALIGN - 1) & ~(uint64_t)(IMAGE_ALIGN - 1);
+
+	*off = at + len;
+	return at;
+}
+
+/*- Places a hash table with room for n entries
+ -*/
+static void place_table(image_table *t, uint64_t *off, uint32_t n)
+{
+	t->size = 1;
+	while (t->size < 2 * (uint64_t)n)
+		t->size <<= 1;
+	t->off = place(off, (uint64_t)t->size * sizeof(image_slot));
+}
+
+/*- Adds an entry to a hash table of the image being built, unless an
+ * entry added before, which is newer, has the same key
+ -*/
+static void build_insert(uint8_t *buf, const image_table *t,
+			 const uint8_t *entries, size_t entry_size,
+			 uint32_t hash, rc_dict_match match, const void *key,
+			 uint32_t ref)
+{
+	image_slot *slots = (image_slot *)(buf + t->off);
+	uint32_t i, mask = t->size - 1;
+
+	for (i = hash & mask; slots[i].ref != 0; i = (i + 1) & mask) {
+		if (slots[i].hash == hash &&
+		    match(entries + (size_t)(slots[i].ref - 1) * entry_size, key))
+			return;
+	}
+
+	slots[i].hash = hash;
+	slots[i].ref = ref;
+}
+
+/*- Writes a file in place of another, which those mapping the old one
+ * keep reading
+ -*/
+static int replace_file(char const *filename, const uint8_t *buf, size_t len)
+{
+	char tmp[PATH_MAX];
+	ssize_t ret;
+	int fd;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", filename) >= (int)sizeof(tmp)) {
+		rc_log(LOG_ERR, "%s: file name too long: %s", __func__, filename);
+		return -1;
+	}
+
+	fd = mkstemp(tmp);
+	if (fd == -1) {
+		rc_log(LOG_ERR, "%s: cannot create %s: %s", __func__, tmp,
+		       strerror(errno));
+		return -1;
+	}
+
+	while (len > 0) {
+		ret = write(fd, buf, len);
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			goto fail;
+		buf += ret;
+		len -= ret;
+	}
+
+	if (fchmod(fd, 0644) == -1 || close(fd) == -1) {
+		fd = -1;
+		goto fail;
+	}
+	fd = -1;
+
+	if (rename(tmp, filename) == -1)
+		goto fail;
+
+	return 0;
+
+ fail:
+	rc_log(LOG_ERR, "%s: cannot write %s: %s", __func__, filename,
+	       strerror(errno));
+	if (fd != -1)
+		close(fd);
+	unlink(tmp);
+	return -1;
+}
+
+/*- Writes a binary dictionary
+ *
+ * @param filename the file, which is replaced atomically.
+ * @param attrs the attributes, newest first.
+ * @param values the values, newest first.
+ * @param vendors the vendors, newest first.
+ * @return 0 on success, or -1 on failure.
+ -*/
+int rc_dict_image_write(char const *filename, const DICT_ATTR *attrs,
+			const DICT_VALUE *values, const DICT_VENDOR *vendors)
+{
+	image_header hdr;
+	const DICT_ATTR *a;
+	const DICT_VALUE *v;
+	const DICT_VENDOR *d;
+	DICT_ATTR *ia;
+	DICT_VALUE *iv;
+	DICT_VENDOR *id;
+	rc_dict_val_key key;
+	uint32_t *std_attrs, i;
+	uint64_t off;
+	uint8_t *buf;
+	int ret;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, RC_DICT_IMAGE_MAGIC, RC_DICT_IMAGE_MAGIC_LEN);
+	hdr.version = IMAGE_VERSION;
+	hdr.byte_order = IMAGE_BYTE_ORDER;
+	hdr.attr_size = sizeof(DICT_ATTR);
+	hdr.value_size = sizeof(DICT_VALUE);
+	hdr.vendor_size = sizeof(DICT_VENDOR);
+	for (a = attrs; a != NULL; a = a->next)
+		hdr.nattrs++;
+	for (v = values; v != NULL; v = v->next)
+		hdr.nvalues++;
+	for (d = vendors; d != NULL; d = d->next)
+		hdr.nvendors++;
+
+	off = sizeof(hdr);
+	hdr.attrs = place(&off, (uint64_t)hdr.nattrs * sizeof(DICT_ATTR));
+	hdr.values = place(&off, (uint64_t)hdr.nvalues * sizeof(DICT_VALUE));
+	hdr.vendors = place(&off, (uint64_t)hdr.nvendors * sizeof(DICT_VENDOR));
+	hdr.std_attrs = place(&off, STD_ATTRS * sizeof(uint32_t));
+	place_table(&hdr.attr_by_id, &off, hdr.nattrs);
+	place_table(&hdr.attr_by_name, &off, hdr.nattrs);
+	place_table(&hdr.val_by_attr, &off, hdr.nvalues);
+	place_table(&hdr.val_by_name, &off, hdr.nvalues);
+	place_table(&hdr.vend_by_id, &off, hdr.nvendors);
+	place_table(&hdr.vend_by_name, &off, hdr.nvendors);
+	if (off > UINT32_MAX) {
+		rc_log(LOG_ERR, "%s: the dictionary is too large", __func__);
+		return -1;
+	}
+	hdr.size = off;
+
+	/* zeroed, so that the padding and the next pointers are too */
+	buf = calloc(1, hdr.size);
+	if (buf == NULL) {
+		rc_log(LOG_CRIT, "%s: out of memory", __func__);
+		return -1;
+	}
+	memcpy(buf, &hdr, sizeof(hdr));
+	ia = (DICT_ATTR *)(buf + hdr.attrs);
+	iv = (DICT_VALUE *)(buf + hdr.values);
+	id = (DICT_VENDOR *)(buf + hdr.vendors);
+	std_attrs = (uint32_t *)(buf + hdr.std_attrs);
+
+	/* the entries are indexed newest first, and the older ones with the
+	 * same key are left out */
+	for (a = attrs, i = 0; a != NULL; a = a->next, i++) {
+		strlcpy(ia[i].name, a->name, sizeof(ia[i].name));
+		ia[i].value = a->value;
+		ia[i].type = a->type;
+
+		if (a->value < STD_ATTRS) {
+			if (std_attrs[a->value] == 0)
+				std_attrs[a->value] = i + 1;
+		} else {
+			build_insert(buf, &hdr.attr_by_id, (uint8_t *)ia,
+				     sizeof(*ia), rc_dict_hash_int(a->value),
+				     rc_dict_match_attr_id, &a->value, i + 1);
+		}
+		build_insert(buf, &hdr.attr_by_name, (uint8_t *)ia, sizeof(*ia),
+			     rc_dict_hash_name(a->name, 1),
+			     rc_dict_match_attr_name, a->name, i + 1);
+	}
+
+	for (v = values, i = 0; v != NULL; v = v->next, i++) {
+		strlcpy(iv[i].attrname, v->attrname, sizeof(iv[i].attrname));
+		strlcpy(iv[i].name, v->name, sizeof(iv[i].name));
+		iv[i].value = v->value;
+
+		key.attrname = v->attrname;
+		key.value = v->value;
+		build_insert(buf, &hdr.val_by_attr, (uint8_t *)iv, sizeof(*iv),
+			     rc_dict_hash_val(v->attrname, v->value),
+			     rc_dict_match_val, &key, i + 1);
+		build_insert(buf, &hdr.val_by_name, (uint8_t *)iv, sizeof(*iv),
+			     rc_dict_hash_name(v->name, 1),
+			     rc_dict_match_val_name, v->name, i + 1);
+	}
+
+	for (d = vendors, i = 0; d != NULL; d = d->next, i++) {
+		strlcpy(id[i].vendorname, d->vendorname, sizeof(id[i].vendorname));
+		id[i].vendorpec = d->vendorpec;
+
+		build_insert(buf, &hdr.vend_by_id, (uint8_t *)id, sizeof(*id),
+			     rc_dict_hash_int(d->vendorpec),
+			     rc_dict_match_vend_id, &d->vendorpec, i + 1);
+		build_insert(buf, &hdr.vend_by_name, (uint8_t *)id, sizeof(*id),
+			     rc_dict_hash_name(d->vendorname, 1),
+			     rc_dict_match_vend_name, d->vendorname, i + 1);
+	}
+
+	ret = replace_file(filename, buf, hdr.size);
+	free(buf);
+	return ret;
+}
+
+static int region_ok(const struct rc_dict_image *img, uint32_t off, uint64_t len)
+{
+	return off % IMAGE_ALIGN == 0 && off >= sizeof(image_header) &&
+	       off + len <= img->size;
+}
+
+static int table_ok(const struct rc_dict_image *img, const image_table *t)
+{
+	return t->size != 0 && (t->size & (t->size - 1)) == 0 &&
+	       region_ok(img, t->off, (uint64_t)t->size * sizeof(image_slot));
+}
+
+/*- Checks the header of an image, and that its names are terminated
+ *
+ * @return 0 when the image is usable, or -1.
+ -*/
+static int check_image(struct rc_dict_image *img, char const *filename)
+{
+	const image_header *hdr = img->hdr;
+	uint32_t i;
+
+	if (memcmp(hdr->magic, RC_DICT_IMAGE_MAGIC, RC_DICT_IMAGE_MAGIC_LEN) != 0)
+		goto invalid;
+
+	if (hdr->version != IMAGE_VERSION || hdr->byte_order != IMAGE_BYTE_ORDER ||
+	    hdr->attr_size != sizeof(DICT_ATTR) ||
+	    hdr->value_size != sizeof(DICT_VALUE) ||
+	    hdr->vendor_size != sizeof(DICT_VENDOR)) {
+		rc_log(LOG_ERR, "%s: dictionary %s was compiled for another "
+		       "version of radcli or another architecture; recompile it",
+		       __func__, filename);
+		return -1;
+	}
+
+	if (hdr->size != img->size ||
+	    !region_ok(img, hdr->attrs, (uint64_t)hdr->nattrs * sizeof(DICT_ATTR)) ||
+	    !region_ok(img, hdr->values, (uint64_t)hdr->nvalues * sizeof(DICT_VALUE)) ||
+	    !region_ok(img, hdr->vendors, (uint64_t)hdr->nvendors * sizeof(DICT_VENDOR)) ||
+	    !region_ok(img, hdr->std_attrs, STD_ATTRS * sizeof(uint32_t)) ||
+	    !table_ok(img, &hdr->attr_by_id) || !table_ok(img, &hdr->attr_by_name) ||
+	    !table_ok(img, &hdr->val_by_attr) || !table_ok(img, &hdr->val_by_name) ||
+	    !table_ok(img, &hdr->vend_by_id) || !table_ok(img, &hdr->vend_by_name))
+		goto invalid;
+
+	img->attrs = (DICT_ATTR *)(img->base + hdr->attrs);
+	img->values = (DICT_VALUE *)(img->base + hdr->values);
+	img->vendors = (DICT_VENDOR *)(img->base + hdr->vendors);
+	img->std_attrs = (const uint32_t *)(img->base + hdr->std_attrs);
+
+	for (i = 0; i < STD_ATTRS; i++) {
+		if (img->std_attrs[i] > hdr->nattrs)
+			goto invalid;
+	}
+	for (i = 0; i < hdr->nattrs; i++) {
+		if (memchr(img->attrs[i].name, '\0', sizeof(img->attrs[i].name)) == NULL)
+			goto invalid;
+	}
+	for (i = 0; i < hdr->nvalues; i++) {
+		if (memchr(img->values[i].attrname, '\0', sizeof(img->values[i].attrname)) == NULL ||
+		    memchr(img->values[i].name, '\0', sizeof(img->values[i].name)) == NULL)
+			goto invalid;
+	}
+	for (i = 0; i < hdr->nvendors; i++) {
+		if (memchr(img->vendors[i].vendorname, '\0', sizeof(img->vendors[i].vendorname)) == NULL)
+			goto invalid;
+	}
+
+	return 0;
+
+ invalid:
+	rc_log(LOG_ERR, "%s: dictionary %s is corrupt", __func__, filename);
+	return -1;
+}
+
+/*- Maps a binary dictionary
+ *
+ * @param filename the file, written by rc_dict_image_write().
+ * @return the image, or NULL on failure.
+ -*/
+struct rc_dict_image *rc_dict_image_open(char const *filename)
+{
+	struct rc_dict_image *img;
+	struct stat st;
+	void *base;
+	int fd;
+
+	fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd == -1 || fstat(fd, &st) == -1) {
+		rc_log(LOG_ERR, "%s: couldn't open dictionary %s: %s", __func__,
+		       filename, strerror(errno));
+		if (fd != -1)
+			close(fd);
+		return NULL;
+	}
+
+	if (st.st_size < (off_t)sizeof(image_header) || st.st_size > UINT32_MAX) {
+		rc_log(LOG_ERR, "%s: dictionary %s is corrupt", __func__, filename);
+		close(fd);
+		return NULL;
+	}
+
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		rc_log(LOG_ERR, "%s: couldn't map dictionary %s: %s", __func__,
+		       filename, strerror(errno));
+		return NULL;
+	}
+
+	img = calloc(1, sizeof(*img));
+	if (img == NULL) {
+		rc_log(LOG_CRIT, "%s: out of memory", __func__);
+		munmap(base, st.st_size);
+		return NULL;
+	}
+	img->base = base;
+	img->size = st.st_size;
+	img->hdr = base;
+
+	if (check_image(img, filename) < 0) {
+		rc_dict_image_close(img);
+		return NULL;
+	}
+
+	return img;
+}
+
+/*- Unmaps a binary dictionary
+ -*/
+void rc_dict_image_close(struct rc_dict_image *img)
+{
+	if (img == NULL)
+		return;
+
+	munmap((void *)img->base, img->size);
+	free(img);
+}
+
+/*- Returns the entry of a hash table with a key, or NULL
+ -*/
+static void *image_lookup(const struct rc_dict_image *img, const image_table *t,
+			  const void *entries, size_t entry_size, uint32_t count,
+			  uint32_t hash, rc_dict_match match, const void *key)
+{
+	const image_slot *slots = (const image_slot *)(img->base + t->off);
+	uint32_t i, n, ref, mask = t->size - 1;
+	const uint8_t *entry;
+
+	for (i = hash & mask, n = 0; n < t->size; i = (i + 1) & mask, n++) {
+		ref = slots[i].ref;
+		if (ref == 0 || ref > count)
+			return NULL;
+
+		entry = (const uint8_t *)entries + (size_t)(ref - 1) * entry_size;
+		if (slots[i].hash == hash && match(entry, key))
+			return (void *)entry;
+	}
+	return NULL;
+}
+
+/* the lookups behind rc_dict_getattr() and the others in dict.c; the
+ * entries returned are read-only */
+
+DICT_ATTR *rc_dict_image_getattr(const struct rc_dict_image *img,
+				 uint64_t attribute)
+{
+	if (attribute < STD_ATTRS) {
+		if (img->std_attrs[attribute] == 0)
+			return NULL;
+		return &img->attrs[img->std_attrs[attribute] - 1];
+	}
+
+	return image_lookup(img, &img->hdr->attr_by_id, img->attrs,
+			    sizeof(DICT_ATTR), img->hdr->nattrs,
+			    rc_dict_hash_int(attribute),
+			    rc_dict_match_attr_id, &attribute);
+}
+
+DICT_ATTR *rc_dict_image_findattr(const struct rc_dict_image *img,
+				  char const *name)
+{
+	return image_lookup(img, &img->hdr->attr_by_name, img->attrs,
+			    sizeof(DICT_ATTR), img->hdr->nattrs,
+			    rc_dict_hash_name(name, 1),
+			    rc_dict_match_attr_name, name);
+}
+
+DICT_VALUE *rc_dict_image_getval(const struct rc_dict_image *img,
+				 uint32_t value, char const *attrname)
+{
+	rc_dict_val_key key = { attrname, value };
+
+	return image_lookup(img, &img->hdr->val_by_attr, img->values,
+			    sizeof(DICT_VALUE), img->hdr->nvalues,
+			    rc_dict_hash_val(attrname, value),
+			    rc_dict_match_val, &key);
+}
+
+DICT_VALUE *rc_dict_image_findval(const struct rc_dict_image *img,
+				  char const *name)
+{
+	return image_lookup(img, &img->hdr->val_by_name, img->values,
+			    sizeof(DICT_VALUE), img->hdr->nvalues,
+			    rc_dict_hash_name(name, 1),
+			    rc_dict_match_val_name, name);
+}
+
+DICT_VENDOR *rc_dict_image_getvend(const struct rc_dict_image *img,
+				   uint32_t vendorpec)
+{
+	return image_lookup(img, &img->hdr->vend_by_id, img->vendors,
+			    sizeof(DICT_VENDOR), img->hdr->nvendors,
+			    rc_dict_hash_int(vendorpec),
+			    rc_dict_match_vend_id, &vendorpec);
+}
+
+DICT_VENDOR *rc_dict_image_findvend(const struct rc_dict_image *img,
+				    char const *name)
+{
+	return image_lookup(img, &img->hdr->vend_by_name, img->vendors,
+			    sizeof(DICT_VENDOR), img->hdr->nvendors,
+			    rc_dict_hash_name(name, 1),
+			    rc_dict_match_vend_name, name);
+}
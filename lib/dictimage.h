@@ -0,0 +1,36 @@
+/*
+ * dictimage.h	Internal reader and writer of the binary dictionaries.
+ *
+ * License:	BSD
+ *
+ */
+#ifndef DICTIMAGE_H
+# define DICTIMAGE_H
+
+#include <includes.h>
+#include <radcli/radcli.h>
+
+/* the first octets of a binary dictionary */
+#define RC_DICT_IMAGE_MAGIC	"RCDICT\r\n"
+#define RC_DICT_IMAGE_MAGIC_LEN	8
+
+struct rc_dict_image *rc_dict_image_open(char const *filename);
+void rc_dict_image_close(struct rc_dict_image *img);
+
+int rc_dict_image_write(char const *filename, const DICT_ATTR *attrs,
+			const DICT_VALUE *values, const DICT_VENDOR *vendors);
+
+DICT_ATTR *rc_dict_image_getattr(const struct rc_dict_image *img,
+				 uint64_t attribute);
+DICT_ATTR *rc_dict_image_findattr(const struct rc_dict_image *img,
+				  char const *name);
+DICT_VALUE *rc_dict_image_getval(const struct rc_dict_image *img,
+				 uint32_t value, char const *attrname);
+DICT_VALUE *rc_dict_image_findval(const struct rc_dict_image *img,
+				  char const *name);
+DICT_VENDOR *rc_dict_image_getvend(const struct rc_dict_image *img,
+				   uint32_t vendorpec);
+DICT_VENDOR *rc_dict_image_findvend(const struct rc_dict_image *img,
+				    char const *name);
+
+#endif /* DICTIMAGE_H */
@@ -0,0 +1,272 @@
+/*
+ * dictindex.c	Hash indexes of the dictionary of a handle.
+ *
+ * The dictionary is kept in the lists of rc_conf, newest entry first,
+ * and a lookup returns the newest entry that matches, so that a later
+ * definition overrides an earlier one. The lists are only walked to free
+ * or save them; the lookups use the indexes below, which hold the same
+ * entries and keep only the newest of those with the same key:
+ *
+ *  - the standard attributes, 0 to 255, in an array indexed by number;
+ *  - the other attributes by their vendor and number;
+ *  - the attributes, the values and the vendors by their name, which is
+ *    compared regardless of case;
+ *  - the values by their attribute name and number;
+ *  - the vendors by their number.
+ *
+ * The hash tables use linear probing and double when half full. The
+ * indexes are built when the dictionary is loaded; the lookups, which
+ * may run concurrently, do not modify them.
+ *
+ * License:	BSD
+ *
+ */
+
+#include <config.h>
+#include <includes.h>
+#include <radcli/radcli.h>
+#include "util.h"
+#include "dictindex.h"
+
+#define STD_ATTRS		256
+#define INDEX_INITIAL_SIZE	64
+
+typedef struct index_slot {
+	uint32_t hash;
+	void *entry;		/* NULL for an unused slot */
+} index_slot;
+
+typedef struct index_table {
+	index_slot *slots;
+	size_t size;		/* zero or a power of two */
+	size_t used;
+} index_table;
+
+struct rc_dict_index {
+	DICT_ATTR *std_attrs[STD_ATTRS];
+	index_table attr_by_id;		/* the attributes not in std_attrs */
+	index_table attr_by_name;
+	index_table val_by_attr;
+	index_table val_by_name;
+	index_table vend_by_id;
+	index_table vend_by_name;
+};
+
+/*- Returns the entry with a key, or NULL
+ -*/
+static void *table_lookup(const index_table *t, uint32_t hash,
+			  rc_dict_match match, const void *key)
+{
+	size_t i;
+
+	if (t->size == 0)
+		return NULL;
+
+	for (i = hash & (t->size - 1); t->slots[i].entry != NULL;
+	     i = (i + 1) & (t->size - 1)) {
+		if (t->slots[i].hash == hash && match(t->slots[i].entry, key))
+			return t->slots[i].entry;
+	}
+	return NULL;
+}
+
+/*- Doubles the size of a table
+ -*/
+static int table_grow(index_table *t)
+{
+	index_slot *slots;
+	size_t size, i, j;
+
+	size = t->size ? t->size * 2 : INDEX_INITIAL_SIZE;
+	slots = calloc(size, sizeof(*slots));
+	if (slots == NULL)
+		return -1;
+
+	/* the keys are distinct */
+	for (i = 0; i < t->size; i++) {
+		if (t->slots[i].entry == NULL)
+			continue;
+		for (j = t->slots[i].hash & (size - 1); slots[j].entry != NULL;
+		     j = (j + 1) & (size - 1))
+			;
+		slots[j] = t->slots[i];
+	}
+
+	free(t->slots);
+	t->slots = slots;
+	t->size = size;
+	return 0;
+}
+
+/*- Makes room in a table for one more entry
+ *
+ * @return 0 on success, or -1 when out of memory.
+ -*/
+static int table_reserve(index_table *t)
+{
+	if ((t->used + 1) * 2 > t->size && table_grow(t) < 0) {
+		rc_log(LOG_CRIT, "%s: out of memory", __func__);
+		return -1;
+	}
+	return 0;
+}
+
+/*- Adds an entry to a table with room for it, in place of the one with
+ * the same key
+ -*/
+static void table_insert(index_table *t, uint32_t hash, rc_dict_match match,
+			 const void *key, void *entry)
+{
+	size_t i;
+
+	for (i = hash & (t->size - 1); t->slots[i].entry != NULL;
+	     i = (i + 1) & (t->size - 1)) {
+		if (t->slots[i].hash == hash && match(t->slots[i].entry, key)) {
+			t->slots[i].entry = entry;
+			return;
+		}
+	}
+
+	t->slots[i].hash = hash;
+	t->slots[i].entry = entry;
+	t->used++;
+}
+
+/*- Creates empty indexes
+ *
+ * @return the indexes, or NULL on failure.
+ -*/
+struct rc_dict_index *rc_dict_index_new(void)
+{
+	struct rc_dict_index *idx;
+
+	idx = calloc(1, sizeof(*idx));
+	if (idx == NULL)
+		rc_log(LOG_CRIT, "%s: out of memory", __func__);
+	return idx;
+}
+
+/*- Releases the indexes, but not the entries
+ -*/
+void rc_dict_index_free(struct rc_dict_index *idx)
+{
+	if (idx == NULL)
+		return;
+
+	free(idx->attr_by_id.slots);
+	free(idx->attr_by_name.slots);
+	free(idx->val_by_attr.slots);
+	free(idx->val_by_name.slots);
+	free(idx->vend_by_id.slots);
+	free(idx->vend_by_name.slots);
+	free(idx);
+}
+
+/*- Indexes an attribute, which overrides those of the same name or number
+ *
+ * @return 0 on success, or -1 when out of memory; the attribute is then
+ *	not indexed.
+ -*/
+int rc_dict_index_attr(struct rc_dict_index *idx, DICT_ATTR *attr)
+{
+	if ((attr->value >= STD_ATTRS && table_reserve(&idx->attr_by_id) < 0) ||
+	    table_reserve(&idx->attr_by_name) < 0)
+		return -1;
+
+	if (attr->value < STD_ATTRS)
+		idx->std_attrs[attr->value] = attr;
+	else
+		table_insert(&idx->attr_by_id, rc_dict_hash_int(attr->value),
+			     rc_dict_match_attr_id, &attr->value, attr);
+	table_insert(&idx->attr_by_name, rc_dict_hash_name(attr->name, 1),
+		     rc_dict_match_attr_name, attr->name, attr);
+	return 0;
+}
+
+/*- Indexes a value, which overrides those of the same name, or of the
+ * same attribute and number
+ *
+ * @return 0 on success, or -1 when out of memory; the value is then not
+ *	indexed.
+ -*/
+int rc_dict_index_value(struct rc_dict_index *idx, DICT_VALUE *dval)
+{
+	rc_dict_val_key key = { dval->attrname, dval->value };
+
+	if (table_reserve(&idx->val_by_attr) < 0 ||
+	    table_reserve(&idx->val_by_name) < 0)
+		return -1;
+
+	table_insert(&idx->val_by_attr, rc_dict_hash_val(dval->attrname, dval->value),
+		     rc_dict_match_val, &key, dval);
+	table_insert(&idx->val_by_name, rc_dict_hash_name(dval->name, 1),
+		     rc_dict_match_val_name, dval->name, dval);
+	return 0;
+}
+
+/*- Indexes a vendor, which overrides those of the same name or number
+ *
+ * @return 0 on success, or -1 when out of memory; the vendor is then not
+ *	indexed.
+ -*/
+int rc_dict_index_vendor(struct rc_dict_index *idx, DICT_VENDOR *dvend)
+{
+	if (table_reserve(&idx->vend_by_id) < 0 ||
+	    table_reserve(&idx->vend_by_name) < 0)
+		return -1;
+
+	table_insert(&idx->vend_by_id, rc_dict_hash_int(dvend->vendorpec),
+		     rc_dict_match_vend_id, &dvend->vendorpec, dvend);
+	table_insert(&idx->vend_by_name, rc_dict_hash_name(dvend->vendorname, 1),
+		     rc_dict_match_vend_name, dvend->vendorname, dvend);
+	return 0;
+}
+
+/* the lookups behind rc_dict_getattr() and the others in dict.c */
+
+DICT_ATTR *rc_dict_index_getattr(const struct rc_dict_index *idx,
+				 uint64_t attribute)
+{
+	if (attribute < STD_ATTRS)
+		return idx->std_attrs[attribute];
+
+	return table_lookup(&idx->attr_by_id, rc_dict_hash_int(attribute),
+			    rc_dict_match_attr_id, &attribute);
+}
+
+DICT_ATTR *rc_dict_index_findattr(const struct rc_dict_index *idx,
+				  char const *name)
+{
+	return table_lookup(&idx->attr_by_name, rc_dict_hash_name(name, 1),
+			    rc_dict_match_attr_name, name);
+}
+
+DICT_VALUE *rc_dict_index_getval(const struct rc_dict_index *idx,
+				 uint32_t value, char const *attrname)
+{
+	rc_dict_val_key key = { attrname, value };
+
+	return table_lookup(&idx->val_by_attr, rc_dict_hash_val(attrname, value),
+			    rc_dict_match_val, &key);
+}
+
+DICT_VALUE *rc_dict_index_findval(const struct rc_dict_index *idx,
+				  char const *name)
+{
+	return table_lookup(&idx->val_by_name, rc_dict_hash_name(name, 1),
+			    rc_dict_match_val_name, name);
+}
+
+DICT_VENDOR *rc_dict_index_getvend(const struct rc_dict_index *idx,
+				   uint32_t vendorpec)
+{
+	return table_lookup(&idx->vend_by_id, rc_dict_hash_int(vendorpec),
+			    rc_dict_match_vend_id, &vendorpec);
+}
+
+DICT_VENDOR *rc_dict_index_findvend(const struct rc_dict_index *idx,
+				    char const *name)
+{
+	return table_lookup(&idx->vend_by_name, rc_dict_hash_name(name, 1),
+			    rc_dict_match_vend_name, name);
+}
@@ -0,0 +1,100 @@
+/*
+ * dictindex.h	Internal hash indexes of the dictionary of a handle.
+ *
+ * License:	BSD
+ *
+ */
+#ifndef DICTINDEX_H
+# define DICTINDEX_H
+
+#include <includes.h>
+#include <radcli/radcli.h>
+
+/* the hashes of the indexes, which the binary dictionaries also use */
+static inline uint32_t rc_dict_hash_int(uint64_t v)
+{
+	return (v * 0x9e3779b97f4a7c15ULL) >> 32;
+}
+
+/* FNV-1a of a name; with nocase, the same for all its cases */
+static inline uint32_t rc_dict_hash_name(char const *name, int nocase)
+{
+	uint32_t h = 2166136261U;
+	unsigned char c;
+
+	for (; *name != '\0'; name++) {
+		c = *name;
+		h ^= nocase ? tolower(c) : c;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static inline uint32_t rc_dict_hash_val(char const *attrname, uint32_t value)
+{
+	return rc_dict_hash_name(attrname, 0) ^ rc_dict_hash_int(value);
+}
+
+/* whether an entry has the given key */
+typedef int (*rc_dict_match)(const void *entry, const void *key);
+
+/* the key of the values by attribute */
+typedef struct rc_dict_val_key {
+	char const *attrname;
+	uint32_t value;
+} rc_dict_val_key;
+
+static inline int rc_dict_match_attr_id(const void *entry, const void *key)
+{
+	return ((const DICT_ATTR *)entry)->value == *(const uint64_t *)key;
+}
+
+static inline int rc_dict_match_attr_name(const void *entry, const void *key)
+{
+	return strcasecmp(((const DICT_ATTR *)entry)->name, key) == 0;
+}
+
+static inline int rc_dict_match_val(const void *entry, const void *key)
+{
+	const DICT_VALUE *dval = entry;
+	const rc_dict_val_key *k = key;
+
+	return dval->value == k->value && strcmp(dval->attrname, k->attrname) == 0;
+}
+
+static inline int rc_dict_match_val_name(const void *entry, const void *key)
+{
+	return strcasecmp(((const DICT_VALUE *)entry)->name, key) == 0;
+}
+
+static inline int rc_dict_match_vend_id(const void *entry, const void *key)
+{
+	return ((const DICT_VENDOR *)entry)->vendorpec == *(const uint32_t *)key;
+}
+
+static inline int rc_dict_match_vend_name(const void *entry, const void *key)
+{
+	return strcasecmp(((const DICT_VENDOR *)entry)->vendorname, key) == 0;
+}
+
+struct rc_dict_index *rc_dict_index_new(void);
+void rc_dict_index_free(struct rc_dict_index *idx);
+
+int rc_dict_index_attr(struct rc_dict_index *idx, DICT_ATTR *attr);
+int rc_dict_index_value(struct rc_dict_index *idx, DICT_VALUE *dval);
+int rc_dict_index_vendor(struct rc_dict_index *idx, DICT_VENDOR *dvend);
+
+DICT_ATTR *rc_dict_index_getattr(const struct rc_dict_index *idx,
+				 uint64_t attribute);
+DICT_ATTR *rc_dict_index_findattr(const struct rc_dict_index *idx,
+				  char const *name);
+DICT_VALUE *rc_dict_index_getval(const struct rc_dict_index *idx,
+				 uint32_t value, char const *attrname);
+DICT_VALUE *rc_dict_index_findval(const struct rc_dict_index *idx,
+				  char const *name);
+DICT_VENDOR *rc_dict_index_getvend(const struct rc_dict_index *idx,
+				   uint32_t vendorpec);
+DICT_VENDOR *rc_dict_index_findvend(const struct rc_dict_index *idx,
+				    char const *name);
+
+#endif /* DICTINDEX_H */
@@ -0,0 +1,411 @@
+/*
+ * dnscache.c	Cache of the resolved addresses of the servers, shared by
+ *		the requests of a handle.
+ *
+ * The first request to a server resolves its name, and the address and
+ * port are kept in numeric form. Later requests turn them back into an
+ * address without a resolver query, reading the entry without a lock:
+ * each entry is protected by a sequence counter, which is odd while the
+ * entry is rewritten, and a reader retries when it changed.
+ *
+ * The entries are refreshed by a thread, started with the first entry,
+ * once they are older than the time to live set with dns-cache-ttl. When
+ * a refresh fails the previous address is kept, so that a stalled or
+ * failing resolver never delays a request to a known server. Names are
+ * resolved in the network namespace of the handle.
+ *
+ * Only the thread which called fork() runs in the child, which may also
+ * inherit the lock, or an entry, in the middle of an update. The first
+ * lookup in the child notices the change of process, resets them and
+ * starts a refresh thread of its own.
+ *
+ * License:	BSD
+ *
+ */
+
+#include <config.h>
+#include <includes.h>
+#include <radcli/radcli.h>
+#include <pthread.h>
+#include <sched.h>
+#include "util.h"
+#include "dnscache.h"
+#include "netns.h"
+
+/* the number of names kept; more are resolved on every request */
+#define DNS_CACHE_SIZE		32
+/* the time in seconds before a failed refresh is retried */
+#define DNS_RETRY_TIME		5
+#define DNS_PORT_LEN		8
+/* the pid of a cache while the child of a fork() resets it */
+#define DNS_PID_RESETTING	((pid_t)-1)
+
+typedef struct dns_entry {
+	/* set before the entry is published, and never changed */
+	char *host;
+	unsigned flags;
+
+	unsigned seq;		/* odd while addr and port are written */
+	char addr[NI_MAXHOST];
+	char port[DNS_PORT_LEN];
+
+	double refresh_at;	/* under the cache lock */
+} dns_entry;
+
+struct rc_dns_cache {
+	pthread_mutex_t lock;	/* serializes the writers */
+	pthread_cond_t cond;
+	pthread_t thread;
+	unsigned running;	/* the refresh thread runs in this process */
+	pid_t pid;		/* the process the cache belongs to */
+	unsigned stop;
+	unsigned ttl;		/* zero when nothing is cached */
+	struct rc_netns *netns;
+	unsigned used;		/* the entries published to the readers */
+	dns_entry entries[DNS_CACHE_SIZE];
+};
+
+/*- Creates a cache of resolved addresses
+ *
+ * @param ttl the time in seconds an address is used before it is refreshed,
+ *	or zero to resolve the names on every request.
+ * @param netns the namespace to resolve the names in, or NULL.
+ * @return the cache, or NULL on failure.
+ -*/
+struct rc_dns_cache *rc_dns_cache_new(unsigned ttl, struct rc_netns *netns)
+{
+	struct rc_dns_cache *cache;
+
+	cache = calloc(1, sizeof(*cache));
+	if (cache == NULL) {
+		rc_log(LOG_CRIT, "%s: out of memory", __func__);
+		return NULL;
+	}
+
+	if (pthread_mutex_init(&cache->lock, NULL) != 0) {
+		free(cache);
+		return NULL;
+	}
+
+	if (pthread_cond_init(&cache->cond, NULL) != 0) {
+		pthread_mutex_destroy(&cache->lock);
+		free(cache);
+		return NULL;
+	}
+
+	cache->ttl = ttl;
+	cache->netns = netns;
+	cache->pid = getpid();
+	return cache;
+}
+
+static void *refresh_thread(void *arg);
+
+/*- Starts the refresh thread; called with the cache lock held
+ *
+ * @return 0 on success, or -1 on failure.
+ -*/
+static int start_thread(struct rc_dns_cache *cache)
+{
+	if (pthread_create(&cache->thread, NULL, refresh_thread, cache) != 0) {
+		rc_log(LOG_ERR, "%s: cannot start the refresh thread", __func__);
+		return -1;
+	}
+	cache->running = 1;
+	return 0;
+}
+
+/*- Takes over a cache inherited over fork()
+ *
+ * The lock and the condition are initialized again, and an entry left in
+ * the middle of an update is emptied and refreshed at once. The other
+ * threads of the child wait until the first one is done.
+ *
+ * @param cache the cache.
+ * @param restart whether to start the refresh thread in this process.
+ -*/
+static void cache_after_fork(struct rc_dns_cache *cache, int restart)
+{
+	pid_t pid = getpid();
+	pid_t owner = __atomic_load_n(&cache->pid, __ATOMIC_ACQUIRE);
+	dns_entry *e;
+	unsigned i;
+
+	if (owner == pid)
+		return;
+
+	if (owner == DNS_PID_RESETTING ||
+	    !__atomic_compare_exchange_n(&cache->pid, &owner, DNS_PID_RESETTING,
+					 0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+		while (__atomic_load_n(&cache->pid, __ATOMIC_ACQUIRE) != pid)
+			sched_yield();
+		return;
+	}
+
+	pthread_mutex_init(&cache->lock, NULL);
+	pthread_cond_init(&cache->cond, NULL);
+	cache->running = 0;
+
+	for (i = 0; i < cache->used; i++) {
+		e = &cache->entries[i];
+		if (e->seq & 1) {
+			e->addr[0] = '\0';
+			e->seq++;
+			e->refresh_at = 0;
+		}
+	}
+
+	if (restart && cache->used > 0 && !cache->stop)
+		start_thread(cache);
+
+	__atomic_store_n(&cache->pid, pid, __ATOMIC_RELEASE);
+}
+
+/*- Releases a cache and stops its refresh thread
+ -*/
+void rc_dns_cache_free(struct rc_dns_cache *cache)
+{
+	unsigned i;
+
+	if (cache == NULL)
+		return;
+
+	cache_after_fork(cache, 0);
+
+	pthread_mutex_lock(&cache->lock);
+	cache->stop = 1;
+	pthread_cond_signal(&cache->cond);
+	pthread_mutex_unlock(&cache->lock);
+
+	if (cache->running)
+		pthread_join(cache->thread, NULL);
+
+	for (i = 0; i < cache->used; i++)
+		free(cache->entries[i].host);
+
+	pthread_cond_destroy(&cache->cond);
+	pthread_mutex_destroy(&cache->lock);
+	free(cache);
+}
+
+/*- Resolves a name to an address and port in numeric form
+ *
+ * @param netns the namespace to resolve the name in, or NULL.
+ * @param host the name of the host.
+ * @param flags a combination of PW_AI flags.
+ * @param addr will hold the address (of NI_MAXHOST).
+ * @param port will hold the port (of DNS_PORT_LEN).
+ * @return the addresses as returned by rc_getaddrinfo(), or NULL on failure.
+ -*/
+static struct addrinfo *resolve(struct rc_netns *netns, char const *host,
+				unsigned flags, char *addr, char *port)
+{
+	struct addrinfo *res;
+
+	res = rc_netns_getaddrinfo(netns, host, flags);
+	if (res == NULL)
+		return NULL;
+
+	if (getnameinfo(res->ai_addr, res->ai_addrlen, addr, NI_MAXHOST,
+			port, DNS_PORT_LEN, NI_NUMERICHOST | NI_NUMERICSERV) != 0) {
+		freeaddrinfo(res);
+		return NULL;
+	}
+
+	return res;
+}
+
+/*- Returns whether a host is an address in numeric form
+ -*/
+static int is_numeric(char const *host)
+{
+	struct in6_addr a;
+
+	return inet_pton(AF_INET, host, &a) == 1 ||
+	       inet_pton(AF_INET6, host, &a) == 1;
+}
+
+/*- Rewrites the address of an entry; called with the cache lock held
+ -*/
+static void entry_write(dns_entry *e, char const *addr, char const *port)
+{
+	unsigned seq = e->seq;
+
+	__atomic_store_n(&e->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	strlcpy(e->addr, addr, sizeof(e->addr));
+	strlcpy(e->port, port, sizeof(e->port));
+	__atomic_store_n(&e->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/*- Copies the address of an entry without taking the cache lock
+ -*/
+static void entry_read(dns_entry *e, char *addr, char *port)
+{
+	unsigned seq;
+
+	for (;;) {
+		seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+		memcpy(addr, e->addr, NI_MAXHOST);
+		memcpy(port, e->port, DNS_PORT_LEN);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) == seq)
+			break;
+	}
+	addr[NI_MAXHOST - 1] = '\0';
+	port[DNS_PORT_LEN - 1] = '\0';
+}
+
+/*- Returns the published entry of a name, or NULL
+ -*/
+static dns_entry *find_entry(struct rc_dns_cache *cache, char const *host,
+			     unsigned flags)
+{
+	unsigned used = __atomic_load_n(&cache->used, __ATOMIC_ACQUIRE);
+	unsigned i;
+
+	for (i = 0; i < used; i++) {
+		if (cache->entries[i].flags == flags &&
+		    strcmp(cache->entries[i].host, host) == 0)
+			return &cache->entries[i];
+	}
+
+	return NULL;
+}
+
+/*- Refreshes the entries older than their time to live
+ -*/
+static void *refresh_thread(void *arg)
+{
+	struct rc_dns_cache *cache = arg;
+	char addr[NI_MAXHOST], port[DNS_PORT_LEN];
+	struct addrinfo *res;
+	struct timespec ts;
+	dns_entry *e;
+	double now, next, wait;
+	unsigned i;
+
+	pthread_mutex_lock(&cache->lock);
+	while (!cache->stop) {
+		now = rc_getmtime();
+		e = NULL;
+		next = 0;
+		for (i = 0; i < cache->used; i++) {
+			if (e == NULL || cache->entries[i].refresh_at < next) {
+				e = &cache->entries[i];
+				next = e->refresh_at;
+			}
+		}
+
+		if (e == NULL || next > now) {
+			/* the condition uses the real time clock */
+			wait = e == NULL ? cache->ttl : next - now;
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += (time_t)wait;
+			ts.tv_nsec += (long)((wait - (time_t)wait) * 1000000000);
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&cache->cond, &cache->lock, &ts);
+			continue;
+		}
+
+		/* the name is resolved without blocking the other writers */
+		pthread_mutex_unlock(&cache->lock);
+		res = resolve(cache->netns, e->host, e->flags, addr, port);
+		pthread_mutex_lock(&cache->lock);
+
+		if (res != NULL) {
+			freeaddrinfo(res);
+			entry_write(e, addr, port);
+			e->refresh_at = rc_getmtime() + cache->ttl;
+		} else {
+			rc_log(LOG_WARNING, "%s: cannot resolve %s; using the previous address",
+			       __func__, e->host);
+			e->refresh_at = rc_getmtime() +
+			    (cache->ttl < DNS_RETRY_TIME ? cache->ttl : DNS_RETRY_TIME);
+		}
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	return NULL;
+}
+
+/*- Adds a resolved name to the cache
+ *
+ * The entry is not added when the cache is full.
+ -*/
+static void add_entry(struct rc_dns_cache *cache, char const *host,
+		      unsigned flags, char const *addr, char const *port)
+{
+	dns_entry *e;
+
+	pthread_mutex_lock(&cache->lock);
+	if (find_entry(cache, host, flags) != NULL ||
+	    cache->used == DNS_CACHE_SIZE || cache->stop)
+		goto exit;
+
+	e = &cache->entries[cache->used];
+	e->host = strdup(host);
+	if (e->host == NULL)
+		goto exit;
+	e->flags = flags;
+	entry_write(e, addr, port);
+	e->refresh_at = rc_getmtime() + cache->ttl;
+
+	if (!cache->running && start_thread(cache) < 0) {
+		free(e->host);
+		e->host = NULL;
+		goto exit;
+	}
+
+	/* the entry is complete before the readers may see it */
+	__atomic_store_n(&cache->used, cache->used + 1, __ATOMIC_RELEASE);
+	pthread_cond_signal(&cache->cond);
+
+ exit:
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/*- Returns the address of a host, using the cache when possible
+ *
+ * @param cache the cache, or NULL to always query the resolver.
+ * @param host the name of the host.
+ * @param flags a combination of PW_AI flags.
+ * @return address which should be deallocated using freeaddrinfo() or NULL on failure.
+ -*/
+struct addrinfo *rc_dns_lookup(struct rc_dns_cache *cache, char const *host,
+			       unsigned flags)
+{
+	char addr[NI_MAXHOST], port[DNS_PORT_LEN];
+	struct addrinfo hints, *res;
+	dns_entry *e;
+
+	if (cache == NULL || host == NULL || is_numeric(host))
+		return rc_getaddrinfo(host, flags);
+
+	if (cache->ttl == 0)
+		return rc_netns_getaddrinfo(cache->netns, host, flags);
+
+	cache_after_fork(cache, 1);
+
+	e = find_entry(cache, host, flags);
+	if (e != NULL) {
+		entry_read(e, addr, port);
+
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_socktype = SOCK_DGRAM;
+		hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+		if (getaddrinfo(addr, port, &hints, &res) == 0)
+			return res;
+	}
+
+	res = resolve(cache->netns, host, flags, addr, port);
+	if (res != NULL)
+		add_entry(cache, host, flags, addr, port);
+
+	return res;
+}
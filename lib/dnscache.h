@@ -0,0 +1,22 @@
+/*
+ * dnscache.h	Internal cache of the resolved addresses of the servers,
+ *		shared by the requests of a handle.
+ *
+ * License:	BSD
+ *
+ */
+#ifndef DNSCACHE_H
+# define DNSCACHE_H
+
+#include <includes.h>
+
+/* the time in seconds a resolved address is used before it is refreshed */
+#define RC_DNS_DEFAULT_TTL	60
+
+struct rc_dns_cache *rc_dns_cache_new(unsigned ttl, struct rc_netns *netns);
+void rc_dns_cache_free(struct rc_dns_cache *cache);
+
+struct addrinfo *rc_dns_lookup(struct rc_dns_cache *cache, char const *host,
+			       unsigned flags);
+
+#endif /* DNSCACHE_H */
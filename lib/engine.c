@@ -0,0 +1,930 @@
+/*
+ * engine.c	Asynchronous request engine.
+ *
+ * License:	BSD
+ *
+ */
+
+/**
+ * @defgroup engine-api Asynchronous API
+ * @brief Functions to keep many requests in flight from a single thread
+ *
+ * The engine keeps an outstanding-request table for a set of shared
+ * UDP sockets. Requests are submitted with rc_engine_submit() and their
+ * completion is reported through a callback, from rc_engine_run().
+ * Replies are matched to requests by socket, server address, Identifier
+ * and response authenticator, and retransmissions of all requests are
+ * driven from the same loop. Each socket has a separate Identifier space
+ * for every server it talks to; when the space of a server is exhausted
+ * on all sockets, another socket (source port) is opened.
+ *
+ * An engine must only be used from a single thread at a time.
+ *
+ * @{
+ */
+
+#include <config.h>
+#include <includes.h>
+#include <radcli/radcli.h>
+#include <poll.h>
+#include "util.h"
+#include "sendserver.h"
+#include "idspace.h"
+#include "srcaddr.h"
+#include "netns.h"
+
+struct engine_sock;
+struct engine_peer;
+
+typedef struct engine_req {
+	SEND_DATA *data;
+	rc_engine_cb cb;
+	void *usr;
+
+	struct engine_sock *sock;
+	struct engine_peer *peer;
+	struct sockaddr_storage dest;
+	socklen_t destlen;
+	char secret[MAX_SECRET_LENGTH + 1];
+	unsigned char vector[AUTH_VECTOR_LEN];
+	uint8_t *packet;
+	int packet_len;
+	int sign_pending;	/* the packet is signed when first transmitted */
+
+	int retries;
+	double deadline;
+	unsigned heap_idx;	/* position in the timer heap; 0 when not armed */
+	struct engine_req *next_queued;
+} engine_req;
+
+/* the requests in flight from one socket to one server */
+typedef struct engine_peer {
+	struct sockaddr_storage addr;
+	rc_id_space ids;
+	engine_req *reqs[RC_ID_SPACE_SIZE];
+	struct engine_peer *next;
+} engine_peer;
+
+typedef struct engine_sock {
+	int fd;
+	int family;
+	engine_peer *peers;
+
+	/* requests waiting to be transmitted */
+	engine_req *queue_head;
+	engine_req *queue_tail;
+} engine_sock;
+
+struct rc_engine_st {
+	rc_handle *rh;
+
+	engine_sock **socks;
+	struct pollfd *pfds;
+	unsigned nsocks;
+
+	/* min-heap of armed requests keyed on their deadline; 1-based */
+	engine_req **heap;
+	unsigned heap_size;
+	unsigned heap_max;
+
+	unsigned pending;
+	unsigned closing;	/* set by rc_engine_free(); no request is accepted */
+	uint8_t buffer[RC_BUFFER_LEN];
+	uint8_t (*rbufs)[RC_BUFFER_LEN];	/* RC_BATCH_MAX receive buffers */
+};
+
+static void heap_swap(RC_ENGINE *eng, unsigned a, unsigned b)
+{
+	engine_req *t = eng->heap[a];
+
+	eng->heap[a] = eng->heap[b];
+	eng->heap[b] = t;
+	eng->heap[a]->heap_idx = a;
+	eng->heap[b]->heap_idx = b;
+}
+
+static void heap_up(RC_ENGINE *eng, unsigned i)
+{
+	while (i > 1 && eng->heap[i]->deadline < eng->heap[i / 2]->deadline) {
+		heap_swap(eng, i, i / 2);
+		i /= 2;
+	}
+}
+
+static void heap_down(RC_ENGINE *eng, unsigned i)
+{
+	unsigned c;
+
+	while ((c = 2 * i) <= eng->heap_size) {
+		if (c < eng->heap_size &&
+		    eng->heap[c + 1]->deadline < eng->heap[c]->deadline)
+			c++;
+		if (eng->heap[i]->deadline <= eng->heap[c]->deadline)
+			break;
+		heap_swap(eng, i, c);
+		i = c;
+	}
+}
+
+static int heap_push(RC_ENGINE *eng, engine_req *req)
+{
+	engine_req **h;
+	unsigned max;
+
+	if (eng->heap_size + 1 >= eng->heap_max) {
+		max = eng->heap_max ? eng->heap_max * 2 : 64;
+		h = realloc(eng->heap, max * sizeof(*h));
+		if (h == NULL)
+			return -1;
+		eng->heap = h;
+		eng->heap_max = max;
+	}
+
+	eng->heap[++eng->heap_size] = req;
+	req->heap_idx = eng->heap_size;
+	heap_up(eng, req->heap_idx);
+	return 0;
+}
+
+static void heap_remove(RC_ENGINE *eng, engine_req *req)
+{
+	unsigned i = req->heap_idx;
+
+	if (i == 0)
+		return;
+
+	req->heap_idx = 0;
+	if (i != eng->heap_size) {
+		eng->heap[i] = eng->heap[eng->heap_size--];
+		eng->heap[i]->heap_idx = i;
+		heap_up(eng, i);
+		heap_down(eng, eng->heap[i]->heap_idx);
+	} else {
+		eng->heap_size--;
+	}
+}
+
+static void queue_remove(engine_sock *sock, engine_req *req)
+{
+	engine_req *p, *prev = NULL;
+
+	for (p = sock->queue_head; p != NULL; prev = p, p = p->next_queued) {
+		if (p != req)
+			continue;
+		if (prev)
+			prev->next_queued = p->next_queued;
+		else
+			sock->queue_head = p->next_queued;
+		if (sock->queue_tail == p)
+			sock->queue_tail = prev;
+		p->next_queued = NULL;
+		return;
+	}
+}
+
+static void queue_append(engine_sock *sock, engine_req *req)
+{
+	req->next_queued = NULL;
+	if (sock->queue_tail)
+		sock->queue_tail->next_queued = req;
+	else
+		sock->queue_head = req;
+	sock->queue_tail = req;
+}
+
+static engine_req *queue_pop(engine_sock *sock)
+{
+	engine_req *req = sock->queue_head;
+
+	if (req != NULL) {
+		sock->queue_head = req->next_queued;
+		if (sock->queue_head == NULL)
+			sock->queue_tail = NULL;
+		req->next_queued = NULL;
+	}
+	return req;
+}
+
+/*- Releases a request and reports its result to the caller
+ -*/
+static void complete_req(RC_ENGINE *eng, engine_req *req, int result)
+{
+	engine_sock *sock = req->sock;
+
+	heap_remove(eng, req);
+	queue_remove(sock, req);
+
+	req->peer->reqs[req->data->seq_nbr] = NULL;
+	rc_id_release(&req->peer->ids, req->data->seq_nbr);
+	eng->pending--;
+
+	memset(req->secret, 0, sizeof(req->secret));
+	free(req->packet);
+
+	if (req->cb)
+		req->cb(eng, req->data, result, req->usr);
+	free(req);
+}
+
+/*- Returns the address the engine sockets of the given family bind to
+ -*/
+static int engine_bind_addr(RC_ENGINE *eng, int family,
+			    struct sockaddr_storage *ss)
+{
+	rc_own_bind_addr(eng->rh, ss);
+
+	if (ss->ss_family == family)
+		return 0;
+
+	if (ss->ss_family == AF_INET &&
+	    ((struct sockaddr_in *)ss)->sin_addr.s_addr == INADDR_ANY) {
+		memset(ss, 0, sizeof(*ss));
+		ss->ss_family = family;
+		if (family == AF_INET6)
+			((struct sockaddr_in6 *)ss)->sin6_addr = in6addr_any;
+		return 0;
+	}
+
+	return -1;
+}
+
+static engine_sock *engine_new_sock(RC_ENGINE *eng, int family)
+{
+	struct sockaddr_storage our_sockaddr;
+	engine_sock *sock, **socks;
+	struct pollfd *pfds;
+	int flags;
+
+	if (eng->rh->so.get_fd == NULL)
+		return NULL;
+
+	if (engine_bind_addr(eng, family, &our_sockaddr) < 0) {
+		rc_log(LOG_ERR, "%s: bindaddr does not match server address family",
+		       __func__);
+		return NULL;
+	}
+
+	socks = realloc(eng->socks, (eng->nsocks + 1) * sizeof(*socks));
+	if (socks == NULL)
+		return NULL;
+	eng->socks = socks;
+
+	pfds = realloc(eng->pfds, (eng->nsocks + 1) * sizeof(*pfds));
+	if (pfds == NULL)
+		return NULL;
+	eng->pfds = pfds;
+
+	sock = calloc(1, sizeof(*sock));
+	if (sock == NULL)
+		return NULL;
+
+	sock->fd = rc_netns_get_fd(eng->rh, SA(&our_sockaddr));
+	if (sock->fd < 0) {
+		rc_log(LOG_ERR, "%s: socket: %s", __func__, strerror(errno));
+		free(sock);
+		return NULL;
+	}
+
+	flags = fcntl(sock->fd, F_GETFL, 0);
+	if (flags == -1 || fcntl(sock->fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+		rc_log(LOG_ERR, "%s: fcntl: %s", __func__, strerror(errno));
+		if (eng->rh->so.close_fd)
+			eng->rh->so.close_fd(sock->fd);
+		free(sock);
+		return NULL;
+	}
+
+	sock->family = family;
+
+	eng->socks[eng->nsocks] = sock;
+	eng->pfds[eng->nsocks].fd = sock->fd;
+	eng->pfds[eng->nsocks].events = POLLIN;
+	eng->nsocks++;
+
+	DEBUG(LOG_INFO, "engine: opened socket %u (fd %d)", eng->nsocks - 1,
+	      sock->fd);
+	return sock;
+}
+
+static int same_addr(const struct sockaddr_storage *a,
+		     const struct sockaddr_storage *b)
+{
+	if (a->ss_family != b->ss_family)
+		return 0;
+
+	if (a->ss_family == AF_INET) {
+		const struct sockaddr_in *a4 = (const struct sockaddr_in *)a;
+		const struct sockaddr_in *b4 = (const struct sockaddr_in *)b;
+		return a4->sin_port == b4->sin_port &&
+		    a4->sin_addr.s_addr == b4->sin_addr.s_addr;
+	} else {
+		const struct sockaddr_in6 *a6 = (const struct sockaddr_in6 *)a;
+		const struct sockaddr_in6 *b6 = (const struct sockaddr_in6 *)b;
+		return a6->sin6_port == b6->sin6_port &&
+		    memcmp(&a6->sin6_addr, &b6->sin6_addr,
+			   sizeof(a6->sin6_addr)) == 0;
+	}
+}
+
+static engine_peer *find_peer(engine_sock *sock,
+			      const struct sockaddr_storage *addr)
+{
+	engine_peer *peer;
+
+	for (peer = sock->peers; peer != NULL; peer = peer->next) {
+		if (same_addr(&peer->addr, addr))
+			return peer;
+	}
+	return NULL;
+}
+
+static engine_peer *new_peer(engine_sock *sock,
+			     const struct sockaddr_storage *addr)
+{
+	engine_peer *peer;
+
+	peer = calloc(1, sizeof(*peer));
+	if (peer == NULL)
+		return NULL;
+
+	memcpy(&peer->addr, addr, sizeof(peer->addr));
+	rc_id_space_init(&peer->ids);
+	peer->next = sock->peers;
+	sock->peers = peer;
+	return peer;
+}
+
+/*- Reserves an Identifier for a request on a socket of the destination's family
+ *
+ * The first socket with a free Identifier for the destination server is
+ * used; a new socket is opened when all of them are exhausted.
+ -*/
+static int engine_get_slot(RC_ENGINE *eng, engine_req *req)
+{
+	engine_sock *sock;
+	engine_peer *peer = NULL;
+	unsigned i;
+	int id;
+
+	for (i = 0; i < eng->nsocks; i++) {
+		sock = eng->socks[i];
+		if (sock->family != req->dest.ss_family)
+			continue;
+
+		peer = find_peer(sock, &req->dest);
+		if (peer == NULL || !rc_id_space_full(&peer->ids))
+			break;
+	}
+
+	if (i == eng->nsocks) {
+		sock = engine_new_sock(eng, req->dest.ss_family);
+		if (sock == NULL)
+			return -1;
+		peer = NULL;
+	}
+
+	if (peer == NULL) {
+		peer = new_peer(sock, &req->dest);
+		if (peer == NULL) {
+			rc_log(LOG_CRIT, "%s: out of memory", __func__);
+			return -1;
+		}
+	}
+
+	id = rc_id_alloc(&peer->ids);
+	if (id < 0)
+		return -1;
+
+	peer->reqs[id] = req;
+	req->sock = sock;
+	req->peer = peer;
+	return id;
+}
+
+/** Creates a new asynchronous request engine
+ *
+ * The engine uses the transport configured in the handle, which must
+ * be UDP. The handle must remain valid for the lifetime of the engine.
+ *
+ * @param rh a handle to parsed configuration.
+ * @return a new engine (free with rc_engine_free()), or NULL on failure.
+ */
+RC_ENGINE *rc_engine_new(rc_handle *rh)
+{
+	RC_ENGINE *eng;
+
+	if (rh->so_type != RC_SOCKET_UDP) {
+		rc_log(LOG_ERR, "%s: the engine supports only UDP transport",
+		       __func__);
+		return NULL;
+	}
+
+	eng = calloc(1, sizeof(*eng));
+	if (eng == NULL) {
+		rc_log(LOG_CRIT, "%s: out of memory", __func__);
+		return NULL;
+	}
+
+	eng->rbufs = malloc(RC_BATCH_MAX * sizeof(*eng->rbufs));
+	if (eng->rbufs == NULL) {
+		rc_log(LOG_CRIT, "%s: out of memory", __func__);
+		free(eng);
+		return NULL;
+	}
+
+	eng->rh = rh;
+	return eng;
+}
+
+/** Destroys an engine
+ *
+ * Any requests still outstanding are completed with ERROR_RC. Their
+ * callbacks cannot submit new requests to this engine: rc_engine_submit()
+ * fails while it is being freed.
+ *
+ * @param engine the engine to free.
+ */
+void rc_engine_free(RC_ENGINE *engine)
+{
+	engine_peer *peer, *next;
+	unsigned i, j;
+
+	if (engine == NULL)
+		return;
+
+	engine->closing = 1;
+	for (i = 0; i < engine->nsocks; i++) {
+		for (peer = engine->socks[i]->peers; peer != NULL; peer = peer->next) {
+			for (j = 0; j < RC_ID_SPACE_SIZE; j++) {
+				if (peer->reqs[j] != NULL)
+					complete_req(engine, peer->reqs[j],
+						     ERROR_RC);
+			}
+		}
+	}
+
+	for (i = 0; i < engine->nsocks; i++) {
+		if (engine->rh->so.close_fd)
+			engine->rh->so.close_fd(engine->socks[i]->fd);
+		for (peer = engine->socks[i]->peers; peer != NULL; peer = next) {
+			next = peer->next;
+			free(peer);
+		}
+		free(engine->socks[i]);
+	}
+
+	free(engine->socks);
+	free(engine->pfds);
+	free(engine->heap);
+	free(engine->rbufs);
+	free(engine);
+}
+
+/** Submits a request to the engine
+ *
+ * The request is built from data, which is typically initialized
+ * using rc_buildreq(); its seq_nbr is assigned by the engine. The data
+ * structure must remain valid until the callback is called. The request
+ * is transmitted on the next call to rc_engine_run().
+ *
+ * On completion the callback receives one of the rc_send_server() return
+ * codes, and on success the received pairs in data->receive_pairs; these
+ * must be released by the caller using rc_avpair_free().
+ *
+ * @param engine the engine.
+ * @param data a pointer to a SEND_DATA structure.
+ * @param type must be %AUTH or %ACCT.
+ * @param cb the function to call on completion.
+ * @param usr a pointer passed to the callback.
+ * @return OK_RC (0) when the request was queued, or negative on failure
+ *	in which case the callback will not be called. It fails from the
+ *	callbacks called by rc_engine_free().
+ */
+int rc_engine_submit(RC_ENGINE *engine, SEND_DATA *data, rc_type type,
+		     rc_engine_cb cb, void *usr)
+{
+	rc_handle *rh = engine->rh;
+	struct sockaddr_storage our_sockaddr;
+	struct addrinfo *auth_addr = NULL;
+	engine_req *req;
+	int id;
+	int result = ERROR_RC;
+
+	if (engine->closing)
+		return ERROR_RC;
+
+	if (data->server == NULL || data->server[0] == '\0')
+		return ERROR_RC;
+
+	req = calloc(1, sizeof(*req));
+	if (req == NULL) {
+		rc_log(LOG_CRIT, "%s: out of memory", __func__);
+		return ERROR_RC;
+	}
+
+	if (rc_resolve_server(rh, data, type, req->secret, &auth_addr) != OK_RC)
+		goto fail;
+
+	memcpy(&req->dest, auth_addr->ai_addr, auth_addr->ai_addrlen);
+	req->destlen = auth_addr->ai_addrlen;
+
+	rc_own_bind_addr(rh, &our_sockaddr);
+	if (our_sockaddr.ss_family == AF_INET &&
+	    ((struct sockaddr_in *)&our_sockaddr)->sin_addr.s_addr == INADDR_ANY) {
+		result = rc_srcaddr_lookup(rh->srcaddr, SA(&our_sockaddr),
+					   SA(&req->dest));
+		if (result != OK_RC) {
+			rc_log(LOG_ERR, "%s: cannot figure our own address",
+			       __func__);
+			goto fail;
+		}
+		result = ERROR_RC;
+	}
+
+	id = engine_get_slot(engine, req);
+	if (id < 0)
+		goto fail;
+
+	req->data = data;
+	req->cb = cb;
+	req->usr = usr;
+	data->seq_nbr = id;
+	data->receive_pairs = NULL;
+
+	rc_fill_nas_attrs(rh, data, &our_sockaddr);
+
+	req->packet_len = rc_pack_request_unsigned(rh, data, req->secret,
+						   (AUTH_HDR *) engine->buffer,
+						   req->vector);
+	req->sign_pending = 1;
+	req->packet = malloc(req->packet_len);
+	if (req->packet == NULL) {
+		rc_log(LOG_CRIT, "%s: out of memory", __func__);
+		req->peer->reqs[id] = NULL;
+		rc_id_release(&req->peer->ids, id);
+		goto fail;
+	}
+	memcpy(req->packet, engine->buffer, req->packet_len);
+
+	engine->pending++;
+	queue_append(req->sock, req);
+	result = OK_RC;
+
+	DEBUG(LOG_INFO, "engine: queued request %u to %s:%d", (unsigned)id,
+	      data->server, data->svc_port);
+
+ fail:
+	if (auth_addr)
+		freeaddrinfo(auth_addr);
+	if (result != OK_RC) {
+		memset(req->secret, 0, sizeof(req->secret));
+		free(req);
+	}
+	return result;
+}
+
+/*- Arms the retransmission timer of a transmitted request
+ -*/
+static void arm_req(RC_ENGINE *eng, engine_req *req, double now)
+{
+	req->deadline = now + SEND_DATA_TIMEOUT(req->data);
+	heap_remove(eng, req);
+	if (heap_push(eng, req) < 0)
+		complete_req(eng, req, ERROR_RC);
+}
+
+/*- Sends a batch of datagrams, one at a time if the transport has no batch call
+ -*/
+static int send_batch(const rc_sockets_override *sfuncs, int sockfd,
+		      rc_dgram *msgs, unsigned n)
+{
+	unsigned i;
+	int ret;
+
+	if (sfuncs->sendmmsg) {
+		do {
+			ret = sfuncs->sendmmsg(sfuncs->ptr, sockfd, msgs, n, 0);
+		} while (ret == -1 && errno == EINTR);
+		return ret;
+	}
+
+	for (i = 0; i < n; i++) {
+		do {
+			ret = sfuncs->sendto(sfuncs->ptr, sockfd, msgs[i].buf,
+					     msgs[i].len, 0, msgs[i].addr,
+					     msgs[i].addrlen);
+		} while (ret == -1 && errno == EINTR);
+		if (ret == -1)
+			return i > 0 ? (int)i : -1;
+	}
+	return n;
+}
+
+/*- Signs the requests of a batch transmitted for the first time
+ -*/
+static void sign_batch(RC_ENGINE *eng, engine_req **batch, unsigned n)
+{
+	rc_sign_job jobs[RC_BATCH_MAX];
+	unsigned i, njobs = 0;
+
+	for (i = 0; i < n; i++) {
+		if (!batch[i]->sign_pending)
+			continue;
+		jobs[njobs].auth = (AUTH_HDR *) batch[i]->packet;
+		jobs[njobs].length = batch[i]->packet_len;
+		jobs[njobs].secret = batch[i]->secret;
+		jobs[njobs].vector = batch[i]->vector;
+		batch[i]->sign_pending = 0;
+		njobs++;
+	}
+
+	if (njobs > 0)
+		rc_sign_requests(eng->rh, jobs, njobs);
+}
+
+/*- Transmits the queued requests of a socket in batches
+ -*/
+static void flush_sock(RC_ENGINE *eng, engine_sock *sock, double now)
+{
+	engine_req *batch[RC_BATCH_MAX];
+	rc_dgram msgs[RC_BATCH_MAX];
+	engine_req *req;
+	unsigned n, i;
+	int ret, blocked;
+
+	while (sock->queue_head != NULL) {
+		for (n = 0; n < RC_BATCH_MAX && (req = queue_pop(sock)) != NULL; n++) {
+			batch[n] = req;
+			msgs[n].buf = req->packet;
+			msgs[n].len = req->packet_len;
+			msgs[n].addr = SA(&req->dest);
+			msgs[n].addrlen = req->destlen;
+		}
+		sign_batch(eng, batch, n);
+
+		ret = send_batch(&eng->rh->so, sock->fd, msgs, n);
+		blocked = (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK));
+		if (ret == -1 && !blocked) {
+			rc_log(LOG_ERR, "%s: sendto: %s", __func__, strerror(errno));
+			/* the first datagram failed; complete it and retry the rest */
+			complete_req(eng, batch[0],
+				     errno == ENETUNREACH ? NETUNREACH_RC : ERROR_RC);
+			ret = 1;
+		} else if (ret == -1) {
+			ret = 0;
+		} else {
+			for (i = 0; i < (unsigned)ret; i++)
+				arm_req(eng, batch[i], now);
+		}
+
+		/* put back what was not sent, preserving the order */
+		for (i = n; i > (unsigned)ret; i--) {
+			req = batch[i - 1];
+			req->next_queued = sock->queue_head;
+			sock->queue_head = req;
+			if (sock->queue_tail == NULL)
+				sock->queue_tail = req;
+		}
+
+		/* wait until the socket is writable */
+		if (blocked)
+			break;
+	}
+}
+
+static void flush_queue(RC_ENGINE *eng, double now)
+{
+	unsigned i;
+
+	for (i = 0; i < eng->nsocks; i++)
+		flush_sock(eng, eng->socks[i], now);
+}
+
+/*- Returns the request a received packet replies to, or NULL
+ -*/
+static engine_req *match_packet(engine_sock *sock, uint8_t *buf, int length,
+				struct sockaddr_storage *from)
+{
+	engine_peer *peer;
+	engine_req *req = NULL;
+
+	if (length < AUTH_HDR_LEN)
+		return NULL;
+
+	peer = find_peer(sock, from);
+	if (peer != NULL)
+		req = peer->reqs[((AUTH_HDR *) buf)->id];
+	if (req == NULL || req->heap_idx == 0) {
+		DEBUG(LOG_INFO, "engine: dropping unexpected reply with id %u",
+		      (unsigned)((AUTH_HDR *) buf)->id);
+		return NULL;
+	}
+
+	return req;
+}
+
+/*- Verifies the matched replies together and completes their requests
+ -*/
+static void process_replies(RC_ENGINE *eng, engine_req **reqs,
+			    rc_reply_check *checks, unsigned n)
+{
+	unsigned i;
+	int result;
+
+	rc_verify_replies(eng->rh, checks, n);
+
+	for (i = 0; i < n; i++) {
+		if (checks[i].result != OK_RC) {
+			/* a spoofed or corrupted reply; keep waiting for the real one */
+			continue;
+		}
+
+		result = rc_decode_reply(eng->rh, reqs[i]->data, checks[i].buf,
+					 NULL);
+		complete_req(eng, reqs[i], result);
+	}
+}
+
+/*- Receives a batch of datagrams, one at a time if the transport has no batch call
+ -*/
+static int recv_batch(const rc_sockets_override *sfuncs, int sockfd,
+		      rc_dgram *msgs, unsigned n)
+{
+	unsigned i;
+	ssize_t ret;
+
+	if (sfuncs->recvmmsg) {
+		do {
+			ret = sfuncs->recvmmsg(sfuncs->ptr, sockfd, msgs, n,
+					       MSG_DONTWAIT);
+		} while (ret == -1 && errno == EINTR);
+		return ret;
+	}
+
+	for (i = 0; i < n; i++) {
+		do {
+			ret = sfuncs->recvfrom(sfuncs->ptr, sockfd, msgs[i].buf,
+					       msgs[i].len, MSG_DONTWAIT,
+					       msgs[i].addr, &msgs[i].addrlen);
+		} while (ret == -1 && errno == EINTR);
+		if (ret == -1)
+			return i > 0 ? (int)i : -1;
+		msgs[i].len = ret;
+	}
+	return n;
+}
+
+/*- Receives the replies of a socket in batches
+ *
+ * The replies of a batch are verified together, then their requests are
+ * completed.
+ -*/
+static void drain_sock(RC_ENGINE *eng, engine_sock *sock)
+{
+	struct sockaddr_storage from[RC_BATCH_MAX];
+	rc_dgram msgs[RC_BATCH_MAX];
+	rc_reply_check checks[RC_BATCH_MAX];
+	engine_req *reqs[RC_BATCH_MAX];
+	engine_req *req;
+	unsigned i, j, n;
+	int ret;
+
+	do {
+		for (i = 0; i < RC_BATCH_MAX; i++) {
+			msgs[i].buf = eng->rbufs[i];
+			msgs[i].len = sizeof(eng->rbufs[i]);
+			msgs[i].addr = SA(&from[i]);
+			msgs[i].addrlen = sizeof(from[i]);
+		}
+
+		ret = recv_batch(&eng->rh->so, sock->fd, msgs, RC_BATCH_MAX);
+		if (ret == -1) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				rc_log(LOG_ERR, "%s: recvfrom: %s", __func__,
+				       strerror(errno));
+			return;
+		}
+
+		n = 0;
+		for (i = 0; i < (unsigned)ret; i++) {
+			req = match_packet(sock, msgs[i].buf, msgs[i].len,
+					   &from[i]);
+			if (req == NULL)
+				continue;
+
+			/* a second reply to a request waits for the first
+			 * to be verified, and is matched again */
+			for (j = 0; j < n && reqs[j] != req; j++)
+				;
+			if (j < n) {
+				process_replies(eng, reqs, checks, n);
+				n = 0;
+				req = match_packet(sock, msgs[i].buf,
+						   msgs[i].len, &from[i]);
+				if (req == NULL)
+					continue;
+			}
+
+			reqs[n] = req;
+			checks[n].data = req->data;
+			checks[n].buf = msgs[i].buf;
+			checks[n].length = msgs[i].len;
+			checks[n].secret = req->secret;
+			checks[n].vector = req->vector;
+			n++;
+		}
+		if (n > 0)
+			process_replies(eng, reqs, checks, n);
+	} while (ret == RC_BATCH_MAX);
+}
+
+static void expire_timers(RC_ENGINE *eng, double now)
+{
+	engine_req *req;
+
+	while (eng->heap_size > 0 && eng->heap[1]->deadline <= now) {
+		req = eng->heap[1];
+		heap_remove(eng, req);
+
+		if (req->retries++ >= req->data->retries) {
+			DEBUG(LOG_INFO, "engine: no reply from %s:%d for id %u",
+			      req->data->server, req->data->svc_port,
+			      (unsigned)req->data->seq_nbr);
+			complete_req(eng, req, TIMEOUT_RC);
+			continue;
+		}
+
+		/* retransmissions keep the Identifier and authenticator */
+		queue_append(req->sock, req);
+	}
+}
+
+/** Processes pending network events and timers
+ *
+ * Transmits queued requests, waits up to timeout_ms for replies and
+ * handles retransmissions and timeouts. Completion callbacks are called
+ * from within this function, and they may submit new requests.
+ *
+ * @param engine the engine.
+ * @param timeout_ms the maximum time to wait in milliseconds; zero does
+ *	not block and a negative value waits until a request completes or
+ *	needs to be retransmitted.
+ * @return the number of requests still outstanding, or -1 on error.
+ */
+int rc_engine_run(RC_ENGINE *engine, int timeout_ms)
+{
+	double now, wait;
+	unsigned i;
+	int ret;
+
+	now = rc_getmtime();
+	flush_queue(engine, now);
+
+	if (engine->pending == 0)
+		return 0;
+
+	wait = timeout_ms;
+	if (engine->heap_size > 0) {
+		double next = (engine->heap[1]->deadline - now) * 1000;
+		if (next < 0)
+			next = 0;
+		if (wait < 0 || next < wait)
+			wait = next + 1;
+	}
+
+	for (i = 0; i < engine->nsocks; i++) {
+		engine->pfds[i].events = POLLIN;
+		if (engine->socks[i]->queue_head != NULL)
+			engine->pfds[i].events |= POLLOUT;
+		engine->pfds[i].revents = 0;
+	}
+
+	ret = poll(engine->pfds, engine->nsocks, (int)wait);
+	if (ret == -1 && errno != EINTR) {
+		rc_log(LOG_ERR, "%s: poll: %s", __func__, strerror(errno));
+		return -1;
+	}
+
+	for (i = 0; ret > 0 && i < engine->nsocks; i++) {
+		if (engine->pfds[i].revents & (POLLIN | POLLERR))
+			drain_sock(engine, engine->socks[i]);
+	}
+
+	now = rc_getmtime();
+	expire_timers(engine, now);
+	flush_queue(engine, now);
+
+	return engine->pending;
+}
+
+/** Returns the number of outstanding requests
+ *
+ * @param engine the engine.
+ * @return the number of submitted requests which have not completed.
+ */
+unsigned rc_engine_pending(RC_ENGINE *engine)
+{
+	return engine->pending;
+}
+
+/** @} */
@@ -0,0 +1,454 @@
+/*
+ * health.c	Tracker of the state of the servers, shared by the requests
+ *		of a handle, and the server selection policies using it.
+ *
+ * A server which did not reply to a request within its retries is
+ * considered dead for radius_deadtime seconds, and is skipped by
+ * rc_aaa_ctx_server() while other servers are available. Once the
+ * dead time expires, a single request probes the server; the others
+ * keep skipping it until the probe completes.
+ *
+ * The requests in flight to each server and a moving average of its
+ * reply time are kept for the authserver-policy and acctserver-policy
+ * options.
+ *
+ * With radius_rto set to adaptive, the round-trip time of the requests
+ * which were not retransmitted is tracked as in RFC 6298, and gives the
+ * initial retransmission timeout of the requests to the server (RFC 5080
+ * section 2.2.1).
+ *
+ * License:	BSD
+ *
+ */
+
+#include <config.h>
+#include <includes.h>
+#include <radcli/radcli.h>
+#include <pthread.h>
+#include "util.h"
+#include "health.h"
+
+/* the weight of a new sample in the moving average of the reply time */
+#define RTT_ALPHA 0.125
+/* the weight of a new sample in the round-trip time variation */
+#define RTT_BETA 0.25
+/* the lowest initial retransmission timeout, in seconds */
+#define RTO_MIN 0.25
+
+typedef enum server_state {
+	SERVER_ALIVE = 0,
+	SERVER_DEAD,
+	SERVER_PROBING
+} server_state;
+
+typedef struct health_entry {
+	char *server;
+	unsigned port;
+	server_state state;
+	double dead_until;	/* when dead, or when a probe is given up */
+	unsigned outstanding;	/* requests in flight */
+	double rtt;		/* moving average of the reply time; 0 if unknown */
+	double srtt;		/* smoothed round-trip time; 0 if unknown */
+	double rttvar;
+	struct health_entry *next;
+} health_entry;
+
+struct rc_health {
+	pthread_mutex_t lock;
+	unsigned deadtime;
+	double mrt;		/* non-zero for adaptive retransmission */
+	double mrd;
+	unsigned seed;
+	health_entry *entries;
+};
+
+/*- Parses the value of a server selection policy option
+ *
+ * @param txt the value of the option, or NULL for the default.
+ * @param policy the policy to initialize.
+ * @return 0 on success, or -1 if the value is invalid.
+ -*/
+int rc_policy_parse(const char *txt, rc_policy *policy)
+{
+	const char *p;
+	char *end;
+	long w;
+	int i;
+
+	memset(policy, 0, sizeof(*policy));
+	for (i = 0; i < RC_SERVER_MAX; i++)
+		policy->weight[i] = 1;
+
+	if (txt == NULL || strcasecmp(txt, "failover") == 0) {
+		policy->type = RC_POLICY_FAILOVER;
+	} else if (strcasecmp(txt, "least-outstanding") == 0) {
+		policy->type = RC_POLICY_LEAST_OUTSTANDING;
+	} else if (strcasecmp(txt, "latency") == 0) {
+		policy->type = RC_POLICY_LATENCY;
+	} else if (strncasecmp(txt, "round-robin", 11) == 0 &&
+		   (txt[11] == '\0' || txt[11] == ':')) {
+		policy->type = RC_POLICY_ROUND_ROBIN;
+
+		/* the weights of the servers, in their order */
+		p = txt + 11;
+		for (i = 0; *p == ':' || *p == ','; i++) {
+			if (i == RC_SERVER_MAX)
+				return -1;
+			w = strtol(p + 1, &end, 10);
+			if (end == p + 1 || w < 0 || w > 1000)
+				return -1;
+			policy->weight[i] = w;
+			p = end;
+		}
+		if (*p != '\0')
+			return -1;
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
+/*- Creates a health tracker
+ *
+ * @param deadtime the time in seconds a server which did not reply is
+ *	skipped; zero to never skip a server.
+ * @return the tracker, or NULL on failure.
+ -*/
+struct rc_health *rc_health_new(unsigned deadtime)
+{
+	struct rc_health *health;
+
+	health = calloc(1, sizeof(*health));
+	if (health == NULL) {
+		rc_log(LOG_CRIT, "%s: out of memory", __func__);
+		return NULL;
+	}
+
+	if (pthread_mutex_init(&health->lock, NULL) != 0) {
+		free(health);
+		return NULL;
+	}
+
+	health->deadtime = deadtime;
+	health->seed = (unsigned)time(NULL) ^ (unsigned)getpid();
+	return health;
+}
+
+/*- Enables adaptive retransmission timeouts
+ *
+ * @param health the tracker.
+ * @param mrt the maximum retransmission timeout in seconds (MRT).
+ * @param mrd the maximum time in seconds a request is retransmitted
+ *	(MRD); zero for no limit other than the retries.
+ -*/
+void rc_health_set_rto(struct rc_health *health, double mrt, double mrd)
+{
+	health->mrt = mrt;
+	health->mrd = mrd;
+}
+
+/*- Releases a health tracker
+ -*/
+void rc_health_free(struct rc_health *health)
+{
+	health_entry *e, *next;
+
+	if (health == NULL)
+		return;
+
+	for (e = health->entries; e != NULL; e = next) {
+		next = e->next;
+		free(e->server);
+		free(e);
+	}
+
+	pthread_mutex_destroy(&health->lock);
+	free(health);
+}
+
+/* must be called with the lock held; returns NULL if a new entry
+ * cannot be allocated */
+static health_entry *find_entry(struct rc_health *health, const char *server,
+				unsigned port, unsigned create)
+{
+	health_entry *e;
+
+	for (e = health->entries; e != NULL; e = e->next) {
+		if (e->port == port && strcmp(e->server, server) == 0)
+			return e;
+	}
+
+	if (!create)
+		return NULL;
+
+	e = calloc(1, sizeof(*e));
+	if (e == NULL)
+		return NULL;
+
+	e->server = strdup(server);
+	if (e->server == NULL) {
+		free(e);
+		return NULL;
+	}
+	e->port = port;
+	e->next = health->entries;
+	health->entries = e;
+	return e;
+}
+
+/* must be called with the lock held; orders the servers after the
+ * first one by the key, keeping their order on ties */
+static void sort_rest(int order[RC_SERVER_MAX], int n, const double *key)
+{
+	int i, j, t;
+
+	for (i = 2; i < n; i++) {
+		for (j = i; j > 1 && key[order[j]] < key[order[j - 1]]; j--) {
+			t = order[j];
+			order[j] = order[j - 1];
+			order[j - 1] = t;
+		}
+	}
+}
+
+/*- Orders the servers of a request according to a policy
+ *
+ * Dead servers are not considered here; they are skipped when the
+ * request is sent (see rc_health_usable()).
+ *
+ * @param health the tracker.
+ * @param policy the selection policy.
+ * @param aaaserver the servers.
+ * @param order will contain the indexes of the servers, the first one
+ *	to be tried first.
+ -*/
+void rc_health_order(struct rc_health *health, rc_policy *policy,
+		     SERVER *aaaserver, int order[RC_SERVER_MAX])
+{
+	double key[RC_SERVER_MAX];
+	health_entry *e;
+	int n = aaaserver->max, i, a, b, first = 0, total = 0;
+
+	for (i = 0; i < n; i++)
+		order[i] = i;
+
+	if (policy->type == RC_POLICY_FAILOVER || n < 2)
+		return;
+
+	pthread_mutex_lock(&health->lock);
+	for (i = 0; i < n; i++) {
+		e = find_entry(health, aaaserver->name[i], aaaserver->port[i], 0);
+		if (policy->type == RC_POLICY_LEAST_OUTSTANDING)
+			key[i] = e ? e->outstanding : 0;
+		else
+			key[i] = e ? e->rtt : 0;
+	}
+
+	switch (policy->type) {
+	case RC_POLICY_ROUND_ROBIN:
+		/* the servers get turns in proportion to their weights,
+		 * interleaved rather than in bursts */
+		for (i = 0; i < n; i++) {
+			policy->current[i] += policy->weight[i];
+			total += policy->weight[i];
+			if (policy->current[i] > policy->current[first])
+				first = i;
+		}
+		policy->current[first] -= total;
+		/* the next servers follow in their order */
+		for (i = 0; i < n; i++)
+			order[i] = (first + i) % n;
+		break;
+
+	case RC_POLICY_LEAST_OUTSTANDING:
+		for (i = 1; i < n; i++) {
+			if (key[i] < key[first])
+				first = i;
+		}
+		order[0] = first;
+		order[first] = 0;
+		sort_rest(order, n, key);
+		break;
+
+	case RC_POLICY_LATENCY:
+		/* the faster of two random servers; a server with no
+		 * reply time yet is tried first */
+		a = rand_r(&health->seed) % n;
+		b = rand_r(&health->seed) % (n - 1);
+		if (b >= a)
+			b++;
+		first = key[b] < key[a] ? b : a;
+		order[0] = first;
+		order[first] = 0;
+		sort_rest(order, n, key);
+		break;
+
+	default:
+		break;
+	}
+	pthread_mutex_unlock(&health->lock);
+}
+
+/*- Checks whether a request may be sent to a server
+ *
+ * A server whose dead time expired is handed out to a single caller,
+ * which must report the result of its request with rc_health_report().
+ *
+ * @param health the tracker.
+ * @param server the name of the server.
+ * @param port the port of the server.
+ * @return 1 if the server is not known to be dead, 0 otherwise.
+ -*/
+int rc_health_usable(struct rc_health *health, const char *server,
+		     unsigned port)
+{
+	health_entry *e;
+	double now;
+	int usable = 1;
+
+	pthread_mutex_lock(&health->lock);
+	e = find_entry(health, server, port, 0);
+	if (e != NULL && e->state != SERVER_ALIVE) {
+		now = rc_getmtime();
+		if (now < e->dead_until) {
+			usable = 0;
+		} else {
+			/* the probe is given up if it is not reported in time */
+			e->state = SERVER_PROBING;
+			e->dead_until = now + health->deadtime;
+			DEBUG(LOG_INFO, "health: probing %s:%u", server, port);
+		}
+	}
+	pthread_mutex_unlock(&health->lock);
+
+	return usable;
+}
+
+/*- Records that a request is sent to a server
+ *
+ * Every request started must be completed with rc_health_report().
+ -*/
+void rc_health_start(struct rc_health *health, const char *server,
+		     unsigned port)
+{
+	health_entry *e;
+
+	pthread_mutex_lock(&health->lock);
+	e = find_entry(health, server, port, 1);
+	if (e != NULL)
+		e->outstanding++;
+	pthread_mutex_unlock(&health->lock);
+}
+
+/*- Records the result of a request to a server
+ *
+ * @param health the tracker.
+ * @param server the name of the server.
+ * @param port the port of the server.
+ * @param result the result of the request, as returned by rc_send_server(),
+ *	or PENDING_RC if it was abandoned.
+ * @param rtt the time in seconds the request took.
+ -*/
+void rc_health_report(struct rc_health *health, const char *server,
+		      unsigned port, int result, double rtt)
+{
+	health_entry *e;
+
+	pthread_mutex_lock(&health->lock);
+	e = find_entry(health, server, port, 1);
+	if (e == NULL)
+		goto exit;
+
+	if (e->outstanding > 0)
+		e->outstanding--;
+
+	if (result == TIMEOUT_RC || result == NETUNREACH_RC) {
+		/* the time waited counts against the server */
+		e->rtt = e->rtt == 0 ? rtt : e->rtt + RTT_ALPHA * (rtt - e->rtt);
+
+		if (health->deadtime == 0)
+			goto exit;
+		if (e->state == SERVER_ALIVE)
+			rc_log(LOG_WARNING,
+			       "server %s:%u is not replying; skipping it for %u seconds",
+			       server, port, health->deadtime);
+		e->state = SERVER_DEAD;
+		e->dead_until = rc_getmtime() + health->deadtime;
+	} else if (result == OK_RC || result == CHALLENGE_RC ||
+		   result == REJECT_RC || result == BADRESP_RC) {
+		e->rtt = e->rtt == 0 ? rtt : e->rtt + RTT_ALPHA * (rtt - e->rtt);
+
+		/* any reply shows the server is up */
+		if (e->state != SERVER_ALIVE) {
+			rc_log(LOG_INFO, "server %s:%u is replying again",
+			       server, port);
+			e->state = SERVER_ALIVE;
+		}
+	}
+
+ exit:
+	pthread_mutex_unlock(&health->lock);
+}
+
+/*- Returns the retransmission timing of a request to a server
+ *
+ * @param health the tracker.
+ * @param server the name of the server.
+ * @param port the port of the server.
+ * @param timeout the configured timeout in seconds, which bounds the
+ *	initial timeout and is used until the round-trip time is known.
+ * @param irt will contain the initial retransmission timeout (IRT).
+ * @param mrt will contain the maximum retransmission timeout (MRT).
+ * @param mrd will contain the maximum retransmission duration (MRD), or zero.
+ * @return 1 if adaptive retransmission is enabled, 0 otherwise.
+ -*/
+int rc_health_rto(struct rc_health *health, const char *server,
+		  unsigned port, double timeout, double *irt, double *mrt,
+		  double *mrd)
+{
+	health_entry *e;
+	double rto = timeout;
+
+	if (health->mrt <= 0)
+		return 0;
+
+	pthread_mutex_lock(&health->lock);
+	e = find_entry(health, server, port, 0);
+	if (e != NULL && e->srtt > 0) {
+		rto = e->srtt + 4 * e->rttvar;
+		if (rto < RTO_MIN)
+			rto = RTO_MIN;
+		if (rto > timeout)
+			rto = timeout;
+	}
+	pthread_mutex_unlock(&health->lock);
+
+	*irt = rto;
+	*mrt = health->mrt;
+	*mrd = health->mrd;
+	return 1;
+}
+
+/*- Records the round-trip time of a request which was not retransmitted
+ -*/
+void rc_health_rtt(struct rc_health *health, const char *server,
+		   unsigned port, double rtt)
+{
+	health_entry *e;
+	double delta;
+
+	pthread_mutex_lock(&health->lock);
+	e = find_entry(health, server, port, 1);
+	if (e != NULL) {
+		if (e->srtt == 0) {
+			e->srtt = rtt;
+			e->rttvar = rtt / 2;
+		} else {
+			delta = e->srtt > rtt ? e->srtt - rtt : rtt - e->srtt;
+			e->rttvar += RTT_BETA * (delta - e->rttvar);
+			e->srtt += RTT_ALPHA * (rtt - e->srtt);
+		}
+	}
+	pthread_mutex_unlock(&health->lock);
+}
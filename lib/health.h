@@ -0,0 +1,50 @@
+/*
+ * health.h	Internal tracker of the state of the servers, shared by the
+ *		requests of a handle, and the server selection policies
+ *		using it.
+ *
+ * License:	BSD
+ *
+ */
+#ifndef HEALTH_H
+# define HEALTH_H
+
+#include <includes.h>
+
+/* how the first server of a request is chosen; the option values are
+ * failover, round-robin[:weight,...], least-outstanding and latency */
+typedef enum rc_policy_type {
+	RC_POLICY_FAILOVER = 0,		/* the servers in their order */
+	RC_POLICY_ROUND_ROBIN,		/* smooth weighted round-robin */
+	RC_POLICY_LEAST_OUTSTANDING,	/* the fewest requests in flight */
+	RC_POLICY_LATENCY		/* the faster of two random servers */
+} rc_policy_type;
+
+typedef struct rc_policy {
+	rc_policy_type type;
+	int weight[RC_SERVER_MAX];
+	int current[RC_SERVER_MAX];	/* round-robin state; under the tracker lock */
+} rc_policy;
+
+int rc_policy_parse(const char *txt, rc_policy *policy);
+
+struct rc_health *rc_health_new(unsigned deadtime);
+void rc_health_free(struct rc_health *health);
+void rc_health_set_rto(struct rc_health *health, double mrt, double mrd);
+
+void rc_health_order(struct rc_health *health, rc_policy *policy,
+		     SERVER *aaaserver, int order[RC_SERVER_MAX]);
+int rc_health_usable(struct rc_health *health, const char *server,
+		     unsigned port);
+void rc_health_start(struct rc_health *health, const char *server,
+		     unsigned port);
+void rc_health_report(struct rc_health *health, const char *server,
+		      unsigned port, int result, double rtt);
+
+int rc_health_rto(struct rc_health *health, const char *server,
+		  unsigned port, double timeout, double *irt, double *mrt,
+		  double *mrd);
+void rc_health_rtt(struct rc_health *health, const char *server,
+		   unsigned port, double rtt);
+
+#endif /* HEALTH_H */
@@ -0,0 +1,60 @@
+/*
+ * idspace.c	Allocation of RADIUS packet Identifiers.
+ *
+ * License:	BSD
+ *
+ */
+
+#include <config.h>
+#include <includes.h>
+#include "idspace.h"
+#include "rng.h"
+
+/*- Initializes an empty Identifier space
+ *
+ * The allocation starts at a random Identifier, so that consecutive
+ * runs do not reuse the Identifiers of earlier ones in the same order.
+ -*/
+void rc_id_space_init(rc_id_space *ids)
+{
+	memset(ids, 0, sizeof(*ids));
+	ids->next = rc_random_u32() % RC_ID_SPACE_SIZE;
+}
+
+/*- Allocates an Identifier which is not in flight
+ *
+ * Identifiers are handed out in sequence, skipping those in use, so a
+ * released Identifier is reused as late as possible.
+ *
+ * @param ids the Identifier space.
+ * @return the Identifier, or -1 if all of them are in flight.
+ -*/
+int rc_id_alloc(rc_id_space *ids)
+{
+	unsigned i, id;
+
+	if (rc_id_space_full(ids))
+		return -1;
+
+	for (i = 0; i < RC_ID_SPACE_SIZE; i++) {
+		id = (ids->next + i) % RC_ID_SPACE_SIZE;
+		if (!(ids->used[id / 32] & (1U << (id % 32)))) {
+			ids->used[id / 32] |= 1U << (id % 32);
+			ids->count++;
+			ids->next = (id + 1) % RC_ID_SPACE_SIZE;
+			return id;
+		}
+	}
+
+	return -1;
+}
+
+/*- Returns an Identifier allocated with rc_id_alloc()
+ -*/
+void rc_id_release(rc_id_space *ids, uint8_t id)
+{
+	if (ids->used[id / 32] & (1U << (id % 32))) {
+		ids->used[id / 32] &= ~(1U << (id % 32));
+		ids->count--;
+	}
+}
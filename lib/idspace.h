@@ -0,0 +1,31 @@
+/*
+ * idspace.h	Allocation of RADIUS packet Identifiers.
+ *
+ * License:	BSD
+ *
+ */
+#ifndef IDSPACE_H
+# define IDSPACE_H
+
+#include <stdint.h>
+
+/* the number of distinct RADIUS Identifiers */
+#define RC_ID_SPACE_SIZE 256
+
+/* The Identifiers in flight on one (source port, server) pair. A reply
+ * is matched on the socket it arrives on and the address it comes from,
+ * so an Identifier only needs to be unique within such a pair. */
+typedef struct rc_id_space {
+	uint32_t used[RC_ID_SPACE_SIZE / 32];
+	unsigned count;
+	unsigned next;
+} rc_id_space;
+
+void rc_id_space_init(rc_id_space *ids);
+int rc_id_alloc(rc_id_space *ids);
+void rc_id_release(rc_id_space *ids, uint8_t id);
+
+/* non-zero when no Identifier can be allocated */
+#define rc_id_space_full(ids) ((ids)->count >= RC_ID_SPACE_SIZE)
+
+#endif /* IDSPACE_H */
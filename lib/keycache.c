@@ -0,0 +1,287 @@
+/*
+ * keycache.c	Cache of the MD5 states keyed with the secrets of the
+ *		servers, shared by the requests of a handle.
+ *
+ * The User-Password attribute is hidden with MD5(secret || vector), and
+ * the Message-Authenticator is HMAC-MD5 keyed with the secret. The state
+ * of MD5 after absorbing the secret, and the inner and outer HMAC states
+ * after absorbing the padded key, only depend on the secret; they are
+ * computed the first time a secret is used and copied afterwards, which
+ * saves the two HMAC key blocks of every packet, and the secret's blocks
+ * of every password block when the secret is 64 octets or longer.
+ *
+ * The states are contexts of the crypto provider of the handle. When the
+ * provider fails to copy one, the digest is computed by rc_md5_multi()
+ * from the secret or the HMAC states kept for it. The entries are
+ * published once complete and never change, so they are read without a
+ * lock. The authenticators of the accounting requests and
+ * of the replies hash the secret last, and cannot use a precomputed state;
+ * see rc_md5_calc_secret().
+ *
+ * License:	BSD
+ *
+ */
+
+#include <config.h>
+#include <includes.h>
+#include <radcli/radcli.h>
+#include <pthread.h>
+#include "util.h"
+#include "keycache.h"
+#include "md5x.h"
+
+/* the number of secrets kept; the states of more are computed per packet */
+#define KEY_CACHE_SIZE 16
+
+#define HMAC_BLOCK_LEN 64
+
+struct rc_key_cache {
+	const rc_crypto_provider *crypto;
+	pthread_mutex_t lock;	/* serializes the writers */
+	unsigned used;		/* the entries published to the readers */
+	rc_md5_key entries[KEY_CACHE_SIZE];
+};
+
+/*- Creates a cache of keyed MD5 states
+ *
+ * @param crypto the provider of MD5.
+ * @return the cache, or NULL on failure.
+ -*/
+struct rc_key_cache *rc_key_cache_new(const rc_crypto_provider *crypto)
+{
+	struct rc_key_cache *cache;
+
+	cache = calloc(1, sizeof(*cache));
+	if (cache == NULL) {
+		rc_log(LOG_CRIT, "%s: out of memory", __func__);
+		return NULL;
+	}
+
+	if (pthread_mutex_init(&cache->lock, NULL) != 0) {
+		free(cache);
+		return NULL;
+	}
+
+	cache->crypto = crypto;
+	return cache;
+}
+
+/*- Erases the states of a secret returned in the tmp of rc_key_lookup()
+ -*/
+void rc_key_clear(rc_md5_key *key)
+{
+	if (key->crypto != NULL) {
+		key->crypto->release(&key->secret);
+		key->crypto->release(&key->inner);
+		key->crypto->release(&key->outer);
+	}
+	memset(key, 0, sizeof(*key));
+}
+
+/*- Releases a cache of keyed MD5 states
+ -*/
+void rc_key_cache_free(struct rc_key_cache *cache)
+{
+	unsigned i;
+
+	if (cache == NULL)
+		return;
+
+	for (i = 0; i < cache->used; i++) {
+		char *str = (char *)cache->entries[i].str;
+
+		memset(str, 0, cache->entries[i].len);
+		free(str);
+		rc_key_clear(&cache->entries[i]);
+	}
+
+	pthread_mutex_destroy(&cache->lock);
+	free(cache);
+}
+
+/*- Computes the MD5 states of a secret
+ -*/
+static void derive_key(const rc_crypto_provider *crypto, rc_md5_key *key,
+		       char const *secret, size_t len)
+{
+	uint8_t pad[HMAC_BLOCK_LEN], digest[16];
+	uint8_t const *k = (uint8_t const *)secret;
+	size_t klen = len;
+	unsigned i;
+
+	key->crypto = crypto;
+	key->str = secret;
+	key->len = len;
+
+	crypto->init(&key->secret);
+	crypto->update(&key->secret, (uint8_t const *)secret, len);
+
+	/* RFC 2104: a longer key is replaced by its hash */
+	if (klen > HMAC_BLOCK_LEN) {
+		rc_md5_calc(crypto, digest, k, klen);
+		k = digest;
+		klen = sizeof(digest);
+	}
+
+	memset(pad, 0, sizeof(pad));
+	memcpy(pad, k, klen);
+	for (i = 0; i < HMAC_BLOCK_LEN; i++)
+		pad[i] ^= 0x36;
+	crypto->init(&key->inner);
+	crypto->update(&key->inner, pad, HMAC_BLOCK_LEN);
+	rc_md5_block_state(key->hmac_iv[0], pad);
+
+	for (i = 0; i < HMAC_BLOCK_LEN; i++)
+		pad[i] ^= 0x36 ^ 0x5c;
+	crypto->init(&key->outer);
+	crypto->update(&key->outer, pad, HMAC_BLOCK_LEN);
+	rc_md5_block_state(key->hmac_iv[1], pad);
+
+	memset(pad, 0, sizeof(pad));
+	memset(digest, 0, sizeof(digest));
+}
+
+/*- Returns the published entry of a secret, or NULL
+ -*/
+static const rc_md5_key *find_entry(struct rc_key_cache *cache,
+				    char const *secret, size_t len)
+{
+	unsigned used = __atomic_load_n(&cache->used, __ATOMIC_ACQUIRE);
+	unsigned i;
+
+	for (i = 0; i < used; i++) {
+		if (cache->entries[i].len == len &&
+		    memcmp(cache->entries[i].str, secret, len) == 0)
+			return &cache->entries[i];
+	}
+
+	return NULL;
+}
+
+/*- Returns the MD5 states of a secret, using the cache when possible
+ *
+ * @param cache the cache, or NULL to compute the states.
+ * @param secret the secret of the server.
+ * @param tmp will hold the states when they are not cached; it refers to
+ *	secret, and should be erased with rc_key_clear() after use.
+ * @return the states of the secret.
+ -*/
+const rc_md5_key *rc_key_lookup(struct rc_key_cache *cache, char const *secret,
+				rc_md5_key *tmp)
+{
+	const rc_md5_key *found;
+	rc_md5_key *e;
+	size_t len = strlen(secret);
+	char *str;
+
+	if (cache == NULL) {
+		derive_key(rc_crypto_default(), tmp, secret, len);
+		return tmp;
+	}
+
+	found = find_entry(cache, secret, len);
+	if (found != NULL)
+		return found;
+
+	derive_key(cache->crypto, tmp, secret, len);
+
+	pthread_mutex_lock(&cache->lock);
+	found = find_entry(cache, secret, len);
+	if (found == NULL && cache->used < KEY_CACHE_SIZE &&
+	    (str = malloc(len + 1)) != NULL) {
+		memcpy(str, secret, len + 1);
+		e = &cache->entries[cache->used];
+		*e = *tmp;
+		e->str = str;
+
+		/* the entry is complete before the readers may see it */
+		__atomic_store_n(&cache->used, cache->used + 1, __ATOMIC_RELEASE);
+
+		/* the states now belong to the entry */
+		memset(tmp, 0, sizeof(*tmp));
+		pthread_mutex_unlock(&cache->lock);
+		return e;
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	if (found != NULL) {
+		/* another thread added the secret meanwhile */
+		rc_key_clear(tmp);
+		return found;
+	}
+
+	return tmp;
+}
+
+/*- Computes MD5(secret || vector), as used to hide User-Password
+ *
+ * @param key the states of the secret.
+ * @param vector the %AUTH_VECTOR_LEN octets hashed after the secret.
+ * @param output will hold the 16-octet digest.
+ -*/
+void rc_md5_keyed(const rc_md5_key *key, uint8_t const *vector,
+		  unsigned char *output)
+{
+	rc_md5_ctx context;
+	rc_md5_job job;
+
+	if (key->crypto->copy(&context, &key->secret) == 0) {
+		key->crypto->update(&context, vector, AUTH_VECTOR_LEN);
+		key->crypto->final(output, &context);
+		return;
+	}
+	key->crypto->release(&context);
+
+	memset(&job, 0, sizeof(job));
+	job.data = (uint8_t const *)key->str;
+	job.len = key->len;
+	job.suffix = vector;
+	job.suffix_len = AUTH_VECTOR_LEN;
+	job.digest = output;
+	rc_md5_multi(&job, 1);
+}
+
+/*- Computes HMAC-MD5 [RFC2104] keyed with the secret, as used by the
+ * Message-Authenticator
+ *
+ * @param key the states of the secret.
+ * @param data the packet.
+ * @param len the length of the packet.
+ * @param output will hold the 16-octet digest.
+ -*/
+void rc_hmac_md5_keyed(const rc_md5_key *key, uint8_t const *data, size_t len,
+		       unsigned char *output)
+{
+	const rc_crypto_provider *crypto = key->crypto;
+	rc_md5_ctx context;
+	rc_md5_job job;
+	uint8_t digest[16];
+
+	memset(&job, 0, sizeof(job));
+	job.prefix_len = HMAC_BLOCK_LEN;
+
+	if (crypto->copy(&context, &key->inner) == 0) {
+		crypto->update(&context, data, len);
+		crypto->final(digest, &context);
+	} else {
+		crypto->release(&context);
+		job.data = data;
+		job.len = len;
+		job.iv = key->hmac_iv[0];
+		job.digest = digest;
+		rc_md5_multi(&job, 1);
+	}
+
+	if (crypto->copy(&context, &key->outer) == 0) {
+		crypto->update(&context, digest, sizeof(digest));
+		crypto->final(output, &context);
+	} else {
+		crypto->release(&context);
+		job.data = digest;
+		job.len = sizeof(digest);
+		job.iv = key->hmac_iv[1];
+		job.digest = output;
+		rc_md5_multi(&job, 1);
+	}
+	memset(digest, 0, sizeof(digest));
+}
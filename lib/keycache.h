@@ -0,0 +1,37 @@
+/*
+ * keycache.h	Internal cache of the MD5 states keyed with the secrets of
+ *		the servers.
+ *
+ * License:	BSD
+ *
+ */
+#ifndef KEYCACHE_H
+# define KEYCACHE_H
+
+#include <includes.h>
+#include "rc-md5.h"
+
+/* the MD5 states derived from a secret */
+typedef struct rc_md5_key {
+	const rc_crypto_provider *crypto;	/* of the states below */
+	rc_md5_ctx secret;	/* after absorbing the secret */
+	rc_md5_ctx inner;	/* HMAC-MD5: after absorbing the key ^ ipad */
+	rc_md5_ctx outer;	/* HMAC-MD5: after absorbing the key ^ opad */
+	uint32_t hmac_iv[2][4];	/* the inner and outer states, for rc_md5_multi() */
+	char const *str;	/* the secret */
+	size_t len;
+} rc_md5_key;
+
+struct rc_key_cache *rc_key_cache_new(const rc_crypto_provider *crypto);
+void rc_key_cache_free(struct rc_key_cache *cache);
+
+const rc_md5_key *rc_key_lookup(struct rc_key_cache *cache, char const *secret,
+				rc_md5_key *tmp);
+void rc_key_clear(rc_md5_key *key);
+
+void rc_md5_keyed(const rc_md5_key *key, uint8_t const *vector,
+		  unsigned char *output);
+void rc_hmac_md5_keyed(const rc_md5_key *key, uint8_t const *data, size_t len,
+		       unsigned char *output);
+
+#endif /* KEYCACHE_H */
@@ -10,11 +10,7 @@
 
 #include "config.h"
 
-#ifdef HAVE_NETTLE
-
-#include <nettle/md5-compat.h>
-
-#else
+/* built even with nettle, as the builtin crypto provider; see crypto.c */
 
 #ifdef HAVE_INTTYPES_H
 #include <inttypes.h>
@@ -61,7 +57,7 @@
 #define	MD5_BLOCK_LENGTH		64
 #define	MD5_DIGEST_LENGTH		16
 
-typedef struct MD5Context {
+typedef struct librad_MD5Context {
 	uint32_t state[4];			//!< State.
 	uint32_t count[2];			//!< Number of bits, mod 2^64.
 	uint8_t buffer[MD5_BLOCK_LENGTH];	//!< Input buffer.
@@ -80,6 +76,4 @@ void	 MD5Transform(uint32_t [4], uint8_t const [MD5_BLOCK_LENGTH])
 /*		__attribute__((__bounded__(__minbytes__,2,MD5_BLOCK_LENGTH)))*/;
 /* __END_DECLS */
 
-#endif /* HAVE_NETTLE */
-
 #endif /* _RCRAD_MD5_H */
@@ -0,0 +1,343 @@
+/*
+ * md5x.c	Multi-buffer MD5.
+ *
+ * A single message cannot be hashed faster, since each step of MD5
+ * depends on the previous one, but independent messages can be hashed in
+ * the lanes of SIMD registers: each lane holds the state of a message,
+ * and all lanes go through the compression function together. A lane is
+ * given the next message as soon as its own is complete.
+ *
+ * The compression function is written with the vector extensions of
+ * GCC and clang, for 4 lanes, which any target supports (in SSE2 or NEON
+ * registers, or in general purpose ones), and on x86 for 8 lanes, in
+ * AVX2 registers, used when the CPU supports them.
+ *
+ * License:	BSD
+ *
+ */
+
+#include <config.h>
+#include <string.h>
+#include "md5x.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+# define MD5X_AVX2
+#endif
+
+typedef uint32_t md5_v4 __attribute__((vector_size(16)));
+#ifdef MD5X_AVX2
+typedef uint32_t md5_v8 __attribute__((vector_size(32)));
+#endif
+
+typedef void (*md5_block_fn)(uint32_t state[4][RC_MD5_MAX_LANES],
+			     const uint8_t *const blocks[RC_MD5_MAX_LANES]);
+
+typedef struct md5_impl {
+	md5_block_fn block;
+	unsigned lanes;
+} md5_impl;
+
+/* a message being hashed in a lane */
+typedef struct md5_lane {
+	rc_md5_job *job;	/* NULL when the lane is idle */
+	size_t block;
+	size_t nblocks;
+	uint8_t buf[64];	/* the blocks not contiguous in job->data */
+} md5_lane;
+
+static const uint32_t md5_iv[4] = {
+	0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476
+};
+
+static const uint32_t T[64] = {
+	0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+	0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+	0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+	0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+	0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+	0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+	0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+	0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+	0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+	0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+	0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+	0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+	0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+	0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+	0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+	0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static inline uint32_t load_le32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+	       ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+#define F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define G(x, y, z) ((y) ^ ((z) & ((x) ^ (y))))
+#define H(x, y, z) ((x) ^ (y) ^ (z))
+#define I(x, y, z) ((y) ^ ((x) | ~(z)))
+
+#define STEP(f, a, b, c, d, k, s, i) do {			\
+		a += f(b, c, d) + m[k] + T[i];			\
+		a = (a << s) | (a >> (32 - s));			\
+		a += b;						\
+	} while (0)
+
+#define MD5_ROUNDS(a, b, c, d) do {				\
+		STEP(F, a, b, c, d,  0,  7,  0);		\
+		STEP(F, d, a, b, c,  1, 12,  1);		\
+		STEP(F, c, d, a, b,  2, 17,  2);		\
+		STEP(F, b, c, d, a,  3, 22,  3);		\
+		STEP(F, a, b, c, d,  4,  7,  4);		\
+		STEP(F, d, a, b, c,  5, 12,  5);		\
+		STEP(F, c, d, a, b,  6, 17,  6);		\
+		STEP(F, b, c, d, a,  7, 22,  7);		\
+		STEP(F, a, b, c, d,  8,  7,  8);		\
+		STEP(F, d, a, b, c,  9, 12,  9);		\
+		STEP(F, c, d, a, b, 10, 17, 10);		\
+		STEP(F, b, c, d, a, 11, 22, 11);		\
+		STEP(F, a, b, c, d, 12,  7, 12);		\
+		STEP(F, d, a, b, c, 13, 12, 13);		\
+		STEP(F, c, d, a, b, 14, 17, 14);		\
+		STEP(F, b, c, d, a, 15, 22, 15);		\
+		STEP(G, a, b, c, d,  1,  5, 16);		\
+		STEP(G, d, a, b, c,  6,  9, 17);		\
+		STEP(G, c, d, a, b, 11, 14, 18);		\
+		STEP(G, b, c, d, a,  0, 20, 19);		\
+		STEP(G, a, b, c, d,  5,  5, 20);		\
+		STEP(G, d, a, b, c, 10,  9, 21);		\
+		STEP(G, c, d, a, b, 15, 14, 22);		\
+		STEP(G, b, c, d, a,  4, 20, 23);		\
+		STEP(G, a, b, c, d,  9,  5, 24);		\
+		STEP(G, d, a, b, c, 14,  9, 25);		\
+		STEP(G, c, d, a, b,  3, 14, 26);		\
+		STEP(G, b, c, d, a,  8, 20, 27);		\
+		STEP(G, a, b, c, d, 13,  5, 28);		\
+		STEP(G, d, a, b, c,  2,  9, 29);		\
+		STEP(G, c, d, a, b,  7, 14, 30);		\
+		STEP(G, b, c, d, a, 12, 20, 31);		\
+		STEP(H, a, b, c, d,  5,  4, 32);		\
+		STEP(H, d, a, b, c,  8, 11, 33);		\
+		STEP(H, c, d, a, b, 11, 16, 34);		\
+		STEP(H, b, c, d, a, 14, 23, 35);		\
+		STEP(H, a, b, c, d,  1,  4, 36);		\
+		STEP(H, d, a, b, c,  4, 11, 37);		\
+		STEP(H, c, d, a, b,  7, 16, 38);		\
+		STEP(H, b, c, d, a, 10, 23, 39);		\
+		STEP(H, a, b, c, d, 13,  4, 40);		\
+		STEP(H, d, a, b, c,  0, 11, 41);		\
+		STEP(H, c, d, a, b,  3, 16, 42);		\
+		STEP(H, b, c, d, a,  6, 23, 43);		\
+		STEP(H, a, b, c, d,  9,  4, 44);		\
+		STEP(H, d, a, b, c, 12, 11, 45);		\
+		STEP(H, c, d, a, b, 15, 16, 46);		\
+		STEP(H, b, c, d, a,  2, 23, 47);		\
+		STEP(I, a, b, c, d,  0,  6, 48);		\
+		STEP(I, d, a, b, c,  7, 10, 49);		\
+		STEP(I, c, d, a, b, 14, 15, 50);		\
+		STEP(I, b, c, d, a,  5, 21, 51);		\
+		STEP(I, a, b, c, d, 12,  6, 52);		\
+		STEP(I, d, a, b, c,  3, 10, 53);		\
+		STEP(I, c, d, a, b, 10, 15, 54);		\
+		STEP(I, b, c, d, a,  1, 21, 55);		\
+		STEP(I, a, b, c, d,  8,  6, 56);		\
+		STEP(I, d, a, b, c, 15, 10, 57);		\
+		STEP(I, c, d, a, b,  6, 15, 58);		\
+		STEP(I, b, c, d, a, 13, 21, 59);		\
+		STEP(I, a, b, c, d,  4,  6, 60);		\
+		STEP(I, d, a, b, c, 11, 10, 61);		\
+		STEP(I, c, d, a, b,  2, 15, 62);		\
+		STEP(I, b, c, d, a,  9, 21, 63);		\
+	} while (0)
+
+/* Defines a compression function over the given number of lanes; the
+ * message words of each lane are gathered into the vectors */
+#define MD5_BLOCK_FN(name, vtype, nlanes, attr)				\
+static attr void name(uint32_t state[4][RC_MD5_MAX_LANES],		\
+		      const uint8_t *const blocks[RC_MD5_MAX_LANES])	\
+{									\
+	vtype m[16], a, b, c, d, aa, bb, cc, dd;			\
+	unsigned i, j;							\
+									\
+	for (i = 0; i < 16; i++)					\
+		for (j = 0; j < nlanes; j++)				\
+			m[i][j] = load_le32(blocks[j] + 4 * i);		\
+									\
+	memcpy(&a, state[0], sizeof(a));				\
+	memcpy(&b, state[1], sizeof(b));				\
+	memcpy(&c, state[2], sizeof(c));				\
+	memcpy(&d, state[3], sizeof(d));				\
+	aa = a;								\
+	bb = b;								\
+	cc = c;								\
+	dd = d;								\
+									\
+	MD5_ROUNDS(a, b, c, d);						\
+									\
+	a += aa;							\
+	b += bb;							\
+	c += cc;							\
+	d += dd;							\
+	memcpy(state[0], &a, sizeof(a));				\
+	memcpy(state[1], &b, sizeof(b));				\
+	memcpy(state[2], &c, sizeof(c));				\
+	memcpy(state[3], &d, sizeof(d));				\
+}
+
+MD5_BLOCK_FN(md5_block_x4, md5_v4, 4, )
+#ifdef MD5X_AVX2
+MD5_BLOCK_FN(md5_block_x8, md5_v8, 8, __attribute__((target("avx2"))))
+#endif
+
+static const md5_impl md5_x4 = { md5_block_x4, 4 };
+#ifdef MD5X_AVX2
+static const md5_impl md5_x8 = { md5_block_x8, 8 };
+#endif
+
+/*- Returns the widest implementation the CPU supports
+ -*/
+static const md5_impl *md5_select(void)
+{
+	static const md5_impl *selected;
+	const md5_impl *impl;
+
+	impl = __atomic_load_n(&selected, __ATOMIC_RELAXED);
+	if (impl != NULL)
+		return impl;
+
+	impl = &md5_x4;
+#ifdef MD5X_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		impl = &md5_x8;
+#endif
+
+	__atomic_store_n(&selected, impl, __ATOMIC_RELAXED);
+	return impl;
+}
+
+/*- Returns the next block of the message of a lane
+ *
+ * The message is the job's data followed by its suffix and the padding of
+ * MD5; the blocks which are not entirely in the data are assembled in the
+ * lane's buffer.
+ -*/
+static const uint8_t *next_block(md5_lane *lane)
+{
+	const rc_md5_job *job = lane->job;
+	size_t off = lane->block * 64;
+	size_t total = job->len + job->suffix_len;
+	size_t i = 0, n;
+	uint64_t bits;
+
+	if (off + 64 <= job->len)
+		return job->data + off;
+
+	memset(lane->buf, 0, sizeof(lane->buf));
+	if (off < job->len) {
+		i = job->len - off;
+		memcpy(lane->buf, job->data + off, i);
+	}
+	if (off + i < total) {
+		n = total - (off + i);
+		if (n > 64 - i)
+			n = 64 - i;
+		memcpy(lane->buf + i, job->suffix + (off + i - job->len), n);
+		i += n;
+	}
+	if (total >= off && total < off + 64)
+		lane->buf[total - off] = 0x80;
+
+	if (lane->block == lane->nblocks - 1) {
+		bits = (job->prefix_len + total) * 8;
+		for (i = 0; i < 8; i++)
+			lane->buf[56 + i] = (uint8_t)(bits >> (8 * i));
+	}
+
+	return lane->buf;
+}
+
+/*- Computes the MD5 digests of several messages
+ *
+ * @param jobs the messages; each holds where its digest is written.
+ * @param n the number of messages.
+ -*/
+void rc_md5_multi(rc_md5_job *jobs, unsigned n)
+{
+	static const uint8_t idle[64];
+	const md5_impl *impl = md5_select();
+	uint32_t state[4][RC_MD5_MAX_LANES];
+	const uint8_t *blocks[RC_MD5_MAX_LANES];
+	md5_lane lanes[RC_MD5_MAX_LANES];
+	const uint32_t *iv;
+	unsigned next = 0, active, i, j;
+
+	memset(state, 0, sizeof(state));
+	for (j = 0; j < RC_MD5_MAX_LANES; j++) {
+		lanes[j].job = NULL;
+		blocks[j] = idle;
+	}
+
+	for (;;) {
+		active = 0;
+		for (j = 0; j < impl->lanes; j++) {
+			if (lanes[j].job == NULL && next < n) {
+				lanes[j].job = &jobs[next++];
+				lanes[j].block = 0;
+				lanes[j].nblocks = (lanes[j].job->len +
+						    lanes[j].job->suffix_len + 8) / 64 + 1;
+				iv = lanes[j].job->iv ? lanes[j].job->iv : md5_iv;
+				for (i = 0; i < 4; i++)
+					state[i][j] = iv[i];
+			}
+
+			if (lanes[j].job != NULL) {
+				blocks[j] = next_block(&lanes[j]);
+				active++;
+			} else {
+				blocks[j] = idle;
+			}
+		}
+
+		if (active == 0)
+			break;
+
+		impl->block(state, blocks);
+
+		for (j = 0; j < impl->lanes; j++) {
+			if (lanes[j].job == NULL ||
+			    ++lanes[j].block < lanes[j].nblocks)
+				continue;
+
+			for (i = 0; i < 16; i++)
+				lanes[j].job->digest[i] =
+				    (uint8_t)(state[i / 4][j] >> (8 * (i % 4)));
+			lanes[j].job = NULL;
+		}
+	}
+}
+
+/*- Computes the state of MD5 after absorbing a single block
+ *
+ * @param[out] state will hold the state, to be used as the iv of a job.
+ * @param[in] block the 64 octets absorbed.
+ -*/
+void rc_md5_block_state(uint32_t state[4], const uint8_t block[64])
+{
+	uint32_t lanes[4][RC_MD5_MAX_LANES];
+	const uint8_t *blocks[RC_MD5_MAX_LANES];
+	unsigned i;
+
+	memset(lanes, 0, sizeof(lanes));
+	for (i = 0; i < RC_MD5_MAX_LANES; i++)
+		blocks[i] = block;
+	for (i = 0; i < 4; i++)
+		lanes[i][0] = md5_iv[i];
+
+	md5_block_x4(lanes, blocks);
+
+	for (i = 0; i < 4; i++)
+		state[i] = lanes[i][0];
+}
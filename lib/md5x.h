@@ -0,0 +1,30 @@
+/*
+ * md5x.h	Internal multi-buffer MD5, hashing several messages at once.
+ *
+ * License:	BSD
+ *
+ */
+#ifndef MD5X_H
+# define MD5X_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* the most messages hashed in parallel */
+#define RC_MD5_MAX_LANES 8
+
+/* a message hashed by rc_md5_multi() */
+typedef struct rc_md5_job {
+	const uint8_t *data;
+	size_t len;
+	const uint8_t *suffix;	/* hashed after data, or NULL */
+	size_t suffix_len;
+	const uint32_t *iv;	/* the state to start from, or NULL */
+	uint64_t prefix_len;	/* the octets absorbed in iv; a multiple of 64 */
+	uint8_t *digest;	/* will hold the 16 octets of the digest */
+} rc_md5_job;
+
+void rc_md5_multi(rc_md5_job *jobs, unsigned n);
+void rc_md5_block_state(uint32_t state[4], const uint8_t block[64]);
+
+#endif /* MD5X_H */
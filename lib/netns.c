@@ -0,0 +1,202 @@
+/*
+ * netns.c	The network namespace set with the namespace option.
+ *
+ * The namespace and the one to return to are opened once, when the
+ * configuration is applied, instead of on every request. A thread enters
+ * the namespace only to create a socket or to query the resolver; the
+ * sockets, which stay in the namespace they were created in, are then
+ * pooled and used from any thread without switching again.
+ *
+ * License:	BSD
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <config.h>
+#include <includes.h>
+#include <radcli/radcli.h>
+#include <pthread.h>
+#include "util.h"
+#include "netns.h"
+
+#ifdef __linux__
+# include <sched.h>
+#endif
+
+struct rc_netns {
+	int ns_fd;		/* the namespace of the sockets */
+	int orig_fd;		/* the namespace of the process */
+	pthread_key_t depth;	/* the nesting of rc_netns_enter() per thread */
+};
+
+/*- Opens a network namespace
+ *
+ * @param name the name of the namespace, under /var/run/netns.
+ * @return the namespace, or NULL on failure.
+ -*/
+struct rc_netns *rc_netns_open(char const *name)
+{
+#ifdef __linux__
+	static char const *crt_nsnet = "/proc/self/ns/net";
+	struct rc_netns *ns;
+	char sock_nsnet[PATH_MAX];
+
+	ns = calloc(1, sizeof(*ns));
+	if (ns == NULL) {
+		rc_log(LOG_CRIT, "%s: out of memory", __func__);
+		return NULL;
+	}
+
+	snprintf(sock_nsnet, sizeof(sock_nsnet), "/var/run/netns/%s", name);
+	ns->orig_fd = open(crt_nsnet, O_RDONLY | O_CLOEXEC);
+	if (ns->orig_fd < 0) {
+		rc_log(LOG_ERR, "Cannot open %s errno=%s(%d)", crt_nsnet, strerror(errno), errno);
+		free(ns);
+		return NULL;
+	}
+
+	ns->ns_fd = open(sock_nsnet, O_RDONLY | O_CLOEXEC);
+	if (ns->ns_fd < 0) {
+		rc_log(LOG_ERR, "Cannot open %s errno=%s(%d)", sock_nsnet, strerror(errno), errno);
+		close(ns->orig_fd);
+		free(ns);
+		return NULL;
+	}
+
+	if (pthread_key_create(&ns->depth, NULL) != 0) {
+		close(ns->ns_fd);
+		close(ns->orig_fd);
+		free(ns);
+		return NULL;
+	}
+
+	return ns;
+#else
+	rc_log(LOG_ERR, "Not a Linux system. No operation performed");
+	return NULL;
+#endif
+}
+
+/*- Closes a network namespace
+ -*/
+void rc_netns_close(struct rc_netns *ns)
+{
+	if (ns == NULL)
+		return;
+
+	pthread_key_delete(ns->depth);
+	close(ns->ns_fd);
+	close(ns->orig_fd);
+	free(ns);
+}
+
+/*- Moves the current thread to a network namespace
+ *
+ * The calls may be nested; the thread leaves the namespace with the
+ * last matching rc_netns_leave().
+ *
+ * @param ns the namespace, or NULL to stay in the current one.
+ * @return 0 on success, -1 on failure.
+ -*/
+int rc_netns_enter(struct rc_netns *ns)
+{
+	uintptr_t depth;
+
+	if (ns == NULL)
+		return 0;
+
+	depth = (uintptr_t)pthread_getspecific(ns->depth);
+#ifdef __linux__
+	if (depth == 0 && setns(ns->ns_fd, CLONE_NEWNET) < 0) {
+		rc_log(LOG_ERR, "'setns' set failed errno=%s(%d)", strerror(errno), errno);
+		return -1;
+	}
+#endif
+	pthread_setspecific(ns->depth, (void *)(depth + 1));
+
+	return 0;
+}
+
+/*- Moves the current thread back to the namespace of the process
+ *
+ * @param ns the namespace given to rc_netns_enter().
+ * @return 0 on success, -1 on failure.
+ -*/
+int rc_netns_leave(struct rc_netns *ns)
+{
+	uintptr_t depth;
+
+	if (ns == NULL)
+		return 0;
+
+	depth = (uintptr_t)pthread_getspecific(ns->depth);
+	if (depth == 0)
+		return -1;
+	pthread_setspecific(ns->depth, (void *)(depth - 1));
+
+#ifdef __linux__
+	if (depth == 1 && setns(ns->orig_fd, CLONE_NEWNET) < 0) {
+		rc_log(LOG_ERR, "'setns' - reset failed errno=%s(%d)", strerror(errno), errno);
+		return -1;
+	}
+#endif
+
+	return 0;
+}
+
+/*- Creates a socket of the handle's transport in its namespace
+ *
+ * @param rh a handle to parsed configuration.
+ * @param our_sockaddr the local address given to the get_fd() callback.
+ * @return the socket, or -1 on failure.
+ -*/
+int rc_netns_get_fd(rc_handle *rh, struct sockaddr *our_sockaddr)
+{
+	int sockfd;
+
+	if (rh->so.get_fd == NULL)
+		return -1;
+
+	if (rc_netns_enter(rh->netns) < 0)
+		return -1;
+
+	sockfd = rh->so.get_fd(rh->so.ptr, our_sockaddr);
+
+	if (rc_netns_leave(rh->netns) < 0) {
+		rc_log(LOG_ERR, "%s: cannot leave the namespace", __func__);
+	}
+
+	return sockfd;
+}
+
+/*- Resolves a name in a network namespace
+ *
+ * Addresses in numeric form are converted without entering the namespace.
+ *
+ * @param ns the namespace, or NULL for the current one.
+ * @param host the name of the host.
+ * @param flags a combination of PW_AI flags.
+ * @return as rc_getaddrinfo().
+ -*/
+struct addrinfo *rc_netns_getaddrinfo(struct rc_netns *ns, char const *host,
+				      unsigned flags)
+{
+	struct addrinfo *res;
+	struct in6_addr a;
+
+	if (ns == NULL || host == NULL ||
+	    inet_pton(AF_INET, host, &a) == 1 || inet_pton(AF_INET6, host, &a) == 1)
+		return rc_getaddrinfo(host, flags);
+
+	if (rc_netns_enter(ns) < 0)
+		return NULL;
+
+	res = rc_getaddrinfo(host, flags);
+
+	if (rc_netns_leave(ns) < 0) {
+		rc_log(LOG_ERR, "%s: cannot leave the namespace", __func__);
+	}
+
+	return res;
+}
@@ -0,0 +1,22 @@
+/*
+ * netns.h	Internal network namespace of a handle.
+ *
+ * License:	BSD
+ *
+ */
+#ifndef NETNS_H
+# define NETNS_H
+
+#include <includes.h>
+
+struct rc_netns *rc_netns_open(char const *name);
+void rc_netns_close(struct rc_netns *ns);
+
+int rc_netns_enter(struct rc_netns *ns);
+int rc_netns_leave(struct rc_netns *ns);
+
+int rc_netns_get_fd(rc_handle *rh, struct sockaddr *our_sockaddr);
+struct addrinfo *rc_netns_getaddrinfo(struct rc_netns *ns, char const *host,
+				      unsigned flags);
+
+#endif /* NETNS_H */
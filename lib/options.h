@@ -38,6 +38,8 @@ static OPTION config_options_default[] = {
 {"tls-ca-file",		OT_STR, ST_UNDEF, NULL},
 {"tls-cert-file",	OT_STR, ST_UNDEF, NULL},
 {"tls-key-file",	OT_STR, ST_UNDEF, NULL},
+{"tls-multiplex",	OT_STR, ST_UNDEF, NULL},
+{"tls-sessions",	OT_INT, ST_UNDEF, NULL},
 {"nas-identifier",	OT_STR, ST_UNDEF, NULL},
 {"nas-ip",		OT_STR, ST_UNDEF, NULL},
 {"authserver",		OT_SRV, ST_UNDEF, NULL},
@@ -46,10 +48,25 @@ static OPTION config_options_default[] = {
 {"dictionary",		OT_STR, ST_UNDEF, NULL},
 {"default_realm",	OT_STR, ST_UNDEF, NULL},
 {"radius_timeout",	OT_INT, ST_UNDEF, NULL},
+{"radius_timeout_ms",	OT_INT, ST_UNDEF, NULL},
+{"radius_deadline_ms",	OT_INT, ST_UNDEF, NULL},
 {"radius_retries",	OT_INT,	ST_UNDEF, NULL},
 {"radius_deadtime",	OT_INT, ST_UNDEF, NULL},
+{"radius_hedge_delay",	OT_INT, ST_UNDEF, NULL},
+{"radius_rto",		OT_STR, ST_UNDEF, NULL},
+{"radius_mrt",		OT_INT, ST_UNDEF, NULL},
+{"radius_mrd",		OT_INT, ST_UNDEF, NULL},
+{"authserver-policy",	OT_STR, ST_UNDEF, NULL},
+{"acctserver-policy",	OT_STR, ST_UNDEF, NULL},
 {"bindaddr",		OT_STR, ST_UNDEF, NULL},
 {"clientdebug",		OT_INT, ST_UNDEF, NULL},
+{"udp-pool-size",	OT_INT, ST_UNDEF, NULL},
+{"udp-connect",		OT_STR, ST_UNDEF, NULL},
+{"udp-rcvbuf",		OT_INT, ST_UNDEF, NULL},
+{"udp-sndbuf",		OT_INT, ST_UNDEF, NULL},
+{"dns-cache-ttl",	OT_INT, ST_UNDEF, NULL},
+{"srcaddr-cache-ttl",	OT_INT, ST_UNDEF, NULL},
+{"crypto-provider",	OT_STR, ST_UNDEF, NULL},
 /* Deprecated options */
 {"login_radius",	OT_STR, ST_UNDEF, NULL},
 {"seqfile",		OT_STR, ST_UNDEF, NULL},
@@ -13,17 +13,41 @@
 
 /*- Hash the provided data using MD5
  *
+ * @param[in] crypto the provider of MD5.
  * @param[out] output will hold a 16-byte checksum.
  * @param[in] input pointer to data to hash.
  * @param[in] inlen the length of input.
  -*/
-void rc_md5_calc(unsigned char *output, unsigned char const *input,
-		 size_t inlen)
+void rc_md5_calc(const rc_crypto_provider *crypto, unsigned char *output,
+		 unsigned char const *input, size_t inlen)
 {
-	MD5_CTX	context;
+	rc_md5_ctx context;
 
-	MD5Init(&context);
-	MD5Update(&context, input, inlen);
-	MD5Final(output, &context);
+	crypto->init(&context);
+	crypto->update(&context, input, inlen);
+	crypto->final(output, &context);
 }
 
+/*- Hash the provided data followed by a secret using MD5
+ *
+ * The secret is hashed where it follows the data, without being copied
+ * after it.
+ *
+ * @param[in] crypto the provider of MD5.
+ * @param[out] output will hold a 16-byte checksum.
+ * @param[in] input pointer to data to hash.
+ * @param[in] inlen the length of input.
+ * @param[in] secret the secret hashed after the data.
+ * @param[in] secretlen the length of secret.
+ -*/
+void rc_md5_calc_secret(const rc_crypto_provider *crypto,
+			unsigned char *output, unsigned char const *input,
+			size_t inlen, char const *secret, size_t secretlen)
+{
+	rc_md5_ctx context;
+
+	crypto->init(&context);
+	crypto->update(&context, input, inlen);
+	crypto->update(&context, (unsigned char const *)secret, secretlen);
+	crypto->final(output, &context);
+}
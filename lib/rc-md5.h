@@ -10,18 +10,12 @@
 
 #include <includes.h>
 #include <stdlib.h>
+#include "crypto.h"
 
-#ifdef HAVE_NETTLE
-
-#include <nettle/md5-compat.h>
-
-#else
-
-#include "md5.h"
-
-#endif /* HAVE_NETTLE */
-
-void rc_md5_calc(unsigned char *output, unsigned char const *input,
-		     size_t inputlen);
+void rc_md5_calc(const rc_crypto_provider *crypto, unsigned char *output,
+		 unsigned char const *input, size_t inputlen);
+void rc_md5_calc_secret(const rc_crypto_provider *crypto,
+			unsigned char *output, unsigned char const *input,
+			size_t inputlen, char const *secret, size_t secretlen);
 
 #endif /* _RC_MD5_H */
@@ -0,0 +1,228 @@
+/*
+ * rng.c	Per-thread random generator for the Request Authenticators
+ *		and the packet Identifiers.
+ *
+ * Each thread expands a 256-bit key from the system source with the
+ * ChaCha20 stream cipher [RFC 8439], and hands out the keystream from a
+ * buffer, so that a Request Authenticator costs neither a system call
+ * nor a lock. The first 32 octets of every refill replace the key, and
+ * the octets handed out are erased from the buffer, so that the state of
+ * a thread does not reveal its earlier output. The key is drawn again
+ * from the system after RNG_RESEED_LEN octets, and in the child after a
+ * fork(), which must not repeat the output of its parent.
+ *
+ * License:	BSD
+ *
+ */
+
+#include <config.h>
+#include <includes.h>
+#include <radcli/radcli.h>
+#include <pathnames.h>
+#include <pthread.h>
+#include "util.h"
+#include "rng.h"
+
+#if defined(HAVE_GNUTLS)
+# include <gnutls/gnutls.h>
+# include <gnutls/crypto.h>
+#endif
+
+#define RNG_KEY_LEN	32
+#define RNG_BLOCK_LEN	64
+/* the keystream produced per refill; its first RNG_KEY_LEN octets are
+ * the next key */
+#define RNG_BUF_LEN	(8 * RNG_BLOCK_LEN)
+/* the octets handed out before the key is drawn from the system again */
+#define RNG_RESEED_LEN	(1024 * 1024)
+
+typedef struct rng_state {
+	uint32_t key[RNG_KEY_LEN / 4];
+	uint8_t buf[RNG_BUF_LEN];
+	unsigned pos;		/* the next unread octet of buf */
+	size_t output;		/* octets handed out since the key was drawn */
+	unsigned generation;	/* fork_generation when seeded; 0 for never */
+} rng_state;
+
+static __thread rng_state rng;
+
+/* incremented in the child of every fork() */
+static unsigned fork_generation = 1;
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+static void rng_atfork_child(void)
+{
+	__atomic_add_fetch(&fork_generation, 1, __ATOMIC_RELAXED);
+}
+
+static void rng_register_atfork(void)
+{
+	pthread_atfork(NULL, NULL, rng_atfork_child);
+}
+
+#define ROTL32(v, n)	(((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QUARTERROUND(a, b, c, d) do {				\
+	a += b; d ^= a; d = ROTL32(d, 16);			\
+	c += d; b ^= c; b = ROTL32(b, 12);			\
+	a += b; d ^= a; d = ROTL32(d, 8);			\
+	c += d; b ^= c; b = ROTL32(b, 7); } while (0)
+
+/*- Computes a block of the ChaCha20 keystream, with a zero nonce
+ -*/
+static void chacha20_block(const uint32_t key[8], uint32_t counter,
+			   uint8_t out[RNG_BLOCK_LEN])
+{
+	uint32_t in[16], x[16];
+	unsigned i;
+
+	in[0] = 0x61707865;	/* "expand 32-byte k" */
+	in[1] = 0x3320646e;
+	in[2] = 0x79622d32;
+	in[3] = 0x6b206574;
+	for (i = 0; i < 8; i++)
+		in[4 + i] = key[i];
+	in[12] = counter;
+	in[13] = in[14] = in[15] = 0;
+
+	memcpy(x, in, sizeof(x));
+	for (i = 0; i < 10; i++) {
+		QUARTERROUND(x[0], x[4], x[8], x[12]);
+		QUARTERROUND(x[1], x[5], x[9], x[13]);
+		QUARTERROUND(x[2], x[6], x[10], x[14]);
+		QUARTERROUND(x[3], x[7], x[11], x[15]);
+		QUARTERROUND(x[0], x[5], x[10], x[15]);
+		QUARTERROUND(x[1], x[6], x[11], x[12]);
+		QUARTERROUND(x[2], x[7], x[8], x[13]);
+		QUARTERROUND(x[3], x[4], x[9], x[14]);
+	}
+
+	for (i = 0; i < 16; i++) {
+		x[i] += in[i];
+		out[4 * i] = x[i];
+		out[4 * i + 1] = x[i] >> 8;
+		out[4 * i + 2] = x[i] >> 16;
+		out[4 * i + 3] = x[i] >> 24;
+	}
+
+	memset(x, 0, sizeof(x));
+	memset(in, 0, sizeof(in));
+}
+
+/*- Reads octets from the system's random source
+ *
+ * @return 0 on success, or -1 when no source is available.
+ -*/
+static int system_random(uint8_t *buf, size_t len)
+{
+#if defined(HAVE_GNUTLS)
+	if (gnutls_rnd(GNUTLS_RND_RANDOM, buf, len) >= 0)
+		return 0;
+#elif defined(HAVE_GETENTROPY)
+	if (getentropy(buf, len) >= 0)
+		return 0;
+#elif defined(HAVE_DEV_URANDOM)
+	ssize_t ret;
+	int fd;
+
+	if ((fd = open(_PATH_DEV_URANDOM, O_RDONLY)) >= 0) {
+		while (len > 0) {
+			ret = read(fd, buf, len);
+			if (ret > 0) {
+				buf += ret;
+				len -= ret;
+			} else if (ret == 0 ||
+				   (errno != EINTR && errno != EAGAIN)) {
+				break;
+			}
+		}
+		close(fd);
+		if (len == 0)
+			return 0;
+	}
+#endif
+	return -1;
+}
+
+/*- Draws the key of the thread from the system
+ -*/
+static void rng_seed(unsigned generation)
+{
+	uint32_t seed[RNG_KEY_LEN / 4];
+
+	if (system_random((uint8_t *)seed, sizeof(seed)) < 0) {
+		/* the previous key, if any, is stirred with what varies */
+		rc_log(LOG_ERR, "%s: no random source; the authenticators are predictable",
+		       __func__);
+		memcpy(seed, rng.key, sizeof(seed));
+		seed[0] ^= (uint32_t)time(NULL);
+		seed[1] ^= (uint32_t)getpid();
+		seed[2] ^= (uint32_t)(uintptr_t)&rng;
+		seed[3] ^= (uint32_t)(rc_getmtime() * 1000000);
+	}
+
+	memcpy(rng.key, seed, sizeof(rng.key));
+	memset(seed, 0, sizeof(seed));
+
+	rng.pos = RNG_BUF_LEN;
+	rng.output = 0;
+	rng.generation = generation;
+}
+
+/*- Refills the buffer, and replaces the key with the start of it
+ -*/
+static void rng_refill(void)
+{
+	unsigned i;
+
+	for (i = 0; i < RNG_BUF_LEN / RNG_BLOCK_LEN; i++)
+		chacha20_block(rng.key, i, rng.buf + i * RNG_BLOCK_LEN);
+
+	memcpy(rng.key, rng.buf, RNG_KEY_LEN);
+	memset(rng.buf, 0, RNG_KEY_LEN);
+	rng.pos = RNG_KEY_LEN;
+}
+
+/*- Fills a buffer with random octets
+ *
+ * The octets are suitable for the Request Authenticators, which must be
+ * unpredictable [RFC 2865, 3].
+ *
+ * @param out the buffer.
+ * @param len its length.
+ -*/
+void rc_random_bytes(void *out, size_t len)
+{
+	uint8_t *p = out;
+	unsigned generation, n;
+
+	pthread_once(&atfork_once, rng_register_atfork);
+	generation = __atomic_load_n(&fork_generation, __ATOMIC_RELAXED);
+	if (rng.generation != generation || rng.output >= RNG_RESEED_LEN)
+		rng_seed(generation);
+
+	while (len > 0) {
+		if (rng.pos == RNG_BUF_LEN)
+			rng_refill();
+
+		n = RNG_BUF_LEN - rng.pos;
+		if (n > len)
+			n = len;
+		memcpy(p, rng.buf + rng.pos, n);
+		memset(rng.buf + rng.pos, 0, n);
+		rng.pos += n;
+		rng.output += n;
+		p += n;
+		len -= n;
+	}
+}
+
+/*- Returns a random 32-bit number
+ -*/
+uint32_t rc_random_u32(void)
+{
+	uint32_t v;
+
+	rc_random_bytes(&v, sizeof(v));
+	return v;
+}
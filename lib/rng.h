@@ -0,0 +1,15 @@
+/*
+ * rng.h	Internal per-thread random generator.
+ *
+ * License:	BSD
+ *
+ */
+#ifndef RNG_H
+# define RNG_H
+
+#include <includes.h>
+
+void rc_random_bytes(void *out, size_t len);
+uint32_t rc_random_u32(void);
+
+#endif /* RNG_H */
@@ -16,25 +16,25 @@
 #include <radcli/radcli.h>
 #include <pathnames.h>
 #include <poll.h>
+#include <stddef.h>
 #include "util.h"
 #include "rc-md5.h"
 #include "rc-hmac.h"
+#include "keycache.h"
+#include "md5x.h"
+#include "rng.h"
+#include "sendserver.h"
+#include "sockpool.h"
+#include "tcpmux.h"
+#include "health.h"
+#include "dnscache.h"
+#include "srcaddr.h"
 
 #if defined(HAVE_GNUTLS)
 # include <gnutls/gnutls.h>
 # include <gnutls/crypto.h>
 #endif
 
-#if defined(__linux__)
-#include <linux/in6.h>
-#endif
-
-
-#define SCLOSE(fd) if (sfuncs->close_fd) sfuncs->close_fd(fd)
-
-static void rc_random_vector(unsigned char *);
-static int rc_check_reply(AUTH_HDR *, int, char const *, unsigned char const *,
-			  unsigned char);
 
 /**
  * @defgroup radcli-api Main API
@@ -46,18 +46,16 @@ static int rc_check_reply(AUTH_HDR *, int, char const *, unsigned char const *,
 /** Packs an attribute value pair list into a buffer
  *
  * @param vp a pointer to a VALUE_PAIR.
- * @param secret the secret used by the server.
+ * @param key the MD5 states of the secret used by the server.
  * @param auth a pointer to AUTH_HDR.
  * @return The number of octets packed.
  */
-static int rc_pack_list(VALUE_PAIR * vp, char *secret, AUTH_HDR * auth)
+static int rc_pack_list(VALUE_PAIR * vp, const rc_md5_key *key, AUTH_HDR * auth)
 {
 	int length, i, pc, padded_length;
 	int total_length = 0;
-	size_t secretlen;
 	uint32_t lvalue, vendor;
 	unsigned char passbuf[RC_MAX(AUTH_PASS_LEN, CHAP_VALUE_LENGTH)];
-	unsigned char md5buf[256];
 	unsigned char *buf, *vector, *vsa_length_ptr;
 
 	buf = auth->data;
@@ -99,15 +97,10 @@ static int rc_pack_list(VALUE_PAIR * vp, char *secret, AUTH_HDR * auth)
 			memset((char *)passbuf, '\0', AUTH_PASS_LEN);
 			memcpy((char *)passbuf, vp->strvalue, (size_t) length);
 
-			secretlen = strlen(secret);
 			vector = (unsigned char *)auth->vector;
 			for (i = 0; i < padded_length; i += AUTH_VECTOR_LEN) {
 				/* Calculate the MD5 digest */
-				strcpy((char *)md5buf, secret);
-				memcpy((char *)md5buf + secretlen, vector,
-				       AUTH_VECTOR_LEN);
-				rc_md5_calc(buf, md5buf,
-					    secretlen + AUTH_VECTOR_LEN);
+				rc_md5_keyed(key, vector, buf);
 
 				/* Remember the start of the digest */
 				vector = buf;
@@ -234,28 +227,36 @@ int rc_send_server(rc_handle * rh, SEND_DATA * data, char *msg, rc_type type)
 	return rc_send_server_ctx(rh, NULL, data, msg, type);
 }
 
-/** Verify items in returned packet
+#ifdef DIGEST_DEBUG
+/*- Logs octets in hexadecimal, 32 per line
+ -*/
+static void digest_debug(char const *title, uint8_t const *p, int len)
+{
+	char buf[65];
+	int i, j;
+
+	rc_log(LOG_ERR, "%s", title);
+	for (i = 0; i < len; i += 32) {
+		buf[0] = '\0';
+		for (j = 0; j < 32 && i + j < len; j++)
+			sprintf(buf + j * 2, "%.2X", p[i + j]);
+		rc_log(LOG_ERR, "  %s", buf);
+	}
+}
+#endif
+
+/** Verify the header of a returned packet
  *
  * @param auth a pointer to AUTH_HDR.
  * @param bufferlen the available buffer length.
- * @param secret the secret used by the server.
- * @param vector a random vector of %AUTH_VECTOR_LEN.
  * @param seq_nbr a unique sequence number.
- * @return OK_RC upon success, BADRESP_RC if anything looks funny.
+ * @return OK_RC upon success, BADRESP_RC or BADRESPID_RC if anything looks funny.
  */
-static int rc_check_reply(AUTH_HDR * auth, int bufferlen, char const *secret,
-			  unsigned char const *vector, uint8_t seq_nbr)
+static int rc_check_reply(AUTH_HDR * auth, int bufferlen, uint8_t seq_nbr)
 {
-	int secretlen;
 	int totallen;
-	unsigned char calc_digest[AUTH_VECTOR_LEN];
-	unsigned char reply_digest[AUTH_VECTOR_LEN];
-#ifdef DIGEST_DEBUG
-	uint8_t *ptr;
-#endif
 
 	totallen = ntohs(auth->length);
-	secretlen = (int)strlen(secret);
 
 	/* Do sanity checks on packet length */
 	if ((totallen < 20) || (totallen > 4096)) {
@@ -265,7 +266,7 @@ static int rc_check_reply(AUTH_HDR * auth, int bufferlen, char const *secret,
 	}
 
 	/* Verify buffer space, should never trigger with current buffer size and check above */
-	if ((totallen + secretlen) > bufferlen) {
+	if (totallen > bufferlen) {
 		rc_log(LOG_ERR,
 		       "rc_check_reply: not enough buffer space to verify RADIUS server response");
 		return BADRESP_RC;
@@ -277,122 +278,8 @@ static int rc_check_reply(AUTH_HDR * auth, int bufferlen, char const *secret,
 		       "rc_check_reply: received non-matching id in RADIUS server response");
 		return BADRESPID_RC;
 	}
-	/* Verify the reply digest */
-	memcpy((char *)reply_digest, (char *)auth->vector, AUTH_VECTOR_LEN);
-	memcpy((char *)auth->vector, (char *)vector, AUTH_VECTOR_LEN);
-	memcpy((char *)auth + totallen, secret, secretlen);
-#ifdef DIGEST_DEBUG
-	rc_log(LOG_ERR, "Calculating digest on:");
-	for (ptr = (u_char *) auth;
-	     ptr < ((u_char *) auth) + totallen + secretlen; ptr += 32) {
-		char buf[65];
-		int i;
-
-		buf[0] = '\0';
-		for (i = 0; i < 32; i++) {
-			if (ptr + i >= ((u_char *) auth) + totallen + secretlen)
-				break;
-			sprintf(buf + i * 2, "%.2X", ptr[i]);
-		}
-		rc_log(LOG_ERR, "  %s", buf);
-	}
-#endif
-	rc_md5_calc(calc_digest, (unsigned char *)auth, totallen + secretlen);
-#ifdef DIGEST_DEBUG
-	rc_log(LOG_ERR, "Calculated digest is:");
-	for (ptr = (u_char *) calc_digest; ptr < ((u_char *) calc_digest) + 16;
-	     ptr += 32) {
-		char buf[65];
-		int i;
-
-		buf[0] = '\0';
-		for (i = 0; i < 32; i++) {
-			if (ptr + i >= ((u_char *) calc_digest) + 16)
-				break;
-			sprintf(buf + i * 2, "%.2X", ptr[i]);
-		}
-		rc_log(LOG_ERR, "  %s", buf);
-	}
-	rc_log(LOG_ERR, "Reply digest is:");
-	for (ptr = (u_char *) reply_digest;
-	     ptr < ((u_char *) reply_digest) + 16; ptr += 32) {
-		char buf[65];
-		int i;
-
-		buf[0] = '\0';
-		for (i = 0; i < 32; i++) {
-			if (ptr + i >= ((u_char *) reply_digest) + 16)
-				break;
-			sprintf(buf + i * 2, "%.2X", ptr[i]);
-		}
-		rc_log(LOG_ERR, "  %s", buf);
-	}
-#endif
-
-	if (memcmp((char *)reply_digest, (char *)calc_digest,
-		   AUTH_VECTOR_LEN) != 0) {
-		rc_log(LOG_ERR,
-		       "rc_check_reply: received invalid reply digest from RADIUS server");
-		return BADRESP_RC;
-	}
 
 	return OK_RC;
-
-}
-
-/** Generates a random vector of AUTH_VECTOR_LEN octets
- *
- * @param vector a buffer with at least %AUTH_VECTOR_LEN bytes.
- */
-static void rc_random_vector(unsigned char *vector)
-{
-	int randno;
-	int i;
-#if defined(HAVE_GNUTLS)
-	if (gnutls_rnd(GNUTLS_RND_NONCE, vector, AUTH_VECTOR_LEN) >= 0) {
-		return;
-	}
-#elif defined(HAVE_GETENTROPY)
-	if (getentropy(vector, AUTH_VECTOR_LEN) >= 0) {
-		return;
-	}			/* else fall through */
-#elif defined(HAVE_DEV_URANDOM)
-	int fd;
-
-/* well, I added this to increase the security for user passwords.
-   we use /dev/urandom here, as /dev/random might block and we don't
-   need that much randomness. BTW, great idea, Ted!     -lf, 03/18/95	*/
-
-	if ((fd = open(_PATH_DEV_URANDOM, O_RDONLY)) >= 0) {
-		unsigned char *pos;
-		int readcount;
-
-		i = AUTH_VECTOR_LEN;
-		pos = vector;
-		while (i > 0) {
-			readcount = read(fd, (char *)pos, i);
-			if (readcount >= 0) {
-				pos += readcount;
-				i -= readcount;
-			} else {
-				if (errno != EINTR && errno != EAGAIN)
-					goto fallback;
-			}
-		}
-
-		close(fd);
-		return;
-	}			/* else fall through */
- fallback:
-#endif
-	for (i = 0; i < AUTH_VECTOR_LEN;) {
-		randno = random();
-		memcpy((char *)vector, (char *)&randno, sizeof(int));
-		vector += sizeof(int);
-		i += sizeof(int);
-	}
-
-	return;
 }
 
 /** @} */
@@ -400,20 +287,16 @@ static void rc_random_vector(unsigned char *vector)
 
 /** Add a Message-Authenticator attribute to a message. This is mandatory,
  *  for example, when sending a message containing an EAP-Message
- *  attribute.
+ *  attribute. Its value is left zero, and computed by rc_sign_requests().
  *
- * @param rh - A handle to parsed configuration
- * @param secret - The server's secret string
  * @param auth - Pointer to the AUTH_HDR structure
  * @param total_length - Total packet length before Message Authenticator
  *                is added.
  *
  * @return Total packet length after Message Authenticator is added.
  */
-static int add_msg_auth_attr(rc_handle * rh, char * secret,
-			AUTH_HDR *auth, int total_length)
+static int add_msg_auth_attr(AUTH_HDR *auth, int total_length)
 {
-	size_t secretlen = strlen(secret);
 	uint8_t *msg_auth = (uint8_t *)auth + total_length;
 	msg_auth[0] = PW_MESSAGE_AUTHENTICATOR;
 	msg_auth[1] = 18;
@@ -421,185 +304,20 @@ static int add_msg_auth_attr(rc_handle * rh, char * secret,
 	total_length += 18;
 	auth->length = htons((unsigned short)total_length);
 
-	/* Calculate HMAC-MD5 [RFC2104] hash */
-	uint8_t digest[MD5_DIGEST_SIZE];
-	rc_hmac_md5((uint8_t *)auth, (size_t)total_length, (uint8_t *)secret, secretlen, digest);
-	memcpy(&msg_auth[2], digest, MD5_DIGEST_SIZE);
-
 	return total_length;
 }
 
-/** Sends a request to a RADIUS server and waits for the reply
+/*- Fills in the NAS-IP-Address (or NAS-IPv6-Address) and NAS-Identifier attributes
  *
- * @param rh a handle to parsed configuration
- * @param ctx if non-NULL it will contain the context of sent request; It must be released using rc_aaa_ctx_free().
- * @param data a pointer to a SEND_DATA structure
- * @param msg must be an array of %PW_MAX_MSG_SIZE or NULL; will contain the concatenation of
- *	any %PW_REPLY_MESSAGE received.
- * @param type must be %AUTH or %ACCT
- * @return OK_RC (0) on success, CHALLENGE_RC when an Access-Challenge
- *  response is received, TIMEOUT_RC on timeout REJECT_RC on access reject,
- *  or negative on failure as return value.
- */
-int rc_send_server_ctx(rc_handle * rh, RC_AAA_CTX ** ctx, SEND_DATA * data,
-		       char *msg, rc_type type)
+ * @param rh a handle to parsed configuration.
+ * @param data a pointer to a SEND_DATA structure.
+ * @param our_sockaddr the local address the request will be sent from.
+ -*/
+void rc_fill_nas_attrs(rc_handle * rh, SEND_DATA * data,
+		       struct sockaddr_storage *our_sockaddr)
 {
-	int sockfd = -1;
-	AUTH_HDR *auth, *recv_auth;
-	char *server_name, *p;	/* Name of server to query */
-	struct sockaddr_storage our_sockaddr;
-	struct addrinfo *auth_addr = NULL;
-	socklen_t salen;
-	int result = 0;
-	int total_length;
-	int length, pos;
-	int retry_max;
-	const rc_sockets_override *sfuncs;
-	unsigned discover_local_ip;
-	size_t secretlen;
-	char secret[MAX_SECRET_LENGTH + 1];
-	unsigned char vector[AUTH_VECTOR_LEN];
-	uint8_t recv_buffer[RC_BUFFER_LEN];
-	uint8_t send_buffer[RC_BUFFER_LEN];
-	uint8_t *attr;
-	uint16_t tlen;
-	int retries;
-	VALUE_PAIR *vp;
-	struct pollfd pfd;
-	double start_time, timeout;
 	struct sockaddr_storage *ss_set = NULL;
-	char *server_type = "auth";
-	char *ns = NULL;
-	int ns_def_hdl = 0;
-
-	server_name = data->server;
-	if (server_name == NULL || server_name[0] == '\0')
-		return ERROR_RC;
-
-	ns = rc_conf_str(rh, "namespace"); /* Check for namespace config */
-	if (ns != NULL) {
-		if(-1 == rc_set_netns(ns, &ns_def_hdl)) {
-			rc_log(LOG_ERR, "rc_send_server: namespace %s set failed", ns);
-			return ERROR_RC;
-		}
-	}
-	if ((vp = rc_avpair_get(data->send_pairs, PW_SERVICE_TYPE, 0)) &&
-	    (vp->lvalue == PW_ADMINISTRATIVE)) {
-		strcpy(secret, MGMT_POLL_SECRET);
-		auth_addr =
-		    rc_getaddrinfo(server_name,
-				   type == AUTH ? PW_AI_AUTH : PW_AI_ACCT);
-		if (auth_addr == NULL) {
-			result = ERROR_RC;
-			goto exit_error;
-		}    
-	} else {
-		if (data->secret != NULL) {
-			strlcpy(secret, data->secret, MAX_SECRET_LENGTH);
-		}
-		/*
-		   else
-		   {
-		 */
-		if (rc_find_server_addr
-		    (rh, server_name, &auth_addr, secret, type) != 0) {
-			rc_log(LOG_ERR,
-			       "rc_send_server: unable to find server: %s",
-			       server_name);
-			result = ERROR_RC;
-			goto exit_error;
-		}
-		/*} */
-	}
-
-	sfuncs = &rh->so;
-
-	if (sfuncs->static_secret) {
-		/* any static secret set in sfuncs overrides the configured */
-		strlcpy(secret, sfuncs->static_secret,
-			MAX_SECRET_LENGTH);
-	}
-
-	if (sfuncs->lock) {
-		if (sfuncs->lock(sfuncs->ptr) != 0) {
-			rc_log(LOG_ERR, "%s: lock error", __func__);
-			result = ERROR_RC;
-			goto exit_error;
-		}
-	}
-
-	rc_own_bind_addr(rh, &our_sockaddr);
-	discover_local_ip = 0;
-	if (our_sockaddr.ss_family == AF_INET) {
-		if (((struct sockaddr_in *)(&our_sockaddr))->sin_addr.s_addr ==
-		    INADDR_ANY) {
-			discover_local_ip = 1;
-		}
-	}
-
-	DEBUG(LOG_ERR, "DEBUG: rc_send_server: creating socket to: %s",
-	      server_name);
-	if (discover_local_ip) {
-		result = rc_get_srcaddr(SA(&our_sockaddr), auth_addr->ai_addr);
-		if (result != OK_RC) {
-			memset(secret, '\0', sizeof(secret));
-			rc_log(LOG_ERR,
-			       "rc_send_server: cannot figure our own address");
-			goto cleanup;
-		}
-	}
-
-	if (sfuncs->get_fd) {
-		sockfd = sfuncs->get_fd(sfuncs->ptr, SA(&our_sockaddr));
-		if (sockfd < 0) {
-			memset(secret, '\0', sizeof(secret));
-			rc_log(LOG_ERR, "rc_send_server: socket: %s",
-			       strerror(errno));
-			result = ERROR_RC;
-			goto cleanup;
-		}
-	}
-
-	if(our_sockaddr.ss_family  == AF_INET6) {
-		/* Check for IPv6 non-temporary address support */
-		char *non_temp_addr = rc_conf_str(rh, "use-public-addr");
-		if (non_temp_addr && (strcasecmp(non_temp_addr, "true") == 0)) {
-#if defined(__linux__)
-			int sock_opt = IPV6_PREFER_SRC_PUBLIC;
-			if (setsockopt(sockfd, IPPROTO_IPV6, IPV6_ADDR_PREFERENCES, 
-					&sock_opt, sizeof(sock_opt)) != 0) {
-				rc_log(LOG_ERR, "rc_send_server: setsockopt: %s", 
-					strerror(errno));
-				result = ERROR_RC;
-				goto cleanup;
-			}
-#elif defined(BSD) || defined(__APPLE__)
-			int sock_opt = 0;
-			if (setsockopt(sockfd, IPPROTO_IPV6, IPV6_PREFER_TEMPADDR,
-				&sock_opt, sizeof(sock_opt)) != 0) {
-				rc_log(LOG_ERR, "rc_send_server: setsockopt: %s", 
-					strerror(errno));
-				result = ERROR_RC;
-				goto cleanup;
-			}
-#else
-			rc_log(LOG_INFO, "rc_send_server: Usage of non-temporary IPv6"
-					" address is not supported in this system");
-#endif       
-		}
-	}
-
-	retry_max = data->retries;	/* Max. numbers to try for reply */
-	retries = 0;		/* Init retry cnt for blocking call */
-
-	if (data->svc_port) {
-		if (our_sockaddr.ss_family == AF_INET)
-			((struct sockaddr_in *)auth_addr->ai_addr)->sin_port =
-			    htons((unsigned short)data->svc_port);
-		else
-			((struct sockaddr_in6 *)auth_addr->ai_addr)->sin6_port =
-			    htons((unsigned short)data->svc_port);
-	}
+	char *p;
 
 	/*
 	 * Fill in NAS-IP-Address (if needed)
@@ -612,7 +330,7 @@ int rc_send_server_ctx(rc_handle * rh, RC_AAA_CTX ** ctx, SEND_DATA * data,
 	} else if (rc_avpair_get(data->send_pairs, PW_NAS_IP_ADDRESS, 0) == NULL &&
 	    	   rc_avpair_get(data->send_pairs, PW_NAS_IPV6_ADDRESS, 0) == NULL) {
 
-	    	ss_set = &our_sockaddr;
+	    	ss_set = our_sockaddr;
 	}
 
 	if (ss_set) {
@@ -643,159 +361,199 @@ int rc_send_server_ctx(rc_handle * rh, RC_AAA_CTX ** ctx, SEND_DATA * data,
 		rc_avpair_add(rh, &(data->send_pairs),
 			      PW_NAS_IDENTIFIER, p, -1, 0);
 	}
+}
+
+/*- Builds a request packet from the pairs in a SEND_DATA structure,
+ * without its authenticator
+ *
+ * The Request Authenticator of an Accounting-Request, or the
+ * Message-Authenticator of other requests, is left zero; the packet is
+ * complete once signed with rc_sign_requests().
+ *
+ * @param rh a handle to parsed configuration.
+ * @param data a pointer to a SEND_DATA structure.
+ * @param secret the secret used by the server.
+ * @param auth the buffer to hold the packet; must be of %RC_BUFFER_LEN size.
+ * @param vector will hold the request authenticator of %AUTH_VECTOR_LEN,
+ *	or, for accounting, once the packet is signed.
+ * @return the total length of the packet.
+ -*/
+int rc_pack_request_unsigned(rc_handle * rh, SEND_DATA * data, char *secret,
+			     AUTH_HDR * auth, unsigned char *vector)
+{
+	int total_length;
+	uint16_t tlen;
+	const rc_md5_key *key;
+	rc_md5_key tmp;
 
-	/* Build a request */
-	auth = (AUTH_HDR *) send_buffer;
 	auth->code = data->code;
 	auth->id = data->seq_nbr;
 
+	key = rc_key_lookup(rh->keys, secret, &tmp);
+
 	if (data->code == PW_ACCOUNTING_REQUEST) {
-		server_type = "acct";
 		total_length =
-		    rc_pack_list(data->send_pairs, secret, auth) + AUTH_HDR_LEN;
+		    rc_pack_list(data->send_pairs, key, auth) + AUTH_HDR_LEN;
 
 		tlen = htons((unsigned short)total_length);
 		memcpy(&auth->length, &tlen, sizeof(uint16_t));
 
 		memset((char *)auth->vector, 0, AUTH_VECTOR_LEN);
-		secretlen = strlen(secret);
-		memcpy((char *)auth + total_length, secret, secretlen);
-		rc_md5_calc(vector, (unsigned char *)auth,
-			    total_length + secretlen);
-		memcpy((char *)auth->vector, (char *)vector, AUTH_VECTOR_LEN);
 	} else {
-		rc_random_vector(vector);
+		rc_random_bytes(vector, AUTH_VECTOR_LEN);
 		memcpy((char *)auth->vector, (char *)vector, AUTH_VECTOR_LEN);
 
 		total_length =
-		    rc_pack_list(data->send_pairs, secret, auth) + AUTH_HDR_LEN;
+		    rc_pack_list(data->send_pairs, key, auth) + AUTH_HDR_LEN;
 
-		total_length = add_msg_auth_attr(rh, secret, auth, total_length);
+		total_length = add_msg_auth_attr(auth, total_length);
 
 		auth->length = htons((unsigned short)total_length);
 	}
 
-	if (radcli_debug) {
-		char our_addr_txt[50] = "";	/* hold a text IP */
-		char auth_addr_txt[50] = "";	/* hold a text IP */
+	if (key == &tmp)
+		rc_key_clear(&tmp);
 
-		getnameinfo(SA(&our_sockaddr), SS_LEN(&our_sockaddr), NULL, 0,
-			    our_addr_txt, sizeof(our_addr_txt), NI_NUMERICHOST);
-		getnameinfo(auth_addr->ai_addr, auth_addr->ai_addrlen, NULL, 0,
-			    auth_addr_txt, sizeof(auth_addr_txt),
-			    NI_NUMERICHOST);
+	return total_length;
+}
 
-		DEBUG(LOG_ERR,
-		      "DEBUG: timeout=%d retries=%d local %s : 0, remote %s : %u\n",
-		      data->timeout, retry_max, our_addr_txt, auth_addr_txt,
-		      data->svc_port);
+/*- Signs a single request with the MD5 of the crypto library
+ -*/
+static void sign_one(rc_handle * rh, rc_sign_job * job)
+{
+	uint8_t *packet = (uint8_t *)job->auth;
+	const rc_md5_key *key;
+	rc_md5_key tmp;
+
+	key = rc_key_lookup(rh->keys, job->secret, &tmp);
+
+	if (job->auth->code == PW_ACCOUNTING_REQUEST) {
+		rc_md5_calc_secret(key->crypto, job->vector, packet,
+				   job->length, key->str, key->len);
+		memcpy(job->auth->vector, job->vector, AUTH_VECTOR_LEN);
+	} else {
+		/* Calculate HMAC-MD5 [RFC2104] hash */
+		rc_hmac_md5_keyed(key, packet, job->length,
+				  packet + job->length - MD5_DIGEST_SIZE);
 	}
 
-	for (;;) {
-		do {
-			result =
-			    sfuncs->sendto(sfuncs->ptr, sockfd, (char *)auth,
-					   (unsigned int)total_length, (int)0,
-					   SA(auth_addr->ai_addr),
-					   auth_addr->ai_addrlen);
-		} while (result == -1 && errno == EINTR);
-		if (result == -1) {
-			result = errno == ENETUNREACH ? NETUNREACH_RC : ERROR_RC;
-			rc_log(LOG_ERR, "%s: socket: %s", __FUNCTION__,
-			       strerror(errno));
-			goto cleanup;
-		}
+	if (key == &tmp)
+		rc_key_clear(&tmp);
+}
 
-		pfd.fd = sockfd;
-		pfd.events = POLLIN;
-		pfd.revents = 0;
-		start_time = rc_getmtime();
-		for (timeout = data->timeout; timeout > 0;
-		     timeout -= rc_getmtime() - start_time) {
-			result = poll(&pfd, 1, timeout * 1000);
-			if (result != -1 || errno != EINTR)
-				break;
+/*- Signs at most %RC_MD5_MAX_LANES requests with the multi-buffer MD5
+ -*/
+static void sign_chunk(rc_handle * rh, rc_sign_job * jobs, unsigned n)
+{
+	rc_md5_key tmp[RC_MD5_MAX_LANES];
+	const rc_md5_key *keys[RC_MD5_MAX_LANES];
+	uint8_t inner[RC_MD5_MAX_LANES][MD5_DIGEST_SIZE];
+	rc_md5_job md5[RC_MD5_MAX_LANES];
+	uint8_t *packet;
+	unsigned i, nouter = 0;
+
+	memset(md5, 0, sizeof(md5));
+	for (i = 0; i < n; i++) {
+		keys[i] = rc_key_lookup(rh->keys, jobs[i].secret, &tmp[i]);
+		md5[i].data = (uint8_t *)jobs[i].auth;
+		md5[i].len = jobs[i].length;
+		if (jobs[i].auth->code == PW_ACCOUNTING_REQUEST) {
+			/* MD5(packet || secret) */
+			md5[i].suffix = (uint8_t const *)keys[i]->str;
+			md5[i].suffix_len = keys[i]->len;
+			md5[i].digest = jobs[i].vector;
+		} else {
+			/* the inner hash of HMAC-MD5 */
+			md5[i].iv = keys[i]->hmac_iv[0];
+			md5[i].prefix_len = 64;
+			md5[i].digest = inner[i];
 		}
-
-		if (result == -1) {
-			rc_log(LOG_ERR, "rc_send_server: poll: %s",
-			       strerror(errno));
-			memset(secret, '\0', sizeof(secret));
-			SCLOSE(sockfd);
-			result = ERROR_RC;
-			goto cleanup;
+	}
+	rc_md5_multi(md5, n);
+
+	/* the outer hashes of HMAC-MD5 */
+	for (i = 0; i < n; i++) {
+		packet = (uint8_t *)jobs[i].auth;
+		if (jobs[i].auth->code == PW_ACCOUNTING_REQUEST) {
+			memcpy(jobs[i].auth->vector, jobs[i].vector,
+			       AUTH_VECTOR_LEN);
+			continue;
 		}
 
-		if (result == 1 && (pfd.revents & POLLIN) != 0) {
-			salen = auth_addr->ai_addrlen;
-			do {
-				length = sfuncs->recvfrom(sfuncs->ptr, sockfd,
-							  (char *)recv_buffer,
-							  (int)
-							  sizeof(recv_buffer),
-							  (int)0,
-							  SA(auth_addr->
-							     ai_addr), &salen);
-			} while (length == -1 && errno == EINTR);
-
-			if (length <= 0) {
-				int e = errno;
-				rc_log(LOG_ERR,
-				       "rc_send_server: recvfrom: %s:%d: %s",
-				       server_name, data->svc_port,
-				       strerror(e));
-				if (length == -1 && (e == EAGAIN || e == EINTR))
-					continue;
-				SCLOSE(sockfd);
-				memset(secret, '\0', sizeof(secret));
-				result = ERROR_RC;
-				goto cleanup;
-			}
+		memset(&md5[nouter], 0, sizeof(md5[nouter]));
+		md5[nouter].data = inner[i];
+		md5[nouter].len = MD5_DIGEST_SIZE;
+		md5[nouter].iv = keys[i]->hmac_iv[1];
+		md5[nouter].prefix_len = 64;
+		md5[nouter].digest = packet + jobs[i].length - MD5_DIGEST_SIZE;
+		nouter++;
+	}
+	if (nouter > 0)
+		rc_md5_multi(md5, nouter);
 
-			recv_auth = (AUTH_HDR *) recv_buffer;
-
-			if (length < AUTH_HDR_LEN
-			    || length < ntohs(recv_auth->length)) {
-				rc_log(LOG_ERR,
-				       "rc_send_server: recvfrom: %s:%d: reply is too short",
-				       server_name, data->svc_port);
-				SCLOSE(sockfd);
-				memset(secret, '\0', sizeof(secret));
-				result = ERROR_RC;
-				goto cleanup;
-			}
+	for (i = 0; i < n; i++) {
+		if (keys[i] == &tmp[i])
+			rc_key_clear(&tmp[i]);
+	}
+	memset(inner, 0, sizeof(inner));
+}
 
-			result =
-			    rc_check_reply(recv_auth, RC_BUFFER_LEN, secret,
-					   vector, data->seq_nbr);
-			if (result != BADRESPID_RC) {
-				/* if a message that doesn't match our ID was received, then ignore
-				 * it, and try to receive more, until timeout. That is because in
-				 * DTLS the channel is shared, and we may receive duplicates or
-				 * out-of-order packets. */
-				break;
-			}
-		}
+/*- Signs requests built by rc_pack_request_unsigned()
+ *
+ * Sets the Request Authenticator of the accounting requests, and the
+ * Message-Authenticator of the others. Several requests are hashed
+ * together, in the lanes of the multi-buffer MD5.
+ *
+ * @param rh a handle to parsed configuration.
+ * @param jobs the requests.
+ * @param n the number of requests.
+ -*/
+void rc_sign_requests(rc_handle * rh, rc_sign_job * jobs, unsigned n)
+{
+	unsigned i, chunk;
 
-		/*
-		 * Timed out waiting for response.  Retry "retry_max" times
-		 * before giving up.  If retry_max = 0, don't retry at all.
-		 */
-		if (retries++ >= retry_max) {
-			char radius_server_ip[128];
-			struct sockaddr_in *si =
-			    (struct sockaddr_in *)auth_addr->ai_addr;
-			inet_ntop(auth_addr->ai_family, &si->sin_addr,
-				  radius_server_ip, sizeof(radius_server_ip));
-			rc_log(LOG_ERR,
-			       "rc_send_server: no reply from RADIUS %s server %s:%u",
-			       server_type, radius_server_ip, data->svc_port);
-			SCLOSE(sockfd);
-			memset(secret, '\0', sizeof(secret));
-			result = TIMEOUT_RC;
-			goto cleanup;
-		}
+	/* a single request is hashed by the MD5 of the crypto library */
+	if (n == 1) {
+		sign_one(rh, jobs);
+		return;
+	}
+
+	for (i = 0; i < n; i += chunk) {
+		chunk = n - i < RC_MD5_MAX_LANES ? n - i : RC_MD5_MAX_LANES;
+		sign_chunk(rh, jobs + i, chunk);
 	}
+}
+
+/*- Builds a request packet from the pairs in a SEND_DATA structure
+ *
+ * @param rh a handle to parsed configuration.
+ * @param data a pointer to a SEND_DATA structure.
+ * @param secret the secret used by the server.
+ * @param auth the buffer to hold the packet; must be of %RC_BUFFER_LEN size.
+ * @param vector will hold the request authenticator of %AUTH_VECTOR_LEN.
+ * @return the total length of the packet.
+ -*/
+int rc_pack_request(rc_handle * rh, SEND_DATA * data, char *secret,
+		    AUTH_HDR * auth, unsigned char *vector)
+{
+	rc_sign_job job;
+
+	job.auth = auth;
+	job.length = rc_pack_request_unsigned(rh, data, secret, auth, vector);
+	job.secret = secret;
+	job.vector = vector;
+	sign_one(rh, &job);
+
+	return job.length;
+}
+
+/*- Verifies that the attributes of a reply are properly encoded
+ -*/
+static int check_reply_attrs(SEND_DATA * data, uint8_t * recv_buffer,
+			     int length)
+{
+	AUTH_HDR *recv_auth = (AUTH_HDR *) recv_buffer;
+	uint8_t *attr;
 
 	/*
 	 *      If UDP is larger than RADIUS, shorten it to RADIUS.
@@ -811,36 +569,172 @@ int rc_send_server_ctx(rc_handle * rh, RC_AAA_CTX ** ctx, SEND_DATA * data,
 		if (attr[0] == 0) {
 			rc_log(LOG_ERR,
 			       "rc_send_server: recvfrom: %s:%d: attribute zero is invalid",
-			       server_name, data->svc_port);
-			SCLOSE(sockfd);
-			memset(secret, '\0', sizeof(secret));
-			result = ERROR_RC;
-			goto cleanup;
+			       data->server, data->svc_port);
+			return ERROR_RC;
 		}
 
 		if (attr[1] < 2) {
 			rc_log(LOG_ERR,
 			       "rc_send_server: recvfrom: %s:%d: attribute length is too small",
-			       server_name, data->svc_port);
-			SCLOSE(sockfd);
-			memset(secret, '\0', sizeof(secret));
-			result = ERROR_RC;
-			goto cleanup;
+			       data->server, data->svc_port);
+			return ERROR_RC;
 		}
 
 		if ((attr + attr[1]) > (recv_buffer + length)) {
 			rc_log(LOG_ERR,
 			       "rc_send_server: recvfrom: %s:%d: attribute overflows the packet",
-			       server_name, data->svc_port);
-			SCLOSE(sockfd);
-			memset(secret, '\0', sizeof(secret));
-			result = ERROR_RC;
-			goto cleanup;
+			       data->server, data->svc_port);
+			return ERROR_RC;
 		}
 
 		attr += attr[1];
 	}
 
+	return OK_RC;
+}
+
+/*- Verifies at most %RC_MD5_MAX_LANES replies
+ -*/
+static void verify_chunk(rc_handle * rh, rc_reply_check * checks, unsigned n)
+{
+	unsigned char calc_digest[RC_MD5_MAX_LANES][AUTH_VECTOR_LEN];
+	unsigned char reply_digest[RC_MD5_MAX_LANES][AUTH_VECTOR_LEN];
+	rc_md5_job md5[RC_MD5_MAX_LANES];
+	rc_reply_check *c;
+	AUTH_HDR *auth;
+	unsigned i, njobs = 0;
+
+	memset(md5, 0, sizeof(md5));
+	for (i = 0; i < n; i++) {
+		c = &checks[i];
+		auth = (AUTH_HDR *) c->buf;
+
+		if (c->length < AUTH_HDR_LEN
+		    || c->length < ntohs(auth->length)) {
+			rc_log(LOG_ERR,
+			       "rc_send_server: recvfrom: %s:%d: reply is too short",
+			       c->data->server, c->data->svc_port);
+			c->result = ERROR_RC;
+			continue;
+		}
+
+		c->result = rc_check_reply(auth, RC_BUFFER_LEN, c->data->seq_nbr);
+		if (c->result != OK_RC)
+			continue;
+
+		/* the Response Authenticator is MD5(reply || secret), computed
+		 * with the Request Authenticator in its place */
+		memcpy(reply_digest[i], auth->vector, AUTH_VECTOR_LEN);
+		memcpy(auth->vector, c->vector, AUTH_VECTOR_LEN);
+#ifdef DIGEST_DEBUG
+		digest_debug("Calculating digest on:", c->buf, ntohs(auth->length));
+#endif
+		md5[njobs].data = c->buf;
+		md5[njobs].len = ntohs(auth->length);
+		md5[njobs].suffix = (uint8_t const *)c->secret;
+		md5[njobs].suffix_len = strlen(c->secret);
+		md5[njobs].digest = calc_digest[i];
+		njobs++;
+	}
+
+	/* a single reply is hashed by the MD5 of the crypto library */
+	if (njobs == 1)
+		rc_md5_calc_secret(rh->crypto ? rh->crypto : rc_crypto_default(),
+				   md5[0].digest, md5[0].data, md5[0].len,
+				   (char const *)md5[0].suffix,
+				   md5[0].suffix_len);
+	else if (njobs > 1)
+		rc_md5_multi(md5, njobs);
+
+	for (i = 0; i < n; i++) {
+		c = &checks[i];
+		if (c->result != OK_RC)
+			continue;
+
+#ifdef DIGEST_DEBUG
+		digest_debug("Calculated digest is:", calc_digest[i], AUTH_VECTOR_LEN);
+		digest_debug("Reply digest is:", reply_digest[i], AUTH_VECTOR_LEN);
+#endif
+		if (memcmp(reply_digest[i], calc_digest[i], AUTH_VECTOR_LEN) != 0) {
+			rc_log(LOG_ERR,
+			       "rc_check_reply: received invalid reply digest from RADIUS server");
+			c->result = BADRESP_RC;
+			continue;
+		}
+
+		c->result = check_reply_attrs(c->data, c->buf, c->length);
+	}
+}
+
+/*- Verifies several received replies
+ *
+ * The authenticators of the replies are computed together, in the lanes
+ * of the multi-buffer MD5. Each check receives the result that
+ * rc_verify_reply() would return.
+ *
+ * @param rh a handle to parsed configuration.
+ * @param checks the replies.
+ * @param n the number of replies.
+ -*/
+void rc_verify_replies(rc_handle * rh, rc_reply_check * checks, unsigned n)
+{
+	unsigned i, chunk;
+
+	for (i = 0; i < n; i += chunk) {
+		chunk = n - i < RC_MD5_MAX_LANES ? n - i : RC_MD5_MAX_LANES;
+		verify_chunk(rh, checks + i, chunk);
+	}
+}
+
+/*- Verifies a reply received for a request
+ *
+ * Checks the length, the identifier and the authenticator of the
+ * reply, and that its attributes are properly encoded.
+ *
+ * @param rh a handle to parsed configuration.
+ * @param data a pointer to the SEND_DATA structure of the request.
+ * @param recv_buffer the received packet; must be of %RC_BUFFER_LEN size.
+ * @param length the number of octets received.
+ * @param secret the secret used by the server.
+ * @param vector the request authenticator.
+ * @return OK_RC if the reply is valid, BADRESPID_RC if it does not
+ *	match the request identifier, BADRESP_RC if its authenticator is
+ *	invalid, or ERROR_RC if it is malformed.
+ -*/
+int rc_verify_reply(rc_handle * rh, SEND_DATA * data, uint8_t * recv_buffer,
+		    int length, char const *secret, unsigned char const *vector)
+{
+	rc_reply_check check;
+
+	check.data = data;
+	check.buf = recv_buffer;
+	check.length = length;
+	check.secret = secret;
+	check.vector = vector;
+	verify_chunk(rh, &check, 1);
+
+	return check.result;
+}
+
+/*- Decodes a verified reply
+ *
+ * The received attributes are placed in data->receive_pairs.
+ *
+ * @param rh a handle to parsed configuration.
+ * @param data a pointer to the SEND_DATA structure of the request.
+ * @param recv_buffer the reply, as verified by rc_verify_reply().
+ * @param msg must be an array of %PW_MAX_MSG_SIZE or NULL; will contain the concatenation of
+ *	any %PW_REPLY_MESSAGE received.
+ * @return OK_RC (0) on accept, CHALLENGE_RC on an Access-Challenge, REJECT_RC on
+ *	reject, or BADRESP_RC on an unexpected reply code.
+ -*/
+int rc_decode_reply(rc_handle * rh, SEND_DATA * data, uint8_t * recv_buffer,
+		    char *msg)
+{
+	AUTH_HDR *recv_auth = (AUTH_HDR *) recv_buffer;
+	VALUE_PAIR *vp;
+	int length, pos;
+
 	length = ntohs(recv_auth->length) - AUTH_HDR_LEN;
 	if (length > 0) {
 		data->receive_pairs = rc_avpair_gen(rh, NULL, recv_auth->data,
@@ -849,15 +743,6 @@ int rc_send_server_ctx(rc_handle * rh, RC_AAA_CTX ** ctx, SEND_DATA * data,
 		data->receive_pairs = NULL;
 	}
 
-	SCLOSE(sockfd);
-	result = populate_ctx(ctx, secret, vector);
-	if (result != OK_RC) {
-		memset(secret, '\0', sizeof(secret));
-		goto cleanup;
-	}
-
-	memset(secret, '\0', sizeof(secret));
-
 	if (msg) {
 		*msg = '\0';
 		pos = 0;
@@ -876,40 +761,650 @@ int rc_send_server_ctx(rc_handle * rh, RC_AAA_CTX ** ctx, SEND_DATA * data,
 	case PW_ACCESS_ACCEPT:
 	case PW_PASSWORD_ACK:
 	case PW_ACCOUNTING_RESPONSE:
-		result = OK_RC;
-		break;
+		return OK_RC;
 
 	case PW_ACCESS_REJECT:
 	case PW_PASSWORD_REJECT:
-		result = REJECT_RC;
-		break;
+		return REJECT_RC;
 
 	case PW_ACCESS_CHALLENGE:
-		result = CHALLENGE_RC;
-		break;
+		return CHALLENGE_RC;
 
 	default:
 		rc_log(LOG_ERR, "rc_send_server: received RADIUS server response neither ACCEPT nor REJECT, code=%d is invalid",
 		       recv_auth->code);
-		result = BADRESP_RC;
+		return BADRESP_RC;
+	}
+}
+
+/*- Finds the address and secret of the server of a request
+ *
+ * @param rh a handle to parsed configuration.
+ * @param data a pointer to a SEND_DATA structure.
+ * @param type must be %AUTH or %ACCT.
+ * @param secret an array of %MAX_SECRET_LENGTH + 1; initialized from data->secret
+ *	and overwritten by any configured secret of the server.
+ * @param auth_addr will hold the address of the server; must be released using
+ *	freeaddrinfo().
+ * @return OK_RC (0) on success, or ERROR_RC on failure.
+ -*/
+int rc_resolve_server(rc_handle * rh, SEND_DATA * data, rc_type type,
+		      char *secret, struct addrinfo **auth_addr)
+{
+	VALUE_PAIR *vp;
+
+	*auth_addr = NULL;
+	if ((vp = rc_avpair_get(data->send_pairs, PW_SERVICE_TYPE, 0)) &&
+	    (vp->lvalue == PW_ADMINISTRATIVE)) {
+		strcpy(secret, MGMT_POLL_SECRET);
+		*auth_addr =
+		    rc_dns_lookup(rh->dnscache, data->server,
+				  type == AUTH ? PW_AI_AUTH : PW_AI_ACCT);
+		if (*auth_addr == NULL)
+			return ERROR_RC;
+	} else {
+		if (data->secret != NULL) {
+			strlcpy(secret, data->secret, MAX_SECRET_LENGTH);
+		}
+
+		if (rc_find_server_addr
+		    (rh, data->server, auth_addr, secret, type) != 0) {
+			rc_log(LOG_ERR,
+			       "rc_send_server: unable to find server: %s",
+			       data->server);
+			return ERROR_RC;
+		}
+	}
+
+	if (rh->so.static_secret) {
+		/* any static secret set in sfuncs overrides the configured */
+		strlcpy(secret, rh->so.static_secret, MAX_SECRET_LENGTH);
+	}
+
+	if (data->svc_port) {
+		if ((*auth_addr)->ai_family == AF_INET)
+			((struct sockaddr_in *)(*auth_addr)->ai_addr)->sin_port =
+			    htons((unsigned short)data->svc_port);
+		else
+			((struct sockaddr_in6 *)(*auth_addr)->ai_addr)->sin6_port =
+			    htons((unsigned short)data->svc_port);
 	}
 
- cleanup:
-	if (auth_addr)
-		freeaddrinfo(auth_addr);
+	return OK_RC;
+}
+
+/*- Completes a request and releases its socket and transport lock
+ -*/
+static int request_finish(RC_REQUEST * req, int result)
+{
+	rc_handle *rh = req->rh;
+
+	req->result = result;
+
+	if (req->tcp != NULL) {
+		rc_tcp_detach(rh, req);
+	} else if (req->sockfd >= 0) {
+		/* only a socket which saw its reply may serve another request */
+		rc_sockpool_put(rh, req->sockfd, &req->our_sockaddr,
+				req->auth_addr->ai_addr,
+				req->auth_addr->ai_addrlen, req->replied);
+		req->sockfd = -1;
+	}
 
-	if (sfuncs->unlock) {
-		if (sfuncs->unlock(sfuncs->ptr) != 0) {
+	if (req->locked) {
+		if (rh->so.unlock(rh->so.ptr) != 0) {
 			rc_log(LOG_ERR, "%s: unlock error", __func__);
 		}
+		req->locked = 0;
+	}
+
+	return result;
+}
+
+/*- Sets the time the reply is awaited until, bounded by the expiry
+ -*/
+static void request_arm(RC_REQUEST * req, double now, double timeout)
+{
+	req->deadline = now + timeout;
+	if (req->expires > 0 && req->deadline > req->expires)
+		req->deadline = req->expires;
+}
+
+/*- Transmits, or retransmits, the request and sets its reply deadline
+ -*/
+static int request_transmit(RC_REQUEST * req)
+{
+	const rc_sockets_override *sfuncs = &req->rh->so;
+	double now;
+	int result;
+
+	if (req->tcp != NULL) {
+		result = rc_tcp_send(req);
+	} else {
+		do {
+			result =
+			    sfuncs->sendto(sfuncs->ptr, req->sockfd,
+					   (char *)req->send_buffer,
+					   (unsigned int)req->total_length, (int)0,
+					   req->connected ? NULL : SA(req->auth_addr->ai_addr),
+					   req->connected ? 0 : req->auth_addr->ai_addrlen);
+		} while (result == -1 && errno == EINTR);
+	}
+	if (result == -1) {
+		result = errno == ENETUNREACH ? NETUNREACH_RC : ERROR_RC;
+		rc_log(LOG_ERR, "%s: socket: %s", __func__, strerror(errno));
+		return request_finish(req, result);
+	}
+
+	now = rc_getmtime();
+	if (req->first_sent == 0)
+		req->first_sent = now;
+	request_arm(req, now, req->rt);
+	return PENDING_RC;
+}
+
+/*- Sets the timeout of a retransmission as in RFC 5080 section 2.2.1
+ *
+ * The timeout is doubled, with a random 10% jitter, up to the maximum
+ * retransmission timeout (MRT), and cut at the end of the maximum
+ * retransmission duration (MRD).
+ *
+ * @return 0 on success, or -1 if the maximum duration elapsed.
+ -*/
+static int request_backoff(RC_REQUEST * req)
+{
+	double rnd, left;
+
+	rnd = ((double)rand_r(&req->seed) / RAND_MAX - 0.5) / 5;
+	req->rt = 2 * req->rt + rnd * req->rt;
+	if (req->rt > req->mrt)
+		req->rt = req->mrt + rnd * req->mrt;
+
+	if (req->mrd > 0) {
+		left = req->first_sent + req->mrd - rc_getmtime();
+		if (left <= 0)
+			return -1;
+		if (req->rt > left)
+			req->rt = left;
+	}
+
+	return 0;
+}
+
+/*- Initializes a request object in place
+ *
+ * The request must be released using rc_request_deinit().
+ -*/
+void rc_request_init(RC_REQUEST * req, rc_handle * rh, SEND_DATA * data,
+		     char *msg, rc_type type)
+{
+	memset(req, 0, offsetof(RC_REQUEST, send_buffer));
+	req->rh = rh;
+	req->data = data;
+	req->msg = msg;
+	req->type = type;
+	req->result = PENDING_RC;
+	req->sockfd = -1;
+}
+
+/*- Releases the resources of a request object initialized in place
+ -*/
+void rc_request_deinit(RC_REQUEST * req)
+{
+	if (req->result == PENDING_RC)
+		request_finish(req, ERROR_RC);
+
+	if (req->auth_addr) {
+		freeaddrinfo(req->auth_addr);
+		req->auth_addr = NULL;
+	}
+
+	memset(req->secret, '\0', sizeof(req->secret));
+}
+
+/*- Stores the context of a request which received a reply
+ *
+ * @param req a completed request.
+ * @param ctx if non-NULL it will contain the context of the request.
+ * @return OK_RC on success, or ERROR_RC on failure.
+ -*/
+int rc_request_get_ctx(RC_REQUEST * req, RC_AAA_CTX ** ctx)
+{
+	if (!req->replied)
+		return ERROR_RC;
+
+	return populate_ctx(ctx, req->secret, req->vector);
+}
+
+/*- Sets the time at which a request is given up even if retries remain
+ *
+ * It must be called before rc_request_start().
+ *
+ * @param req a request.
+ * @param expires the time as returned by rc_getmtime(), or zero for none.
+ -*/
+void rc_request_set_expiry(RC_REQUEST * req, double expires)
+{
+	req->expires = expires;
+}
+
+/**
+ * @defgroup request-api Event loop API
+ * @brief Functions to drive a request from an application's event loop
+ *
+ * A request object performs the same exchange as rc_send_server(), but
+ * never blocks waiting for the reply. After rc_request_start() the
+ * application waits for the descriptor returned by rc_request_get_fd()
+ * to become readable, for at most rc_request_get_timeout() milliseconds,
+ * and calls rc_request_on_readable() or rc_request_on_timeout()
+ * accordingly until they return something other than %PENDING_RC.
+ *
+ * With the TLS and DTLS transports the connection of the handle is
+ * held by the request until it completes. With the TCP transport the
+ * requests to a server share a connection and its descriptor; a reply
+ * may then be read while processing another request, in which case
+ * rc_request_get_timeout() of its own request returns zero.
+ *
+ * @{
+ */
+
+/** Creates a new request
+ *
+ * @param rh a handle to parsed configuration.
+ * @param data a pointer to a SEND_DATA structure; it must remain valid until
+ *	the request is freed.
+ * @param msg must be an array of %PW_MAX_MSG_SIZE or NULL; will contain the concatenation of
+ *	any %PW_REPLY_MESSAGE received.
+ * @param type must be %AUTH or %ACCT.
+ * @return a new request (free with rc_request_free()), or NULL on failure.
+ */
+RC_REQUEST *rc_request_new(rc_handle * rh, SEND_DATA * data, char *msg,
+			   rc_type type)
+{
+	RC_REQUEST *req;
+
+	req = malloc(sizeof(*req));
+	if (req == NULL) {
+		rc_log(LOG_CRIT, "%s: out of memory", __func__);
+		return NULL;
+	}
+
+	rc_request_init(req, rh, data, msg, type);
+	return req;
+}
+
+/** Releases a request
+ *
+ * A request which has not completed is abandoned.
+ *
+ * @param req the request.
+ */
+void rc_request_free(RC_REQUEST * req)
+{
+	if (req == NULL)
+		return;
+
+	rc_request_deinit(req);
+	free(req);
+}
+
+/** Starts a request by sending it to the server
+ *
+ * @param req the request.
+ * @return %PENDING_RC when the request was sent and a reply is awaited, or
+ *	a final result as returned by rc_send_server().
+ */
+int rc_request_start(RC_REQUEST * req)
+{
+	rc_handle *rh = req->rh;
+	SEND_DATA *data = req->data;
+	const rc_sockets_override *sfuncs = &rh->so;
+	unsigned discover_local_ip;
+	int result;
+
+	if (req->result != PENDING_RC || req->auth_addr != NULL)
+		return ERROR_RC;
+
+	if (data->server == NULL || data->server[0] == '\0')
+		return request_finish(req, ERROR_RC);
+
+	result = rc_resolve_server(rh, data, req->type, req->secret,
+				   &req->auth_addr);
+	if (result != OK_RC)
+		goto exit;
+
+	if (sfuncs->lock) {
+		if (sfuncs->lock(sfuncs->ptr) != 0) {
+			rc_log(LOG_ERR, "%s: lock error", __func__);
+			result = ERROR_RC;
+			goto exit;
+		}
+		req->locked = 1;
+	}
+
+	rc_own_bind_addr(rh, &req->our_sockaddr);
+	discover_local_ip = 0;
+	if (req->our_sockaddr.ss_family == AF_INET) {
+		if (((struct sockaddr_in *)(&req->our_sockaddr))->sin_addr.s_addr ==
+		    INADDR_ANY) {
+			discover_local_ip = 1;
+		}
+	}
+
+	DEBUG(LOG_ERR, "DEBUG: rc_send_server: creating socket to: %s",
+	      data->server);
+	if (discover_local_ip) {
+		result = rc_srcaddr_lookup(rh->srcaddr, SA(&req->our_sockaddr),
+					   req->auth_addr->ai_addr);
+		if (result != OK_RC) {
+			rc_log(LOG_ERR,
+			       "rc_send_server: cannot figure our own address");
+			goto exit;
+		}
+	}
+
+	if (rh->tcpmux != NULL) {
+		if (rc_tcp_attach(rh, req) < 0)
+			req->sockfd = -1;
+	} else {
+		req->sockfd = rc_sockpool_get(rh, &req->our_sockaddr,
+					      req->auth_addr->ai_addr,
+					      req->auth_addr->ai_addrlen,
+					      &req->connected);
+	}
+	if (req->sockfd < 0) {
+		rc_log(LOG_ERR, "rc_send_server: socket: %s",
+		       strerror(errno));
+		result = ERROR_RC;
+		goto exit;
+	}
+
+	rc_fill_nas_attrs(rh, data, &req->our_sockaddr);
+
+	/* Build a request */
+	req->total_length = rc_pack_request(rh, data, req->secret,
+					    (AUTH_HDR *) req->send_buffer,
+					    req->vector);
+
+	if (radcli_debug) {
+		char our_addr_txt[50] = "";	/* hold a text IP */
+		char auth_addr_txt[50] = "";	/* hold a text IP */
+
+		getnameinfo(SA(&req->our_sockaddr), SS_LEN(&req->our_sockaddr),
+			    NULL, 0, our_addr_txt, sizeof(our_addr_txt),
+			    NI_NUMERICHOST);
+		getnameinfo(req->auth_addr->ai_addr, req->auth_addr->ai_addrlen,
+			    NULL, 0, auth_addr_txt, sizeof(auth_addr_txt),
+			    NI_NUMERICHOST);
+
+		DEBUG(LOG_ERR,
+		      "DEBUG: timeout=%.3f retries=%d local %s : 0, remote %s : %u\n",
+		      SEND_DATA_TIMEOUT(data), data->retries, our_addr_txt, auth_addr_txt,
+		      data->svc_port);
+	}
+
+	req->rt = SEND_DATA_TIMEOUT(data);
+	/* requests are not retransmitted over TCP */
+	if (rh->health != NULL && (req->tcp == NULL || rc_tcp_retransmits(req)) &&
+	    rc_health_rto(rh->health, data->server, data->svc_port,
+			  SEND_DATA_TIMEOUT(data), &req->rt, &req->mrt, &req->mrd)) {
+		if (req->mrd > 0 && req->rt > req->mrd)
+			req->rt = req->mrd;
+		req->seed = (unsigned)(uintptr_t)req ^
+			    (unsigned)(rc_getmtime() * 1000000);
+	}
+
+	result = request_transmit(req);
+
+ exit:
+	if (result != PENDING_RC)
+		return request_finish(req, result);
+
+	return result;
+}
+
+/** Returns the descriptor to wait on for the reply
+ *
+ * @param req the request.
+ * @return a file descriptor, or -1 if the request is not in progress.
+ */
+int rc_request_get_fd(RC_REQUEST * req)
+{
+	if (req->result != PENDING_RC)
+		return -1;
+	return req->sockfd;
+}
+
+/** Returns the time until rc_request_on_timeout() must be called
+ *
+ * @param req the request.
+ * @return the time in milliseconds, or -1 if the request is not in progress.
+ */
+int rc_request_get_timeout(RC_REQUEST * req)
+{
+	double left;
+
+	if (req->result != PENDING_RC || req->sockfd < 0)
+		return -1;
+
+	if (req->tcp != NULL && rc_tcp_delivered(req))
+		return 0;
+
+	left = (req->deadline - rc_getmtime()) * 1000;
+	if (left <= 0)
+		return 0;
+	return (int)left + 1;
+}
+
+/** Processes a readable request descriptor
+ *
+ * Replies which do not match the request are ignored.
+ *
+ * @param req the request.
+ * @return %PENDING_RC while the reply is awaited, or a final result as
+ *	returned by rc_send_server().
+ */
+int rc_request_on_readable(RC_REQUEST * req)
+{
+	const rc_sockets_override *sfuncs = &req->rh->so;
+	SEND_DATA *data = req->data;
+	struct sockaddr_storage from;
+	socklen_t salen;
+	int length;
+	int result;
+
+	if (req->result != PENDING_RC || req->sockfd < 0)
+		return req->result;
+
+	if (req->tcp != NULL) {
+		length = rc_tcp_receive(req);
+		if (length == 0)
+			return PENDING_RC;
+		if (length < 0) {
+			rc_log(LOG_ERR, "rc_send_server: connection to %s:%d failed",
+			       data->server, data->svc_port);
+			return request_finish(req, ERROR_RC);
+		}
+		/* replies are verified as they are read from the connection */
+		goto reply;
+	}
+
+	do {
+		salen = sizeof(from);
+		length = sfuncs->recvfrom(sfuncs->ptr, req->sockfd,
+					  (char *)req->recv_buffer,
+					  (int)sizeof(req->recv_buffer),
+					  MSG_DONTWAIT, SA(&from), &salen);
+	} while (length == -1 && errno == EINTR);
+
+	if (length == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return PENDING_RC;
+
+	if (length <= 0) {
+		rc_log(LOG_ERR, "rc_send_server: recvfrom: %s:%d: %s",
+		       data->server, data->svc_port, strerror(errno));
+		return request_finish(req, ERROR_RC);
+	}
+
+	result = rc_verify_reply(req->rh, data, req->recv_buffer, length,
+				 req->secret, req->vector);
+	if (result == BADRESPID_RC) {
+		/* if a message that doesn't match our ID was received, then ignore
+		 * it, and try to receive more, until timeout. That is because in
+		 * DTLS the channel is shared, and we may receive duplicates or
+		 * out-of-order packets. */
+		return PENDING_RC;
+	}
+
+	if (result != OK_RC) {
+		/* a malformed reply or one with an invalid authenticator */
+		return request_finish(req, result);
+	}
+
+ reply:
+	/* the exchange completed; the socket can serve another request */
+	req->replied = 1;
+
+	/* only a request sent once tells the round-trip time (Karn) */
+	if (req->mrt > 0 && req->retries == 0)
+		rc_health_rtt(req->rh->health, data->server, data->svc_port,
+			      rc_getmtime() - req->first_sent);
+
+	result = rc_decode_reply(req->rh, data, req->recv_buffer, req->msg);
+	return request_finish(req, result);
+}
+
+/** Processes an expired request timeout
+ *
+ * The request is retransmitted, or completed with %TIMEOUT_RC when
+ * its retries are exhausted. With the radius_rto option set to adaptive
+ * the timeout is backed off after each retransmission.
+ *
+ * @param req the request.
+ * @return %PENDING_RC while the reply is awaited, or a final result as
+ *	returned by rc_send_server().
+ */
+int rc_request_on_timeout(RC_REQUEST * req)
+{
+	SEND_DATA *data = req->data;
+
+	if (req->result != PENDING_RC || req->sockfd < 0)
+		return req->result;
+
+	if (req->tcp != NULL && rc_tcp_delivered(req))
+		return rc_request_on_readable(req);
+
+	if (rc_getmtime() < req->deadline)
+		return PENDING_RC;
+
+	/*
+	 * Timed out waiting for response.  Retry "retry_max" times
+	 * before giving up.  If retry_max = 0, don't retry at all.
+	 */
+	if (req->retries++ >= data->retries ||
+	    (req->expires > 0 && req->deadline >= req->expires) ||
+	    (req->mrt > 0 && request_backoff(req) < 0)) {
+		char radius_server_ip[128];
+		struct sockaddr_in *si =
+		    (struct sockaddr_in *)req->auth_addr->ai_addr;
+		inet_ntop(req->auth_addr->ai_family, &si->sin_addr,
+			  radius_server_ip, sizeof(radius_server_ip));
+		rc_log(LOG_ERR,
+		       "rc_send_server: no reply from RADIUS %s server %s:%u",
+		       data->code == PW_ACCOUNTING_REQUEST ? "acct" : "auth",
+		       radius_server_ip, data->svc_port);
+		return request_finish(req, TIMEOUT_RC);
+	}
+
+	if (req->tcp != NULL && !rc_tcp_retransmits(req)) {
+		/* RFC 6613: a request is never retransmitted on the same
+		 * connection; the retries extend the wait for its reply */
+		request_arm(req, rc_getmtime(), SEND_DATA_TIMEOUT(data));
+		return PENDING_RC;
 	}
- exit_error:
-	if (ns != NULL) {
-		if(-1 == rc_reset_netns(&ns_def_hdl)) {
-			rc_log(LOG_ERR, "rc_send_server: namespace %s reset failed", ns);
+
+	return request_transmit(req);
+}
+
+/** Returns the result of a request
+ *
+ * @param req the request.
+ * @return %PENDING_RC if the request has not completed, or its result as
+ *	returned by rc_send_server().
+ */
+int rc_request_get_result(RC_REQUEST * req)
+{
+	return req->result;
+}
+
+/** @} */
+
+/** Sends a request to a RADIUS server and waits for the reply
+ *
+ * @param rh a handle to parsed configuration
+ * @param ctx if non-NULL it will contain the context of sent request; It must be released using rc_aaa_ctx_free().
+ * @param data a pointer to a SEND_DATA structure
+ * @param msg must be an array of %PW_MAX_MSG_SIZE or NULL; will contain the concatenation of
+ *	any %PW_REPLY_MESSAGE received.
+ * @param type must be %AUTH or %ACCT
+ * @return OK_RC (0) on success, CHALLENGE_RC when an Access-Challenge
+ *  response is received, TIMEOUT_RC on timeout REJECT_RC on access reject,
+ *  or negative on failure as return value.
+ */
+int rc_send_server_ctx(rc_handle * rh, RC_AAA_CTX ** ctx, SEND_DATA * data,
+		       char *msg, rc_type type)
+{
+	return rc_send_server_until(rh, ctx, data, msg, type, 0);
+}
+
+/*- Sends a request to a RADIUS server and waits for the reply until a time
+ *
+ * This is rc_send_server_ctx() for a request which is given up at expires,
+ * as returned by rc_getmtime(), even if retries remain; zero sets no limit.
+ -*/
+int rc_send_server_until(rc_handle * rh, RC_AAA_CTX ** ctx, SEND_DATA * data,
+			 char *msg, rc_type type, double expires)
+{
+	const rc_sockets_override *sfuncs = &rh->so;
+	RC_REQUEST req;
+	struct pollfd pfd;
+	int result, ret;
+
+	rc_request_init(&req, rh, data, msg, type);
+	rc_request_set_expiry(&req, expires);
+
+	result = rc_request_start(&req);
+	while (result == PENDING_RC) {
+		if (req.tcp != NULL) {
+			ret = rc_tcp_wait(&req, rc_request_get_timeout(&req));
+		} else if (sfuncs->wait_fd) {
+			ret = sfuncs->wait_fd(sfuncs->ptr, req.sockfd,
+					      rc_request_get_timeout(&req));
+		} else {
+			pfd.fd = req.sockfd;
+			pfd.events = POLLIN;
+			pfd.revents = 0;
+			ret = poll(&pfd, 1, rc_request_get_timeout(&req));
+		}
+
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			rc_log(LOG_ERR, "rc_send_server: poll: %s",
+			       strerror(errno));
 			result = ERROR_RC;
+			break;
 		}
+
+		if (ret > 0)
+			result = rc_request_on_readable(&req);
+		else
+			result = rc_request_on_timeout(&req);
 	}
 
+	if (req.replied && rc_request_get_ctx(&req, ctx) != OK_RC)
+		result = ERROR_RC;
+
+	rc_request_deinit(&req);
 	return result;
 }
@@ -0,0 +1,98 @@
+/*
+ * sendserver.h	Internal request packing and reply verification helpers.
+ *
+ * License:	BSD
+ *
+ */
+
+#ifndef SENDSERVER_H
+# define SENDSERVER_H
+
+#include <includes.h>
+
+void rc_fill_nas_attrs(rc_handle *rh, SEND_DATA *data,
+		       struct sockaddr_storage *our_sockaddr);
+int rc_pack_request(rc_handle *rh, SEND_DATA *data, char *secret,
+		    AUTH_HDR *auth, unsigned char *vector);
+int rc_verify_reply(rc_handle *rh, SEND_DATA *data, uint8_t *recv_buffer,
+		    int length, char const *secret, unsigned char const *vector);
+
+/* a request packed by rc_pack_request_unsigned(), to be signed */
+typedef struct rc_sign_job {
+	AUTH_HDR *auth;
+	int length;
+	char const *secret;
+	unsigned char *vector;	/* the request authenticator */
+} rc_sign_job;
+
+int rc_pack_request_unsigned(rc_handle *rh, SEND_DATA *data, char *secret,
+			     AUTH_HDR *auth, unsigned char *vector);
+void rc_sign_requests(rc_handle *rh, rc_sign_job *jobs, unsigned n);
+
+/* a reply verified by rc_verify_replies() */
+typedef struct rc_reply_check {
+	SEND_DATA *data;
+	uint8_t *buf;		/* of %RC_BUFFER_LEN size */
+	int length;
+	char const *secret;
+	unsigned char const *vector;
+	int result;		/* as returned by rc_verify_reply() */
+} rc_reply_check;
+
+void rc_verify_replies(rc_handle *rh, rc_reply_check *checks, unsigned n);
+int rc_decode_reply(rc_handle *rh, SEND_DATA *data, uint8_t *recv_buffer,
+		    char *msg);
+int rc_resolve_server(rc_handle *rh, SEND_DATA *data, rc_type type,
+		      char *secret, struct addrinfo **auth_addr);
+
+/* the timeout of a request in seconds */
+#define SEND_DATA_TIMEOUT(d) \
+	((d)->timeout_ms > 0 ? (d)->timeout_ms / 1000.0 : (double)(d)->timeout)
+
+/* the state of a request started with rc_request_start() */
+struct rc_request_st {
+	rc_handle *rh;
+	SEND_DATA *data;
+	char *msg;
+	rc_type type;
+	int result;		/* PENDING_RC until the request completes */
+
+	int sockfd;
+	unsigned connected;	/* sockfd is connected to the server */
+	unsigned locked;	/* the transport lock is held */
+	unsigned replied;	/* a verified reply was received */
+	struct sockaddr_storage our_sockaddr;
+	struct addrinfo *auth_addr;
+	char secret[MAX_SECRET_LENGTH + 1];
+	unsigned char vector[AUTH_VECTOR_LEN];
+
+	int total_length;
+	int retries;
+	double deadline;
+
+	/* retransmission timing; mrt is zero unless radius_rto is adaptive */
+	double rt;		/* the current retransmission timeout */
+	double mrt;
+	double mrd;
+	double first_sent;
+	unsigned seed;		/* for the jitter of the timeouts */
+	double expires;		/* if non-zero, the request is given up then */
+
+	/* set when the request is pipelined on a TCP connection; see tcpmux.c */
+	struct rc_tcp_conn *tcp;
+	int recv_length;	/* length of the reply read for us, or -1 on failure */
+
+	/* not cleared on initialization */
+	uint8_t send_buffer[RC_BUFFER_LEN];
+	uint8_t recv_buffer[RC_BUFFER_LEN];
+};
+
+void rc_request_init(RC_REQUEST *req, rc_handle *rh, SEND_DATA *data,
+		     char *msg, rc_type type);
+void rc_request_deinit(RC_REQUEST *req);
+int rc_request_get_ctx(RC_REQUEST *req, RC_AAA_CTX **ctx);
+void rc_request_set_expiry(RC_REQUEST *req, double expires);
+int rc_send_server_until(rc_handle *rh, RC_AAA_CTX **ctx, SEND_DATA *data,
+			 char *msg, rc_type type, double expires);
+
+#endif /* SENDSERVER_H */
@@ -0,0 +1,352 @@
+/*
+ * sockpool.c	Pool of long-lived UDP sockets, shared by the requests of
+ *		a handle.
+ *
+ * License:	BSD
+ *
+ */
+
+#include <config.h>
+#include <includes.h>
+#include <radcli/radcli.h>
+#include <pthread.h>
+#include <sched.h>
+#include "util.h"
+#if defined(__linux__)
+#include <linux/in6.h>
+#endif
+#include "sockpool.h"
+#include "netns.h"
+
+/* the maximum number of stale datagrams discarded when borrowing a socket */
+#define MAX_DRAIN 64
+
+/* the pid of a pool while the child of a fork() resets it */
+#define POOL_PID_RESETTING	((pid_t)-1)
+
+typedef struct sockpool_bucket {
+	struct sockaddr_storage local;
+	struct sockaddr_storage remote;
+	unsigned nfds;
+	struct sockpool_bucket *next;
+	int fds[];
+} sockpool_bucket;
+
+struct rc_sockpool {
+	pthread_mutex_t lock;
+	unsigned size;		/* idle sockets kept per bucket */
+	unsigned do_connect;
+	int rcvbuf;
+	int sndbuf;
+	pid_t pid;		/* the process the idle sockets belong to */
+	sockpool_bucket *buckets;
+};
+
+/*- Creates a socket pool
+ *
+ * @param size the number of idle sockets kept per local and server address.
+ * @param do_connect if non-zero the sockets are connected to the server.
+ * @param rcvbuf the SO_RCVBUF size of new sockets; zero for the system default.
+ * @param sndbuf the SO_SNDBUF size of new sockets; zero for the system default.
+ * @return the pool, or NULL on failure.
+ -*/
+struct rc_sockpool *rc_sockpool_new(unsigned size, unsigned do_connect,
+				    int rcvbuf, int sndbuf)
+{
+	struct rc_sockpool *pool;
+
+	pool = calloc(1, sizeof(*pool));
+	if (pool == NULL) {
+		rc_log(LOG_CRIT, "%s: out of memory", __func__);
+		return NULL;
+	}
+
+	if (pthread_mutex_init(&pool->lock, NULL) != 0) {
+		free(pool);
+		return NULL;
+	}
+
+	pool->size = size;
+	pool->do_connect = do_connect;
+	pool->rcvbuf = rcvbuf;
+	pool->sndbuf = sndbuf;
+	pool->pid = getpid();
+	return pool;
+}
+
+/*- Takes over a pool inherited over fork()
+ *
+ * The idle sockets are shared with the parent, which would receive the
+ * replies to the requests of the child, so they are closed in the child
+ * and its requests start with sockets of their own. The lock is
+ * initialized again, and the other threads of the child wait until the
+ * first one is done.
+ -*/
+static void pool_after_fork(rc_handle *rh, struct rc_sockpool *pool)
+{
+	pid_t pid = getpid();
+	pid_t owner = __atomic_load_n(&pool->pid, __ATOMIC_ACQUIRE);
+	sockpool_bucket *b, *next;
+	unsigned i;
+
+	if (owner == pid)
+		return;
+
+	if (owner == POOL_PID_RESETTING ||
+	    !__atomic_compare_exchange_n(&pool->pid, &owner, POOL_PID_RESETTING,
+					 0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+		while (__atomic_load_n(&pool->pid, __ATOMIC_ACQUIRE) != pid)
+			sched_yield();
+		return;
+	}
+
+	pthread_mutex_init(&pool->lock, NULL);
+
+	for (b = pool->buckets; b != NULL; b = next) {
+		next = b->next;
+		for (i = 0; i < b->nfds; i++) {
+			if (rh->so.close_fd)
+				rh->so.close_fd(b->fds[i]);
+		}
+		free(b);
+	}
+	pool->buckets = NULL;
+
+	__atomic_store_n(&pool->pid, pid, __ATOMIC_RELEASE);
+}
+
+/*- Closes all idle sockets and releases the pool
+ -*/
+void rc_sockpool_free(rc_handle *rh, struct rc_sockpool *pool)
+{
+	sockpool_bucket *b, *next;
+	unsigned i;
+
+	if (pool == NULL)
+		return;
+
+	pool_after_fork(rh, pool);
+
+	for (b = pool->buckets; b != NULL; b = next) {
+		next = b->next;
+		for (i = 0; i < b->nfds; i++) {
+			if (rh->so.close_fd)
+				rh->so.close_fd(b->fds[i]);
+		}
+		free(b);
+	}
+
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
+
+static void make_key(struct sockaddr_storage *local,
+		     struct sockaddr_storage *remote,
+		     const struct sockaddr_storage *our_sockaddr,
+		     const struct sockaddr *dest, socklen_t destlen)
+{
+	memset(local, 0, sizeof(*local));
+	memset(remote, 0, sizeof(*remote));
+
+	memcpy(local, our_sockaddr, SS_LEN(our_sockaddr));
+	if (local->ss_family == AF_INET)
+		((struct sockaddr_in *)local)->sin_port = 0;
+	else
+		((struct sockaddr_in6 *)local)->sin6_port = 0;
+
+	memcpy(remote, dest, RC_MIN(destlen, sizeof(*remote)));
+}
+
+static sockpool_bucket *find_bucket(struct rc_sockpool *pool,
+				    const struct sockaddr_storage *local,
+				    const struct sockaddr_storage *remote)
+{
+	sockpool_bucket *b;
+
+	for (b = pool->buckets; b != NULL; b = b->next) {
+		if (memcmp(&b->local, local, sizeof(*local)) == 0 &&
+		    memcmp(&b->remote, remote, sizeof(*remote)) == 0)
+			return b;
+	}
+	return NULL;
+}
+
+/*- Discards any datagrams or errors queued on an idle socket
+ -*/
+static void drain_socket(int sockfd)
+{
+	uint8_t buffer[RC_BUFFER_LEN];
+	unsigned i;
+	ssize_t ret;
+
+	for (i = 0; i < MAX_DRAIN; i++) {
+		ret = recv(sockfd, buffer, sizeof(buffer), MSG_DONTWAIT);
+		if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+	}
+}
+
+static int setup_socket(rc_handle *rh, int sockfd,
+			struct sockaddr_storage *our_sockaddr)
+{
+	if (our_sockaddr->ss_family == AF_INET6) {
+		/* Check for IPv6 non-temporary address support */
+		char *non_temp_addr = rc_conf_str(rh, "use-public-addr");
+		if (non_temp_addr && (strcasecmp(non_temp_addr, "true") == 0)) {
+#if defined(__linux__)
+			int sock_opt = IPV6_PREFER_SRC_PUBLIC;
+			if (setsockopt(sockfd, IPPROTO_IPV6, IPV6_ADDR_PREFERENCES,
+					&sock_opt, sizeof(sock_opt)) != 0) {
+				rc_log(LOG_ERR, "rc_send_server: setsockopt: %s",
+					strerror(errno));
+				return -1;
+			}
+#elif defined(BSD) || defined(__APPLE__)
+			int sock_opt = 0;
+			if (setsockopt(sockfd, IPPROTO_IPV6, IPV6_PREFER_TEMPADDR,
+				&sock_opt, sizeof(sock_opt)) != 0) {
+				rc_log(LOG_ERR, "rc_send_server: setsockopt: %s",
+					strerror(errno));
+				return -1;
+			}
+#else
+			rc_log(LOG_INFO, "rc_send_server: Usage of non-temporary IPv6"
+					" address is not supported in this system");
+#endif
+		}
+	}
+	return 0;
+}
+
+/*- Borrows a socket for a request to a server
+ *
+ * An idle socket of the handle's pool is returned when available;
+ * otherwise a new one is created using the handle's socket functions.
+ * Sockets which are not pooled are created as before. The idle sockets
+ * inherited over fork() are not used by the child.
+ *
+ * @param rh a handle to parsed configuration.
+ * @param our_sockaddr the local address to bind to.
+ * @param dest the server address.
+ * @param destlen the length of dest.
+ * @param connected will be set to non-zero if the socket is connected to dest.
+ * @return the socket, or -1 on failure.
+ -*/
+int rc_sockpool_get(rc_handle *rh, struct sockaddr_storage *our_sockaddr,
+		    const struct sockaddr *dest, socklen_t destlen,
+		    unsigned *connected)
+{
+	struct rc_sockpool *pool = rh->sockpool;
+	struct sockaddr_storage local, remote;
+	sockpool_bucket *b;
+	int sockfd = -1;
+
+	*connected = 0;
+
+	if (pool != NULL && pool->size > 0) {
+		pool_after_fork(rh, pool);
+		make_key(&local, &remote, our_sockaddr, dest, destlen);
+
+		pthread_mutex_lock(&pool->lock);
+		b = find_bucket(pool, &local, &remote);
+		if (b != NULL && b->nfds > 0)
+			sockfd = b->fds[--b->nfds];
+		pthread_mutex_unlock(&pool->lock);
+
+		if (sockfd >= 0) {
+			drain_socket(sockfd);
+			*connected = pool->do_connect;
+			return sockfd;
+		}
+	}
+
+	if (rh->so.get_fd == NULL)
+		return -1;
+
+	sockfd = rc_netns_get_fd(rh, SA(our_sockaddr));
+	if (sockfd < 0)
+		return -1;
+
+	if (setup_socket(rh, sockfd, our_sockaddr) < 0)
+		goto fail;
+
+	if (pool == NULL)
+		return sockfd;
+
+	if (pool->rcvbuf > 0 &&
+	    setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &pool->rcvbuf,
+		       sizeof(pool->rcvbuf)) != 0)
+		rc_log(LOG_WARNING, "%s: cannot set SO_RCVBUF: %s", __func__,
+		       strerror(errno));
+
+	if (pool->sndbuf > 0 &&
+	    setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &pool->sndbuf,
+		       sizeof(pool->sndbuf)) != 0)
+		rc_log(LOG_WARNING, "%s: cannot set SO_SNDBUF: %s", __func__,
+		       strerror(errno));
+
+	if (pool->do_connect) {
+		if (connect(sockfd, dest, destlen) != 0) {
+			rc_log(LOG_ERR, "%s: connect: %s", __func__,
+			       strerror(errno));
+			goto fail;
+		}
+		*connected = 1;
+	}
+
+	return sockfd;
+
+ fail:
+	if (rh->so.close_fd)
+		rh->so.close_fd(sockfd);
+	return -1;
+}
+
+/*- Returns a borrowed socket
+ *
+ * @param rh a handle to parsed configuration.
+ * @param sockfd the socket returned by rc_sockpool_get().
+ * @param our_sockaddr the local address given to rc_sockpool_get().
+ * @param dest the server address given to rc_sockpool_get().
+ * @param destlen the length of dest.
+ * @param reuse non-zero if the socket is in a clean state and may be
+ *	given to another request; otherwise it is closed.
+ -*/
+void rc_sockpool_put(rc_handle *rh, int sockfd,
+		     const struct sockaddr_storage *our_sockaddr,
+		     const struct sockaddr *dest, socklen_t destlen,
+		     unsigned reuse)
+{
+	struct rc_sockpool *pool = rh->sockpool;
+	struct sockaddr_storage local, remote;
+	sockpool_bucket *b;
+
+	if (sockfd < 0)
+		return;
+
+	if (reuse && pool != NULL && pool->size > 0) {
+		pool_after_fork(rh, pool);
+		make_key(&local, &remote, our_sockaddr, dest, destlen);
+
+		pthread_mutex_lock(&pool->lock);
+		b = find_bucket(pool, &local, &remote);
+		if (b == NULL) {
+			b = calloc(1, sizeof(*b) + pool->size * sizeof(int));
+			if (b != NULL) {
+				b->local = local;
+				b->remote = remote;
+				b->next = pool->buckets;
+				pool->buckets = b;
+			}
+		}
+
+		if (b != NULL && b->nfds < pool->size) {
+			b->fds[b->nfds++] = sockfd;
+			sockfd = -1;
+		}
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	if (sockfd >= 0 && rh->so.close_fd)
+		rh->so.close_fd(sockfd);
+}
@@ -0,0 +1,27 @@
+/*
+ * sockpool.h	Internal pool of long-lived UDP sockets.
+ *
+ * License:	BSD
+ *
+ */
+#ifndef SOCKPOOL_H
+# define SOCKPOOL_H
+
+#include <includes.h>
+
+/* the number of idle sockets kept per server unless configured */
+#define RC_SOCKPOOL_DEFAULT_SIZE 4
+
+struct rc_sockpool *rc_sockpool_new(unsigned size, unsigned do_connect,
+				    int rcvbuf, int sndbuf);
+void rc_sockpool_free(rc_handle *rh, struct rc_sockpool *pool);
+
+int rc_sockpool_get(rc_handle *rh, struct sockaddr_storage *our_sockaddr,
+		    const struct sockaddr *dest, socklen_t destlen,
+		    unsigned *connected);
+void rc_sockpool_put(rc_handle *rh, int sockfd,
+		     const struct sockaddr_storage *our_sockaddr,
+		     const struct sockaddr *dest, socklen_t destlen,
+		     unsigned reuse);
+
+#endif /* SOCKPOOL_H */
@@ -0,0 +1,335 @@
+/*
+ * srcaddr.c	Cache of the source addresses used towards the servers,
+ *		shared by the requests of a handle.
+ *
+ * When bindaddr is unset, the address put in NAS-IP-Address is the one
+ * the system routes the request from, which rc_get_srcaddr() finds with
+ * a connected socket. It is kept per server address for the time set
+ * with srcaddr-cache-ttl. On Linux the cache is also emptied whenever a
+ * netlink message reports a change of the addresses or routes; the
+ * messages are read at most every SRCADDR_POLL_INTERVAL seconds rather
+ * than on every lookup. Both the lookups and the netlink socket are in
+ * the network namespace of the handle, and the child of a fork() opens
+ * a netlink socket of its own.
+ *
+ * License:	BSD
+ *
+ */
+
+#include <config.h>
+#include <includes.h>
+#include <radcli/radcli.h>
+#include <pthread.h>
+#include <sched.h>
+#include "util.h"
+#include "srcaddr.h"
+#include "netns.h"
+
+#ifdef HAVE_LINUX_RTNETLINK_H
+# include <linux/netlink.h>
+# include <linux/rtnetlink.h>
+#endif
+
+/* the number of server addresses kept; the oldest entry is replaced */
+#define SRCADDR_CACHE_SIZE 32
+
+/* the seconds between reads of the netlink notifications */
+#define SRCADDR_POLL_INTERVAL 1
+
+/* the pid of a cache while the child of a fork() resets it */
+#define SRCADDR_PID_RESETTING	((pid_t)-1)
+
+typedef struct srcaddr_entry {
+	struct sockaddr_storage dest;	/* the port is not compared */
+	struct sockaddr_storage src;	/* with a zero port */
+	double expires;			/* zero for an unused entry */
+} srcaddr_entry;
+
+struct rc_srcaddr_cache {
+	pthread_mutex_t lock;
+	unsigned ttl;		/* zero when nothing is cached */
+	struct rc_netns *netns;
+	int nlfd;		/* netlink socket notified of changes, or -1 */
+	pid_t pid;		/* the process nlfd belongs to */
+	double polled;		/* when the notifications were last read */
+	unsigned generation;	/* incremented when the cache is emptied */
+	srcaddr_entry entries[SRCADDR_CACHE_SIZE];
+};
+
+/*- Opens a netlink socket notified of changes to the addresses and routes
+ -*/
+static int open_netlink(void)
+{
+#ifdef HAVE_LINUX_RTNETLINK_H
+	struct sockaddr_nl snl;
+	int fd;
+
+	fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+	if (fd == -1)
+		return -1;
+
+	memset(&snl, 0, sizeof(snl));
+	snl.nl_family = AF_NETLINK;
+	snl.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR |
+			RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE;
+	if (bind(fd, (struct sockaddr *)&snl, sizeof(snl)) == -1 ||
+	    fcntl(fd, F_SETFL, O_NONBLOCK) == -1 ||
+	    fcntl(fd, F_SETFD, FD_CLOEXEC) == -1) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+#else
+	return -1;
+#endif
+}
+
+/*- Creates a cache of source addresses
+ *
+ * @param ttl the time in seconds a source address is used, or zero to
+ *	find it on every request.
+ * @param netns the namespace of the sockets, or NULL.
+ * @return the cache, or NULL on failure.
+ -*/
+struct rc_srcaddr_cache *rc_srcaddr_cache_new(unsigned ttl,
+					      struct rc_netns *netns)
+{
+	struct rc_srcaddr_cache *cache;
+
+	cache = calloc(1, sizeof(*cache));
+	if (cache == NULL) {
+		rc_log(LOG_CRIT, "%s: out of memory", __func__);
+		return NULL;
+	}
+
+	if (pthread_mutex_init(&cache->lock, NULL) != 0) {
+		free(cache);
+		return NULL;
+	}
+
+	cache->ttl = ttl;
+	cache->netns = netns;
+	cache->nlfd = -1;
+	cache->pid = getpid();
+	if (ttl == 0)
+		return cache;
+
+	if (rc_netns_enter(netns) == 0) {
+		cache->nlfd = open_netlink();
+		rc_netns_leave(netns);
+	}
+	if (cache->nlfd == -1)
+		DEBUG(LOG_INFO, "source addresses are not invalidated by route changes");
+
+	return cache;
+}
+
+/*- Forgets the cached source addresses
+ -*/
+static void flush(struct rc_srcaddr_cache *cache)
+{
+	unsigned i;
+
+	DEBUG(LOG_INFO, "forgetting the source addresses");
+	for (i = 0; i < SRCADDR_CACHE_SIZE; i++)
+		cache->entries[i].expires = 0;
+	cache->generation++;
+}
+
+/*- Takes over a cache inherited over fork()
+ *
+ * The netlink socket is shared with the parent, which would consume the
+ * notifications meant for the child, so the child opens its own. The
+ * lock is initialized again, and the other threads of the child wait
+ * until the first one is done.
+ -*/
+static void cache_after_fork(struct rc_srcaddr_cache *cache)
+{
+	pid_t pid = getpid();
+	pid_t owner = __atomic_load_n(&cache->pid, __ATOMIC_ACQUIRE);
+
+	if (owner == pid)
+		return;
+
+	if (owner == SRCADDR_PID_RESETTING ||
+	    !__atomic_compare_exchange_n(&cache->pid, &owner, SRCADDR_PID_RESETTING,
+					 0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+		while (__atomic_load_n(&cache->pid, __ATOMIC_ACQUIRE) != pid)
+			sched_yield();
+		return;
+	}
+
+	pthread_mutex_init(&cache->lock, NULL);
+
+	if (cache->nlfd != -1) {
+		close(cache->nlfd);
+		cache->nlfd = -1;
+		if (rc_netns_enter(cache->netns) == 0) {
+			cache->nlfd = open_netlink();
+			rc_netns_leave(cache->netns);
+		}
+		if (cache->nlfd == -1)
+			DEBUG(LOG_INFO, "source addresses are not invalidated by route changes");
+	}
+
+	/* changes may have been consumed by the parent since */
+	cache->polled = 0;
+	flush(cache);
+
+	__atomic_store_n(&cache->pid, pid, __ATOMIC_RELEASE);
+}
+
+/*- Releases a cache of source addresses
+ -*/
+void rc_srcaddr_cache_free(struct rc_srcaddr_cache *cache)
+{
+	if (cache == NULL)
+		return;
+
+	cache_after_fork(cache);
+
+	if (cache->nlfd != -1)
+		close(cache->nlfd);
+	pthread_mutex_destroy(&cache->lock);
+	free(cache);
+}
+
+/*- Returns whether the addresses or routes changed since the last read
+ *
+ * The pending notifications are consumed; a lost one counts as a change.
+ * They are read at most every SRCADDR_POLL_INTERVAL seconds.
+ -*/
+static int routes_changed(struct rc_srcaddr_cache *cache, double now)
+{
+	char buf[4096];
+	ssize_t ret;
+	int changed = 0;
+
+	if (cache->nlfd == -1 || now - cache->polled < SRCADDR_POLL_INTERVAL)
+		return 0;
+	cache->polled = now;
+
+	for (;;) {
+		ret = recv(cache->nlfd, buf, sizeof(buf), MSG_DONTWAIT);
+		if (ret > 0) {
+			changed = 1;
+			continue;
+		}
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret == -1 && errno == ENOBUFS)
+			changed = 1;
+		else
+			break;
+	}
+
+	return changed;
+}
+
+/*- Returns whether two addresses are the same, regardless of their port
+ -*/
+static int same_addr(const struct sockaddr_storage *a, const struct sockaddr *b)
+{
+	if (a->ss_family != b->sa_family)
+		return 0;
+
+	if (b->sa_family == AF_INET)
+		return memcmp(&((struct sockaddr_in *)a)->sin_addr,
+			      &((struct sockaddr_in *)b)->sin_addr,
+			      sizeof(struct in_addr)) == 0;
+
+	if (b->sa_family == AF_INET6)
+		return memcmp(&((struct sockaddr_in6 *)a)->sin6_addr,
+			      &((struct sockaddr_in6 *)b)->sin6_addr,
+			      sizeof(struct in6_addr)) == 0 &&
+		       ((struct sockaddr_in6 *)a)->sin6_scope_id ==
+		       ((struct sockaddr_in6 *)b)->sin6_scope_id;
+
+	return 0;
+}
+
+/*- Finds the source address towards a destination in the namespace
+ -*/
+static int get_srcaddr(struct rc_srcaddr_cache *cache, struct sockaddr *lia,
+		       const struct sockaddr *ria)
+{
+	int result;
+
+	if (rc_netns_enter(cache->netns) < 0)
+		return ERROR_RC;
+
+	result = rc_get_srcaddr(lia, ria);
+
+	if (rc_netns_leave(cache->netns) < 0)
+		return ERROR_RC;
+
+	return result;
+}
+
+/*- Finds the source address towards a destination, using the cache
+ *
+ * @param cache the cache, or NULL to always ask the system.
+ * @param[out] lia local address.
+ * @param[in]  ria the remote address.
+ * @return as rc_get_srcaddr().
+ -*/
+int rc_srcaddr_lookup(struct rc_srcaddr_cache *cache, struct sockaddr *lia,
+		      const struct sockaddr *ria)
+{
+	srcaddr_entry *e, *victim = NULL;
+	double now;
+	unsigned i, generation;
+	int result;
+
+	if (cache == NULL)
+		return rc_get_srcaddr(lia, ria);
+
+	if (cache->ttl == 0 ||
+	    (ria->sa_family != AF_INET && ria->sa_family != AF_INET6))
+		return get_srcaddr(cache, lia, ria);
+
+	cache_after_fork(cache);
+
+	pthread_mutex_lock(&cache->lock);
+	now = rc_getmtime();
+	if (routes_changed(cache, now))
+		flush(cache);
+	generation = cache->generation;
+
+	for (i = 0; i < SRCADDR_CACHE_SIZE; i++) {
+		e = &cache->entries[i];
+		if (e->expires > now && same_addr(&e->dest, ria)) {
+			memcpy(lia, &e->src, SS_LEN(&e->src));
+			pthread_mutex_unlock(&cache->lock);
+			return OK_RC;
+		}
+		if (victim == NULL || e->expires < victim->expires)
+			victim = e;
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	result = get_srcaddr(cache, lia, ria);
+	if (result != OK_RC)
+		return result;
+
+	/* the port of the temporary socket is of no use */
+	if (lia->sa_family == AF_INET)
+		((struct sockaddr_in *)lia)->sin_port = 0;
+	else if (lia->sa_family == AF_INET6)
+		((struct sockaddr_in6 *)lia)->sin6_port = 0;
+
+	/* the address found may predate a change reported meanwhile */
+	pthread_mutex_lock(&cache->lock);
+	now = rc_getmtime();
+	if (routes_changed(cache, now))
+		flush(cache);
+	if (cache->generation == generation) {
+		memcpy(&victim->dest, ria, SA_LEN(ria));
+		memcpy(&victim->src, lia, SA_LEN(lia));
+		victim->expires = rc_getmtime() + cache->ttl;
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	return OK_RC;
+}
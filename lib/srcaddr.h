@@ -0,0 +1,23 @@
+/*
+ * srcaddr.h	Internal cache of the source addresses used towards the
+ *		servers, shared by the requests of a handle.
+ *
+ * License:	BSD
+ *
+ */
+#ifndef SRCADDR_H
+# define SRCADDR_H
+
+#include <includes.h>
+
+/* the time in seconds a discovered source address is used */
+#define RC_SRCADDR_DEFAULT_TTL	60
+
+struct rc_srcaddr_cache *rc_srcaddr_cache_new(unsigned ttl,
+					       struct rc_netns *netns);
+void rc_srcaddr_cache_free(struct rc_srcaddr_cache *cache);
+
+int rc_srcaddr_lookup(struct rc_srcaddr_cache *cache, struct sockaddr *lia,
+		      const struct sockaddr *ria);
+
+#endif /* SRCADDR_H */
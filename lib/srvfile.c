@@ -0,0 +1,367 @@
+/*
+ * srvfile.c	Index of the secrets in the servers file, shared by the
+ *		requests of a handle.
+ *
+ * The servers file is read once, and the addresses of its hosts are
+ * resolved and kept in a hash table, so that the secret of a server is
+ * found without reading the file. The file is read again when its
+ * modification time, size or inode change, and, if it names hosts
+ * rather than addresses, once their addresses are older than the time
+ * to live of the index. The names are resolved in the network namespace
+ * of the handle.
+ *
+ * License:	BSD
+ *
+ */
+
+#include <config.h>
+#include <includes.h>
+#include <radcli/radcli.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "util.h"
+#include "srvfile.h"
+#include "netns.h"
+
+/* a file modified this recently may change again within the same second,
+ * unnoticed by its modification time */
+#define MTIME_GRANULARITY 2
+
+typedef struct srv_entry {
+	uint8_t addr[16];
+	unsigned len;
+	unsigned line;		/* the line of the file it was read from */
+	char *secret;
+	int next;		/* the next entry in the bucket, or -1 */
+} srv_entry;
+
+struct rc_servers_file {
+	pthread_rwlock_t lock;
+	unsigned ttl;
+	struct rc_netns *netns;
+
+	/* the file the index was read from */
+	char *path;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+	double expires;		/* when it is read again; zero for never */
+
+	srv_entry *entries;
+	unsigned nentries;
+	unsigned size_entries;
+	int *buckets;
+	unsigned nbuckets;	/* a power of two */
+};
+
+/*- Creates an empty index of the servers file
+ *
+ * @param ttl the time in seconds the resolved addresses of the hosts in
+ *	the file are used before it is read again.
+ * @param netns the namespace to resolve the names in, or NULL.
+ * @return the index, or NULL on failure.
+ -*/
+struct rc_servers_file *rc_servers_file_new(unsigned ttl, struct rc_netns *netns)
+{
+	struct rc_servers_file *sf;
+
+	sf = calloc(1, sizeof(*sf));
+	if (sf == NULL) {
+		rc_log(LOG_CRIT, "%s: out of memory", __func__);
+		return NULL;
+	}
+
+	if (pthread_rwlock_init(&sf->lock, NULL) != 0) {
+		free(sf);
+		return NULL;
+	}
+
+	sf->ttl = ttl;
+	sf->netns = netns;
+	return sf;
+}
+
+static void clear_index(struct rc_servers_file *sf)
+{
+	unsigned i;
+
+	for (i = 0; i < sf->nentries; i++) {
+		memset(sf->entries[i].secret, 0, strlen(sf->entries[i].secret));
+		free(sf->entries[i].secret);
+	}
+	free(sf->entries);
+	free(sf->buckets);
+	free(sf->path);
+
+	sf->entries = NULL;
+	sf->nentries = sf->size_entries = 0;
+	sf->buckets = NULL;
+	sf->nbuckets = 0;
+	sf->path = NULL;
+}
+
+/*- Releases an index of the servers file
+ -*/
+void rc_servers_file_free(struct rc_servers_file *sf)
+{
+	if (sf == NULL)
+		return;
+
+	clear_index(sf);
+	pthread_rwlock_destroy(&sf->lock);
+	free(sf);
+}
+
+static unsigned hash_addr(const uint8_t *addr, unsigned len)
+{
+	unsigned h = 2166136261u;	/* FNV-1a */
+	unsigned i;
+
+	for (i = 0; i < len; i++) {
+		h ^= addr[i];
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+/*- Returns the entry of an address, or NULL
+ -*/
+static srv_entry *find_entry(struct rc_servers_file *sf, const uint8_t *addr,
+			     unsigned len)
+{
+	srv_entry *e;
+	int i;
+
+	if (sf->nbuckets == 0)
+		return NULL;
+
+	i = sf->buckets[hash_addr(addr, len) & (sf->nbuckets - 1)];
+	for (; i >= 0; i = e->next) {
+		e = &sf->entries[i];
+		if (e->len == len && memcmp(e->addr, addr, len) == 0)
+			return e;
+	}
+
+	return NULL;
+}
+
+/*- Adds the addresses of a host to the index
+ *
+ * An address already in the index keeps the secret of its first line.
+ *
+ * @return 0 on success, or -1 when out of memory.
+ -*/
+static int add_host(struct rc_servers_file *sf, const struct addrinfo *info,
+		    char const *secret, unsigned line)
+{
+	const struct addrinfo *p;
+	srv_entry *e;
+	unsigned len;
+
+	for (p = info; p != NULL; p = p->ai_next) {
+		len = SA_GET_INLEN(p->ai_addr);
+		if (find_entry(sf, SA_GET_INADDR(p->ai_addr), len) != NULL)
+			continue;
+
+		if (sf->nentries == sf->size_entries) {
+			sf->size_entries = sf->size_entries ? 2 * sf->size_entries : 64;
+			e = realloc(sf->entries, sf->size_entries * sizeof(*e));
+			if (e == NULL)
+				return -1;
+			sf->entries = e;
+		}
+
+		e = &sf->entries[sf->nentries];
+		memcpy(e->addr, SA_GET_INADDR(p->ai_addr), len);
+		e->len = len;
+		e->line = line;
+		e->secret = strdup(secret);
+		if (e->secret == NULL)
+			return -1;
+		sf->nentries++;
+
+		/* the table is kept at most half full */
+		if (2 * sf->nentries > sf->nbuckets) {
+			unsigned i, b, n = sf->nbuckets ? 2 * sf->nbuckets : 128;
+			int *buckets = malloc(n * sizeof(int));
+
+			if (buckets == NULL)
+				return -1;
+			free(sf->buckets);
+			sf->buckets = buckets;
+			sf->nbuckets = n;
+			for (i = 0; i < n; i++)
+				buckets[i] = -1;
+			for (i = 0; i < sf->nentries; i++) {
+				b = hash_addr(sf->entries[i].addr, sf->entries[i].len) & (n - 1);
+				sf->entries[i].next = buckets[b];
+				buckets[b] = i;
+			}
+		} else {
+			unsigned b = hash_addr(e->addr, len) & (sf->nbuckets - 1);
+
+			e->next = sf->buckets[b];
+			sf->buckets[b] = sf->nentries - 1;
+		}
+	}
+
+	return 0;
+}
+
+/*- Returns whether a host is an address in numeric form
+ -*/
+static int is_numeric(char const *host)
+{
+	struct in6_addr a;
+
+	return inet_pton(AF_INET, host, &a) == 1 ||
+	       inet_pton(AF_INET6, host, &a) == 1;
+}
+
+/*- Reads the servers file into the index; called with the write lock held
+ *
+ * Each line holds a host and its secret. A host in the <name1>/<name2>
+ * form is indexed by its first name.
+ *
+ * @return 0 on success, or -1 on failure.
+ -*/
+static int load_index(struct rc_servers_file *sf, char const *path,
+		      const struct stat *st)
+{
+	FILE *clientfd;
+	char buffer[128];
+	char hostnm[AUTH_ID_LEN + 1];
+	char *h, *s, *buffer_save, *hostnm_save;
+	struct addrinfo *tmpinfo;
+	unsigned names = 0, line = 0;
+	double now;
+
+	clear_index(sf);
+
+	if ((clientfd = fopen(path, "r")) == NULL) {
+		rc_log(LOG_ERR, "rc_find_server: couldn't open file: %s: %s", strerror(errno), path);
+		return -1;
+	}
+
+	while (fgets(buffer, sizeof(buffer), clientfd) != NULL) {
+		line++;
+		if (*buffer == '#')
+			continue;
+
+		if ((h = strtok_r(buffer, " \t\n", &buffer_save)) == NULL) /* first hostname */
+			continue;
+
+		strlcpy(hostnm, h, AUTH_ID_LEN);
+
+		if ((s = strtok_r(NULL, " \t\n", &buffer_save)) == NULL) /* and secret field */
+			continue;
+
+		if (strchr(hostnm, '/')) /* "paired" form */
+			strtok_r(hostnm, "/", &hostnm_save);
+
+		if (!is_numeric(hostnm))
+			names = 1;
+
+		tmpinfo = rc_netns_getaddrinfo(sf->netns, hostnm, 0);
+		if (tmpinfo == NULL)
+			continue;
+
+		if (add_host(sf, tmpinfo, s, line) < 0) {
+			rc_log(LOG_CRIT, "%s: out of memory", __func__);
+			freeaddrinfo(tmpinfo);
+			fclose(clientfd);
+			clear_index(sf);
+			return -1;
+		}
+		freeaddrinfo(tmpinfo);
+	}
+	fclose(clientfd);
+	memset(buffer, 0, sizeof(buffer));
+
+	sf->path = strdup(path);
+	if (sf->path == NULL) {
+		clear_index(sf);
+		return -1;
+	}
+	sf->dev = st->st_dev;
+	sf->ino = st->st_ino;
+	sf->size = st->st_size;
+	sf->mtime = st->st_mtime;
+
+	now = rc_getmtime();
+	sf->expires = names ? now + sf->ttl : 0;
+	if (time(NULL) - st->st_mtime < MTIME_GRANULARITY &&
+	    (sf->expires == 0 || sf->expires > now + MTIME_GRANULARITY))
+		sf->expires = now + MTIME_GRANULARITY;
+
+	DEBUG(LOG_INFO, "indexed %u addresses of %s", sf->nentries, path);
+	return 0;
+}
+
+/*- Returns whether the index must be read again
+ -*/
+static int is_stale(struct rc_servers_file *sf, char const *path,
+		    const struct stat *st)
+{
+	return sf->path == NULL || strcmp(sf->path, path) != 0 ||
+	       sf->dev != st->st_dev || sf->ino != st->st_ino ||
+	       sf->size != st->st_size || sf->mtime != st->st_mtime ||
+	       (sf->expires != 0 && rc_getmtime() >= sf->expires);
+}
+
+/*- Finds the secret of a server in the servers file
+ *
+ * @param sf the index of the file, or NULL to read the file once.
+ * @param path the name of the servers file.
+ * @param info the addresses of the server; the first line of the file
+ *	holding one of them is used.
+ * @param secret will hold the server's secret (of %MAX_SECRET_LENGTH).
+ * @return 0 on success, -1 if the server is not in the file or on failure.
+ -*/
+int rc_servers_file_find(struct rc_servers_file *sf, char const *path,
+			 const struct addrinfo *info, char *secret)
+{
+	const struct addrinfo *p;
+	struct stat st;
+	srv_entry *e, *found = NULL;
+	int result = -1;
+
+	if (sf == NULL) {
+		sf = rc_servers_file_new(0, NULL);
+		if (sf == NULL)
+			return -1;
+		result = rc_servers_file_find(sf, path, info, secret);
+		rc_servers_file_free(sf);
+		return result;
+	}
+
+	if (stat(path, &st) == -1) {
+		rc_log(LOG_ERR, "rc_find_server: couldn't open file: %s: %s", strerror(errno), path);
+		return -1;
+	}
+
+	pthread_rwlock_rdlock(&sf->lock);
+	if (is_stale(sf, path, &st)) {
+		pthread_rwlock_unlock(&sf->lock);
+		pthread_rwlock_wrlock(&sf->lock);
+		if (is_stale(sf, path, &st) && load_index(sf, path, &st) < 0) {
+			pthread_rwlock_unlock(&sf->lock);
+			return -1;
+		}
+	}
+
+	for (p = info; p != NULL; p = p->ai_next) {
+		e = find_entry(sf, SA_GET_INADDR(p->ai_addr), SA_GET_INLEN(p->ai_addr));
+		if (e != NULL && (found == NULL || e->line < found->line))
+			found = e;
+	}
+	if (found != NULL) {
+		strlcpy(secret, found->secret, MAX_SECRET_LENGTH);
+		result = 0;
+	}
+	pthread_rwlock_unlock(&sf->lock);
+
+	return result;
+}
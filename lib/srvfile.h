@@ -0,0 +1,18 @@
+/*
+ * srvfile.h	Internal index of the secrets in the servers file.
+ *
+ * License:	BSD
+ *
+ */
+#ifndef SRVFILE_H
+# define SRVFILE_H
+
+#include <includes.h>
+
+struct rc_servers_file *rc_servers_file_new(unsigned ttl, struct rc_netns *netns);
+void rc_servers_file_free(struct rc_servers_file *sf);
+
+int rc_servers_file_find(struct rc_servers_file *sf, char const *path,
+			 const struct addrinfo *info, char *secret);
+
+#endif /* SRVFILE_H */
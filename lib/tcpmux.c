@@ -0,0 +1,730 @@
+/*
+ * tcpmux.c	Persistent RADIUS/TCP connections, shared by the requests
+ *		of a handle.
+ *
+ * The same multiplexing is used over the TLS and DTLS sessions of a
+ * handle, in which case the connection is the session, and the record
+ * layer is the only part serialized between requests.
+ *
+ * A connection is opened per local and server address on first use
+ * and kept open afterwards. Requests are pipelined on it: each one
+ * takes an Identifier of the connection, writes its packet, and the
+ * replies are split from the stream using the RADIUS length field and
+ * handed to the request with the matching Identifier. A further
+ * connection to the same server is opened when all Identifiers of the
+ * existing ones are in flight.
+ *
+ * License:	BSD
+ *
+ */
+
+#include <config.h>
+#include <includes.h>
+#include <radcli/radcli.h>
+#include <pthread.h>
+#include <poll.h>
+#include <netinet/tcp.h>
+#include "util.h"
+#include "sendserver.h"
+#include "idspace.h"
+#include "tcpmux.h"
+#include "netns.h"
+
+/* the most connections a request asks a RC_MUX_SHARED_FD transport for */
+#define MAX_SHARED_TRIES	64
+
+#ifndef MSG_NOSIGNAL
+# define MSG_NOSIGNAL 0
+#endif
+
+struct rc_tcp_conn {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;	/* signalled when a reader or a writer finished */
+	int fd;
+	unsigned flags;		/* RC_MUX_* */
+	struct sockaddr_storage local;
+	struct sockaddr_storage remote;
+
+	unsigned refs;		/* attached requests; protected by the mux lock */
+	unsigned dead;		/* the connection failed or was closed */
+	unsigned reading;	/* a thread is waiting for data in rc_tcp_wait() */
+	unsigned writing;	/* a thread is writing a packet in rc_tcp_send() */
+
+	rc_id_space ids;
+	RC_REQUEST *waiters[RC_ID_SPACE_SIZE];
+
+	/* the incomplete packet at the head of the stream */
+	unsigned rlen;
+	uint8_t rbuf[RC_BUFFER_LEN];
+
+	struct rc_tcp_conn *next;
+};
+
+struct rc_tcp_mux {
+	pthread_mutex_t lock;
+	unsigned flags;
+	struct rc_tcp_conn *conns;
+};
+
+/*- Creates the connection table of a handle
+ *
+ * @param flags zero for plain TCP, or a combination of %RC_MUX_SHARED_FD
+ *	and %RC_MUX_DATAGRAM.
+ -*/
+struct rc_tcp_mux *rc_tcp_mux_new(unsigned flags)
+{
+	struct rc_tcp_mux *mux;
+
+	mux = calloc(1, sizeof(*mux));
+	if (mux == NULL) {
+		rc_log(LOG_CRIT, "%s: out of memory", __func__);
+		return NULL;
+	}
+
+	if (pthread_mutex_init(&mux->lock, NULL) != 0) {
+		free(mux);
+		return NULL;
+	}
+
+	mux->flags = flags;
+	return mux;
+}
+
+static void conn_close(rc_handle *rh, struct rc_tcp_conn *conn)
+{
+	if (!(conn->flags & RC_MUX_SHARED_FD) && rh->so.close_fd)
+		rh->so.close_fd(conn->fd);
+	pthread_cond_destroy(&conn->cond);
+	pthread_mutex_destroy(&conn->lock);
+	free(conn);
+}
+
+/*- Closes all connections and releases the table
+ *
+ * No requests may be attached to the connections.
+ -*/
+void rc_tcp_mux_free(rc_handle *rh, struct rc_tcp_mux *mux)
+{
+	struct rc_tcp_conn *conn, *next;
+
+	if (mux == NULL)
+		return;
+
+	for (conn = mux->conns; conn != NULL; conn = next) {
+		next = conn->next;
+		conn_close(rh, conn);
+	}
+
+	pthread_mutex_destroy(&mux->lock);
+	free(mux);
+}
+
+/*- Marks a connection as failed and completes its waiting requests
+ -*/
+static void conn_fail(struct rc_tcp_conn *conn)
+{
+	unsigned i;
+
+	conn->dead = 1;
+	for (i = 0; i < RC_ID_SPACE_SIZE; i++) {
+		if (conn->waiters[i] != NULL) {
+			conn->waiters[i]->recv_length = -1;
+			conn->waiters[i] = NULL;
+		}
+	}
+	pthread_cond_broadcast(&conn->cond);
+}
+
+/*- Hands a reply to the request waiting for it
+ *
+ * Replies which do not verify against the request are dropped, as the
+ * request may still receive the genuine one.
+ -*/
+static void conn_dispatch(struct rc_tcp_conn *conn, uint8_t *buf, unsigned len)
+{
+	uint8_t id = ((AUTH_HDR *) buf)->id;
+	RC_REQUEST *req = conn->waiters[id];
+
+	if (req == NULL) {
+		DEBUG(LOG_INFO, "tcp: dropping unexpected reply with id %u",
+		      (unsigned)id);
+		return;
+	}
+
+	/* rc_verify_reply() overwrites the authenticator of the reply with
+	 * the Request Authenticator, so it is done on a copy rather than on
+	 * the stream buffer */
+	memcpy(req->recv_buffer, buf, len);
+	if (rc_verify_reply(req->rh, req->data, req->recv_buffer, len,
+			    req->secret, req->vector) != OK_RC)
+		return;
+
+	req->recv_length = len;
+	conn->waiters[id] = NULL;
+}
+
+/*- Reads whatever the connection has available and dispatches the complete replies
+ *
+ * Must be called with the connection lock held; never blocks.
+ -*/
+static void conn_read(rc_handle *rh, struct rc_tcp_conn *conn)
+{
+	const rc_sockets_override *sfuncs = &rh->so;
+	unsigned plen;
+	ssize_t ret;
+
+	while (!conn->dead) {
+		do {
+			ret = sfuncs->recvfrom(sfuncs->ptr, conn->fd,
+					       conn->rbuf + conn->rlen,
+					       sizeof(conn->rbuf) - conn->rlen,
+					       MSG_DONTWAIT, NULL, NULL);
+		} while (ret == -1 && errno == EINTR);
+
+		if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+
+		if (ret <= 0) {
+			if (ret == 0) {
+				DEBUG(LOG_INFO, "tcp: connection closed by server");
+			} else {
+				rc_log(LOG_ERR, "%s: recv: %s", __func__,
+				       strerror(errno));
+			}
+			conn_fail(conn);
+			return;
+		}
+		conn->rlen += ret;
+
+		if (conn->flags & RC_MUX_DATAGRAM) {
+			/* a damaged datagram is dropped; the stream is unaffected */
+			plen = conn->rlen >= 4 ?
+			    (conn->rbuf[2] << 8) | conn->rbuf[3] : 0;
+			if (plen >= AUTH_HDR_LEN && plen <= conn->rlen)
+				conn_dispatch(conn, conn->rbuf, plen);
+			conn->rlen = 0;
+			continue;
+		}
+
+		while (conn->rlen >= 4) {
+			plen = (conn->rbuf[2] << 8) | conn->rbuf[3];
+			if (plen < AUTH_HDR_LEN || plen > sizeof(conn->rbuf)) {
+				rc_log(LOG_ERR, "%s: invalid packet length %u",
+				       __func__, plen);
+				conn_fail(conn);
+				return;
+			}
+			if (conn->rlen < plen)
+				break;
+
+			conn_dispatch(conn, conn->rbuf, plen);
+			memmove(conn->rbuf, conn->rbuf + plen, conn->rlen - plen);
+			conn->rlen -= plen;
+		}
+	}
+}
+
+static void make_key(struct sockaddr_storage *local,
+		     struct sockaddr_storage *remote,
+		     const struct sockaddr_storage *our_sockaddr,
+		     const struct sockaddr *dest, socklen_t destlen)
+{
+	memset(local, 0, sizeof(*local));
+	memset(remote, 0, sizeof(*remote));
+
+	memcpy(local, our_sockaddr, SS_LEN(our_sockaddr));
+	if (local->ss_family == AF_INET)
+		((struct sockaddr_in *)local)->sin_port = 0;
+	else
+		((struct sockaddr_in6 *)local)->sin6_port = 0;
+
+	memcpy(remote, dest, RC_MIN(destlen, sizeof(*remote)));
+}
+
+static struct rc_tcp_conn *conn_open(rc_handle *rh, RC_REQUEST *req,
+				     unsigned flags, int fd,
+				     const struct sockaddr_storage *local,
+				     const struct sockaddr_storage *remote)
+{
+	struct rc_tcp_conn *conn;
+	int one = 1;
+
+	if (rh->so.get_fd == NULL)
+		return NULL;
+
+	conn = calloc(1, sizeof(*conn));
+	if (conn == NULL) {
+		rc_log(LOG_CRIT, "%s: out of memory", __func__);
+		return NULL;
+	}
+
+	if (pthread_mutex_init(&conn->lock, NULL) != 0) {
+		free(conn);
+		return NULL;
+	}
+	if (pthread_cond_init(&conn->cond, NULL) != 0) {
+		pthread_mutex_destroy(&conn->lock);
+		free(conn);
+		return NULL;
+	}
+
+	conn->flags = flags;
+	if (flags & RC_MUX_SHARED_FD)
+		conn->fd = fd;
+	else
+		conn->fd = rc_netns_get_fd(rh, SA(&req->our_sockaddr));
+	if (conn->fd < 0) {
+		rc_log(LOG_ERR, "%s: socket: %s", __func__, strerror(errno));
+		conn->fd = -1;
+		goto fail;
+	}
+
+	if (flags & RC_MUX_SHARED_FD)
+		goto established;
+
+	if (connect(conn->fd, req->auth_addr->ai_addr,
+		    req->auth_addr->ai_addrlen) != 0) {
+		rc_log(LOG_ERR, "%s: connect: %s", __func__, strerror(errno));
+		goto fail;
+	}
+
+	/* pipelined requests are written as soon as they are built */
+	if (setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one,
+		       sizeof(one)) != 0)
+		rc_log(LOG_WARNING, "%s: cannot set TCP_NODELAY: %s", __func__,
+		       strerror(errno));
+
+ established:
+	conn->local = *local;
+	conn->remote = *remote;
+	rc_id_space_init(&conn->ids);
+
+	DEBUG(LOG_INFO, "tcp: connected to %s (fd %d)", req->data->server,
+	      conn->fd);
+	return conn;
+
+ fail:
+	if (conn->fd >= 0 && !(flags & RC_MUX_SHARED_FD) && rh->so.close_fd)
+		rh->so.close_fd(conn->fd);
+	pthread_cond_destroy(&conn->cond);
+	pthread_mutex_destroy(&conn->lock);
+	free(conn);
+	return NULL;
+}
+
+/*- Attaches a request to a connection to its server
+ *
+ * An open connection with a free Identifier is used, or a new one is
+ * established. With RC_MUX_SHARED_FD the transport picks the connection
+ * (e.g., one of several TLS sessions) and only its descriptor is
+ * matched; when all its Identifiers are in flight, any other connection
+ * of the transport is used, or the next one it picks. On success the request's socket and Identifier
+ * (data->seq_nbr) are set; the request must be detached using
+ * rc_tcp_detach().
+ *
+ * @param rh a handle to parsed configuration.
+ * @param req a request with its server address and local address set.
+ * @return 0 on success, or -1 on failure.
+ -*/
+int rc_tcp_attach(rc_handle *rh, RC_REQUEST *req)
+{
+	struct rc_tcp_mux *mux = rh->tcpmux;
+	struct sockaddr_storage local, remote;
+	struct rc_tcp_conn *conn, **pp, *fresh = NULL, *stale = NULL;
+	int id = -1, fd = -1, first_fd = -1, busy = 0;
+	unsigned tries = 0;
+
+	make_key(&local, &remote, &req->our_sockaddr, req->auth_addr->ai_addr,
+		 req->auth_addr->ai_addrlen);
+
+	if (mux->flags & RC_MUX_SHARED_FD) {
+		if (rh->so.get_fd == NULL)
+			return -1;
+		fd = rc_netns_get_fd(rh, SA(&req->our_sockaddr));
+		if (fd < 0) {
+			rc_log(LOG_ERR, "%s: no connection to %s", __func__,
+			       req->data->server);
+			return -1;
+		}
+		first_fd = fd;
+	}
+
+	for (;;) {
+		busy = 0;
+		pthread_mutex_lock(&mux->lock);
+		for (pp = &mux->conns; (conn = *pp) != NULL;) {
+			if ((mux->flags & RC_MUX_SHARED_FD) ? conn->fd != fd :
+			    memcmp(&conn->local, &local, sizeof(local)) != 0 ||
+			    memcmp(&conn->remote, &remote, sizeof(remote)) != 0) {
+				pp = &conn->next;
+				continue;
+			}
+
+			pthread_mutex_lock(&conn->lock);
+			/* notice a connection the server closed while idle */
+			if (conn->refs == 0)
+				conn_read(rh, conn);
+			if (!conn->dead)
+				id = rc_id_alloc(&conn->ids);
+			if (id >= 0) {
+				conn->waiters[id] = req;
+				conn->refs++;
+				pthread_mutex_unlock(&conn->lock);
+				break;
+			}
+			if (!conn->dead)
+				busy = 1;
+			pthread_mutex_unlock(&conn->lock);
+
+			if (conn->dead && conn->refs == 0 && stale == NULL) {
+				*pp = conn->next;
+				stale = conn;
+				continue;
+			}
+			pp = &conn->next;
+		}
+
+		/* a shared connection cannot be opened twice; another one of
+		 * the transport with a free Identifier is used instead */
+		if (conn == NULL && busy && (mux->flags & RC_MUX_SHARED_FD)) {
+			for (conn = mux->conns; conn != NULL; conn = conn->next) {
+				pthread_mutex_lock(&conn->lock);
+				if (!conn->dead)
+					id = rc_id_alloc(&conn->ids);
+				if (id >= 0) {
+					conn->waiters[id] = req;
+					conn->refs++;
+				}
+				pthread_mutex_unlock(&conn->lock);
+				if (id >= 0)
+					break;
+			}
+		}
+
+		/* or the next one the transport picks, which may not be open
+		 * yet, until it picks the first one again */
+		if (conn == NULL && busy && (mux->flags & RC_MUX_SHARED_FD)) {
+			pthread_mutex_unlock(&mux->lock);
+			if (stale != NULL) {
+				conn_close(rh, stale);
+				stale = NULL;
+			}
+			if (fresh != NULL) {
+				conn_close(rh, fresh);
+				fresh = NULL;
+			}
+
+			if (++tries < MAX_SHARED_TRIES) {
+				fd = rc_netns_get_fd(rh, SA(&req->our_sockaddr));
+				if (fd >= 0 && fd != first_fd)
+					continue;
+			}
+			rc_log(LOG_ERR, "%s: no free Identifier on the connections to %s",
+			       __func__, req->data->server);
+			return -1;
+		}
+
+		if (conn == NULL && fresh != NULL) {
+			conn = fresh;
+			fresh = NULL;
+			id = rc_id_alloc(&conn->ids);
+			conn->waiters[id] = req;
+			conn->refs++;
+			conn->next = mux->conns;
+			mux->conns = conn;
+		}
+		pthread_mutex_unlock(&mux->lock);
+
+		if (stale != NULL) {
+			conn_close(rh, stale);
+			stale = NULL;
+		}
+
+		if (conn != NULL)
+			break;
+
+		fresh = conn_open(rh, req, mux->flags, fd, &local, &remote);
+		if (fresh == NULL)
+			return -1;
+	}
+
+	/* another request opened a connection in the meantime */
+	if (fresh != NULL)
+		conn_close(rh, fresh);
+
+	req->tcp = conn;
+	req->sockfd = conn->fd;
+	req->recv_length = 0;
+	req->data->seq_nbr = id;
+	return 0;
+}
+
+/*- Detaches a request from its connection and releases its Identifier
+ -*/
+void rc_tcp_detach(rc_handle *rh, RC_REQUEST *req)
+{
+	struct rc_tcp_mux *mux = rh->tcpmux;
+	struct rc_tcp_conn *conn = req->tcp, **pp;
+	uint8_t id = req->data->seq_nbr;
+	unsigned unlink;
+
+	if (conn == NULL)
+		return;
+
+	pthread_mutex_lock(&mux->lock);
+	pthread_mutex_lock(&conn->lock);
+	if (conn->waiters[id] == req)
+		conn->waiters[id] = NULL;
+	rc_id_release(&conn->ids, id);
+	conn->refs--;
+	unlink = conn->dead && conn->refs == 0;
+	pthread_mutex_unlock(&conn->lock);
+
+	if (unlink) {
+		for (pp = &mux->conns; *pp != NULL; pp = &(*pp)->next) {
+			if (*pp == conn) {
+				*pp = conn->next;
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&mux->lock);
+
+	if (unlink)
+		conn_close(rh, conn);
+
+	req->tcp = NULL;
+	req->sockfd = -1;
+}
+
+/*- Fails the connections over a descriptor the transport is about to close
+ *
+ * Used by a RC_MUX_SHARED_FD transport before it releases a session. The
+ * attached requests are failed under the connection lock, which the
+ * reads and writes of the connection are done under, so that none is
+ * in progress once this returns. The connections are not matched again,
+ * so one opened over the same descriptor number later starts afresh;
+ * those without requests are closed.
+ -*/
+void rc_tcp_invalidate(rc_handle *rh, int fd)
+{
+	struct rc_tcp_mux *mux = rh->tcpmux;
+	struct rc_tcp_conn *conn, **pp, *stale = NULL;
+
+	if (mux == NULL || fd < 0)
+		return;
+
+	pthread_mutex_lock(&mux->lock);
+	for (pp = &mux->conns; (conn = *pp) != NULL;) {
+		if (conn->fd != fd) {
+			pp = &conn->next;
+			continue;
+		}
+
+		pthread_mutex_lock(&conn->lock);
+		conn_fail(conn);
+		pthread_mutex_unlock(&conn->lock);
+
+		if (conn->refs == 0) {
+			*pp = conn->next;
+			conn->next = stale;
+			stale = conn;
+			continue;
+		}
+		pp = &conn->next;
+	}
+	pthread_mutex_unlock(&mux->lock);
+
+	while ((conn = stale) != NULL) {
+		stale = conn->next;
+		conn_close(rh, conn);
+	}
+}
+
+/*- Writes the packet of a request to its connection
+ *
+ * The packets are written one at a time. When the transport cannot take
+ * more data, the connection is polled for writing until the reply to the
+ * request would be given up; the connection lock is released meanwhile,
+ * so that the replies of other requests can still be read.
+ *
+ * @return 0 on success, or -1 on failure with errno set.
+ -*/
+int rc_tcp_send(RC_REQUEST *req)
+{
+	const rc_sockets_override *sfuncs = &req->rh->so;
+	struct rc_tcp_conn *conn = req->tcp;
+	struct pollfd pfd;
+	double deadline, left;
+	int sent = 0;
+	ssize_t ret = 0;
+
+	deadline = rc_getmtime() + req->rt;
+	if (req->expires > 0 && deadline > req->expires)
+		deadline = req->expires;
+
+	pthread_mutex_lock(&conn->lock);
+	while (conn->writing && !conn->dead)
+		pthread_cond_wait(&conn->cond, &conn->lock);
+	if (conn->dead) {
+		pthread_mutex_unlock(&conn->lock);
+		errno = ECONNRESET;
+		return -1;
+	}
+	conn->writing = 1;
+
+	while (sent < req->total_length) {
+		ret = sfuncs->sendto(sfuncs->ptr, conn->fd,
+				     req->send_buffer + sent,
+				     req->total_length - sent, MSG_NOSIGNAL,
+				     NULL, 0);
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			left = deadline - rc_getmtime();
+			if (left <= 0) {
+				errno = ETIMEDOUT;
+			} else {
+				pthread_mutex_unlock(&conn->lock);
+				pfd.fd = conn->fd;
+				pfd.events = POLLOUT;
+				pfd.revents = 0;
+				ret = poll(&pfd, 1, (int)(left * 1000) + 1);
+				pthread_mutex_lock(&conn->lock);
+
+				if (conn->dead) {
+					errno = ECONNRESET;
+					ret = -1;
+					break;
+				}
+				if (ret >= 0 || errno == EINTR)
+					continue;
+			}
+			ret = -1;
+		}
+		if (ret <= 0) {
+			rc_log(LOG_ERR, "%s: send: %s", __func__, strerror(errno));
+			/* the stream may hold a partial packet */
+			conn_fail(conn);
+			ret = -1;
+			break;
+		}
+		sent += ret;
+	}
+	conn->writing = 0;
+	pthread_cond_broadcast(&conn->cond);
+	pthread_mutex_unlock(&conn->lock);
+
+	return ret < 0 ? -1 : 0;
+}
+
+/*- Reads any available replies without blocking
+ *
+ * @return the length of the request's verified reply in its receive
+ *	buffer, 0 if it has not arrived yet, or -1 if the connection failed.
+ -*/
+int rc_tcp_receive(RC_REQUEST *req)
+{
+	struct rc_tcp_conn *conn = req->tcp;
+	int length;
+
+	pthread_mutex_lock(&conn->lock);
+	if (req->recv_length == 0)
+		conn_read(req->rh, conn);
+	length = req->recv_length;
+	if (length == 0 && conn->dead)
+		length = -1;
+	pthread_mutex_unlock(&conn->lock);
+
+	return length;
+}
+
+/*- Returns non-zero if the reply of a request was read by another request
+ -*/
+int rc_tcp_delivered(RC_REQUEST *req)
+{
+	struct rc_tcp_conn *conn = req->tcp;
+	int delivered;
+
+	pthread_mutex_lock(&conn->lock);
+	delivered = req->recv_length != 0;
+	pthread_mutex_unlock(&conn->lock);
+
+	return delivered;
+}
+
+/*- Waits until the reply of a request is available
+ *
+ * One of the threads waiting on a connection polls it and dispatches
+ * the replies it reads; the others wait for it to finish.
+ *
+ * @param req the request.
+ * @param timeout_ms the maximum time to wait in milliseconds.
+ * @return 1 when rc_tcp_receive() will return the outcome, or 0 on timeout.
+ -*/
+int rc_tcp_wait(RC_REQUEST *req, int timeout_ms)
+{
+	struct rc_tcp_conn *conn = req->tcp;
+	struct pollfd pfd;
+	struct timespec ts;
+	double deadline, left;
+	int ret;
+
+	deadline = rc_getmtime() + timeout_ms / 1000.0;
+
+	pthread_mutex_lock(&conn->lock);
+	while (req->recv_length == 0 && !conn->dead) {
+		left = deadline - rc_getmtime();
+		if (left <= 0)
+			break;
+
+		if (conn->reading) {
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += (time_t)left;
+			ts.tv_nsec += (long)((left - (time_t)left) * 1e9);
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&conn->cond, &conn->lock, &ts);
+			continue;
+		}
+
+		conn->reading = 1;
+		pthread_mutex_unlock(&conn->lock);
+
+		if (req->rh->so.wait_fd) {
+			ret = req->rh->so.wait_fd(req->rh->so.ptr, conn->fd,
+						  (int)(left * 1000) + 1);
+		} else {
+			pfd.fd = conn->fd;
+			pfd.events = POLLIN;
+			pfd.revents = 0;
+			ret = poll(&pfd, 1, (int)(left * 1000) + 1);
+		}
+
+		pthread_mutex_lock(&conn->lock);
+		conn->reading = 0;
+		if (ret > 0) {
+			conn_read(req->rh, conn);
+		} else if (ret == -1 && errno != EINTR) {
+			rc_log(LOG_ERR, "%s: poll: %s", __func__, strerror(errno));
+			conn_fail(conn);
+		}
+		pthread_cond_broadcast(&conn->cond);
+	}
+	ret = req->recv_length != 0 || conn->dead;
+	pthread_mutex_unlock(&conn->lock);
+
+	return ret;
+}
+
+/*- Returns non-zero if a request without a reply may be sent again
+ *
+ * Requests are only retransmitted over datagram transports; RFC 6613
+ * forbids retransmission over the same TCP connection.
+ -*/
+int rc_tcp_retransmits(RC_REQUEST *req)
+{
+	return (req->tcp->flags & RC_MUX_DATAGRAM) != 0;
+}
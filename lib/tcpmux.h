@@ -0,0 +1,31 @@
+/*
+ * tcpmux.h	Internal persistent RADIUS/TCP, TLS and DTLS connections
+ *		shared by the requests of a handle.
+ *
+ * License:	BSD
+ *
+ */
+#ifndef TCPMUX_H
+# define TCPMUX_H
+
+#include <includes.h>
+
+/* the transport's get_fd() returns an established connection, which
+ * is neither connected nor closed by the mux; used by TLS and DTLS */
+#define RC_MUX_SHARED_FD	1
+/* each read returns a single packet, which may be lost; used by DTLS */
+#define RC_MUX_DATAGRAM		(1<<1)
+
+struct rc_tcp_mux *rc_tcp_mux_new(unsigned flags);
+void rc_tcp_mux_free(rc_handle *rh, struct rc_tcp_mux *mux);
+
+int rc_tcp_attach(rc_handle *rh, RC_REQUEST *req);
+void rc_tcp_detach(rc_handle *rh, RC_REQUEST *req);
+void rc_tcp_invalidate(rc_handle *rh, int fd);
+int rc_tcp_send(RC_REQUEST *req);
+int rc_tcp_receive(RC_REQUEST *req);
+int rc_tcp_delivered(RC_REQUEST *req);
+int rc_tcp_wait(RC_REQUEST *req, int timeout_ms);
+int rc_tcp_retransmits(RC_REQUEST *req);
+
+#endif /* TCPMUX_H */
@@ -28,6 +28,8 @@
 #include <radcli/radcli.h>
 #include "util.h"
 #include "tls.h"
+#include "tcpmux.h"
+#include "netns.h"
 
 #ifdef HAVE_GNUTLS
 
@@ -47,6 +49,7 @@
 #include <gnutls/gnutls.h>
 #include <gnutls/dtls.h>
 #include <pthread.h>
+#include <poll.h>
 #include <time.h>
 
 #define DEFAULT_DTLS_SECRET "radius/dtls"
@@ -66,20 +69,65 @@ typedef struct tls_int_st {
 	time_t last_restart;
 } tls_int_st;
 
+/* the number of parallel sessions unless configured */
+#define DEFAULT_TLS_SESSIONS 1
+#define MAX_TLS_SESSIONS 64
+
 typedef struct tls_st {
 	gnutls_psk_client_credentials_t psk_cred;
 	gnutls_certificate_credentials_t x509_cred;
-	struct tls_int_st ctx;	/* one for ACCT and another for AUTH */
+	struct tls_int_st *ctx;	/* the parallel sessions to the server */
+	unsigned nctx;
+	unsigned next; /* the session the next request starts with */
+	pthread_key_t current; /* the session locked by a thread */
 	unsigned flags; /* the flags set on init */
+	unsigned multiplex; /* requests share the session; see tcpmux.c */
+	pthread_mutex_t restart_lock; /* serializes restarts when multiplexing */
 	rc_handle *rh; /* a pointer to our owner */
 } tls_st;
 
-static void restart_session(rc_handle *rh, tls_st *st);
+static void restart_session(rc_handle *rh, tls_st *st, tls_int_st *ses);
+
+/* Returns the session a request uses: the one it locked or, when
+ * multiplexing, the one its connection was opened on. */
+static tls_int_st *get_session(tls_st *st, int sockfd)
+{
+	tls_int_st *ses;
+	unsigned i;
+
+	if (!st->multiplex) {
+		ses = pthread_getspecific(st->current);
+		return ses ? ses : &st->ctx[0];
+	}
+
+	/* the descriptor of another session may be replaced meanwhile */
+	for (i = 0; i < st->nctx; i++) {
+		if (__atomic_load_n(&st->ctx[i].sockfd, __ATOMIC_ACQUIRE) == sockfd)
+			return &st->ctx[i];
+	}
+	return NULL;
+}
 
 static int tls_get_fd(void *ptr, struct sockaddr *our_sockaddr)
 {
 	tls_st *st = ptr;
-	return st->ctx.sockfd;
+	tls_int_st *ses;
+	int fd;
+
+	if (!st->multiplex)
+		return get_session(st, -1)->sockfd;
+
+	/* a new connection is requested for every request; they are
+	 * spread over the sessions, and a failed session is restarted
+	 * before it is handed out again */
+	pthread_mutex_lock(&st->restart_lock);
+	ses = &st->ctx[st->next++ % st->nctx];
+	if (ses->need_restart != 0)
+		restart_session(st->rh, st, ses);
+	fd = ses->sockfd;
+	pthread_mutex_unlock(&st->restart_lock);
+
+	return fd;
 }
 
 static ssize_t tls_sendto(void *ptr, int sockfd,
@@ -88,42 +136,77 @@ static ssize_t tls_sendto(void *ptr, int sockfd,
 			   socklen_t addrlen)
 {
 	tls_st *st = ptr;
+	tls_int_st *ses = get_session(st, sockfd);
 	int ret;
 
-	if (st->ctx.need_restart != 0) {
-		restart_session(st->rh, st);
+	if (ses == NULL) {
+		/* the session was restarted under this connection */
+		errno = EIO;
+		return -1;
+	}
+
+	/* when multiplexing, the session is restarted by tls_get_fd() */
+	if (ses->need_restart != 0 && !st->multiplex) {
+		restart_session(st->rh, st, ses);
 	}
 
-	ret = gnutls_record_send(st->ctx.session, buf, len);
-	if (ret == GNUTLS_E_AGAIN || ret == GNUTLS_E_INTERRUPTED) {
+	ret = gnutls_record_send(ses->session, buf, len);
+	if (ret == GNUTLS_E_INTERRUPTED) {
 		errno = EINTR;
 		return -1;
 	}
+	if (ret == GNUTLS_E_AGAIN) {
+		/* the caller polls for writing before it retries */
+		errno = EAGAIN;
+		return -1;
+	}
 
 	if (ret < 0) {
 		rc_log(LOG_ERR, "%s: error in sending: %s", __func__,
 		       gnutls_strerror(ret));
 		errno = EIO;
-		st->ctx.need_restart = 1;
+		ses->need_restart = 1;
 		return -1;
 	}
 
-	st->ctx.last_msg = time(0);
+	ses->last_msg = time(0);
 	return ret;
 }
 
+/* Locks a session for the calling thread: the first idle one, or the
+ * next one in turn if all are busy. */
 static int tls_lock(void *ptr)
 {
 	tls_st *st = ptr;
+	tls_int_st *ses = NULL;
+	unsigned i, start;
+	int ret;
+
+	start = __sync_fetch_and_add(&st->next, 1);
+	for (i = 0; i < st->nctx; i++) {
+		if (pthread_mutex_trylock(&st->ctx[(start + i) % st->nctx].lock) == 0) {
+			ses = &st->ctx[(start + i) % st->nctx];
+			break;
+		}
+	}
+
+	if (ses == NULL) {
+		ses = &st->ctx[start % st->nctx];
+		ret = pthread_mutex_lock(&ses->lock);
+		if (ret != 0)
+			return ret;
+	}
 
-	return pthread_mutex_lock(&st->ctx.lock);
+	return pthread_setspecific(st->current, ses);
 }
 
 static int tls_unlock(void *ptr)
 {
 	tls_st *st = ptr;
+	tls_int_st *ses = get_session(st, -1);
 
-	return pthread_mutex_unlock(&st->ctx.lock);
+	pthread_setspecific(st->current, NULL);
+	return pthread_mutex_unlock(&ses->lock);
 }
 
 static ssize_t tls_recvfrom(void *ptr, int sockfd,
@@ -132,10 +215,21 @@ static ssize_t tls_recvfrom(void *ptr, int sockfd,
 			     socklen_t * addrlen)
 {
 	tls_st *st = ptr;
+	tls_int_st *ses = get_session(st, sockfd);
 	int ret;
 
-	ret = gnutls_record_recv(st->ctx.session, buf, len);
-	if (ret == GNUTLS_E_AGAIN || ret == GNUTLS_E_INTERRUPTED ||
+	if (ses == NULL) {
+		errno = EIO;
+		return -1;
+	}
+
+	ret = gnutls_record_recv(ses->session, buf, len);
+	if (ret == GNUTLS_E_AGAIN) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	if (ret == GNUTLS_E_INTERRUPTED ||
 	    ret == GNUTLS_E_HEARTBEAT_PING_RECEIVED || ret == GNUTLS_E_HEARTBEAT_PONG_RECEIVED) {
 		errno = EINTR;
 		return -1;
@@ -143,7 +237,7 @@ static ssize_t tls_recvfrom(void *ptr, int sockfd,
 
 	if (ret == GNUTLS_E_WARNING_ALERT_RECEIVED) {
 		rc_log(LOG_ERR, "%s: received alert: %s", __func__,
-		       gnutls_alert_get_name(gnutls_alert_get(st->ctx.session)));
+		       gnutls_alert_get_name(gnutls_alert_get(ses->session)));
 		errno = EINTR;
 		return -1;
 	}
@@ -164,14 +258,35 @@ static ssize_t tls_recvfrom(void *ptr, int sockfd,
 		rc_log(LOG_ERR, "%s: error in receiving: %s", __func__,
 		       gnutls_strerror(ret));
 		errno = EIO;
-		st->ctx.need_restart = 1;
+		ses->need_restart = 1;
 		return -1;
 	}
 
-	st->ctx.last_msg = time(0);
+	ses->last_msg = time(0);
 	return ret;
 }
 
+/* Data which was already decrypted does not make the socket readable.
+ * When multiplexing, the session is not looked at: it may be restarted
+ * meanwhile, and tcpmux.c reads until nothing is left decrypted. */
+static int tls_wait_fd(void *ptr, int sockfd, int timeout_ms)
+{
+	tls_st *st = ptr;
+	tls_int_st *ses;
+	struct pollfd pfd;
+
+	if (!st->multiplex) {
+		ses = get_session(st, sockfd);
+		if (ses != NULL && gnutls_record_check_pending(ses->session) > 0)
+			return 1;
+	}
+
+	pfd.fd = sockfd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	return poll(&pfd, 1, timeout_ms);
+}
+
 /* This function will verify the peer's certificate, and check
  * if the hostname matches.
  */
@@ -218,7 +333,6 @@ static void deinit_session(tls_int_st *ses)
 {
 	if (ses->init != 0) {
 		ses->init = 0;
-		pthread_mutex_destroy(&ses->lock);
 		if (ses->sockfd != -1)
 			close(ses->sockfd);
 		if (ses->session)
@@ -229,7 +343,7 @@ static void deinit_session(tls_int_st *ses)
 static int init_session(rc_handle *rh, tls_int_st *ses,
 			const char *hostname, unsigned port,
 			struct sockaddr_storage *our_sockaddr,
-			int timeout,
+			int timeout_ms,
 			unsigned secflags)
 {
 	int sockfd, ret, e;
@@ -242,8 +356,13 @@ static int init_session(rc_handle *rh, tls_int_st *ses,
 	ses->sockfd = -1;
 	ses->init = 1;
 
-	pthread_mutex_init(&ses->lock, NULL);
+	/* a socket stays in the namespace it was created in */
+	if (rc_netns_enter(rh->netns) < 0) {
+		ret = -1;
+		goto cleanup;
+	}
 	sockfd = socket(our_sockaddr->ss_family, (secflags&SEC_FLAG_DTLS)?SOCK_DGRAM:SOCK_STREAM, 0);
+	rc_netns_leave(rh->netns);
 	if (sockfd < 0) {
 		rc_log(LOG_ERR,
 		       "%s: cannot open socket", __func__);
@@ -273,14 +392,17 @@ static int init_session(rc_handle *rh, tls_int_st *ses,
 
 	memcpy(&ses->our_sockaddr, our_sockaddr, sizeof(*our_sockaddr));
 	if (!(secflags&SEC_FLAG_DTLS)) {
-		if (timeout > 0) {
-			gnutls_handshake_set_timeout(ses->session, timeout*1000);
+		if (timeout_ms > 0) {
+			gnutls_handshake_set_timeout(ses->session, timeout_ms);
 		} else {
 			gnutls_handshake_set_timeout(ses->session, GNUTLS_DEFAULT_HANDSHAKE_TIMEOUT);
 		}
 	} else { /* DTLS */
-		if (timeout > 0)
-			gnutls_dtls_set_timeouts(ses->session, 1000, timeout*1000);
+		/* the retransmission timeout may not exceed the total one */
+		if (timeout_ms > 0)
+			gnutls_dtls_set_timeouts(ses->session,
+						 timeout_ms < 1000 ? timeout_ms : 1000,
+						 timeout_ms);
 	}
 
 	gnutls_transport_set_int(ses->session, sockfd);
@@ -321,7 +443,7 @@ static int init_session(rc_handle *rh, tls_int_st *ses,
 			       hostname, strlen(hostname));
 
 	info =
-	    rc_getaddrinfo(hostname, PW_AI_AUTH);
+	    rc_netns_getaddrinfo(rh->netns, hostname, PW_AI_AUTH);
 	if (info == NULL) {
 		ret = -1;
 		rc_log(LOG_ERR, "%s: cannot resolve %s", __func__,
@@ -381,6 +503,17 @@ static int init_session(rc_handle *rh, tls_int_st *ses,
 		goto cleanup;
 	}
 
+	/* replies are read whenever available, by any of the requests */
+	if (st && st->multiplex) {
+		e = fcntl(sockfd, F_GETFL, 0);
+		if (e == -1 || fcntl(sockfd, F_SETFL, e | O_NONBLOCK) == -1) {
+			rc_log(LOG_ERR, "%s: fcntl: %s", __func__,
+			       strerror(errno));
+			ret = -1;
+			goto cleanup;
+		}
+	}
+
 	return 0;
  cleanup:
 	deinit_session(ses);
@@ -392,32 +525,55 @@ static int init_session(rc_handle *rh, tls_int_st *ses,
  * we will try heartbeats */
 #define TIME_ALIVE 120
 
-static void restart_session(rc_handle *rh, tls_st *st)
+/* Replaces a session by a new one to the same server.
+ *
+ * When multiplexing, the caller holds restart_lock, and the requests
+ * using the session are not serialized with it: their connection is
+ * failed first, which waits for the read or write in progress, and the
+ * descriptor is shut down to wake a request polling it. */
+static void restart_session(rc_handle *rh, tls_st *st, tls_int_st *ses)
 {
 	struct tls_int_st tmps;
 	time_t now = time(0);
-	int ret;
-	int timeout;
+	int ret, fd;
+	int timeout_ms;
 
-	if (now - st->ctx.last_restart < TIME_ALIVE)
+	if (now - ses->last_restart < TIME_ALIVE)
 		return;
 
-	st->ctx.last_restart = now;
+	ses->last_restart = now;
 
-	timeout = rc_conf_int(rh, "radius_timeout");
+	timeout_ms = rc_conf_timeout_ms(rh);
 
 	/* reinitialize this session */
-	ret = init_session(rh, &tmps, st->ctx.hostname, st->ctx.port, &st->ctx.our_sockaddr, timeout, st->flags);
+	memset(&tmps, 0, sizeof(tmps));
+	ret = init_session(rh, &tmps, ses->hostname, ses->port, &ses->our_sockaddr, timeout_ms, st->flags);
 	if (ret < 0) {
 		rc_log(LOG_ERR, "%s: error in re-initializing DTLS", __func__);
 		return;
 	}
 
-	if (tmps.sockfd == st->ctx.sockfd)
-		st->ctx.sockfd = -1;
-	deinit_session(&st->ctx);
-	memcpy(&st->ctx, &tmps, sizeof(tmps));
-	st->ctx.need_restart = 0;
+	fd = ses->sockfd;
+	if (st->multiplex && fd != -1) {
+		rc_tcp_invalidate(rh, fd);
+		shutdown(fd, SHUT_RDWR);
+	}
+
+	/* the descriptor is closed after no session is found by it */
+	__atomic_store_n(&ses->sockfd, -1, __ATOMIC_RELEASE);
+	deinit_session(ses);
+	if (fd != -1)
+		close(fd);
+
+	/* the lock may be held by the caller and is kept; the descriptor
+	 * is set last, once the session can be found by it */
+	ses->session = tmps.session;
+	ses->init = tmps.init;
+	ses->skip_hostname_check = tmps.skip_hostname_check;
+	ses->last_msg = tmps.last_msg;
+	gnutls_session_set_ptr(ses->session, ses);
+	ses->need_restart = 0;
+	__atomic_store_n(&ses->sockfd, tmps.sockfd, __ATOMIC_RELEASE);
 
 	return;
 }
@@ -427,8 +583,12 @@ static void restart_session(rc_handle *rh, tls_st *st)
  * This can also be used as a test for the application to see
  * whether TLS or DTLS are in use.
  *
+ * When several sessions are established (see tls-sessions in
+ * radiusclient.conf), only the descriptor of the first one is returned;
+ * those of the others are not available through this function.
+ *
  * @param rh a handle to parsed configuration
- * @return the file descriptor used by the TLS session, or -1 on error
+ * @return the file descriptor used by the first TLS session, or -1 on error
  */
 int rc_tls_fd(rc_handle * rh)
 {
@@ -439,8 +599,8 @@ int rc_tls_fd(rc_handle * rh)
 
 	st = rh->so.ptr;
 
-	if (st->ctx.init != 0) {
-		return st->ctx.sockfd;
+	if (st->ctx[0].init != 0) {
+		return st->ctx[0].sockfd;
 	}
 	return -1;
 }
@@ -451,8 +611,11 @@ int rc_tls_fd(rc_handle * rh)
  * for TLS or DTLS are operational, and will re-establish the channel
  * if necessary. If this function fails then  the TLS or DTLS state 
  * should be considered as disconnected.
- * It must be called at a time when the sessions are not in usage
- * (e.g., in a different thread).
+ * It may be called while requests are in progress (e.g., in a different
+ * thread): a session in use by a request is skipped, and is restarted
+ * by the request itself if it failed. With tls-multiplex the requests
+ * share the sessions and read from them at any time, so no heartbeat is
+ * sent; only the sessions known to have failed are restarted.
  *
  * Note: It is recommended to run this function periodically if you
  * have a DTLS channel since an undetected server reset may
@@ -464,7 +627,9 @@ int rc_tls_fd(rc_handle * rh)
 int rc_check_tls(rc_handle * rh)
 {
 	tls_st *st;
+	tls_int_st *ses;
 	time_t now = time(0);
+	unsigned i;
 	int ret;
 
 	if (rh->so_type != RC_SOCKET_TLS && rh->so_type != RC_SOCKET_DTLS)
@@ -472,22 +637,61 @@ int rc_check_tls(rc_handle * rh)
 
 	st = rh->so.ptr;
 
-	if (st->ctx.init != 0) {
-		if (st->ctx.need_restart != 0) {
-			restart_session(rh, st);
-		} else if (now - st->ctx.last_msg > TIME_ALIVE) {
-			ret = gnutls_heartbeat_ping(st->ctx.session, 64, 4, GNUTLS_HEARTBEAT_WAIT);
+	if (st->multiplex) {
+		pthread_mutex_lock(&st->restart_lock);
+		for (i = 0; i < st->nctx; i++) {
+			ses = &st->ctx[i];
+			if (ses->init != 0 && ses->need_restart != 0)
+				restart_session(rh, st, ses);
+		}
+		pthread_mutex_unlock(&st->restart_lock);
+		return 0;
+	}
+
+	/* each session is checked, and restarted, on its own */
+	for (i = 0; i < st->nctx; i++) {
+		ses = &st->ctx[i];
+		if (pthread_mutex_trylock(&ses->lock) != 0)
+			continue;
+
+		if (ses->init == 0) {
+			pthread_mutex_unlock(&ses->lock);
+			continue;
+		}
+
+		if (ses->need_restart != 0) {
+			restart_session(rh, st, ses);
+		} else if (now - ses->last_msg > TIME_ALIVE) {
+			ret = gnutls_heartbeat_ping(ses->session, 64, 4, GNUTLS_HEARTBEAT_WAIT);
 			if (ret < 0) {
-				restart_session(rh, st);
+				restart_session(rh, st, ses);
 			}
-			st->ctx.last_msg = now;
+			ses->last_msg = now;
 		}
+		pthread_mutex_unlock(&ses->lock);
 	}
 	return 0;
 }
 
 /** @} */
 
+static void free_sessions(tls_st *st)
+{
+	unsigned i;
+
+	if (st->ctx == NULL)
+		return;
+
+	for (i = 0; i < st->nctx; i++) {
+		if (st->ctx[i].init != 0)
+			deinit_session(&st->ctx[i]);
+		pthread_mutex_destroy(&st->ctx[i].lock);
+	}
+	free(st->ctx);
+	st->ctx = NULL;
+	pthread_key_delete(st->current);
+}
+
 /*- This function will deinitialize a previously initialed DTLS or TLS session.
  *
  * @param rh the configuration handle.
@@ -495,27 +699,14 @@ int rc_check_tls(rc_handle * rh)
 void rc_deinit_tls(rc_handle * rh)
 {
 	tls_st *st = rh->so.ptr;
-	char *ns = NULL;
-	int ns_def_hdl = 0;
 
 	if (st) {
-		ns = rc_conf_str(rh, "namespace"); /* Check for namespace config */
-		if (ns != NULL) {
-			if(-1 == rc_set_netns(ns, &ns_def_hdl)) {
-				rc_log(LOG_ERR, "rc_send_server: namespace %s set failed", ns);
-				return;
-			}
-		}
-		if (st->ctx.init != 0)
-			deinit_session(&st->ctx);
+		free_sessions(st);
 		if (st->x509_cred)
 			gnutls_certificate_free_credentials(st->x509_cred);
 		if (st->psk_cred)
 			gnutls_psk_free_client_credentials(st->psk_cred);
-		if (ns != NULL) {
-			if(-1 == rc_reset_netns(&ns_def_hdl))
-			rc_log(LOG_ERR, "rc_send_server: namespace %s reset failed", ns);
-		}
+		pthread_mutex_destroy(&st->restart_lock);
 	}
 	free(st);
 }
@@ -530,29 +721,21 @@ void rc_deinit_tls(rc_handle * rh)
  -*/
 int rc_init_tls(rc_handle * rh, unsigned flags)
 {
-	int ret;
+	int ret = -1;
 	tls_st *st = NULL;
 	struct sockaddr_storage our_sockaddr;
 	const char *ca_file = rc_conf_str(rh, "tls-ca-file");
 	const char *cert_file = rc_conf_str(rh, "tls-cert-file");
 	const char *key_file = rc_conf_str(rh, "tls-key-file");
 	const char *pskkey = NULL;
+	const char *txt;
 	SERVER *authservers;
 	char hostname[256];	/* server's hostname */
 	unsigned port;		/* server's port */
-	char *ns = NULL;
-	int ns_def_hdl = 0;
+	unsigned i;
 
 	memset(&rh->so, 0, sizeof(rh->so));
 
-	ns = rc_conf_str(rh, "namespace"); /* Check for namespace config */
-	if (ns != NULL) {
-		if(-1 == rc_set_netns(ns, &ns_def_hdl)) {
-			rc_log(LOG_ERR, "rc_send_server: namespace %s set failed", ns);
-			return -1;
-		}
-	}
-
 	if (flags & SEC_FLAG_DTLS) {
 		rh->so_type = RC_SOCKET_DTLS;
 		rh->so.static_secret = DEFAULT_DTLS_SECRET;
@@ -571,9 +754,38 @@ int rc_init_tls(rc_handle * rh, unsigned flags)
 
 	st->rh = rh;
 	st->flags = flags;
+	pthread_mutex_init(&st->restart_lock, NULL);
+
+	txt = rc_conf_str(rh, "tls-multiplex");
+	if (txt && strcasecmp(txt, "true") == 0)
+		st->multiplex = 1;
 
 	rh->so.ptr = st;
 
+	st->nctx = rc_conf_int_2(rh, "tls-sessions", 0);
+	if (st->nctx == 0)
+		st->nctx = DEFAULT_TLS_SESSIONS;
+	if (st->nctx > MAX_TLS_SESSIONS) {
+		rc_log(LOG_ERR, "%s: tls-sessions must be between 1 and %u",
+		       __func__, MAX_TLS_SESSIONS);
+		ret = -1;
+		goto cleanup;
+	}
+
+	st->ctx = calloc(st->nctx, sizeof(tls_int_st));
+	if (st->ctx == NULL) {
+		ret = -1;
+		goto cleanup;
+	}
+	if (pthread_key_create(&st->current, NULL) != 0) {
+		free(st->ctx);
+		st->ctx = NULL;
+		ret = -1;
+		goto cleanup;
+	}
+	for (i = 0; i < st->nctx; i++)
+		pthread_mutex_init(&st->ctx[i].lock, NULL);
+
 	if (ca_file || (key_file && cert_file)) {
 		ret = gnutls_certificate_allocate_credentials(&st->x509_cred);
 		if (ret < 0) {
@@ -696,38 +908,43 @@ int rc_init_tls(rc_handle * rh, unsigned flags)
 		}
 	}
 
-	ret = init_session(rh, &st->ctx, hostname, port, &our_sockaddr, 0, flags);
-	if (ret < 0) {
-		ret = -1;
-		goto cleanup;
+	for (i = 0; i < st->nctx; i++) {
+		ret = init_session(rh, &st->ctx[i], hostname, port, &our_sockaddr, 0, flags);
+		if (ret < 0) {
+			ret = -1;
+			goto cleanup;
+		}
 	}
 
 	rh->so.get_fd = tls_get_fd;
 	rh->so.sendto = tls_sendto;
 	rh->so.recvfrom = tls_recvfrom;
-	rh->so.lock = tls_lock;
-	rh->so.unlock = tls_unlock;
-	if (ns != NULL) {
-		if(-1 == rc_reset_netns(&ns_def_hdl)) {
-			rc_log(LOG_ERR, "rc_send_server: namespace %s reset failed", ns);
+	rh->so.wait_fd = tls_wait_fd;
+	if (st->multiplex) {
+		/* only the record layer is serialized, by the connection
+		 * lock of the mux */
+		rh->tcpmux = rc_tcp_mux_new(RC_MUX_SHARED_FD |
+					    ((flags & SEC_FLAG_DTLS) ?
+					     RC_MUX_DATAGRAM : 0));
+		if (rh->tcpmux == NULL) {
+			ret = -1;
 			goto cleanup;
 		}
+	} else {
+		rh->so.lock = tls_lock;
+		rh->so.unlock = tls_unlock;
 	}
 	return 0;
  cleanup:
 	if (st) {
-		if (st->ctx.init != 0)
-			deinit_session(&st->ctx);
+		free_sessions(st);
 		if (st->x509_cred)
 			gnutls_certificate_free_credentials(st->x509_cred);
 		if (st->psk_cred)
 			gnutls_psk_free_client_credentials(st->psk_cred);
+		pthread_mutex_destroy(&st->restart_lock);
 	}
 	free(st);
-	if (ns != NULL) {
-		if(-1 == rc_reset_netns(&ns_def_hdl))
-		rc_log(LOG_ERR, "rc_send_server: namespace %s reset failed", ns);
-	}
 	return ret;
 }
 
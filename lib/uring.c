@@ -0,0 +1,584 @@
+/*
+ * uring.c	UDP transport over an io_uring submission ring.
+ *
+ * Each thread has its own ring, set up on its first operation, since an
+ * operation waits for its completions, for as long as the reply timeout
+ * when waiting for a reply; a ring shared by the threads of a handle
+ * would hold them all back meanwhile. The ring of a thread is released
+ * when the thread exits, and the remaining ones with the handle.
+ *
+ * A thread may exit while its handle is released, so the rings are owned
+ * under a lock which outlives the handles: a thread keeps the rings it
+ * set up in a table of its own, and at exit releases those of the
+ * handles which are still in use, told apart by a serial number, since
+ * the address of a released handle may be reused.
+ *
+ * License:	BSD
+ *
+ */
+
+#include <config.h>
+#include <includes.h>
+#include <radcli/radcli.h>
+#include "util.h"
+#include "uring.h"
+
+#ifdef HAVE_IO_URING
+
+#include <pthread.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/* a batch of RC_BATCH_MAX operations, or a poll and its timeout */
+#define RING_ENTRIES (2 * RC_BATCH_MAX)
+
+typedef struct uring_ring {
+	int fd;
+
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ptr;
+	size_t sq_len;
+	void *cq_ptr;
+	size_t cq_len;
+	size_t sqes_len;
+
+	struct uring_ring *prev, *next;	/* in the rings of the handle */
+} uring_ring;
+
+struct rc_uring {
+	uint64_t serial;
+	uring_ring *rings;	/* of the threads which used the handle */
+	struct rc_uring *next;	/* in live_urings */
+};
+
+/* the rings of a thread, one per handle it used */
+typedef struct thread_rings {
+	unsigned n, size;
+	struct thread_ring {
+		struct rc_uring *uring;
+		uint64_t serial;
+		uring_ring *ring;
+	} *entries;
+} thread_rings;
+
+/* protects live_urings and the rings of every handle */
+static pthread_mutex_t uring_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct rc_uring *live_urings;
+static uint64_t uring_serial;
+
+static pthread_key_t rings_key;	/* the thread_rings of the calling thread */
+static pthread_once_t rings_once = PTHREAD_ONCE_INIT;
+static int rings_key_error;
+
+static uring_ring *get_ring(struct rc_uring *uring);
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+			      unsigned flags)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+			    flags, NULL, 0);
+}
+
+/*- Returns a cleared submission entry; n is its position in the current batch
+ -*/
+static struct io_uring_sqe *get_sqe(uring_ring *ring, unsigned n)
+{
+	unsigned tail = *ring->sq_tail + n;
+	unsigned idx = tail & *ring->sq_mask;
+
+	ring->sq_array[idx] = idx;
+	memset(&ring->sqes[idx], 0, sizeof(ring->sqes[idx]));
+	ring->sqes[idx].user_data = n;
+	return &ring->sqes[idx];
+}
+
+/*- Submits n prepared entries and collects their results in order
+ *
+ * @return 0 on success, or -1 if the ring could not be entered.
+ -*/
+static int submit_and_wait(uring_ring *ring, unsigned n, int *res)
+{
+	unsigned head, done = 0;
+	struct io_uring_cqe *cqe;
+	int ret;
+
+	__atomic_store_n(ring->sq_tail, *ring->sq_tail + n, __ATOMIC_RELEASE);
+
+	while (done < n) {
+		ret = sys_io_uring_enter(ring->fd, done == 0 ? n : 0, n - done,
+					 IORING_ENTER_GETEVENTS);
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		head = *ring->cq_head;
+		while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+			cqe = &ring->cqes[head & *ring->cq_mask];
+			if (cqe->user_data < n)
+				res[cqe->user_data] = cqe->res;
+			head++;
+			done++;
+		}
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	return 0;
+}
+
+static void prep_msg(struct io_uring_sqe *sqe, int op, int sockfd,
+		     struct msghdr *msg, int flags)
+{
+	sqe->opcode = op;
+	sqe->fd = sockfd;
+	sqe->addr = (unsigned long)msg;
+	sqe->len = 1;
+	sqe->msg_flags = flags;
+}
+
+/*- Runs a linked chain of send or receive operations
+ *
+ * A failed operation cancels the ones after it, so the datagrams moved
+ * are always a prefix of msgs.
+ -*/
+static int uring_batch(void *ptr, int op, int sockfd, rc_dgram *msgs,
+		       unsigned vlen, int flags)
+{
+	uring_ring *ring;
+	struct msghdr hdr[RC_BATCH_MAX];
+	struct iovec iov[RC_BATCH_MAX];
+	struct io_uring_sqe *sqe;
+	int res[RC_BATCH_MAX];
+	unsigned i;
+
+	vlen = RC_MIN(vlen, RC_BATCH_MAX);
+	if (vlen == 0)
+		return 0;
+
+	ring = get_ring(ptr);
+	if (ring == NULL)
+		return -1;
+
+	memset(hdr, 0, vlen * sizeof(hdr[0]));
+
+	for (i = 0; i < vlen; i++) {
+		iov[i].iov_base = msgs[i].buf;
+		iov[i].iov_len = msgs[i].len;
+		hdr[i].msg_iov = &iov[i];
+		hdr[i].msg_iovlen = 1;
+		hdr[i].msg_name = msgs[i].addr;
+		hdr[i].msg_namelen = msgs[i].addrlen;
+
+		sqe = get_sqe(ring, i);
+		/* as with recvmmsg(), only the first receive may block */
+		prep_msg(sqe, op, sockfd, &hdr[i],
+			 (op == IORING_OP_RECVMSG && i > 0) ? flags | MSG_DONTWAIT : flags);
+		if (i + 1 < vlen)
+			sqe->flags |= IOSQE_IO_LINK;
+	}
+
+	if (submit_and_wait(ring, vlen, res) < 0)
+		return -1;
+
+	for (i = 0; i < vlen; i++) {
+		if (res[i] < 0)
+			break;
+		if (op == IORING_OP_RECVMSG) {
+			msgs[i].len = res[i];
+			msgs[i].addrlen = hdr[i].msg_namelen;
+		}
+	}
+
+	if (i == 0) {
+		errno = -res[0];
+		return -1;
+	}
+	return i;
+}
+
+static int uring_sendmmsg(void *ptr, int sockfd, rc_dgram *msgs,
+			  unsigned vlen, int flags)
+{
+	return uring_batch(ptr, IORING_OP_SENDMSG, sockfd, msgs, vlen, flags);
+}
+
+static int uring_recvmmsg(void *ptr, int sockfd, rc_dgram *msgs,
+			  unsigned vlen, int flags)
+{
+	return uring_batch(ptr, IORING_OP_RECVMSG, sockfd, msgs, vlen, flags);
+}
+
+static ssize_t uring_sendto(void *ptr, int sockfd, const void *buf, size_t len,
+			    int flags, const struct sockaddr *dest_addr,
+			    socklen_t addrlen)
+{
+	rc_dgram msg;
+
+	msg.buf = (void *)buf;
+	msg.len = len;
+	msg.addr = (struct sockaddr *)dest_addr;
+	msg.addrlen = addrlen;
+
+	if (uring_batch(ptr, IORING_OP_SENDMSG, sockfd, &msg, 1, flags) < 0)
+		return -1;
+	return len;
+}
+
+static ssize_t uring_recvfrom(void *ptr, int sockfd, void *buf, size_t len,
+			      int flags, struct sockaddr *src_addr,
+			      socklen_t *addrlen)
+{
+	rc_dgram msg;
+
+	msg.buf = buf;
+	msg.len = len;
+	msg.addr = src_addr;
+	msg.addrlen = addrlen ? *addrlen : 0;
+
+	if (uring_batch(ptr, IORING_OP_RECVMSG, sockfd, &msg, 1, flags) < 0)
+		return -1;
+
+	if (addrlen)
+		*addrlen = msg.addrlen;
+	return msg.len;
+}
+
+/*- Waits for a socket to become readable, with the timeout kept in the kernel
+ -*/
+static int uring_wait_fd(void *ptr, int sockfd, int timeout_ms)
+{
+	struct __kernel_timespec ts;
+	struct io_uring_sqe *sqe;
+	uring_ring *ring;
+	int res[2];
+
+	ring = get_ring(ptr);
+	if (ring == NULL)
+		return -1;
+
+	ts.tv_sec = timeout_ms / 1000;
+	ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+
+	sqe = get_sqe(ring, 0);
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = sockfd;
+	sqe->poll_events = POLLIN;
+	sqe->flags = IOSQE_IO_LINK;
+
+	sqe = get_sqe(ring, 1);
+	sqe->opcode = IORING_OP_LINK_TIMEOUT;
+	sqe->fd = -1;
+	sqe->addr = (unsigned long)&ts;
+	sqe->len = 1;
+
+	if (submit_and_wait(ring, 2, res) < 0)
+		return -1;
+
+	if (res[0] >= 0)
+		return 1;
+	if (res[0] == -ECANCELED)
+		return 0;
+
+	errno = -res[0];
+	return -1;
+}
+
+static void ring_free(uring_ring *ring)
+{
+	if (ring->sqes && ring->sqes != MAP_FAILED)
+		munmap(ring->sqes, ring->sqes_len);
+	if (ring->cq_ptr && ring->cq_ptr != MAP_FAILED && ring->cq_ptr != ring->sq_ptr)
+		munmap(ring->cq_ptr, ring->cq_len);
+	if (ring->sq_ptr && ring->sq_ptr != MAP_FAILED)
+		munmap(ring->sq_ptr, ring->sq_len);
+	if (ring->fd >= 0)
+		close(ring->fd);
+	free(ring);
+}
+
+/*- Sets up a ring
+ *
+ * @return the ring, or NULL when io_uring is not available.
+ -*/
+static uring_ring *ring_new(void)
+{
+	struct io_uring_params p;
+	uring_ring *ring;
+
+	ring = calloc(1, sizeof(*ring));
+	if (ring == NULL) {
+		rc_log(LOG_CRIT, "%s: out of memory", __func__);
+		return NULL;
+	}
+
+	memset(&p, 0, sizeof(p));
+	ring->fd = sys_io_uring_setup(RING_ENTRIES, &p);
+	if (ring->fd < 0) {
+		rc_log(LOG_ERR, "%s: io_uring_setup: %s", __func__, strerror(errno));
+		goto fail;
+	}
+
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP) ||
+	    !(p.features & IORING_FEAT_NODROP)) {
+		rc_log(LOG_ERR, "%s: the kernel io_uring is too old", __func__);
+		goto fail;
+	}
+
+	ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (ring->cq_len > ring->sq_len)
+		ring->sq_len = ring->cq_len;
+	ring->cq_len = ring->sq_len;
+
+	ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ptr == MAP_FAILED)
+		goto fail_mmap;
+	ring->cq_ptr = ring->sq_ptr;
+
+	ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED)
+		goto fail_mmap;
+
+	ring->sq_head = (unsigned *)((char *)ring->sq_ptr + p.sq_off.head);
+	ring->sq_tail = (unsigned *)((char *)ring->sq_ptr + p.sq_off.tail);
+	ring->sq_mask = (unsigned *)((char *)ring->sq_ptr + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)((char *)ring->sq_ptr + p.sq_off.array);
+	ring->cq_head = (unsigned *)((char *)ring->cq_ptr + p.cq_off.head);
+	ring->cq_tail = (unsigned *)((char *)ring->cq_ptr + p.cq_off.tail);
+	ring->cq_mask = (unsigned *)((char *)ring->cq_ptr + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_ptr + p.cq_off.cqes);
+
+	return ring;
+
+ fail_mmap:
+	rc_log(LOG_ERR, "%s: mmap: %s", __func__, strerror(errno));
+ fail:
+	ring_free(ring);
+	return NULL;
+}
+
+/*- Returns whether a handle is still in use; called with uring_lock held
+ -*/
+static int uring_live(const struct rc_uring *uring, uint64_t serial)
+{
+	struct rc_uring *u;
+
+	for (u = live_urings; u != NULL; u = u->next) {
+		if (u == uring && u->serial == serial)
+			return 1;
+	}
+	return 0;
+}
+
+/*- Unlinks a ring from its handle; called with uring_lock held
+ -*/
+static void ring_unlink(struct rc_uring *uring, uring_ring *ring)
+{
+	if (ring->prev != NULL)
+		ring->prev->next = ring->next;
+	else
+		uring->rings = ring->next;
+	if (ring->next != NULL)
+		ring->next->prev = ring->prev;
+}
+
+/*- Releases the rings of an exiting thread
+ *
+ * The rings of the handles already released were released with them.
+ -*/
+static void rings_release(void *ptr)
+{
+	thread_rings *t = ptr;
+	unsigned i;
+
+	pthread_mutex_lock(&uring_lock);
+	for (i = 0; i < t->n; i++) {
+		if (!uring_live(t->entries[i].uring, t->entries[i].serial))
+			continue;
+		ring_unlink(t->entries[i].uring, t->entries[i].ring);
+		ring_free(t->entries[i].ring);
+	}
+	pthread_mutex_unlock(&uring_lock);
+
+	free(t->entries);
+	free(t);
+}
+
+static void rings_key_create(void)
+{
+	if (pthread_key_create(&rings_key, rings_release) != 0)
+		rings_key_error = 1;
+}
+
+/*- Returns the ring of the calling thread, which is set up on first use
+ *
+ * @return the ring, or NULL on failure.
+ -*/
+static uring_ring *get_ring(struct rc_uring *uring)
+{
+	thread_rings *t;
+	struct thread_ring *entries;
+	uring_ring *ring;
+	unsigned i, n;
+
+	t = pthread_getspecific(rings_key);
+	if (t != NULL) {
+		for (i = 0; i < t->n; i++) {
+			if (t->entries[i].uring == uring &&
+			    t->entries[i].serial == uring->serial)
+				return t->entries[i].ring;
+		}
+	} else {
+		t = calloc(1, sizeof(*t));
+		if (t == NULL || pthread_setspecific(rings_key, t) != 0) {
+			rc_log(LOG_CRIT, "%s: out of memory", __func__);
+			free(t);
+			return NULL;
+		}
+	}
+
+	ring = ring_new();
+	if (ring == NULL)
+		return NULL;
+
+	pthread_mutex_lock(&uring_lock);
+	/* the entries of the handles released meanwhile are dropped */
+	for (i = 0, n = 0; i < t->n; i++) {
+		if (uring_live(t->entries[i].uring, t->entries[i].serial))
+			t->entries[n++] = t->entries[i];
+	}
+	t->n = n;
+
+	if (t->n == t->size) {
+		entries = realloc(t->entries, (t->size + 4) * sizeof(*entries));
+		if (entries == NULL) {
+			pthread_mutex_unlock(&uring_lock);
+			rc_log(LOG_CRIT, "%s: out of memory", __func__);
+			ring_free(ring);
+			return NULL;
+		}
+		t->entries = entries;
+		t->size += 4;
+	}
+	t->entries[t->n].uring = uring;
+	t->entries[t->n].serial = uring->serial;
+	t->entries[t->n].ring = ring;
+	t->n++;
+
+	ring->prev = NULL;
+	ring->next = uring->rings;
+	if (ring->next != NULL)
+		ring->next->prev = ring;
+	uring->rings = ring;
+	pthread_mutex_unlock(&uring_lock);
+
+	return ring;
+}
+
+/*- Releases a handle and the rings of the threads which used it
+ -*/
+static void uring_free(struct rc_uring *uring)
+{
+	struct rc_uring **pp;
+	uring_ring *ring, *next;
+
+	pthread_mutex_lock(&uring_lock);
+	for (pp = &live_urings; *pp != NULL; pp = &(*pp)->next) {
+		if (*pp == uring) {
+			*pp = uring->next;
+			break;
+		}
+	}
+
+	for (ring = uring->rings; ring != NULL; ring = next) {
+		next = ring->next;
+		ring_free(ring);
+	}
+	pthread_mutex_unlock(&uring_lock);
+
+	free(uring);
+}
+
+/*- Switches the UDP transport of a handle to io_uring
+ *
+ * The handle must have been set up with the default UDP socket functions;
+ * socket creation is kept, while data transfer and waiting for replies
+ * are submitted through the ring of the calling thread.
+ *
+ * @param rh a handle to parsed configuration.
+ * @return 0 on success, -1 when io_uring is not available.
+ -*/
+int rc_init_uring(rc_handle *rh)
+{
+	struct rc_uring *uring;
+
+	uring = calloc(1, sizeof(*uring));
+	if (uring == NULL) {
+		rc_log(LOG_CRIT, "%s: out of memory", __func__);
+		return -1;
+	}
+
+	pthread_once(&rings_once, rings_key_create);
+	if (rings_key_error) {
+		rc_log(LOG_ERR, "%s: pthread_key_create failed", __func__);
+		free(uring);
+		return -1;
+	}
+
+	pthread_mutex_lock(&uring_lock);
+	uring->serial = ++uring_serial;
+	uring->next = live_urings;
+	live_urings = uring;
+	pthread_mutex_unlock(&uring_lock);
+
+	/* the ring of this thread tells whether io_uring is available */
+	if (get_ring(uring) == NULL) {
+		uring_free(uring);
+		return -1;
+	}
+
+	rh->uring = uring;
+	rh->so.ptr = uring;
+	rh->so.sendto = uring_sendto;
+	rh->so.recvfrom = uring_recvfrom;
+	rh->so.sendmmsg = uring_sendmmsg;
+	rh->so.recvmmsg = uring_recvmmsg;
+	rh->so.wait_fd = uring_wait_fd;
+
+	return 0;
+}
+
+/*- Releases the rings of a handle
+ -*/
+void rc_deinit_uring(rc_handle *rh)
+{
+	if (rh->uring == NULL)
+		return;
+
+	uring_free(rh->uring);
+	rh->uring = NULL;
+}
+
+#endif /* HAVE_IO_URING */
@@ -0,0 +1,17 @@
+/*
+ * uring.h	Internal io_uring UDP transport.
+ *
+ * License:	BSD
+ *
+ */
+#ifndef URING_H
+# define URING_H
+
+#include <config.h>
+
+#ifdef HAVE_IO_URING
+int rc_init_uring(rc_handle *rh);
+void rc_deinit_uring(rc_handle *rh);
+#endif
+
+#endif /* URING_H */
@@ -46,8 +46,8 @@ struct addrinfo *rc_getaddrinfo (char const *host, unsigned flags);
 void rc_own_bind_addr(rc_handle *rh, struct sockaddr_storage *lia);
 double rc_getmtime(void);
 void rc_str2tm (char const *valstr, struct tm *tm);
-int rc_set_netns(const char *net_namespace, int *prev_ns_handle);
-int rc_reset_netns(int *prev_ns_handle);
+int rc_conf_int_2(rc_handle const *rh, char const *optname, int complain);
+int rc_conf_timeout_ms(rc_handle const *rh);
 
 #undef rc_log
 
@@ -0,0 +1,39 @@
+/*
+ * radcrypto.c - measures the crypto providers available to radcli on
+ * this host, and prints the crypto-provider option selecting the fastest.
+ *
+ * See the file COPYRIGHT for the respective terms and conditions.
+ *
+ */
+
+#include	<config.h>
+#include	<stdio.h>
+#include	<radcli/radcli.h>
+
+#define MAX_PROVIDERS	8
+
+int
+main (int argc, char **argv)
+{
+	rc_crypto_bench	results[MAX_PROVIDERS];
+	int		n, i, best = 0;
+
+	rc_openlog("radcrypto");
+
+	n = rc_crypto_benchmark(results, MAX_PROVIDERS);
+	if (n <= 0) {
+		fprintf(stderr, "no crypto provider is usable\n");
+		return ERROR_RC;
+	}
+
+	for (i = 0; i < n; i++) {
+		printf("%-10s %8.0f ns per request\n", results[i].name,
+		       results[i].ns);
+		if (results[i].ns < results[best].ns)
+			best = i;
+	}
+
+	printf("\ncrypto-provider\t%s\n", results[best].name);
+
+	return 0;
+}
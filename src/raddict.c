@@ -0,0 +1,42 @@
+/*
+ * raddict.c - compiles a dictionary and the files it includes into a
+ * binary dictionary, which radcli maps in memory instead of parsing.
+ *
+ * See the file COPYRIGHT for the respective terms and conditions.
+ *
+ */
+
+#include	<config.h>
+#include	<stdio.h>
+#include	<radcli/radcli.h>
+
+int
+main (int argc, char **argv)
+{
+	rc_handle	*rh;
+	int		ret = 0;
+
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s <dictionary> <binary dictionary>\n",
+			argv[0]);
+		return ERROR_RC;
+	}
+
+	rc_openlog("raddict");
+
+	rh = rc_new();
+	if (rh == NULL || (rh = rc_config_init(rh)) == NULL) {
+		fprintf(stderr, "%s: failed to initialize\n", argv[0]);
+		return ERROR_RC;
+	}
+
+	if (rc_read_dictionary(rh, argv[1]) != 0 ||
+	    rc_write_dictionary(rh, argv[2]) != 0) {
+		fprintf(stderr, "%s: could not compile %s; see the system log\n",
+			argv[0], argv[1]);
+		ret = ERROR_RC;
+	}
+
+	rc_destroy(rh);
+	return ret;
+}
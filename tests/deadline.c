@@ -0,0 +1,167 @@
+/*
+ * deadline.c	Checks of the request deadlines.
+ *
+ * License:	BSD
+ *
+ */
+
+
+/* Checks that a request deadline bounds the time spent in retries and
+ * failover, that the servers still share it, and that the radius_deadline_ms
+ * option and rc_aaa_ctx_server_deadline() are honoured, also when hedging. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <radcli/radcli.h>
+#include "mock-server.h"
+
+#define SERVERS 3
+
+/* the number of requests each server saw, and whether it replies */
+struct server_state {
+	unsigned requests;
+	unsigned silent;
+};
+
+static int handler(struct mock_server *ms, const uint8_t *pkt, int len,
+		   const struct sockaddr_in *from)
+{
+	struct server_state *state = ms->usr;
+
+	state->requests++;
+	if (state->silent)
+		return MOCK_DROP;
+
+	return MOCK_REPLY;
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static rc_handle *init_handle(struct mock_server *ms, const char *deadline,
+			      const char *hedge)
+{
+	char servers[256];
+
+	mock_servers(servers, sizeof(servers), ms, SERVERS);
+	return mock_handle_new(servers, "radius_timeout", "2",
+			       "radius_retries", "2", "radius_deadline_ms", deadline,
+			       "radius_hedge_delay", hedge, NULL);
+}
+
+/* sends a request with rc_auth(), or with the given deadline if non-zero */
+static int send_request(rc_handle *rh, int deadline_ms)
+{
+	VALUE_PAIR *send = NULL, *received = NULL;
+	uint32_t service = PW_AUTHENTICATE_ONLY;
+	char msg[PW_MAX_MSG_SIZE];
+	int ret;
+
+	if (deadline_ms <= 0)
+		return mock_send_auth(rh, "test");
+
+	if (rc_avpair_add(rh, &send, PW_USER_NAME, "test", -1, 0) == NULL ||
+	    rc_avpair_add(rh, &send, PW_SERVICE_TYPE, &service, -1, 0) == NULL) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	ret = rc_aaa_ctx_server_deadline(rh, NULL, rc_conf_srv(rh, "authserver"),
+					 AUTH, 0, send, &received, msg, 0,
+					 PW_ACCESS_REQUEST, deadline_ms);
+
+	rc_avpair_free(send);
+	rc_avpair_free(received);
+	return ret;
+}
+
+static void set_silent(struct server_state *state, unsigned silent)
+{
+	int i;
+
+	for (i = 0; i < SERVERS; i++) {
+		state[i].requests = 0;
+		state[i].silent = silent;
+	}
+}
+
+/* checks that a request to silent servers completes within [min, max] */
+static void check_timeout(rc_handle *rh, struct server_state *state,
+			  int deadline_ms, double min, double max)
+{
+	double start, elapsed;
+
+	set_silent(state, 1);
+	start = now();
+	if (send_request(rh, deadline_ms) != TIMEOUT_RC) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	elapsed = now() - start;
+	if (elapsed < min || elapsed > max) {
+		fprintf(stderr, "error in %d: the request took %.2fs\n",
+			__LINE__, elapsed);
+		exit(1);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct server_state state[SERVERS];
+	struct mock_server ms[SERVERS];
+	rc_handle *rh;
+	int i;
+
+	memset(state, 0, sizeof(state));
+	for (i = 0; i < SERVERS; i++) {
+		if (mock_server_start(&ms[i], handler, &state[i]) < 0) {
+			fprintf(stderr, "error in %d\n", __LINE__);
+			exit(1);
+		}
+	}
+
+	/* without a deadline this would take 18 seconds */
+	rh = init_handle(ms, "0", "0");
+	check_timeout(rh, state, 600, 0.5, 1.2);
+	for (i = 0; i < SERVERS; i++) {
+		if (state[i].requests != 3) {
+			fprintf(stderr, "error in %d: server %d saw %u requests\n",
+				__LINE__, i, state[i].requests);
+			exit(1);
+		}
+	}
+
+	set_silent(state, 0);
+	if (send_request(rh, 600) != OK_RC) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	rc_destroy(rh);
+
+	/* the option applies to rc_auth() */
+	rh = init_handle(ms, "300", "0");
+	check_timeout(rh, state, 0, 0.25, 0.9);
+	rc_destroy(rh);
+
+	/* and bounds the hedged requests */
+	rh = init_handle(ms, "400", "100");
+	check_timeout(rh, state, 0, 0.35, 1.0);
+	if (state[1].requests == 0) {
+		fprintf(stderr, "error in %d: the request was not hedged\n", __LINE__);
+		exit(1);
+	}
+	rc_destroy(rh);
+
+	for (i = 0; i < SERVERS; i++)
+		mock_server_stop(&ms[i]);
+
+	return 0;
+}
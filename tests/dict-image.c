@@ -0,0 +1,285 @@
+/*
+ * dict-image.c	Checks of the binary dictionaries.
+ *
+ * License:	BSD
+ *
+ */
+
+/*
+ * Checks the binary dictionaries: an image compiled from a text
+ * dictionary answers every lookup as the text does, also when a text
+ * dictionary includes it, entries added later override it, and a damaged
+ * image, one of another version or one given as a buffer is refused.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include <radcli/radcli.h>
+
+#define NVENDORS	10
+#define NATTRS		300	/* per vendor */
+#define NVALUES		10	/* per integer attribute */
+
+static char overrides_dict[] =
+"VENDOR		Acme		9999\n"
+"ATTRIBUTE	Acme-Color	1	integer	Acme\n"
+"VALUE		Acme-Color	Red	1\n"
+"VALUE		Acme-Color	Green	2\n"
+"ATTRIBUTE	Old-Name	200	string\n"
+"ATTRIBUTE	New-Name	200	ipaddr\n"
+"ATTRIBUTE	Renumbered	300	string\n"
+"ATTRIBUTE	Renumbered	301	date\n"
+"VALUE		Acme-Color	Crimson	1\n"
+"VENDOR		Acme		10000\n";
+
+static rc_handle *new_handle(void)
+{
+	rc_handle *rh;
+
+	rh = rc_new();
+	if (rh == NULL) {
+		printf("ERROR: Failed to allocate initial structure\n");
+		exit(1);
+	}
+
+	rh = rc_config_init(rh);
+	if (rh == NULL) {
+		printf("ERROR: Failed to initialize configuration\n");
+		exit(1);
+	}
+	return rh;
+}
+
+static void tmp_name(char *name)
+{
+	int fd;
+
+	strcpy(name, "/tmp/radcli-dict-XXXXXX");
+	fd = mkstemp(name);
+	assert(fd != -1);
+	close(fd);
+}
+
+static void write_text(char const *filename)
+{
+	unsigned v, a, i, pec;
+	FILE *fp;
+
+	fp = fopen(filename, "w");
+	assert(fp != NULL);
+	fputs(overrides_dict, fp);
+	for (a = 1; a < 256; a++) {
+		if (a != 200)
+			fprintf(fp, "ATTRIBUTE\tStd-%u\t%u\tinteger\n", a, a);
+	}
+	for (v = 0; v < NVENDORS; v++) {
+		pec = 1000 + v * 7;
+		fprintf(fp, "VENDOR\tVendor-%u\t%u\nBEGIN-VENDOR\tVendor-%u\n",
+			v, pec, v);
+		for (a = 1; a <= NATTRS; a++) {
+			fprintf(fp, "ATTRIBUTE\tV%u-Attr-%u\t%u\t%s\n",
+				v, a, a, a % 2 ? "integer" : "string");
+			if (a % 2 == 0)
+				continue;
+			for (i = 0; i < NVALUES; i++)
+				fprintf(fp, "VALUE\tV%u-Attr-%u\tV%u-A%u-Val-%u\t%u\n",
+					v, a, v, a, i, i);
+		}
+		fprintf(fp, "END-VENDOR\tVendor-%u\n", v);
+	}
+	assert(fclose(fp) == 0);
+}
+
+static void same_attr(DICT_ATTR *t, DICT_ATTR *i)
+{
+	assert(t != NULL && i != NULL && t != i);
+	assert(strcmp(t->name, i->name) == 0);
+	assert(t->value == i->value && t->type == i->type);
+}
+
+static void same_val(DICT_VALUE *t, DICT_VALUE *i)
+{
+	assert(t != NULL && i != NULL && t != i);
+	assert(strcmp(t->attrname, i->attrname) == 0);
+	assert(strcmp(t->name, i->name) == 0);
+	assert(t->value == i->value);
+}
+
+static void same_vend(DICT_VENDOR *t, DICT_VENDOR *i)
+{
+	assert(t != NULL && i != NULL && t != i);
+	assert(strcmp(t->vendorname, i->vendorname) == 0);
+	assert(t->vendorpec == i->vendorpec);
+}
+
+/* the image answers as the text */
+static void compare(rc_handle *th, rc_handle *ih)
+{
+	char name[64];
+	unsigned v, a, i, pec;
+	DICT_ATTR *attr;
+
+	for (a = 0; a < 256; a++) {
+		if (rc_dict_getattr(th, a) == NULL) {
+			assert(rc_dict_getattr(ih, a) == NULL);
+			continue;
+		}
+		same_attr(rc_dict_getattr(th, a), rc_dict_getattr(ih, a));
+	}
+
+	same_attr(rc_dict_findattr(th, "old-name"), rc_dict_findattr(ih, "OLD-NAME"));
+	same_attr(rc_dict_findattr(th, "Renumbered"), rc_dict_findattr(ih, "renumbered"));
+	same_attr(rc_dict_getattr(th, 300), rc_dict_getattr(ih, 300));
+	attr = rc_dict_findattr(ih, "Acme-Color");
+	same_attr(rc_dict_getattr(th, attr->value), rc_dict_getattr(ih, attr->value));
+	same_val(rc_dict_getval(th, 1, "Acme-Color"), rc_dict_getval(ih, 1, "Acme-Color"));
+	assert(strcmp(rc_dict_getval(ih, 1, "Acme-Color")->name, "Crimson") == 0);
+	same_val(rc_dict_findval(th, "red"), rc_dict_findval(ih, "RED"));
+	assert(rc_dict_getval(ih, 2, "acme-color") == NULL);
+	same_vend(rc_dict_findvend(th, "acme"), rc_dict_findvend(ih, "ACME"));
+	assert(rc_dict_findvend(ih, "Acme")->vendorpec == 10000);
+	same_vend(rc_dict_getvend(th, 9999), rc_dict_getvend(ih, 9999));
+
+	for (v = 0; v < NVENDORS; v++) {
+		pec = 1000 + v * 7;
+		snprintf(name, sizeof(name), "vendor-%u", v);
+		same_vend(rc_dict_findvend(th, name), rc_dict_findvend(ih, name));
+		same_vend(rc_dict_getvend(th, pec), rc_dict_getvend(ih, pec));
+
+		for (a = 1; a <= NATTRS; a++) {
+			snprintf(name, sizeof(name), "V%u-Attr-%u", v, a);
+			same_attr(rc_dict_findattr(th, name), rc_dict_findattr(ih, name));
+			same_attr(rc_dict_getattr(th, RADCLI_VENDOR_ATTR_SET(a, pec)),
+				  rc_dict_getattr(ih, RADCLI_VENDOR_ATTR_SET(a, pec)));
+			if (a % 2 == 0)
+				continue;
+
+			for (i = 0; i < NVALUES; i++) {
+				same_val(rc_dict_getval(th, i, name), rc_dict_getval(ih, i, name));
+				snprintf(name, sizeof(name), "V%u-A%u-Val-%u", v, a, i);
+				same_val(rc_dict_findval(th, name), rc_dict_findval(ih, name));
+				snprintf(name, sizeof(name), "V%u-Attr-%u", v, a);
+			}
+			assert(rc_dict_getval(ih, NVALUES, name) == NULL);
+		}
+		assert(rc_dict_getattr(ih, RADCLI_VENDOR_ATTR_SET(NATTRS + 1, pec)) == NULL);
+	}
+
+	assert(rc_dict_findattr(ih, "V0-Attr-0") == NULL);
+	assert(rc_dict_findval(ih, "V0-A2-Val-0") == NULL);
+	assert(rc_dict_getvend(ih, 999) == NULL);
+}
+
+/* a copy of an image with an octet changed, or truncated when off < 0 */
+static void damage(char const *image, char const *copy, long off)
+{
+	char buf[1 << 16];
+	FILE *in, *out;
+	size_t n, total = 0;
+	long size;
+
+	in = fopen(image, "r");
+	out = fopen(copy, "w");
+	assert(in != NULL && out != NULL);
+	fseek(in, 0, SEEK_END);
+	size = ftell(in);
+	rewind(in);
+
+	while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+		if (off >= 0 && (size_t)off >= total && (size_t)off < total + n)
+			buf[off - total] ^= 0x40;
+		if (off < 0 && total + n > (size_t)size / 2)
+			n = size / 2 - total;
+		assert(fwrite(buf, 1, n, out) == n);
+		total += n;
+		if (off < 0 && total == (size_t)size / 2)
+			break;
+	}
+	fclose(in);
+	assert(fclose(out) == 0);
+}
+
+int main(int argc, char **argv)
+{
+	char text[64], image[64], copy[64];
+	char buf[4096];
+	rc_handle *th, *ih;
+	DICT_ATTR *attr;
+	FILE *fp;
+	size_t n;
+
+	tmp_name(text);
+	tmp_name(image);
+	tmp_name(copy);
+	write_text(text);
+
+	th = new_handle();
+	assert(rc_read_dictionary(th, text) == 0);
+	assert(rc_write_dictionary(th, image) == 0);
+
+	ih = new_handle();
+	assert(rc_read_dictionary(ih, image) == 0);
+	compare(th, ih);
+
+	/* entries added afterwards override those of the image */
+	attr = rc_dict_addattr(ih, "Local", 200, PW_TYPE_STRING, 0);
+	assert(attr != NULL && rc_dict_getattr(ih, 200) == attr);
+	assert(rc_dict_findattr(ih, "New-Name") != NULL);
+	assert(rc_dict_findattr(ih, "new-name")->value == 200);
+
+	/* only one image per handle, and it is not compiled again */
+	assert(rc_write_dictionary(th, copy) == 0);
+	assert(rc_read_dictionary(ih, copy) != 0);
+	assert(rc_write_dictionary(ih, copy) != 0);
+	rc_destroy(ih);
+
+	/* an image named by $INCLUDE is mapped */
+	fp = fopen(copy, "w");
+	assert(fp != NULL);
+	fprintf(fp, "$INCLUDE %s\n", image);
+	assert(fclose(fp) == 0);
+	ih = new_handle();
+	assert(rc_read_dictionary(ih, copy) == 0);
+	compare(th, ih);
+	rc_destroy(ih);
+
+	/* an image cannot be parsed from a buffer */
+	fp = fopen(image, "r");
+	assert(fp != NULL);
+	n = fread(buf, 1, sizeof(buf), fp);
+	fclose(fp);
+	ih = new_handle();
+	assert(rc_read_dictionary_from_buffer(ih, buf, n) != 0);
+	rc_destroy(ih);
+
+	/* rc_dict_free() releases the image */
+	ih = new_handle();
+	assert(rc_read_dictionary(ih, image) == 0);
+	rc_dict_free(ih);
+	assert(rc_dict_findattr(ih, "Old-Name") == NULL);
+	assert(rc_read_dictionary_from_buffer(ih, overrides_dict,
+					      sizeof(overrides_dict) - 1) == 0);
+	assert(rc_dict_getattr(ih, 200) != NULL);
+	rc_destroy(ih);
+
+	/* damaged images and those of another format version */
+	damage(image, copy, -1);
+	ih = new_handle();
+	assert(rc_read_dictionary(ih, copy) != 0);
+	rc_destroy(ih);
+
+	damage(image, copy, 8);
+	ih = new_handle();
+	assert(rc_read_dictionary(ih, copy) != 0);
+	rc_destroy(ih);
+
+	rc_destroy(th);
+	unlink(text);
+	unlink(image);
+	unlink(copy);
+	return 0;
+}
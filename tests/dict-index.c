@@ -0,0 +1,195 @@
+/*
+ * dict-index.c	Checks of the indexed dictionary lookups.
+ *
+ * License:	BSD
+ *
+ */
+
+/*
+ * Checks the indexed lookups of the dictionary: the entry defined last
+ * wins, names are compared regardless of case, and every entry of a
+ * dictionary of thousands is found by name and by number.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <radcli/radcli.h>
+
+#define NVENDORS	20
+#define NATTRS		300	/* per vendor */
+#define NVALUES		10	/* per integer attribute */
+
+static char overrides_dict[] =
+"VENDOR		Acme		9999\n"
+"ATTRIBUTE	Acme-Color	1	integer	Acme\n"
+"VALUE		Acme-Color	Red	1\n"
+"VALUE		Acme-Color	Green	2\n"
+"ATTRIBUTE	Old-Name	200	string\n"
+"ATTRIBUTE	New-Name	200	integer\n"
+"ATTRIBUTE	Renumbered	300	string\n"
+"ATTRIBUTE	Renumbered	301	string\n"
+"VALUE		Acme-Color	Crimson	1\n"
+"VENDOR		Acme		10000\n";
+
+static void check_overrides(rc_handle *rh)
+{
+	DICT_ATTR *attr;
+	DICT_VALUE *dv;
+	DICT_VENDOR *v;
+
+	assert(rc_read_dictionary_from_buffer(rh, overrides_dict,
+					      sizeof(overrides_dict) - 1) == 0);
+
+	/* the number of an attribute maps to the one defined last */
+	attr = rc_dict_getattr(rh, 200);
+	assert(attr != NULL && strcmp(attr->name, "New-Name") == 0);
+	assert(attr->type == PW_TYPE_INTEGER);
+	assert(rc_dict_findattr(rh, "old-name") != NULL);
+
+	/* and so does a name */
+	attr = rc_dict_findattr(rh, "RENUMBERED");
+	assert(attr != NULL && attr->value == 301);
+	assert(rc_dict_getattr(rh, 300) != NULL);
+
+	/* a VSA is found by its vendor and number */
+	attr = rc_dict_findattr(rh, "acme-color");
+	assert(attr != NULL);
+	assert(VENDOR(attr->value) == 9999 && ATTRID(attr->value) == 1);
+	assert(rc_dict_getattr(rh, attr->value) == attr);
+	assert(rc_dict_getattr(rh, 1) == NULL);
+
+	dv = rc_dict_getval(rh, 1, "Acme-Color");
+	assert(dv != NULL && strcmp(dv->name, "Crimson") == 0);
+	dv = rc_dict_findval(rh, "red");
+	assert(dv != NULL && dv->value == 1);
+	/* the attribute name of a value is compared with its case */
+	assert(rc_dict_getval(rh, 2, "acme-color") == NULL);
+	assert(rc_dict_getval(rh, 3, "Acme-Color") == NULL);
+
+	v = rc_dict_findvend(rh, "ACME");
+	assert(v != NULL && v->vendorpec == 10000);
+	v = rc_dict_getvend(rh, 9999);
+	assert(v != NULL && strcmp(v->vendorname, "Acme") == 0);
+
+	/* entries added through the API are indexed too */
+	attr = rc_dict_addattr(rh, "Added", 200, PW_TYPE_STRING, 0);
+	assert(attr != NULL && rc_dict_getattr(rh, 200) == attr);
+	assert(rc_dict_findattr(rh, "added") == attr);
+	dv = rc_dict_addval(rh, "Added", "Some", 7);
+	assert(dv != NULL && rc_dict_getval(rh, 7, "Added") == dv);
+	v = rc_dict_addvend(rh, "Other", 42);
+	assert(v != NULL && rc_dict_findvend(rh, "other") == v);
+
+	rc_dict_free(rh);
+	assert(rc_dict_getattr(rh, 200) == NULL);
+	assert(rc_dict_findattr(rh, "Added") == NULL);
+	assert(rc_dict_findval(rh, "Red") == NULL);
+	assert(rc_dict_getvend(rh, 9999) == NULL);
+}
+
+static void check_large(rc_handle *rh)
+{
+	char *buf, *p, name[64];
+	size_t size = 4 * 1024 * 1024;
+	unsigned v, a, i, pec;
+	DICT_ATTR *attr;
+	DICT_VALUE *dv;
+	DICT_VENDOR *vend;
+
+	p = buf = malloc(size);
+	assert(buf != NULL);
+
+	for (a = 1; a < 256; a++)
+		p += sprintf(p, "ATTRIBUTE\tStd-%u\t%u\tinteger\n", a, a);
+	for (v = 0; v < NVENDORS; v++) {
+		pec = 1000 + v * 7;
+		p += sprintf(p, "VENDOR\tVendor-%u\t%u\nBEGIN-VENDOR\tVendor-%u\n",
+			     v, pec, v);
+		for (a = 1; a <= NATTRS; a++) {
+			p += sprintf(p, "ATTRIBUTE\tV%u-Attr-%u\t%u\t%s\n",
+				     v, a, a, a % 2 ? "integer" : "string");
+			if (a % 2 == 0)
+				continue;
+			for (i = 0; i < NVALUES; i++)
+				p += sprintf(p, "VALUE\tV%u-Attr-%u\tV%u-A%u-Val-%u\t%u\n",
+					     v, a, v, a, i, i);
+		}
+		p += sprintf(p, "END-VENDOR\tVendor-%u\n", v);
+		assert((size_t)(p - buf) < size - 65536);
+	}
+
+	assert(rc_read_dictionary_from_buffer(rh, buf, p - buf) == 0);
+	free(buf);
+
+	for (a = 1; a < 256; a++) {
+		attr = rc_dict_getattr(rh, a);
+		assert(attr != NULL && attr->value == a);
+		snprintf(name, sizeof(name), "std-%u", a);
+		assert(rc_dict_findattr(rh, name) == attr);
+	}
+
+	for (v = 0; v < NVENDORS; v++) {
+		pec = 1000 + v * 7;
+		snprintf(name, sizeof(name), "VENDOR-%u", v);
+		vend = rc_dict_findvend(rh, name);
+		assert(vend != NULL && vend->vendorpec == pec);
+		assert(rc_dict_getvend(rh, pec) == vend);
+
+		for (a = 1; a <= NATTRS; a++) {
+			attr = rc_dict_getattr(rh, RADCLI_VENDOR_ATTR_SET(a, pec));
+			assert(attr != NULL);
+			snprintf(name, sizeof(name), "V%u-Attr-%u", v, a);
+			assert(strcmp(attr->name, name) == 0);
+			assert(rc_dict_findattr(rh, name) == attr);
+			if (a % 2 == 0)
+				continue;
+
+			for (i = 0; i < NVALUES; i++) {
+				dv = rc_dict_getval(rh, i, attr->name);
+				assert(dv != NULL && dv->value == i);
+				snprintf(name, sizeof(name), "V%u-A%u-Val-%u", v, a, i);
+				assert(strcmp(dv->name, name) == 0);
+				assert(rc_dict_findval(rh, name) == dv);
+			}
+			assert(rc_dict_getval(rh, NVALUES, attr->name) == NULL);
+		}
+		assert(rc_dict_getattr(rh, RADCLI_VENDOR_ATTR_SET(NATTRS + 1, pec)) == NULL);
+	}
+
+	assert(rc_dict_findattr(rh, "V0-Attr-0") == NULL);
+	assert(rc_dict_getvend(rh, 999) == NULL);
+
+	rc_dict_free(rh);
+}
+
+int main(int argc, char **argv)
+{
+	rc_handle *rh;
+
+	rh = rc_new();
+	if (rh == NULL) {
+		printf("ERROR: Failed to allocate initial structure\n");
+		exit(1);
+	}
+
+	rh = rc_config_init(rh);
+	if (rh == NULL) {
+		printf("ERROR: Failed to initialize configuration\n");
+		exit(1);
+	}
+
+	/* nothing is found before a dictionary is loaded */
+	assert(rc_dict_getattr(rh, 1) == NULL);
+	assert(rc_dict_findattr(rh, "User-Name") == NULL);
+	assert(rc_dict_getval(rh, 1, "Service-Type") == NULL);
+	assert(rc_dict_findvend(rh, "Acme") == NULL);
+
+	check_overrides(rh);
+	check_large(rh);
+
+	rc_destroy(rh);
+	return 0;
+}
@@ -0,0 +1,193 @@
+/*
+ * dnscache.c	Checks of the cache of server addresses.
+ *
+ * License:	BSD
+ *
+ */
+
+
+/* Checks that the address of a server is resolved once and then taken
+ * from the cache, that a stalled resolver does not delay the requests
+ * while the cache is refreshed, that the child of a fork() refreshes
+ * the entries it inherited, and that dns-cache-ttl 0 disables it.
+ * The resolver is replaced by one which knows a single name. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+
+#include <radcli/radcli.h>
+#include "mock-server.h"
+
+#define NAME "radius.test"
+
+static unsigned lookups;	/* of NAME */
+static unsigned stall_ms;	/* the time a lookup of NAME takes */
+
+struct fake_addrinfo {
+	struct addrinfo ai;
+	struct sockaddr_in sin;
+};
+
+int getaddrinfo(const char *node, const char *service,
+		const struct addrinfo *hints, struct addrinfo **res)
+{
+	struct fake_addrinfo *fa;
+	struct in_addr addr;
+	char *end;
+	long port = 0;
+
+	if (service != NULL) {
+		if (strcmp(service, "radius") == 0)
+			port = 1812;
+		else if (strcmp(service, "radius-acct") == 0)
+			port = 1813;
+		else {
+			port = strtol(service, &end, 10);
+			if (*end != '\0')
+				return EAI_SERVICE;
+		}
+	}
+
+	if (node == NULL) {
+		addr.s_addr = htonl(INADDR_ANY);
+	} else if (strcmp(node, NAME) == 0) {
+		__atomic_add_fetch(&lookups, 1, __ATOMIC_SEQ_CST);
+		usleep(stall_ms * 1000);
+		addr.s_addr = htonl(INADDR_LOOPBACK);
+	} else if (inet_pton(AF_INET, node, &addr) != 1) {
+		return EAI_NONAME;
+	}
+
+	fa = calloc(1, sizeof(*fa));
+	if (fa == NULL)
+		return EAI_MEMORY;
+	fa->sin.sin_family = AF_INET;
+	fa->sin.sin_addr = addr;
+	fa->sin.sin_port = htons(port);
+	fa->ai.ai_family = AF_INET;
+	fa->ai.ai_socktype = hints ? hints->ai_socktype : SOCK_DGRAM;
+	fa->ai.ai_addr = (struct sockaddr *)&fa->sin;
+	fa->ai.ai_addrlen = sizeof(fa->sin);
+	*res = &fa->ai;
+	return 0;
+}
+
+void freeaddrinfo(struct addrinfo *res)
+{
+	struct addrinfo *next;
+
+	for (; res != NULL; res = next) {
+		next = res->ai_next;
+		free(res);
+	}
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static rc_handle *init_handle(struct mock_server *ms, const char *ttl)
+{
+	char servers[64];
+
+	snprintf(servers, sizeof(servers), NAME ":%u:" MOCK_SECRET, ms->port);
+	return mock_handle_new(servers, "radius_timeout", "2",
+			       "radius_retries", "0", "dns-cache-ttl", ttl, NULL);
+}
+
+static void send_request(rc_handle *rh)
+{
+	if (mock_send_auth(rh, "test") != OK_RC) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct mock_server ms;
+	rc_handle *rh;
+	unsigned base;
+	double start;
+	pid_t pid;
+	int i, status;
+
+	if (mock_server_start(&ms, NULL, NULL) < 0) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	rh = init_handle(&ms, "1");
+	base = lookups;
+	for (i = 0; i < 5; i++)
+		send_request(rh);
+	if (lookups - base != 1) {
+		fprintf(stderr, "error in %d: %u lookups\n", __LINE__, lookups - base);
+		exit(1);
+	}
+
+	/* the entry expires and is refreshed while the resolver stalls */
+	stall_ms = 1500;
+	usleep(1200 * 1000);
+	start = now();
+	send_request(rh);
+	if (now() - start > 0.5) {
+		fprintf(stderr, "error in %d: the request waited for the resolver\n",
+			__LINE__);
+		exit(1);
+	}
+	if (lookups - base != 2) {
+		fprintf(stderr, "error in %d: %u lookups\n", __LINE__, lookups - base);
+		exit(1);
+	}
+	stall_ms = 0;
+
+	/* the refresh thread of the parent is not running in the child */
+	pid = fork();
+	if (pid == -1) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	if (pid == 0) {
+		base = lookups;
+		send_request(rh);
+		usleep(1500 * 1000);
+		if (lookups - base == 0) {
+			fprintf(stderr, "error in %d: %u lookups\n", __LINE__,
+				lookups - base);
+			exit(1);
+		}
+		rc_destroy(rh);
+		exit(0);
+	}
+	if (waitpid(pid, &status, 0) != pid ||
+	    !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "error in %d: the child failed\n", __LINE__);
+		exit(1);
+	}
+	rc_destroy(rh);
+
+	rh = init_handle(&ms, "0");
+	base = lookups;
+	for (i = 0; i < 3; i++)
+		send_request(rh);
+	if (lookups - base != 3) {
+		fprintf(stderr, "error in %d: %u lookups\n", __LINE__, lookups - base);
+		exit(1);
+	}
+	rc_destroy(rh);
+
+	mock_server_stop(&ms);
+
+	return 0;
+}
@@ -0,0 +1,147 @@
+/*
+ * engine-ids.c	Checks of the Identifier spaces of the engine.
+ *
+ * License:	BSD
+ *
+ */
+
+/* Checks that the asynchronous engine keeps a separate Identifier space
+ * per server on each socket: requests to two servers, more than 256 to
+ * each, must share the same two source ports rather than open four. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <radcli/radcli.h>
+#include "mock-server.h"
+
+#define REQUESTS 300
+#define MAX_PORTS 8
+
+struct ports {
+	unsigned port[MAX_PORTS];
+	unsigned n;
+};
+
+static int handler(struct mock_server *ms, const uint8_t *pkt, int len,
+		   const struct sockaddr_in *from)
+{
+	struct ports *p = ms->usr;
+	unsigned i;
+
+	for (i = 0; i < p->n; i++) {
+		if (p->port[i] == ntohs(from->sin_port))
+			break;
+	}
+	if (i == p->n && p->n < MAX_PORTS)
+		p->port[p->n++] = ntohs(from->sin_port);
+
+	return MOCK_REPLY;
+}
+
+static void completed(RC_ENGINE *engine, SEND_DATA *data, int result, void *usr)
+{
+	int *r = usr;
+
+	*r = result;
+	rc_avpair_free(data->receive_pairs);
+	data->receive_pairs = NULL;
+}
+
+/* the request is built for the authserver, then sent to the given one */
+static void init_data(rc_handle *rh, SEND_DATA *data, struct mock_server *ms)
+{
+	mock_init_data(rh, data, "test", 5, 2);
+	data->svc_port = ms->port;
+}
+
+int main(int argc, char **argv)
+{
+	static SEND_DATA data[2][REQUESTS];
+	static int results[2][REQUESTS];
+	struct mock_server ms[2];
+	struct ports ports[2];
+	char server_name[64];
+	RC_ENGINE *engine;
+	rc_handle *rh;
+	unsigned i, j, k;
+	int ret;
+
+	memset(ports, 0, sizeof(ports));
+	for (k = 0; k < 2; k++) {
+		if (mock_server_start(&ms[k], handler, &ports[k]) < 0) {
+			fprintf(stderr, "error in %d\n", __LINE__);
+			exit(1);
+		}
+	}
+
+	mock_servers(server_name, sizeof(server_name), ms, 1);
+	rh = mock_handle_new(server_name, NULL);
+
+	engine = rc_engine_new(rh);
+	if (engine == NULL) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	for (i = 0; i < REQUESTS; i++) {
+		for (k = 0; k < 2; k++) {
+			init_data(rh, &data[k][i], &ms[k]);
+			results[k][i] = -100;
+			ret = rc_engine_submit(engine, &data[k][i], AUTH, completed,
+					       &results[k][i]);
+			if (ret != OK_RC) {
+				fprintf(stderr, "error in %d: %d\n", __LINE__, ret);
+				exit(1);
+			}
+		}
+	}
+
+	while ((ret = rc_engine_run(engine, 1000)) > 0)
+		;
+
+	if (ret < 0) {
+		fprintf(stderr, "error in %d: %d\n", __LINE__, ret);
+		exit(1);
+	}
+
+	for (k = 0; k < 2; k++) {
+		for (i = 0; i < REQUESTS; i++) {
+			if (results[k][i] != OK_RC) {
+				fprintf(stderr, "error in %d: request %u/%u: %d\n",
+					__LINE__, k, i, results[k][i]);
+				exit(1);
+			}
+			rc_avpair_free(data[k][i].send_pairs);
+		}
+	}
+
+	rc_engine_free(engine);
+	rc_destroy(rh);
+
+	for (k = 0; k < 2; k++)
+		mock_server_stop(&ms[k]);
+
+	/* both servers must have been reached from the same two ports */
+	for (k = 0; k < 2; k++) {
+		if (ports[k].n != 2) {
+			fprintf(stderr, "error in %d: server %u saw %u ports\n",
+				__LINE__, k, ports[k].n);
+			exit(1);
+		}
+	}
+	for (i = 0; i < 2; i++) {
+		for (j = 0; j < 2; j++) {
+			if (ports[0].port[i] == ports[1].port[j])
+				break;
+		}
+		if (j == 2) {
+			fprintf(stderr, "error in %d: port %u not shared\n",
+				__LINE__, ports[0].port[i]);
+			exit(1);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,175 @@
+/*
+ * engine.c	Checks of the asynchronous engine.
+ *
+ * License:	BSD
+ *
+ */
+
+/* Runs many requests through the asynchronous engine against a minimal
+ * RADIUS server on the loopback interface. The server drops the first
+ * transmission of some requests, precedes some replies with a forged
+ * one, and never answers others. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <radcli/radcli.h>
+#include "mock-server.h"
+
+#define REQUESTS 600
+
+struct result {
+	int done;
+	int result;
+};
+
+static int handler(struct mock_server *ms, const uint8_t *pkt, int len,
+		   const struct sockaddr_in *from)
+{
+	static int retried = 0;
+
+	if (mock_has_user(pkt, len, "silent"))
+		return MOCK_DROP;
+
+	if (mock_has_user(pkt, len, "retry") && retried++ == 0)
+		return MOCK_DROP;
+
+	if (pkt[1] % 7 == 0)
+		return MOCK_FORGE;
+
+	return MOCK_REPLY;
+}
+
+static void completed(RC_ENGINE *engine, SEND_DATA *data, int result, void *usr)
+{
+	struct result *r = usr;
+
+	r->done++;
+	r->result = result;
+	rc_avpair_free(data->receive_pairs);
+	data->receive_pairs = NULL;
+}
+
+/* resubmits a request which failed, as rc_engine_run() allows */
+static void resubmit(RC_ENGINE *engine, SEND_DATA *data, int result, void *usr)
+{
+	struct result *r = usr;
+
+	r->done++;
+	r->result = result;
+	if (result == ERROR_RC)
+		r->result = rc_engine_submit(engine, data, AUTH, resubmit, usr);
+}
+
+int main(int argc, char **argv)
+{
+	static SEND_DATA data[REQUESTS];
+	static struct result results[REQUESTS];
+	SEND_DATA retry_data, silent_data;
+	struct result retry_res = { 0, 0 }, silent_res = { 0, 0 };
+	struct mock_server ms;
+	char server_name[64];
+	RC_ENGINE *engine;
+	rc_handle *rh;
+	int i, ret;
+
+	if (mock_server_start(&ms, handler, NULL) < 0) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	mock_servers(server_name, sizeof(server_name), &ms, 1);
+	rh = mock_handle_new(server_name, NULL);
+
+	engine = rc_engine_new(rh);
+	if (engine == NULL) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	mock_init_data(rh, &retry_data, "retry", 1, 1);
+	mock_init_data(rh, &silent_data, "silent", 1, 1);
+	if (rc_engine_submit(engine, &retry_data, AUTH, completed, &retry_res) != OK_RC ||
+	    rc_engine_submit(engine, &silent_data, AUTH, completed, &silent_res) != OK_RC) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	/* more requests than a single socket can hold in flight */
+	for (i = 0; i < REQUESTS; i++) {
+		mock_init_data(rh, &data[i], "test", 5, 2);
+		ret = rc_engine_submit(engine, &data[i], AUTH, completed, &results[i]);
+		if (ret != OK_RC) {
+			fprintf(stderr, "error in %d: %d\n", __LINE__, ret);
+			exit(1);
+		}
+	}
+
+	if (rc_engine_pending(engine) != REQUESTS + 2) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	while ((ret = rc_engine_run(engine, 1000)) > 0)
+		;
+
+	if (ret < 0) {
+		fprintf(stderr, "error in %d: %d\n", __LINE__, ret);
+		exit(1);
+	}
+
+	for (i = 0; i < REQUESTS; i++) {
+		if (results[i].done != 1 || results[i].result != OK_RC) {
+			fprintf(stderr, "error in %d: request %d: %d/%d\n", __LINE__,
+				i, results[i].done, results[i].result);
+			exit(1);
+		}
+		rc_avpair_free(data[i].send_pairs);
+	}
+
+	if (retry_res.done != 1 || retry_res.result != OK_RC) {
+		fprintf(stderr, "error in %d: %d\n", __LINE__, retry_res.result);
+		exit(1);
+	}
+
+	if (silent_res.done != 1 || silent_res.result != TIMEOUT_RC) {
+		fprintf(stderr, "error in %d: %d\n", __LINE__, silent_res.result);
+		exit(1);
+	}
+
+	rc_avpair_free(retry_data.send_pairs);
+	rc_avpair_free(silent_data.send_pairs);
+
+	rc_engine_free(engine);
+
+	/* the requests outstanding when the engine is freed fail, and cannot
+	 * be submitted again from their callback */
+	engine = rc_engine_new(rh);
+	if (engine == NULL) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	silent_res.done = 0;
+	mock_init_data(rh, &silent_data, "silent", 5, 0);
+	if (rc_engine_submit(engine, &silent_data, AUTH, resubmit, &silent_res) != OK_RC ||
+	    rc_engine_run(engine, 0) < 0) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	rc_engine_free(engine);
+	if (silent_res.done != 1 || silent_res.result != ERROR_RC) {
+		fprintf(stderr, "error in %d: %d/%d\n", __LINE__, silent_res.done,
+			silent_res.result);
+		exit(1);
+	}
+	rc_avpair_free(silent_data.send_pairs);
+
+	rc_destroy(rh);
+
+	mock_server_stop(&ms);
+
+	return 0;
+}
@@ -0,0 +1,130 @@
+/*
+ * health.c	Checks of the dead time of servers.
+ *
+ * License:	BSD
+ *
+ */
+
+
+/* Checks that with radius_deadtime a server which did not reply is
+ * skipped by the following requests, and is tried again once the dead
+ * time expired. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <radcli/radcli.h>
+#include "mock-server.h"
+
+/* the number of requests each server saw, and whether it replies */
+struct server_state {
+	unsigned requests;
+	unsigned silent;
+};
+
+static int handler(struct mock_server *ms, const uint8_t *pkt, int len,
+		   const struct sockaddr_in *from)
+{
+	struct server_state *state = ms->usr;
+
+	state->requests++;
+	if (state->silent)
+		return MOCK_DROP;
+
+	return MOCK_REPLY;
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+int main(int argc, char **argv)
+{
+	struct server_state first_state, second_state;
+	struct mock_server first, second;
+	char server_name[128];
+	rc_handle *rh;
+	double start;
+
+	memset(&first_state, 0, sizeof(first_state));
+	memset(&second_state, 0, sizeof(second_state));
+	if (mock_server_start(&first, handler, &first_state) < 0 ||
+	    mock_server_start(&second, handler, &second_state) < 0) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	snprintf(server_name, sizeof(server_name),
+		 "127.0.0.1:%u:" MOCK_SECRET ",127.0.0.1:%u:" MOCK_SECRET,
+		 first.port, second.port);
+	rh = mock_handle_new(server_name, "radius_timeout", "1",
+			     "radius_retries", "0", "radius_deadtime", "2", NULL);
+
+	/* the first server times out, and the second one replies */
+	first_state.silent = 1;
+	if (mock_send_auth(rh, "test") != OK_RC) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	if (first_state.requests != 1 || second_state.requests != 1) {
+		fprintf(stderr, "error in %d: %u/%u requests\n", __LINE__,
+			first_state.requests, second_state.requests);
+		exit(1);
+	}
+
+	/* the first server is now skipped */
+	if (mock_send_auth(rh, "test") != OK_RC) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	if (first_state.requests != 1 || second_state.requests != 2) {
+		fprintf(stderr, "error in %d: %u/%u requests\n", __LINE__,
+			first_state.requests, second_state.requests);
+		exit(1);
+	}
+
+	/* a dead server is still tried when all others fail */
+	second_state.silent = 1;
+	if (mock_send_auth(rh, "test") != TIMEOUT_RC) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	if (first_state.requests != 2 || second_state.requests != 3) {
+		fprintf(stderr, "error in %d: %u/%u requests\n", __LINE__,
+			first_state.requests, second_state.requests);
+		exit(1);
+	}
+
+	/* once the dead time expires, the first server is probed */
+	first_state.silent = 0;
+	second_state.silent = 0;
+	first_state.requests = second_state.requests = 0;
+	start = now();
+	sleep(3);
+	if (mock_send_auth(rh, "test") != OK_RC) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	if (first_state.requests != 1) {
+		fprintf(stderr, "error in %d: %u/%u requests\n", __LINE__,
+			first_state.requests, second_state.requests);
+		exit(1);
+	}
+	if (now() - start > 3.5) {
+		fprintf(stderr, "error in %d: the probe was slow\n", __LINE__);
+		exit(1);
+	}
+
+	rc_destroy(rh);
+	mock_server_stop(&first);
+	mock_server_stop(&second);
+
+	return 0;
+}
@@ -0,0 +1,166 @@
+/*
+ * hedge.c	Checks of the hedged requests.
+ *
+ * License:	BSD
+ *
+ */
+
+
+/* Checks that with radius_hedge_delay a request is also sent to the next
+ * server when the first does not reply in time, that the first reply
+ * is taken, that the next server is not used when the first replies
+ * before the delay, and that accounting requests are not hedged. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <radcli/radcli.h>
+#include "mock-server.h"
+
+/* the number of requests each server saw, and whether it replies */
+struct server_state {
+	unsigned requests;
+	unsigned silent;
+};
+
+static int handler(struct mock_server *ms, const uint8_t *pkt, int len,
+		   const struct sockaddr_in *from)
+{
+	struct server_state *state = ms->usr;
+
+	state->requests++;
+	if (state->silent)
+		return MOCK_DROP;
+
+	return MOCK_REPLY;
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static rc_handle *init_handle(struct mock_server *first,
+			      struct mock_server *second, const char *delay)
+{
+	char servers[128];
+
+	snprintf(servers, sizeof(servers),
+		 "127.0.0.1:%u:" MOCK_SECRET ",127.0.0.1:%u:" MOCK_SECRET,
+		 first->port, second->port);
+	return mock_handle_new(servers, "radius_timeout", "1",
+			       "radius_retries", "1", "radius_hedge_delay", delay,
+			       NULL);
+}
+
+static int send_request(rc_handle *rh, int acct)
+{
+	VALUE_PAIR *send = NULL;
+	uint32_t status = PW_STATUS_START;
+	int ret;
+
+	if (!acct)
+		return mock_send_auth(rh, "test");
+
+	if (rc_avpair_add(rh, &send, PW_USER_NAME, "test", -1, 0) == NULL ||
+	    rc_avpair_add(rh, &send, PW_ACCT_STATUS_TYPE, &status, -1, 0) == NULL ||
+	    rc_avpair_add(rh, &send, PW_ACCT_SESSION_ID, "1", -1, 0) == NULL) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	ret = rc_acct(rh, 0, send);
+
+	rc_avpair_free(send);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	struct server_state first_state, second_state;
+	struct mock_server first, second;
+	rc_handle *rh;
+	double start;
+	int ret;
+
+	memset(&first_state, 0, sizeof(first_state));
+	memset(&second_state, 0, sizeof(second_state));
+	if (mock_server_start(&first, handler, &first_state) < 0 ||
+	    mock_server_start(&second, handler, &second_state) < 0) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	/* the first server is down: the second answers after the delay,
+	 * well before the first would time out */
+	rh = init_handle(&first, &second, "100");
+	first_state.silent = 1;
+
+	start = now();
+	ret = send_request(rh, 0);
+	if (ret != OK_RC) {
+		fprintf(stderr, "error in %d: %d\n", __LINE__, ret);
+		exit(1);
+	}
+	if (now() - start > 0.8) {
+		fprintf(stderr, "error in %d: the request was not hedged\n", __LINE__);
+		exit(1);
+	}
+	if (first_state.requests != 1 || second_state.requests != 1) {
+		fprintf(stderr, "error in %d: %u/%u requests\n", __LINE__,
+			first_state.requests, second_state.requests);
+		exit(1);
+	}
+
+	/* accounting is not hedged: the second server is only tried once
+	 * the first did not answer within its retries */
+	ret = send_request(rh, 1);
+	if (ret != OK_RC) {
+		fprintf(stderr, "error in %d: %d\n", __LINE__, ret);
+		exit(1);
+	}
+	if (first_state.requests != 3 || second_state.requests != 2) {
+		fprintf(stderr, "error in %d: %u/%u requests\n", __LINE__,
+			first_state.requests, second_state.requests);
+		exit(1);
+	}
+	rc_destroy(rh);
+
+	/* the first server answers before the delay */
+	rh = init_handle(&first, &second, "1000");
+	first_state.silent = 0;
+	first_state.requests = second_state.requests = 0;
+
+	if (send_request(rh, 0) != OK_RC) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	if (first_state.requests != 1 || second_state.requests != 0) {
+		fprintf(stderr, "error in %d: %u/%u requests\n", __LINE__,
+			first_state.requests, second_state.requests);
+		exit(1);
+	}
+
+	/* both servers are down; each is tried through its retries */
+	second_state.silent = first_state.silent = 1;
+	first_state.requests = second_state.requests = 0;
+	if (send_request(rh, 0) != TIMEOUT_RC) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	if (first_state.requests != 2 || second_state.requests != 2) {
+		fprintf(stderr, "error in %d: %u/%u requests\n", __LINE__,
+			first_state.requests, second_state.requests);
+		exit(1);
+	}
+	rc_destroy(rh);
+
+	mock_server_stop(&first);
+	mock_server_stop(&second);
+
+	return 0;
+}
@@ -0,0 +1,180 @@
+/*
+ * keycache.c	Checks of the cached MD5 states of secrets.
+ *
+ * License:	BSD
+ *
+ */
+
+
+/* Checks that the User-Password, the Message-Authenticator and the
+ * accounting request authenticator computed from the cached MD5 states
+ * of a secret are correct, for secrets shorter than, as long as, and
+ * longer than an MD5 block, on the first and the following requests. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gnutls/crypto.h>
+
+#include <radcli/radcli.h>
+#include "mock-server.h"
+
+#define PASSWORD "a password longer than a block"
+
+static volatile unsigned errors;
+
+static const uint8_t *find_attr(const uint8_t *pkt, int len, uint8_t type)
+{
+	int pos = 20;
+
+	while (pos + 2 <= len && pkt[pos + 1] >= 2 && pos + pkt[pos + 1] <= len) {
+		if (pkt[pos] == type)
+			return pkt + pos;
+		pos += pkt[pos + 1];
+	}
+
+	return NULL;
+}
+
+static int check_access_request(struct mock_server *ms, const uint8_t *pkt,
+				int len)
+{
+	size_t slen = strlen(ms->secret);
+	uint8_t buf[4096], digest[16], plain[128];
+	const uint8_t *attr, *prev;
+	int i, j, plen;
+
+	/* User-Password: each block is xored with MD5(secret || previous) */
+	attr = find_attr(pkt, len, PW_USER_PASSWORD);
+	if (attr == NULL)
+		return -1;
+	plen = attr[1] - 2;
+	prev = pkt + 4;
+	for (i = 0; i < plen; i += 16) {
+		memcpy(buf, ms->secret, slen);
+		memcpy(buf + slen, prev, 16);
+		gnutls_hash_fast(GNUTLS_DIG_MD5, buf, slen + 16, digest);
+		for (j = 0; j < 16; j++)
+			plain[i + j] = attr[2 + i + j] ^ digest[j];
+		prev = attr + 2 + i;
+	}
+	if (plen != (int)((strlen(PASSWORD) + 15) & ~15) ||
+	    memcmp(plain, PASSWORD, strlen(PASSWORD)) != 0)
+		return -1;
+
+	/* Message-Authenticator: HMAC-MD5 with the attribute zeroed */
+	attr = find_attr(pkt, len, PW_MESSAGE_AUTHENTICATOR);
+	if (attr == NULL || attr[1] != 18)
+		return -1;
+	memcpy(buf, pkt, len);
+	memset(buf + (attr - pkt) + 2, 0, 16);
+	gnutls_hmac_fast(GNUTLS_MAC_MD5, ms->secret, slen, buf, len, digest);
+	if (memcmp(digest, attr + 2, 16) != 0)
+		return -1;
+
+	return 0;
+}
+
+static int check_accounting_request(struct mock_server *ms, const uint8_t *pkt,
+				    int len)
+{
+	size_t slen = strlen(ms->secret);
+	uint8_t buf[4096 + 256], digest[16];
+
+	memcpy(buf, pkt, len);
+	memset(buf + 4, 0, 16);
+	memcpy(buf + len, ms->secret, slen);
+	gnutls_hash_fast(GNUTLS_DIG_MD5, buf, len + slen, digest);
+
+	return memcmp(digest, pkt + 4, 16) == 0 ? 0 : -1;
+}
+
+static int handler(struct mock_server *ms, const uint8_t *pkt, int len,
+		   const struct sockaddr_in *from)
+{
+	int ret;
+
+	if (pkt[0] == PW_ACCOUNTING_REQUEST)
+		ret = check_accounting_request(ms, pkt, len);
+	else
+		ret = check_access_request(ms, pkt, len);
+
+	if (ret < 0) {
+		errors++;
+		return MOCK_DROP;
+	}
+
+	return MOCK_REPLY;
+}
+
+static void test_secret(const char *secret)
+{
+	struct mock_server ms;
+	char server_name[512];
+	VALUE_PAIR *send = NULL, *received = NULL;
+	uint32_t service = PW_AUTHENTICATE_ONLY, status = PW_STATUS_START;
+	char msg[PW_MAX_MSG_SIZE];
+	rc_handle *rh;
+	int i;
+
+	if (mock_server_start(&ms, handler, NULL) < 0) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	/* no request was received yet */
+	ms.secret = secret;
+
+	mock_servers(server_name, sizeof(server_name), &ms, 1);
+	rh = mock_handle_new(server_name, "radius_timeout", "2",
+			     "radius_retries", "0", NULL);
+
+	for (i = 0; i < 3; i++) {
+		send = received = NULL;
+		if (rc_avpair_add(rh, &send, PW_USER_NAME, "test", -1, 0) == NULL ||
+		    rc_avpair_add(rh, &send, PW_USER_PASSWORD, PASSWORD, -1, 0) == NULL ||
+		    rc_avpair_add(rh, &send, PW_SERVICE_TYPE, &service, -1, 0) == NULL) {
+			fprintf(stderr, "error in %d\n", __LINE__);
+			exit(1);
+		}
+		if (rc_auth(rh, 0, send, &received, msg) != OK_RC || errors != 0) {
+			fprintf(stderr, "error in %d: secret of %u octets\n",
+				__LINE__, (unsigned)strlen(secret));
+			exit(1);
+		}
+		rc_avpair_free(send);
+		rc_avpair_free(received);
+
+		send = NULL;
+		if (rc_avpair_add(rh, &send, PW_USER_NAME, "test", -1, 0) == NULL ||
+		    rc_avpair_add(rh, &send, PW_ACCT_STATUS_TYPE, &status, -1, 0) == NULL) {
+			fprintf(stderr, "error in %d\n", __LINE__);
+			exit(1);
+		}
+		if (rc_acct(rh, 0, send) != OK_RC || errors != 0) {
+			fprintf(stderr, "error in %d: secret of %u octets\n",
+				__LINE__, (unsigned)strlen(secret));
+			exit(1);
+		}
+		rc_avpair_free(send);
+	}
+
+	rc_destroy(rh);
+	mock_server_stop(&ms);
+}
+
+int main(int argc, char **argv)
+{
+	char secret[101];
+
+	test_secret(MOCK_SECRET);
+
+	memset(secret, 'k', 64);
+	secret[64] = 0;
+	test_secret(secret);
+
+	memset(secret, 's', 100);
+	secret[100] = 0;
+	test_secret(secret);
+
+	return 0;
+}
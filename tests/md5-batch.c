@@ -0,0 +1,190 @@
+/*
+ * md5-batch.c	Checks of the batched MD5 of the engine.
+ *
+ * License:	BSD
+ *
+ */
+
+
+/* Checks that the requests signed together by the asynchronous engine
+ * carry valid Message-Authenticators and accounting request
+ * authenticators, for packets of many lengths and secrets shorter and
+ * longer than an MD5 block, and that the replies verified together are
+ * accepted unless forged. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gnutls/crypto.h>
+
+#include <radcli/radcli.h>
+#include "mock-server.h"
+
+#define REQUESTS 300
+
+static volatile unsigned errors;
+
+struct result {
+	int done;
+	int result;
+};
+
+static const uint8_t *find_attr(const uint8_t *pkt, int len, uint8_t type)
+{
+	int pos = 20;
+
+	while (pos + 2 <= len && pkt[pos + 1] >= 2 && pos + pkt[pos + 1] <= len) {
+		if (pkt[pos] == type)
+			return pkt + pos;
+		pos += pkt[pos + 1];
+	}
+
+	return NULL;
+}
+
+static int check_request(struct mock_server *ms, const uint8_t *pkt, int len)
+{
+	size_t slen = strlen(ms->secret);
+	uint8_t buf[4096 + 256], digest[16];
+	const uint8_t *attr;
+
+	memcpy(buf, pkt, len);
+	if (pkt[0] == PW_ACCOUNTING_REQUEST) {
+		/* MD5(packet || secret) with a zero authenticator */
+		memset(buf + 4, 0, 16);
+		memcpy(buf + len, ms->secret, slen);
+		gnutls_hash_fast(GNUTLS_DIG_MD5, buf, len + slen, digest);
+		return memcmp(digest, pkt + 4, 16) == 0 ? 0 : -1;
+	}
+
+	/* HMAC-MD5 with the Message-Authenticator zeroed */
+	attr = find_attr(pkt, len, PW_MESSAGE_AUTHENTICATOR);
+	if (attr == NULL || attr[1] != 18)
+		return -1;
+	memset(buf + (attr - pkt) + 2, 0, 16);
+	gnutls_hmac_fast(GNUTLS_MAC_MD5, ms->secret, slen, buf, len, digest);
+
+	return memcmp(digest, attr + 2, 16) == 0 ? 0 : -1;
+}
+
+static int handler(struct mock_server *ms, const uint8_t *pkt, int len,
+		   const struct sockaddr_in *from)
+{
+	if (check_request(ms, pkt, len) < 0) {
+		errors++;
+		return MOCK_DROP;
+	}
+
+	if (pkt[1] % 5 == 0)
+		return MOCK_FORGE;
+
+	return MOCK_REPLY;
+}
+
+static void completed(RC_ENGINE *engine, SEND_DATA *data, int result, void *usr)
+{
+	struct result *r = usr;
+
+	r->done++;
+	r->result = result;
+	rc_avpair_free(data->receive_pairs);
+	data->receive_pairs = NULL;
+}
+
+static void test_secret(const char *secret)
+{
+	static SEND_DATA data[REQUESTS];
+	static struct result results[REQUESTS];
+	struct mock_server ms;
+	uint32_t service = PW_AUTHENTICATE_ONLY, status = PW_STATUS_START;
+	char server_name[512];
+	char user[201];
+	VALUE_PAIR *send;
+	RC_ENGINE *engine;
+	rc_handle *rh;
+	int i, ret, acct;
+
+	if (mock_server_start(&ms, handler, NULL) < 0) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	/* no request was received yet */
+	ms.secret = secret;
+
+	mock_servers(server_name, sizeof(server_name), &ms, 1);
+	rh = mock_handle_new(server_name, NULL);
+
+	engine = rc_engine_new(rh);
+	if (engine == NULL) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	/* user names of 1 to 200 octets move the end of the packets across
+	 * the MD5 blocks */
+	memset(results, 0, sizeof(results));
+	for (i = 0; i < REQUESTS; i++) {
+		acct = i % 3 == 0;
+		memset(user, 'a' + i % 26, sizeof(user));
+		user[i % 200 + 1] = 0;
+
+		send = NULL;
+		if (rc_avpair_add(rh, &send, PW_USER_NAME, user, -1, 0) == NULL ||
+		    (acct ?
+		     rc_avpair_add(rh, &send, PW_ACCT_STATUS_TYPE, &status, -1, 0) :
+		     rc_avpair_add(rh, &send, PW_SERVICE_TYPE, &service, -1, 0)) == NULL) {
+			fprintf(stderr, "error in %d\n", __LINE__);
+			exit(1);
+		}
+
+		rc_buildreq(rh, &data[i],
+			    acct ? PW_ACCOUNTING_REQUEST : PW_ACCESS_REQUEST,
+			    rc_conf_srv(rh, "authserver")->name[0],
+			    rc_conf_srv(rh, "authserver")->port[0],
+			    rc_conf_srv(rh, "authserver")->secret[0], 5, 2);
+		data[i].send_pairs = send;
+
+		ret = rc_engine_submit(engine, &data[i], acct ? ACCT : AUTH,
+				       completed, &results[i]);
+		if (ret != OK_RC) {
+			fprintf(stderr, "error in %d: %d\n", __LINE__, ret);
+			exit(1);
+		}
+	}
+
+	while ((ret = rc_engine_run(engine, 1000)) > 0)
+		;
+
+	if (ret < 0 || errors != 0) {
+		fprintf(stderr, "error in %d: secret of %u octets: %d, %u bad requests\n",
+			__LINE__, (unsigned)strlen(secret), ret, errors);
+		exit(1);
+	}
+
+	for (i = 0; i < REQUESTS; i++) {
+		if (results[i].done != 1 || results[i].result != OK_RC) {
+			fprintf(stderr, "error in %d: secret of %u octets: request %d: %d/%d\n",
+				__LINE__, (unsigned)strlen(secret), i,
+				results[i].done, results[i].result);
+			exit(1);
+		}
+		rc_avpair_free(data[i].send_pairs);
+	}
+
+	rc_engine_free(engine);
+	rc_destroy(rh);
+	mock_server_stop(&ms);
+}
+
+int main(int argc, char **argv)
+{
+	char secret[101];
+
+	test_secret(MOCK_SECRET);
+
+	memset(secret, 's', 100);
+	secret[100] = 0;
+	test_secret(secret);
+
+	return 0;
+}
@@ -0,0 +1,535 @@
+/*
+ * mock-server.c	A minimal RADIUS server on the loopback interface,
+ *			running in a thread of the test, and the handles and
+ *			requests of the tests using it.
+ *
+ * License:	BSD
+ *
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <gnutls/gnutls.h>
+#include <gnutls/crypto.h>
+
+#include <radcli/radcli.h>
+#include "mock-server.h"
+
+#define MOCK_MAX_CONNS 16
+
+static void mock_build_reply(struct mock_server *ms, const uint8_t *pkt,
+			     int forged, uint8_t *out)
+{
+	uint8_t buf[20 + 256];
+	uint8_t digest[16];
+	size_t slen = strlen(ms->secret);
+
+	/* the request authenticator is kept in place for the digest */
+	memcpy(buf, pkt, 20);
+	buf[0] = pkt[0] == PW_ACCOUNTING_REQUEST ?
+	    PW_ACCOUNTING_RESPONSE : PW_ACCESS_ACCEPT;
+	buf[2] = 0;
+	buf[3] = 20;
+
+	if (slen > 256)
+		slen = 256;
+	memcpy(buf + 20, ms->secret, slen);
+	gnutls_hash_fast(GNUTLS_DIG_MD5, buf, 20 + slen, digest);
+	if (forged)
+		digest[0] ^= 0xff;
+	memcpy(buf + 4, digest, 16);
+	memcpy(out, buf, 20);
+}
+
+static void mock_reply(struct mock_server *ms, const uint8_t *pkt,
+		       const struct sockaddr_in *from, int forged)
+{
+	uint8_t buf[20];
+
+	mock_build_reply(ms, pkt, forged, buf);
+	sendto(ms->fd, buf, 20, 0, (struct sockaddr *)from, sizeof(*from));
+}
+
+static void *mock_thread(void *arg)
+{
+	struct mock_server *ms = arg;
+	uint8_t buf[4096];
+	struct sockaddr_in from;
+	socklen_t fromlen;
+	struct pollfd pfd;
+	int len;
+
+	pfd.fd = ms->fd;
+	pfd.events = POLLIN;
+
+	while (!ms->stop) {
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+
+		fromlen = sizeof(from);
+		len = recvfrom(ms->fd, buf, sizeof(buf), 0,
+			       (struct sockaddr *)&from, &fromlen);
+		if (len < 20)
+			continue;
+
+		switch (ms->handler ? ms->handler(ms, buf, len, &from) : MOCK_REPLY) {
+		case MOCK_DROP:
+			break;
+		case MOCK_FORGE:
+			mock_reply(ms, buf, &from, 1);
+			/* fall through */
+		default:
+			mock_reply(ms, buf, &from, 0);
+		}
+	}
+
+	return NULL;
+}
+
+struct mock_conn {
+	int fd;
+	gnutls_session_t session;	/* NULL unless over TLS */
+	struct sockaddr_in from;
+	int len;
+	uint8_t buf[8192];
+};
+
+static int mock_conn_recv(struct mock_conn *c)
+{
+	int ret;
+
+	if (c->session == NULL)
+		return recv(c->fd, c->buf + c->len, sizeof(c->buf) - c->len, 0);
+
+	do {
+		ret = gnutls_record_recv(c->session, c->buf + c->len,
+					 sizeof(c->buf) - c->len);
+	} while (ret == GNUTLS_E_AGAIN || ret == GNUTLS_E_INTERRUPTED);
+	return ret;
+}
+
+static int mock_conn_send(struct mock_conn *c, const uint8_t *buf, int len)
+{
+	if (c->session == NULL)
+		return send(c->fd, buf, len, MSG_NOSIGNAL);
+	return gnutls_record_send(c->session, buf, len);
+}
+
+static void mock_conn_close(struct mock_conn *c)
+{
+	if (c->session != NULL)
+		gnutls_deinit(c->session);
+	close(c->fd);
+}
+
+/* the number of complete packets in the connection buffer */
+static unsigned mock_conn_packets(struct mock_conn *c)
+{
+	int pos = 0, plen;
+	unsigned n = 0;
+
+	while (c->len - pos >= 20) {
+		plen = (c->buf[pos + 2] << 8) | c->buf[pos + 3];
+		if (plen < 20 || c->len - pos < plen)
+			break;
+		pos += plen;
+		n++;
+	}
+	return n;
+}
+
+/* Answers the complete requests in the connection buffer, in reverse
+ * order, so that pipelined replies arrive out of order. With a batch
+ * size set, nothing is answered until that many requests are pending. */
+static int mock_tcp_serve(struct mock_server *ms, struct mock_conn *c)
+{
+	uint8_t out[sizeof(c->buf) / 20][20];
+	unsigned nout = 0;
+	int pos = 0, plen, ret;
+
+	do {
+		ret = mock_conn_recv(c);
+		if (ret <= 0)
+			return -1;
+		c->len += ret;
+	} while (c->session != NULL && gnutls_record_check_pending(c->session) > 0);
+
+	if (mock_conn_packets(c) < ms->batch)
+		return 0;
+
+	while (c->len - pos >= 20) {
+		plen = (c->buf[pos + 2] << 8) | c->buf[pos + 3];
+		if (plen < 20 || plen > (int)sizeof(c->buf))
+			return -1;
+		if (c->len - pos < plen)
+			break;
+
+		switch (ms->handler ? ms->handler(ms, c->buf + pos, plen, &c->from) : MOCK_REPLY) {
+		case MOCK_DROP:
+			break;
+		case MOCK_FORGE:
+			if (nout < sizeof(out) / sizeof(out[0]))
+				mock_build_reply(ms, c->buf + pos, 1, out[nout++]);
+			/* fall through */
+		default:
+			if (nout < sizeof(out) / sizeof(out[0]))
+				mock_build_reply(ms, c->buf + pos, 0, out[nout++]);
+		}
+		pos += plen;
+	}
+
+	memmove(c->buf, c->buf + pos, c->len - pos);
+	c->len -= pos;
+
+	while (nout > 0) {
+		nout--;
+		if (mock_conn_send(c, out[nout], 20) != 20)
+			return -1;
+	}
+	return 0;
+}
+
+static int mock_psk_cb(gnutls_session_t session, const char *username,
+		       gnutls_datum_t *key)
+{
+	gnutls_datum_t hex = { (void *)MOCK_PSK_KEY, sizeof(MOCK_PSK_KEY) - 1 };
+	size_t size = sizeof(MOCK_PSK_KEY) / 2;
+
+	key->data = gnutls_malloc(size);
+	if (key->data == NULL)
+		return -1;
+	if (gnutls_hex_decode(&hex, key->data, &size) < 0) {
+		gnutls_free(key->data);
+		return -1;
+	}
+	key->size = size;
+	return 0;
+}
+
+static int mock_tls_accept(struct mock_server *ms, struct mock_conn *c)
+{
+	int ret;
+
+	if (gnutls_init(&c->session, GNUTLS_SERVER) < 0)
+		return -1;
+
+	if (gnutls_priority_set_direct(c->session,
+				       "NORMAL:+ECDHE-PSK:+DHE-PSK:+PSK", NULL) < 0 ||
+	    gnutls_credentials_set(c->session, GNUTLS_CRD_PSK,
+				   ms->psk_cred) < 0)
+		goto fail;
+
+	gnutls_transport_set_int(c->session, c->fd);
+	gnutls_handshake_set_timeout(c->session, 10000);
+	do {
+		ret = gnutls_handshake(c->session);
+	} while (ret < 0 && gnutls_error_is_fatal(ret) == 0);
+	if (ret < 0)
+		goto fail;
+
+	return 0;
+
+ fail:
+	gnutls_deinit(c->session);
+	c->session = NULL;
+	return -1;
+}
+
+static void *mock_tcp_thread(void *arg)
+{
+	struct mock_server *ms = arg;
+	struct mock_conn conns[MOCK_MAX_CONNS];
+	struct pollfd pfd[MOCK_MAX_CONNS + 1];
+	socklen_t fromlen;
+	unsigned nconns = 0, i;
+	int fd;
+
+	while (!ms->stop) {
+		if (ms->drop) {
+			for (i = 0; i < nconns; i++)
+				mock_conn_close(&conns[i]);
+			nconns = 0;
+			ms->drop = 0;
+		}
+
+		pfd[0].fd = ms->fd;
+		pfd[0].events = POLLIN;
+		for (i = 0; i < nconns; i++) {
+			pfd[i + 1].fd = conns[i].fd;
+			pfd[i + 1].events = POLLIN;
+			pfd[i + 1].revents = 0;
+		}
+
+		if (poll(pfd, nconns + 1, 100) <= 0)
+			continue;
+
+		for (i = nconns; i > 0; i--) {
+			if (!(pfd[i].revents & (POLLIN | POLLERR | POLLHUP)))
+				continue;
+			if (mock_tcp_serve(ms, &conns[i - 1]) < 0) {
+				mock_conn_close(&conns[i - 1]);
+				conns[i - 1] = conns[--nconns];
+			}
+		}
+
+		if ((pfd[0].revents & POLLIN) && nconns < MOCK_MAX_CONNS) {
+			fromlen = sizeof(conns[nconns].from);
+			fd = accept(ms->fd, (struct sockaddr *)&conns[nconns].from,
+				    &fromlen);
+			if (fd >= 0) {
+				conns[nconns].fd = fd;
+				conns[nconns].len = 0;
+				conns[nconns].session = NULL;
+				if (ms->psk_cred != NULL &&
+				    mock_tls_accept(ms, &conns[nconns]) < 0) {
+					close(fd);
+					continue;
+				}
+				nconns++;
+				ms->accepted++;
+			}
+		}
+	}
+
+	for (i = 0; i < nconns; i++)
+		mock_conn_close(&conns[i]);
+
+	return NULL;
+}
+
+/* the fields of ms other than the handler are set by the caller */
+static int mock_start(struct mock_server *ms, mock_handler handler, void *usr,
+		      int type)
+{
+	struct sockaddr_in addr;
+	socklen_t addrlen = sizeof(addr);
+
+	ms->handler = handler;
+	ms->usr = usr;
+	if (ms->secret == NULL)
+		ms->secret = MOCK_SECRET;
+
+	ms->fd = socket(AF_INET, type, 0);
+	if (ms->fd < 0)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(ms->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    getsockname(ms->fd, (struct sockaddr *)&addr, &addrlen) < 0) {
+		close(ms->fd);
+		return -1;
+	}
+	ms->port = ntohs(addr.sin_port);
+
+	if (type == SOCK_STREAM && listen(ms->fd, MOCK_MAX_CONNS) < 0) {
+		close(ms->fd);
+		return -1;
+	}
+
+	if (pthread_create(&ms->thread, NULL,
+			   type == SOCK_STREAM ? mock_tcp_thread : mock_thread,
+			   ms) != 0) {
+		close(ms->fd);
+		return -1;
+	}
+
+	return 0;
+}
+
+int mock_server_start(struct mock_server *ms, mock_handler handler, void *usr)
+{
+	memset(ms, 0, sizeof(*ms));
+	return mock_start(ms, handler, usr, SOCK_DGRAM);
+}
+
+int mock_tcp_server_start(struct mock_server *ms, mock_handler handler,
+			  void *usr)
+{
+	memset(ms, 0, sizeof(*ms));
+	return mock_start(ms, handler, usr, SOCK_STREAM);
+}
+
+int mock_tls_server_start(struct mock_server *ms, mock_handler handler,
+			  void *usr, unsigned batch)
+{
+	memset(ms, 0, sizeof(*ms));
+	ms->secret = MOCK_TLS_SECRET;
+	ms->batch = batch;
+
+	if (gnutls_psk_allocate_server_credentials(&ms->psk_cred) < 0)
+		return -1;
+	gnutls_psk_set_server_credentials_function(ms->psk_cred, mock_psk_cb);
+
+	if (mock_start(ms, handler, usr, SOCK_STREAM) < 0) {
+		gnutls_psk_free_server_credentials(ms->psk_cred);
+		return -1;
+	}
+
+	return 0;
+}
+
+void mock_server_stop(struct mock_server *ms)
+{
+	ms->stop = 1;
+	pthread_join(ms->thread, NULL);
+	close(ms->fd);
+	if (ms->psk_cred != NULL)
+		gnutls_psk_free_server_credentials(ms->psk_cred);
+}
+
+int mock_has_user(const uint8_t *pkt, int len, const char *user)
+{
+	int pos = 20;
+
+	while (pos + 2 <= len && pkt[pos + 1] >= 2) {
+		if (pkt[pos] == PW_USER_NAME &&
+		    pkt[pos + 1] - 2 == (int)strlen(user) &&
+		    memcmp(pkt + pos + 2, user, strlen(user)) == 0)
+			return 1;
+		pos += pkt[pos + 1];
+	}
+	return 0;
+}
+
+void mock_servers(char *buf, size_t size, const struct mock_server *ms,
+		  unsigned n)
+{
+	size_t pos = 0;
+	unsigned i;
+
+	buf[0] = 0;
+	for (i = 0; i < n && pos < size; i++) {
+		if (ms[i].psk_cred != NULL)
+			pos += snprintf(buf + pos, size - pos,
+					"%s127.0.0.1:%u:psk@" MOCK_PSK_USER "@" MOCK_PSK_KEY,
+					i ? "," : "", ms[i].port);
+		else
+			pos += snprintf(buf + pos, size - pos, "%s127.0.0.1:%u:%s",
+					i ? "," : "", ms[i].port, ms[i].secret);
+	}
+}
+
+static rc_handle *handle_config(const char *servers, va_list args)
+{
+	const char *name, *value;
+	rc_handle *rh;
+
+	rh = rc_new();
+	if (rh == NULL || (rh = rc_config_init(rh)) == NULL) {
+		fprintf(stderr, "error in %s:%d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	if (rc_add_config(rh, "dictionary", "../etc/dictionary", "config", 0) != 0 ||
+	    rc_add_config(rh, "authserver", servers, "config", 0) != 0 ||
+	    rc_add_config(rh, "acctserver", servers, "config", 0) != 0) {
+		fprintf(stderr, "error in %s:%d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	while ((name = va_arg(args, const char *)) != NULL) {
+		value = va_arg(args, const char *);
+		if (rc_add_config(rh, name, value, "config", 0) != 0) {
+			fprintf(stderr, "error in %s:%d: %s\n", __FILE__, __LINE__,
+				name);
+			exit(1);
+		}
+	}
+
+	if (rc_read_dictionary(rh, rc_conf_str(rh, "dictionary")) != 0) {
+		fprintf(stderr, "error in %s:%d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	return rh;
+}
+
+rc_handle *mock_handle_config(const char *servers, ...)
+{
+	rc_handle *rh;
+	va_list args;
+
+	va_start(args, servers);
+	rh = handle_config(servers, args);
+	va_end(args);
+
+	return rh;
+}
+
+rc_handle *mock_handle_new(const char *servers, ...)
+{
+	rc_handle *rh;
+	va_list args;
+
+	va_start(args, servers);
+	rh = handle_config(servers, args);
+	va_end(args);
+
+	if (rc_apply_config(rh) == -1) {
+		fprintf(stderr, "error in %s:%d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	return rh;
+}
+
+int mock_send_auth(rc_handle *rh, const char *user)
+{
+	VALUE_PAIR *send = NULL, *received = NULL;
+	uint32_t service = PW_AUTHENTICATE_ONLY;
+	char msg[PW_MAX_MSG_SIZE];
+	int ret;
+
+	if (rc_avpair_add(rh, &send, PW_USER_NAME, user, -1, 0) == NULL ||
+	    rc_avpair_add(rh, &send, PW_SERVICE_TYPE, &service, -1, 0) == NULL) {
+		fprintf(stderr, "error in %s:%d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	ret = rc_auth(rh, 0, send, &received, msg);
+
+	rc_avpair_free(send);
+	rc_avpair_free(received);
+	return ret;
+}
+
+void mock_init_data(rc_handle *rh, SEND_DATA *data, const char *user,
+		    int timeout, int retries)
+{
+	SERVER *srv = rc_conf_srv(rh, "authserver");
+	VALUE_PAIR *send = NULL;
+	uint32_t service = PW_AUTHENTICATE_ONLY;
+
+	if (rc_avpair_add(rh, &send, PW_USER_NAME, user, -1, 0) == NULL ||
+	    rc_avpair_add(rh, &send, PW_SERVICE_TYPE, &service, -1, 0) == NULL) {
+		fprintf(stderr, "error in %s:%d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	rc_buildreq(rh, data, PW_ACCESS_REQUEST, srv->name[0], srv->port[0],
+		    srv->secret[0], timeout, retries);
+	data->send_pairs = send;
+	data->receive_pairs = NULL;
+}
+
+int mock_send_server(rc_handle *rh, const char *user, int timeout)
+{
+	char msg[PW_MAX_MSG_SIZE];
+	SEND_DATA data;
+	int ret;
+
+	mock_init_data(rh, &data, user, timeout, 0);
+	ret = rc_send_server(rh, &data, msg, AUTH);
+
+	rc_avpair_free(data.send_pairs);
+	rc_avpair_free(data.receive_pairs);
+	return ret;
+}
@@ -0,0 +1,86 @@
+/*
+ * mock-server.h	A minimal RADIUS server on the loopback interface,
+ *			running in a thread of the test, and the handles and
+ *			requests of the tests using it.
+ *
+ * License:	BSD
+ *
+ */
+#ifndef MOCK_SERVER_H
+# define MOCK_SERVER_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <gnutls/gnutls.h>
+#include <radcli/radcli.h>
+
+#define MOCK_SECRET "testing123"
+
+/* the PSK accepted over TLS, and the RADIUS secret implied by RadSec */
+#define MOCK_PSK_USER "test"
+#define MOCK_PSK_KEY "9e32cf7786321a828ef7668f09fb35db"
+#define MOCK_TLS_SECRET "radsec"
+
+/* actions returned by the packet handler */
+#define MOCK_REPLY	0	/* send an Accept or Accounting-Response */
+#define MOCK_DROP	1	/* ignore the request */
+#define MOCK_FORGE	2	/* send a reply with a bad authenticator, then a valid one */
+
+struct mock_server;
+
+typedef int (*mock_handler)(struct mock_server *ms, const uint8_t *pkt,
+			    int len, const struct sockaddr_in *from);
+
+struct mock_server {
+	int fd;
+	unsigned port;
+	mock_handler handler;
+	void *usr;
+	const char *secret;
+
+	pthread_t thread;
+	volatile int stop;
+
+	/* TCP and TLS only */
+	volatile unsigned accepted;	/* connections accepted */
+	volatile int drop;		/* set to close all connections */
+	unsigned batch;			/* requests held before answering */
+	gnutls_psk_server_credentials_t psk_cred;	/* set for TLS */
+};
+
+int mock_server_start(struct mock_server *ms, mock_handler handler, void *usr);
+/* a server over TCP; replies to pipelined requests are sent in reverse order */
+int mock_tcp_server_start(struct mock_server *ms, mock_handler handler,
+			  void *usr);
+/* a RadSec server authenticating clients with MOCK_PSK_KEY; replies are
+ * held until batch requests are pending on a connection */
+int mock_tls_server_start(struct mock_server *ms, mock_handler handler,
+			  void *usr, unsigned batch);
+void mock_server_stop(struct mock_server *ms);
+
+int mock_has_user(const uint8_t *pkt, int len, const char *user);
+
+/* writes the servers option naming n servers: their address, port and
+ * secret, or the PSK of a TLS server */
+void mock_servers(char *buf, size_t size, const struct mock_server *ms,
+		  unsigned n);
+
+/* a handle with the dictionary, the servers as authserver and acctserver,
+ * and the options given as name and value pairs ended by NULL; the test
+ * exits on failure */
+rc_handle *mock_handle_config(const char *servers, ...);
+/* as mock_handle_config(), with the configuration applied */
+rc_handle *mock_handle_new(const char *servers, ...);
+
+/* sends an Access-Request of user with rc_auth(), and returns its result */
+int mock_send_auth(rc_handle *rh, const char *user);
+
+/* builds an Access-Request of user to the first authserver */
+void mock_init_data(rc_handle *rh, SEND_DATA *data, const char *user,
+		    int timeout, int retries);
+/* sends an Access-Request of user with rc_send_server(), without retries,
+ * and returns its result */
+int mock_send_server(rc_handle *rh, const char *user, int timeout);
+
+#endif
@@ -0,0 +1,184 @@
+/*
+ * netns.c	Checks of the namespace option.
+ *
+ * License:	BSD
+ *
+ */
+
+
+/* Checks that with the namespace option the sockets are created in the
+ * namespace, reaching a server only listening there, and that the
+ * thread switches namespaces to create them rather than on every
+ * request. It needs the privilege to create a namespace, and is skipped
+ * otherwise. */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+
+#include <radcli/radcli.h>
+#include "mock-server.h"
+
+#if defined(__linux__) && defined(SYS_setns)
+static unsigned switches;
+
+int setns(int fd, int nstype)
+{
+	__atomic_add_fetch(&switches, 1, __ATOMIC_SEQ_CST);
+	return syscall(SYS_setns, fd, nstype);
+}
+
+static char ns_name[32];
+static char ns_path[64];
+static struct mock_server ms;
+
+static int handler(struct mock_server *ms, const uint8_t *pkt, int len,
+		   const struct sockaddr_in *from)
+{
+	return MOCK_REPLY;
+}
+
+/*- Creates a namespace with a loopback interface, named by a bind mount,
+ * and starts the server in it; the thread is left in the namespace.
+ -*/
+static void *ns_thread(void *arg)
+{
+	struct ifreq ifr;
+	int fd;
+
+	if (unshare(CLONE_NEWNET) == -1)
+		return (void *)77;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	memset(&ifr, 0, sizeof(ifr));
+	strcpy(ifr.ifr_name, "lo");
+	if (fd == -1 || ioctl(fd, SIOCGIFFLAGS, &ifr) == -1)
+		return (void *)1;
+	ifr.ifr_flags |= IFF_UP;
+	if (ioctl(fd, SIOCSIFFLAGS, &ifr) == -1)
+		return (void *)1;
+	close(fd);
+
+	if (mount("/proc/thread-self/ns/net", ns_path, NULL, MS_BIND, NULL) == -1)
+		return (void *)77;
+
+	if (mock_server_start(&ms, handler, NULL) < 0)
+		return (void *)1;
+
+	return NULL;
+}
+
+static int create_namespace(void)
+{
+	pthread_t thread;
+	void *ret;
+	int fd;
+
+	snprintf(ns_name, sizeof(ns_name), "radcli-test-%u", (unsigned)getpid());
+	snprintf(ns_path, sizeof(ns_path), "/var/run/netns/%s", ns_name);
+
+	mkdir("/var/run/netns", 0755);
+	fd = open(ns_path, O_RDONLY | O_CREAT | O_EXCL, 0444);
+	if (fd == -1)
+		return 77;
+	close(fd);
+
+	if (pthread_create(&thread, NULL, ns_thread, NULL) != 0 ||
+	    pthread_join(thread, &ret) != 0)
+		ret = (void *)1;
+
+	if (ret != NULL)
+		unlink(ns_path);
+	return (int)(intptr_t)ret;
+}
+
+static void remove_namespace(void)
+{
+	umount2(ns_path, MNT_DETACH);
+	unlink(ns_path);
+}
+
+static rc_handle *init_handle(const char *ns)
+{
+	char servers[64];
+
+	mock_servers(servers, sizeof(servers), &ms, 1);
+	return mock_handle_config(servers, "radius_timeout", "1",
+				  "radius_retries", "0", "namespace", ns, NULL);
+}
+
+int main(int argc, char **argv)
+{
+	rc_handle *rh;
+	unsigned base;
+	int i, ret;
+
+	ret = create_namespace();
+	if (ret != 0) {
+		if (ret == 77)
+			fprintf(stderr, "cannot create a network namespace\n");
+		return ret;
+	}
+
+	/* an unknown namespace is refused when the configuration is applied */
+	rh = init_handle("radcli-test-none");
+	if (rc_apply_config(rh) != -1) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		goto fail;
+	}
+	rc_destroy(rh);
+
+	rh = init_handle(ns_name);
+	if (rc_apply_config(rh) == -1) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		goto fail;
+	}
+
+	if (mock_send_auth(rh, "test") != OK_RC) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		goto fail;
+	}
+
+	/* the pooled socket and the source address are reused */
+	base = switches;
+	for (i = 0; i < 4; i++) {
+		if (mock_send_auth(rh, "test") != OK_RC) {
+			fprintf(stderr, "error in %d\n", __LINE__);
+			goto fail;
+		}
+	}
+	if (switches != base) {
+		fprintf(stderr, "error in %d: %u namespace switches\n", __LINE__,
+			switches - base);
+		goto fail;
+	}
+	rc_destroy(rh);
+
+	mock_server_stop(&ms);
+	remove_namespace();
+	return 0;
+
+ fail:
+	mock_server_stop(&ms);
+	remove_namespace();
+	exit(1);
+}
+#else
+int main(int argc, char **argv)
+{
+	/* network namespaces are specific to Linux */
+	return 77;
+}
+#endif
@@ -0,0 +1,173 @@
+/*
+ * policy.c	Checks of the server selection policies.
+ *
+ * License:	BSD
+ *
+ */
+
+
+/* Checks the server selection policies: that round-robin spreads the
+ * requests by the weights of the servers, that least-outstanding avoids
+ * a server with a request in flight, and that latency prefers the
+ * faster server. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <radcli/radcli.h>
+#include "mock-server.h"
+
+#define SERVERS 3
+
+/* the number of requests each server saw, and its reply delay */
+struct server_state {
+	unsigned requests;
+	unsigned delay_ms;
+};
+
+static struct mock_server servers[SERVERS];
+static struct server_state states[SERVERS];
+
+static int handler(struct mock_server *ms, const uint8_t *pkt, int len,
+		   const struct sockaddr_in *from)
+{
+	struct server_state *state = ms->usr;
+
+	state->requests++;
+	if (state->delay_ms)
+		usleep(state->delay_ms * 1000);
+
+	return MOCK_REPLY;
+}
+
+static rc_handle *init_handle(const char *policy)
+{
+	char server_name[256];
+	int i;
+
+	for (i = 0; i < SERVERS; i++) {
+		states[i].requests = 0;
+		states[i].delay_ms = 0;
+	}
+
+	mock_servers(server_name, sizeof(server_name), servers, SERVERS);
+	return mock_handle_new(server_name, "radius_timeout", "5",
+			       "radius_retries", "0", "authserver-policy", policy,
+			       NULL);
+}
+
+static void *send_request(void *arg)
+{
+	if (mock_send_auth(arg, "test") != OK_RC) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	return NULL;
+}
+
+static void check_round_robin(void)
+{
+	rc_handle *rh;
+	int i;
+
+	rh = init_handle("round-robin:2,1,0");
+	for (i = 0; i < 30; i++)
+		send_request(rh);
+
+	if (states[0].requests != 20 || states[1].requests != 10 ||
+	    states[2].requests != 0) {
+		fprintf(stderr, "error in %d: %u/%u/%u requests\n", __LINE__,
+			states[0].requests, states[1].requests,
+			states[2].requests);
+		exit(1);
+	}
+	rc_destroy(rh);
+
+	rh = init_handle("round-robin");
+	for (i = 0; i < 30; i++)
+		send_request(rh);
+
+	if (states[0].requests != 10 || states[1].requests != 10 ||
+	    states[2].requests != 10) {
+		fprintf(stderr, "error in %d: %u/%u/%u requests\n", __LINE__,
+			states[0].requests, states[1].requests,
+			states[2].requests);
+		exit(1);
+	}
+	rc_destroy(rh);
+}
+
+static void check_least_outstanding(void)
+{
+	pthread_t threads[2];
+	rc_handle *rh;
+	int i;
+
+	rh = init_handle("least-outstanding");
+	states[0].delay_ms = 300;
+
+	/* the second request starts while the first is in flight */
+	for (i = 0; i < 2; i++) {
+		if (pthread_create(&threads[i], NULL, send_request, rh) != 0) {
+			fprintf(stderr, "error in %d\n", __LINE__);
+			exit(1);
+		}
+		usleep(100 * 1000);
+	}
+	for (i = 0; i < 2; i++)
+		pthread_join(threads[i], NULL);
+
+	if (states[0].requests != 1 || states[1].requests != 1) {
+		fprintf(stderr, "error in %d: %u/%u/%u requests\n", __LINE__,
+			states[0].requests, states[1].requests,
+			states[2].requests);
+		exit(1);
+	}
+	rc_destroy(rh);
+}
+
+static void check_latency(void)
+{
+	rc_handle *rh;
+	int i;
+
+	rh = init_handle("latency");
+	states[0].delay_ms = 20;
+
+	for (i = 0; i < 40; i++)
+		send_request(rh);
+
+	/* the slow server loses every choice once its reply time is known */
+	if (states[0].requests > 1 ||
+	    states[0].requests + states[1].requests + states[2].requests != 40) {
+		fprintf(stderr, "error in %d: %u/%u/%u requests\n", __LINE__,
+			states[0].requests, states[1].requests,
+			states[2].requests);
+		exit(1);
+	}
+	rc_destroy(rh);
+}
+
+int main(int argc, char **argv)
+{
+	int i;
+
+	for (i = 0; i < SERVERS; i++) {
+		if (mock_server_start(&servers[i], handler, &states[i]) < 0) {
+			fprintf(stderr, "error in %d\n", __LINE__);
+			exit(1);
+		}
+	}
+
+	check_round_robin();
+	check_least_outstanding();
+	check_latency();
+
+	for (i = 0; i < SERVERS; i++)
+		mock_server_stop(&servers[i]);
+
+	return 0;
+}
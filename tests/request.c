@@ -0,0 +1,120 @@
+/*
+ * request.c	Checks of the request object API.
+ *
+ * License:	BSD
+ *
+ */
+
+/* Drives several requests concurrently from a poll() loop using the
+ * request object API. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+
+#include <radcli/radcli.h>
+#include "mock-server.h"
+
+#define REQUESTS 3
+
+static int handler(struct mock_server *ms, const uint8_t *pkt, int len,
+		   const struct sockaddr_in *from)
+{
+	static int retried = 0;
+
+	if (mock_has_user(pkt, len, "silent"))
+		return MOCK_DROP;
+
+	if (mock_has_user(pkt, len, "retry") && retried++ == 0)
+		return MOCK_DROP;
+
+	return MOCK_REPLY;
+}
+
+int main(int argc, char **argv)
+{
+	static const char *users[REQUESTS] = { "test", "retry", "silent" };
+	static const int expected[REQUESTS] = { OK_RC, OK_RC, TIMEOUT_RC };
+	SEND_DATA data[REQUESTS];
+	RC_REQUEST *req[REQUESTS];
+	struct pollfd pfd[REQUESTS];
+	struct mock_server ms;
+	char server_name[64];
+	rc_handle *rh;
+	int i, ret, active, timeout, t;
+
+	if (mock_server_start(&ms, handler, NULL) < 0) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	mock_servers(server_name, sizeof(server_name), &ms, 1);
+	rh = mock_handle_new(server_name, NULL);
+
+	for (i = 0; i < REQUESTS; i++) {
+		mock_init_data(rh, &data[i], users[i], 1, 1);
+		req[i] = rc_request_new(rh, &data[i], NULL, AUTH);
+		if (req[i] == NULL) {
+			fprintf(stderr, "error in %d\n", __LINE__);
+			exit(1);
+		}
+
+		ret = rc_request_start(req[i]);
+		if (ret != PENDING_RC) {
+			fprintf(stderr, "error in %d: %d\n", __LINE__, ret);
+			exit(1);
+		}
+	}
+
+	do {
+		active = 0;
+		timeout = -1;
+		for (i = 0; i < REQUESTS; i++) {
+			pfd[i].fd = rc_request_get_fd(req[i]);
+			pfd[i].events = POLLIN;
+			pfd[i].revents = 0;
+			if (pfd[i].fd < 0)
+				continue;
+
+			active++;
+			t = rc_request_get_timeout(req[i]);
+			if (timeout < 0 || t < timeout)
+				timeout = t;
+		}
+
+		if (active == 0)
+			break;
+
+		if (poll(pfd, REQUESTS, timeout) < 0) {
+			fprintf(stderr, "error in %d\n", __LINE__);
+			exit(1);
+		}
+
+		for (i = 0; i < REQUESTS; i++) {
+			if (pfd[i].fd < 0)
+				continue;
+			if (pfd[i].revents & POLLIN)
+				rc_request_on_readable(req[i]);
+			else if (rc_request_get_timeout(req[i]) == 0)
+				rc_request_on_timeout(req[i]);
+		}
+	} while (1);
+
+	for (i = 0; i < REQUESTS; i++) {
+		ret = rc_request_get_result(req[i]);
+		if (ret != expected[i]) {
+			fprintf(stderr, "error in %d: request %d: %d\n", __LINE__, i, ret);
+			exit(1);
+		}
+
+		rc_request_free(req[i]);
+		rc_avpair_free(data[i].send_pairs);
+		rc_avpair_free(data[i].receive_pairs);
+	}
+
+	rc_destroy(rh);
+	mock_server_stop(&ms);
+
+	return 0;
+}
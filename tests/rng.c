@@ -0,0 +1,148 @@
+/*
+ * rng.c	Checks of the Request Authenticators.
+ *
+ * License:	BSD
+ *
+ */
+
+
+/* Checks that the Request Authenticators are never repeated, by the
+ * threads of a process, nor by a child forked after the parent used the
+ * random generator. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+
+#include <radcli/radcli.h>
+#include "mock-server.h"
+
+#define THREADS 4
+#define PER_THREAD 50
+#define SERIAL 20
+#define MAX_VECTORS (THREADS * PER_THREAD + 3 * SERIAL)
+
+/* written by the thread of the mock server only */
+static uint8_t vectors[MAX_VECTORS][16];
+static unsigned nvectors;
+
+static int handler(struct mock_server *ms, const uint8_t *pkt, int len,
+		   const struct sockaddr_in *from)
+{
+	if (nvectors < MAX_VECTORS)
+		memcpy(vectors[nvectors], pkt + 4, 16);
+	nvectors++;
+
+	return MOCK_REPLY;
+}
+
+static int send_requests(rc_handle *rh, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (mock_send_auth(rh, "test") != OK_RC)
+			return -1;
+	}
+
+	return 0;
+}
+
+static rc_handle *init_handle(unsigned port)
+{
+	char servers[64];
+
+	snprintf(servers, sizeof(servers), "127.0.0.1:%u:" MOCK_SECRET, port);
+	return mock_handle_new(servers, "radius_timeout", "5",
+			       "radius_retries", "0", NULL);
+}
+
+/* each thread has its own handle, and draws from its own generator */
+static void *thread_main(void *arg)
+{
+	rc_handle *rh = init_handle(*(unsigned *)arg);
+
+	if (send_requests(rh, PER_THREAD) < 0) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	rc_destroy(rh);
+
+	return NULL;
+}
+
+static int cmp_vector(const void *a, const void *b)
+{
+	return memcmp(a, b, 16);
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t threads[THREADS];
+	struct mock_server ms;
+	rc_handle *rh;
+	pid_t pid;
+	int i, status;
+
+	if (mock_server_start(&ms, handler, NULL) < 0) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	for (i = 0; i < THREADS; i++) {
+		if (pthread_create(&threads[i], NULL, thread_main, &ms.port) != 0) {
+			fprintf(stderr, "error in %d\n", __LINE__);
+			exit(1);
+		}
+	}
+	for (i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	rh = init_handle(ms.port);
+
+	/* the child would continue the keystream of the parent if it was
+	 * not seeded again; the parent waits for it, since they share the
+	 * sockets */
+	if (send_requests(rh, SERIAL) < 0) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	pid = fork();
+	if (pid == -1) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	if (pid == 0)
+		_exit(send_requests(rh, SERIAL) < 0 ? 1 : 0);
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+	    WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	if (send_requests(rh, SERIAL) < 0) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	rc_destroy(rh);
+	mock_server_stop(&ms);
+
+	if (nvectors != MAX_VECTORS) {
+		fprintf(stderr, "error in %d: %u requests\n", __LINE__, nvectors);
+		exit(1);
+	}
+
+	qsort(vectors, nvectors, 16, cmp_vector);
+	for (i = 1; i < (int)nvectors; i++) {
+		if (memcmp(vectors[i - 1], vectors[i], 16) == 0) {
+			fprintf(stderr, "error in %d: repeated authenticator\n",
+				__LINE__);
+			exit(1);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,120 @@
+/*
+ * rto.c	Checks of the adaptive retransmission timeout.
+ *
+ * License:	BSD
+ *
+ */
+
+
+/* Checks that with radius_rto set to adaptive the retransmission timeout
+ * follows the round-trip time of the server rather than radius_timeout,
+ * and that radius_mrd bounds the time a request is retransmitted. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <radcli/radcli.h>
+#include "mock-server.h"
+
+/* the number of requests the server saw, and how many more it drops */
+struct server_state {
+	unsigned requests;
+	int drop;
+};
+
+static int handler(struct mock_server *ms, const uint8_t *pkt, int len,
+		   const struct sockaddr_in *from)
+{
+	struct server_state *state = ms->usr;
+
+	state->requests++;
+	if (state->drop != 0) {
+		if (state->drop > 0)
+			state->drop--;
+		return MOCK_DROP;
+	}
+
+	return MOCK_REPLY;
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static rc_handle *init_handle(struct mock_server *ms, const char *mrd)
+{
+	char servers[64];
+
+	mock_servers(servers, sizeof(servers), ms, 1);
+	return mock_handle_new(servers, "radius_timeout", "2",
+			       "radius_retries", "3", "radius_rto", "adaptive",
+			       "radius_mrd", mrd, NULL);
+}
+
+int main(int argc, char **argv)
+{
+	struct server_state state;
+	struct mock_server ms;
+	rc_handle *rh;
+	double start;
+	int i;
+
+	memset(&state, 0, sizeof(state));
+	if (mock_server_start(&ms, handler, &state) < 0) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	/* the round-trip time over the loopback is learned */
+	rh = init_handle(&ms, "0");
+	for (i = 0; i < 5; i++) {
+		if (mock_send_auth(rh, "test") != OK_RC) {
+			fprintf(stderr, "error in %d\n", __LINE__);
+			exit(1);
+		}
+	}
+
+	/* two lost requests are retransmitted well before radius_timeout */
+	state.requests = 0;
+	state.drop = 2;
+	start = now();
+	if (mock_send_auth(rh, "test") != OK_RC) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	if (state.requests != 3) {
+		fprintf(stderr, "error in %d: %u requests\n", __LINE__,
+			state.requests);
+		exit(1);
+	}
+	if (now() - start > 1.5) {
+		fprintf(stderr, "error in %d: the timeout did not adapt\n", __LINE__);
+		exit(1);
+	}
+	rc_destroy(rh);
+
+	/* a request to a silent server is given up after radius_mrd */
+	rh = init_handle(&ms, "1");
+	state.drop = -1;
+	start = now();
+	if (mock_send_auth(rh, "test") != TIMEOUT_RC) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	if (now() - start < 0.9 || now() - start > 1.5) {
+		fprintf(stderr, "error in %d: the request took %.2fs\n",
+			__LINE__, now() - start);
+		exit(1);
+	}
+	rc_destroy(rh);
+
+	mock_server_stop(&ms);
+
+	return 0;
+}
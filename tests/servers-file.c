@@ -0,0 +1,104 @@
+/*
+ * servers-file.c	Checks of the lookups in the servers file.
+ *
+ * License:	BSD
+ *
+ */
+
+
+/* Checks that the secret of a server without one in authserver is found
+ * in a large servers file, that the first line of a server is used, and
+ * that a change to the file is noticed. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <radcli/radcli.h>
+#include "mock-server.h"
+
+#define ENTRIES 500
+
+static void write_servers(const char *path, const char *first,
+			  const char *second)
+{
+	FILE *fp;
+	int i;
+
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	fprintf(fp, "# generated by the servers-file test\n");
+	for (i = 0; i < ENTRIES; i++)
+		fprintf(fp, "10.%d.%d.%d\tsecret%d\n", i >> 16, (i >> 8) & 0xff,
+			i & 0xff, i);
+	fprintf(fp, "127.0.0.1\t%s\n", first);
+	if (second != NULL)
+		fprintf(fp, "127.0.0.1\t%s\n", second);
+	fclose(fp);
+}
+
+static rc_handle *init_handle(struct mock_server *ms, const char *path)
+{
+	char servers[64];
+
+	/* no secret: it is taken from the servers file */
+	snprintf(servers, sizeof(servers), "127.0.0.1:%u", ms->port);
+	return mock_handle_new(servers, "servers", path, "radius_timeout", "1",
+			       "radius_retries", "0", NULL);
+}
+
+int main(int argc, char **argv)
+{
+	char path[64];
+	struct mock_server ms;
+	rc_handle *rh;
+	int i;
+
+	if (mock_server_start(&ms, NULL, NULL) < 0) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	snprintf(path, sizeof(path), "servers-file-test.%u", (unsigned)getpid());
+
+	/* the first line of a server gives its secret */
+	write_servers(path, MOCK_SECRET, "wrong");
+	rh = init_handle(&ms, path);
+	for (i = 0; i < 3; i++) {
+		if (mock_send_auth(rh, "test") != OK_RC) {
+			fprintf(stderr, "error in %d\n", __LINE__);
+			exit(1);
+		}
+	}
+
+	/* the replies fail verification once the secret changed */
+	write_servers(path, "wrongsecret", NULL);
+	if (mock_send_auth(rh, "test") != BADRESP_RC) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	write_servers(path, MOCK_SECRET, NULL);
+	if (mock_send_auth(rh, "test") != OK_RC) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	/* a server missing from the file is not sent a request */
+	fclose(fopen(path, "w"));
+	if (mock_send_auth(rh, "test") == OK_RC) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	rc_destroy(rh);
+	unlink(path);
+	mock_server_stop(&ms);
+
+	return 0;
+}
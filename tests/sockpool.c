@@ -0,0 +1,164 @@
+/*
+ * sockpool.c	Checks of the pool of UDP sockets.
+ *
+ * License:	BSD
+ *
+ */
+
+/* Checks that consecutive requests to a server reuse a pooled UDP
+ * socket, that a socket is not reused after a request timed out, and
+ * that the child of a fork() does not use the idle sockets of its
+ * parent. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <radcli/radcli.h>
+#include "mock-server.h"
+
+static unsigned last_port;
+
+static int handler(struct mock_server *ms, const uint8_t *pkt, int len,
+		   const struct sockaddr_in *from)
+{
+	last_port = ntohs(from->sin_port);
+
+	if (mock_has_user(pkt, len, "silent"))
+		return MOCK_DROP;
+
+	return MOCK_REPLY;
+}
+
+static rc_handle *init_handle(struct mock_server *ms, const char *do_connect)
+{
+	char servers[64];
+
+	mock_servers(servers, sizeof(servers), ms, 1);
+	return mock_handle_new(servers, "radius_timeout", "1",
+			       "radius_retries", "0", "udp-connect", do_connect,
+			       NULL);
+}
+
+static void check_reuse(rc_handle *rh)
+{
+	unsigned port;
+	int i;
+
+	if (mock_send_auth(rh, "test") != OK_RC) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	port = last_port;
+
+	for (i = 0; i < 5; i++) {
+		if (mock_send_auth(rh, "test") != OK_RC) {
+			fprintf(stderr, "error in %d\n", __LINE__);
+			exit(1);
+		}
+
+		if (last_port != port) {
+			fprintf(stderr, "error in %d: socket was not reused\n", __LINE__);
+			exit(1);
+		}
+	}
+
+	if (mock_send_auth(rh, "silent") != TIMEOUT_RC) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	if (last_port != port) {
+		fprintf(stderr, "error in %d: socket was not reused\n", __LINE__);
+		exit(1);
+	}
+
+	/* the timed out socket may still receive a late reply */
+	if (mock_send_auth(rh, "test") != OK_RC) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	if (last_port == port) {
+		fprintf(stderr, "error in %d: socket was reused after a timeout\n", __LINE__);
+		exit(1);
+	}
+}
+
+static void check_fork(rc_handle *rh)
+{
+	unsigned port;
+	pid_t pid;
+	int status;
+
+	if (mock_send_auth(rh, "test") != OK_RC) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	port = last_port;
+
+	pid = fork();
+	if (pid == -1) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	if (pid == 0) {
+		if (mock_send_auth(rh, "test") != OK_RC) {
+			fprintf(stderr, "error in %d\n", __LINE__);
+			exit(1);
+		}
+		rc_destroy(rh);
+		exit(0);
+	}
+	if (waitpid(pid, &status, 0) != pid ||
+	    !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "error in %d: the child failed\n", __LINE__);
+		exit(1);
+	}
+
+	/* the server runs in this process and saw the child's request */
+	if (last_port == port) {
+		fprintf(stderr, "error in %d: the child used a socket of its parent\n",
+			__LINE__);
+		exit(1);
+	}
+
+	/* the idle socket of the parent is still usable */
+	if (mock_send_auth(rh, "test") != OK_RC) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	if (last_port != port) {
+		fprintf(stderr, "error in %d: socket was not reused\n", __LINE__);
+		exit(1);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct mock_server ms;
+	rc_handle *rh;
+
+	if (mock_server_start(&ms, handler, NULL) < 0) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	rh = init_handle(&ms, "false");
+	check_reuse(rh);
+	rc_destroy(rh);
+
+	rh = init_handle(&ms, "true");
+	check_reuse(rh);
+	rc_destroy(rh);
+
+	rh = init_handle(&ms, "false");
+	check_fork(rh);
+	rc_destroy(rh);
+
+	mock_server_stop(&ms);
+
+	return 0;
+}
@@ -0,0 +1,177 @@
+/*
+ * srcaddr.c	Checks of the cache of source addresses.
+ *
+ * License:	BSD
+ *
+ */
+
+
+/* Checks that the source address towards a server is found once and
+ * then taken from the cache, that it is put in NAS-IP-Address, and that
+ * srcaddr-cache-ttl 0 disables the cache. getsockname() is counted to
+ * tell whether the address was looked up. The reads of the netlink
+ * notifications and the netlink sockets opened are counted to tell that
+ * a cached lookup does not read them, and that the child of a fork()
+ * opens its own socket. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <radcli/radcli.h>
+#include "mock-server.h"
+
+#if defined(SYS_getsockname) && defined(SYS_socket) && defined(SYS_recvfrom)
+static unsigned lookups;
+static unsigned netlink_sockets;
+static unsigned netlink_reads;
+
+int getsockname(int fd, struct sockaddr *addr, socklen_t *len)
+{
+	__atomic_add_fetch(&lookups, 1, __ATOMIC_SEQ_CST);
+	return syscall(SYS_getsockname, fd, addr, len);
+}
+
+int socket(int domain, int type, int protocol)
+{
+	if (domain == AF_NETLINK)
+		__atomic_add_fetch(&netlink_sockets, 1, __ATOMIC_SEQ_CST);
+	return syscall(SYS_socket, domain, type, protocol);
+}
+
+ssize_t recv(int fd, void *buf, size_t len, int flags)
+{
+	int domain;
+	socklen_t size = sizeof(domain);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_DOMAIN, &domain, &size) == 0 &&
+	    domain == AF_NETLINK)
+		__atomic_add_fetch(&netlink_reads, 1, __ATOMIC_SEQ_CST);
+	return syscall(SYS_recvfrom, fd, buf, len, flags, NULL, NULL);
+}
+
+/* the NAS-IP-Address of the last request */
+static uint32_t nas_ip;
+
+static int handler(struct mock_server *ms, const uint8_t *pkt, int len,
+		   const struct sockaddr_in *from)
+{
+	int pos = 20;
+
+	nas_ip = 0;
+	while (pos + 2 <= len && pkt[pos + 1] >= 2) {
+		if (pkt[pos] == PW_NAS_IP_ADDRESS && pkt[pos + 1] == 6)
+			memcpy(&nas_ip, pkt + pos + 2, 4);
+		pos += pkt[pos + 1];
+	}
+
+	return MOCK_REPLY;
+}
+
+static rc_handle *init_handle(struct mock_server *ms, const char *ttl)
+{
+	char servers[64];
+
+	mock_servers(servers, sizeof(servers), ms, 1);
+	return mock_handle_new(servers, "radius_timeout", "2",
+			       "radius_retries", "0", "srcaddr-cache-ttl", ttl,
+			       NULL);
+}
+
+static void send_request(rc_handle *rh)
+{
+	if (mock_send_auth(rh, "test") != OK_RC) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	if (nas_ip != htonl(INADDR_LOOPBACK)) {
+		fprintf(stderr, "error in %d: NAS-IP-Address is %08x\n", __LINE__,
+			ntohl(nas_ip));
+		exit(1);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct mock_server ms;
+	rc_handle *rh;
+	unsigned base, reads, sockets;
+	pid_t pid;
+	int i, status;
+
+	if (mock_server_start(&ms, handler, NULL) < 0) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	rh = init_handle(&ms, "60");
+	base = lookups;
+	reads = netlink_reads;
+	for (i = 0; i < 4; i++)
+		send_request(rh);
+	if (lookups - base != 1) {
+		fprintf(stderr, "error in %d: %u lookups\n", __LINE__, lookups - base);
+		exit(1);
+	}
+	/* the notifications are read at most once a second */
+	if (netlink_sockets > 0 && netlink_reads - reads > 2) {
+		fprintf(stderr, "error in %d: %u netlink reads\n", __LINE__,
+			netlink_reads - reads);
+		exit(1);
+	}
+
+	/* the child does not share the netlink socket of its parent */
+	sockets = netlink_sockets;
+	pid = fork();
+	if (pid == -1) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	if (pid == 0) {
+		send_request(rh);
+		if (sockets > 0 && netlink_sockets - sockets != 1) {
+			fprintf(stderr, "error in %d: %u netlink sockets\n", __LINE__,
+				netlink_sockets - sockets);
+			exit(1);
+		}
+		rc_destroy(rh);
+		exit(0);
+	}
+	if (waitpid(pid, &status, 0) != pid ||
+	    !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "error in %d: the child failed\n", __LINE__);
+		exit(1);
+	}
+	send_request(rh);
+	if (netlink_sockets != sockets) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	rc_destroy(rh);
+
+	rh = init_handle(&ms, "0");
+	base = lookups;
+	for (i = 0; i < 3; i++)
+		send_request(rh);
+	if (lookups - base != 3) {
+		fprintf(stderr, "error in %d: %u lookups\n", __LINE__, lookups - base);
+		exit(1);
+	}
+	rc_destroy(rh);
+
+	mock_server_stop(&ms);
+
+	return 0;
+}
+#else
+int main(int argc, char **argv)
+{
+	/* getsockname(), socket() and recv() cannot be counted */
+	return 77;
+}
+#endif
@@ -0,0 +1,180 @@
+/*
+ * tcp-mux.c	Checks of the pipelined RADIUS/TCP requests.
+ *
+ * License:	BSD
+ *
+ */
+
+/* Checks that RADIUS/TCP requests are pipelined on a persistent
+ * connection: sequential and concurrent requests share it, replies
+ * which arrive out of order reach their requests, and a connection
+ * closed by the server is replaced. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <radcli/radcli.h>
+#include "mock-server.h"
+
+#define THREADS 4
+#define THREAD_REQUESTS 100
+
+static int handler(struct mock_server *ms, const uint8_t *pkt, int len,
+		   const struct sockaddr_in *from)
+{
+	if (mock_has_user(pkt, len, "silent"))
+		return MOCK_DROP;
+
+	return MOCK_REPLY;
+}
+
+static rc_handle *rh;
+
+static void *thread_main(void *arg)
+{
+	int i;
+
+	for (i = 0; i < THREAD_REQUESTS; i++) {
+		if (mock_send_server(rh, "test", 5) != OK_RC) {
+			fprintf(stderr, "error in %d\n", __LINE__);
+			exit(1);
+		}
+	}
+	return NULL;
+}
+
+/* two requests driven from one loop share the descriptor */
+static void check_event_loop(void)
+{
+	SEND_DATA data[2];
+	RC_REQUEST *req[2];
+	struct pollfd pfd;
+	int i, ret, timeout;
+
+	for (i = 0; i < 2; i++) {
+		mock_init_data(rh, &data[i], "test", 5, 0);
+		req[i] = rc_request_new(rh, &data[i], NULL, AUTH);
+		if (req[i] == NULL || rc_request_start(req[i]) != PENDING_RC) {
+			fprintf(stderr, "error in %d\n", __LINE__);
+			exit(1);
+		}
+	}
+
+	if (rc_request_get_fd(req[0]) != rc_request_get_fd(req[1])) {
+		fprintf(stderr, "error in %d: requests use different connections\n",
+			__LINE__);
+		exit(1);
+	}
+
+	while (rc_request_get_result(req[0]) == PENDING_RC ||
+	       rc_request_get_result(req[1]) == PENDING_RC) {
+		timeout = -1;
+		for (i = 0; i < 2; i++) {
+			if (rc_request_get_result(req[i]) != PENDING_RC)
+				continue;
+			pfd.fd = rc_request_get_fd(req[i]);
+			ret = rc_request_get_timeout(req[i]);
+			if (timeout < 0 || ret < timeout)
+				timeout = ret;
+		}
+
+		pfd.events = POLLIN;
+		ret = poll(&pfd, 1, timeout);
+		for (i = 0; i < 2; i++) {
+			if (ret > 0)
+				rc_request_on_readable(req[i]);
+			else
+				rc_request_on_timeout(req[i]);
+		}
+	}
+
+	for (i = 0; i < 2; i++) {
+		if (rc_request_get_result(req[i]) != OK_RC) {
+			fprintf(stderr, "error in %d: %d\n", __LINE__,
+				rc_request_get_result(req[i]));
+			exit(1);
+		}
+		rc_request_free(req[i]);
+		rc_avpair_free(data[i].send_pairs);
+		rc_avpair_free(data[i].receive_pairs);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t threads[THREADS];
+	struct mock_server ms;
+	char server_name[64];
+	unsigned accepted;
+	int i;
+
+	if (mock_tcp_server_start(&ms, handler, NULL) < 0) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	mock_servers(server_name, sizeof(server_name), &ms, 1);
+	rh = mock_handle_new(server_name, "serv-type", "tcp", NULL);
+
+	for (i = 0; i < 20; i++) {
+		if (mock_send_server(rh, "test", 5) != OK_RC) {
+			fprintf(stderr, "error in %d\n", __LINE__);
+			exit(1);
+		}
+	}
+
+	if (ms.accepted != 1) {
+		fprintf(stderr, "error in %d: %u connections\n", __LINE__,
+			ms.accepted);
+		exit(1);
+	}
+
+	for (i = 0; i < THREADS; i++) {
+		if (pthread_create(&threads[i], NULL, thread_main, NULL) != 0) {
+			fprintf(stderr, "error in %d\n", __LINE__);
+			exit(1);
+		}
+	}
+	for (i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	check_event_loop();
+
+	/* an unanswered request leaves the connection usable */
+	accepted = ms.accepted;
+	if (mock_send_server(rh, "silent", 1) != TIMEOUT_RC ||
+	    mock_send_server(rh, "test", 5) != OK_RC) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	if (ms.accepted != accepted) {
+		fprintf(stderr, "error in %d: connection was not kept\n", __LINE__);
+		exit(1);
+	}
+
+	/* the server closes the idle connection */
+	ms.drop = 1;
+	while (ms.drop)
+		usleep(10000);
+
+	if (mock_send_server(rh, "test", 5) != OK_RC) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	if (ms.accepted != accepted + 1) {
+		fprintf(stderr, "error in %d: %u connections\n", __LINE__,
+			ms.accepted);
+		exit(1);
+	}
+
+	rc_destroy(rh);
+	mock_server_stop(&ms);
+
+	return 0;
+}
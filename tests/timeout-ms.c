@@ -0,0 +1,152 @@
+/*
+ * timeout-ms.c	Checks of the timeouts below a second.
+ *
+ * License:	BSD
+ *
+ */
+
+
+/* Checks that timeouts below a second are honoured, when set with the
+ * radius_timeout_ms option or with rc_buildreq_ms(). */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <radcli/radcli.h>
+#include "mock-server.h"
+
+static unsigned requests;
+
+static int handler(struct mock_server *ms, const uint8_t *pkt, int len,
+		   const struct sockaddr_in *from)
+{
+	requests++;
+
+	if (mock_has_user(pkt, len, "silent"))
+		return MOCK_DROP;
+
+	return MOCK_REPLY;
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static rc_handle *init_handle(struct mock_server *ms)
+{
+	char servers[64];
+
+	mock_servers(servers, sizeof(servers), ms, 1);
+	return mock_handle_new(servers, "radius_timeout_ms", "200",
+			       "radius_retries", "1", NULL);
+}
+
+static VALUE_PAIR *make_pairs(rc_handle *rh, const char *user)
+{
+	VALUE_PAIR *send = NULL;
+	uint32_t service = PW_AUTHENTICATE_ONLY;
+
+	if (rc_avpair_add(rh, &send, PW_USER_NAME, user, -1, 0) == NULL ||
+	    rc_avpair_add(rh, &send, PW_SERVICE_TYPE, &service, -1, 0) == NULL) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	return send;
+}
+
+/* sends a request with rc_auth(), using radius_timeout_ms */
+static int send_auth(rc_handle *rh, const char *user)
+{
+	VALUE_PAIR *send, *received = NULL;
+	char msg[PW_MAX_MSG_SIZE];
+	int ret;
+
+	send = make_pairs(rh, user);
+	ret = rc_auth(rh, 0, send, &received, msg);
+
+	rc_avpair_free(send);
+	rc_avpair_free(received);
+	return ret;
+}
+
+/* sends a request with rc_send_server(), using rc_buildreq_ms() */
+static int send_direct(rc_handle *rh, const char *user, int timeout_ms)
+{
+	SERVER *srv = rc_conf_srv(rh, "authserver");
+	char msg[PW_MAX_MSG_SIZE];
+	SEND_DATA data;
+	int ret;
+
+	rc_buildreq_ms(rh, &data, PW_ACCESS_REQUEST, srv->name[0], srv->port[0],
+		       srv->secret[0], timeout_ms, 0);
+	data.send_pairs = make_pairs(rh, user);
+	data.receive_pairs = NULL;
+
+	ret = rc_send_server(rh, &data, msg, AUTH);
+
+	rc_avpair_free(data.send_pairs);
+	rc_avpair_free(data.receive_pairs);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	struct mock_server ms;
+	rc_handle *rh;
+	double start, elapsed;
+
+	if (mock_server_start(&ms, handler, NULL) < 0) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	rh = init_handle(&ms);
+
+	if (send_auth(rh, "test") != OK_RC ||
+	    send_direct(rh, "test", 200) != OK_RC) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	/* a request and its retransmission wait for 200ms each */
+	requests = 0;
+	start = now();
+	if (send_auth(rh, "silent") != TIMEOUT_RC) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	elapsed = now() - start;
+	if (requests != 2) {
+		fprintf(stderr, "error in %d: %u requests\n", __LINE__, requests);
+		exit(1);
+	}
+	if (elapsed < 0.35 || elapsed > 0.9) {
+		fprintf(stderr, "error in %d: the request took %.2fs\n",
+			__LINE__, elapsed);
+		exit(1);
+	}
+
+	start = now();
+	if (send_direct(rh, "silent", 150) != TIMEOUT_RC) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	elapsed = now() - start;
+	if (elapsed < 0.1 || elapsed > 0.6) {
+		fprintf(stderr, "error in %d: the request took %.2fs\n",
+			__LINE__, elapsed);
+		exit(1);
+	}
+
+	rc_destroy(rh);
+	mock_server_stop(&ms);
+
+	return 0;
+}
@@ -0,0 +1,247 @@
+/*
+ * tls-mux.c	Checks of the multiplexed TLS sessions.
+ *
+ * License:	BSD
+ *
+ */
+
+/* Checks that with tls-multiplex requests from several threads are in
+ * flight over a TLS session at the same time. The server answers only
+ * once a request from every thread is pending, so requests which hold
+ * the session for their round trip would time out. Then checks that
+ * with tls-sessions the requests are spread over parallel sessions,
+ * both when multiplexing and when a request holds its session, and
+ * that a request goes to another session when all the Identifiers of
+ * the one it was handed are in flight, and that the requests over a
+ * session which is restarted are failed. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <radcli/radcli.h>
+#include "mock-server.h"
+
+#define THREADS 4
+#define THREAD_REQUESTS 25
+#define IDENTIFIERS 256
+
+static rc_handle *rh;
+
+/* the client ports seen by the server; it serves from a single thread */
+static unsigned ports[THREADS];
+static unsigned nports;
+
+static int handler(struct mock_server *ms, const uint8_t *pkt, int len,
+		   const struct sockaddr_in *from)
+{
+	unsigned i;
+
+	for (i = 0; i < nports; i++) {
+		if (ports[i] == ntohs(from->sin_port))
+			return MOCK_REPLY;
+	}
+	if (nports < THREADS)
+		ports[nports++] = ntohs(from->sin_port);
+
+	return MOCK_REPLY;
+}
+
+static void *thread_main(void *arg)
+{
+	int i, ret;
+
+	for (i = 0; i < THREAD_REQUESTS; i++) {
+		ret = mock_send_server(rh, "test", 5);
+		if (ret != OK_RC) {
+			fprintf(stderr, "error in %d: %d\n", __LINE__, ret);
+			exit(1);
+		}
+	}
+	return NULL;
+}
+
+static void new_handle(struct mock_server *ms, const char *multiplex,
+		       const char *sessions)
+{
+	char server_name[128];
+
+	mock_servers(server_name, sizeof(server_name), ms, 1);
+	rh = mock_handle_new(server_name, "serv-type", "tls",
+			     "tls-multiplex", multiplex,
+			     "tls-sessions", sessions, NULL);
+}
+
+static void check(const char *multiplex, const char *sessions, unsigned batch)
+{
+	pthread_t threads[THREADS];
+	struct mock_server ms;
+	unsigned expected = atoi(sessions);
+	int i;
+
+	nports = 0;
+	if (mock_tls_server_start(&ms, handler, NULL, batch) < 0) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	new_handle(&ms, multiplex, sessions);
+
+	for (i = 0; i < THREADS; i++) {
+		if (pthread_create(&threads[i], NULL, thread_main, NULL) != 0) {
+			fprintf(stderr, "error in %d\n", __LINE__);
+			exit(1);
+		}
+	}
+	for (i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	if (ms.accepted != expected) {
+		fprintf(stderr, "error in %d: %u connections\n", __LINE__,
+			ms.accepted);
+		exit(1);
+	}
+
+	if (nports != expected) {
+		fprintf(stderr, "error in %d: %u sessions used\n", __LINE__,
+			nports);
+		exit(1);
+	}
+
+	rc_destroy(rh);
+	mock_server_stop(&ms);
+}
+
+static int silent_handler(struct mock_server *ms, const uint8_t *pkt,
+			  int len, const struct sockaddr_in *from)
+{
+	return mock_has_user(pkt, len, "silent") ? MOCK_DROP : MOCK_REPLY;
+}
+
+/* The sessions are handed out in turn; a request which is never answered
+ * is started on the first session and one which is answered on the
+ * second, until all the Identifiers of the first are in flight. */
+static void check_spill(void)
+{
+	static SEND_DATA silent[IDENTIFIERS];
+	static RC_REQUEST *req[IDENTIFIERS];
+	struct mock_server ms;
+	SEND_DATA data;
+	int i, ret;
+
+	if (mock_tls_server_start(&ms, silent_handler, NULL, 1) < 0) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	new_handle(&ms, "true", "2");
+
+	for (i = 0; i < IDENTIFIERS; i++) {
+		mock_init_data(rh, &silent[i], "silent", 10, 0);
+		req[i] = rc_request_new(rh, &silent[i], NULL, AUTH);
+		if (req[i] == NULL || rc_request_start(req[i]) != PENDING_RC) {
+			fprintf(stderr, "error in %d: request %d\n", __LINE__, i);
+			exit(1);
+		}
+
+		mock_init_data(rh, &data, "test", 10, 0);
+		ret = rc_send_server(rh, &data, NULL, AUTH);
+		if (ret != OK_RC) {
+			fprintf(stderr, "error in %d: %d\n", __LINE__, ret);
+			exit(1);
+		}
+		rc_avpair_free(data.send_pairs);
+		rc_avpair_free(data.receive_pairs);
+	}
+
+	/* handed the first session, this one is sent over the second */
+	mock_init_data(rh, &data, "test", 10, 0);
+	ret = rc_send_server(rh, &data, NULL, AUTH);
+	if (ret != OK_RC) {
+		fprintf(stderr, "error in %d: %d\n", __LINE__, ret);
+		exit(1);
+	}
+	rc_avpair_free(data.send_pairs);
+	rc_avpair_free(data.receive_pairs);
+
+	for (i = 0; i < IDENTIFIERS; i++) {
+		rc_request_free(req[i]);
+		rc_avpair_free(silent[i].send_pairs);
+	}
+
+	rc_destroy(rh);
+	mock_server_stop(&ms);
+}
+
+/* The server closes the session while a request awaits its reply; the
+ * next request notices, and the session is restarted. */
+static void check_restart(void)
+{
+	struct mock_server ms;
+	SEND_DATA silent;
+	RC_REQUEST *req;
+	int ret;
+
+	if (mock_tls_server_start(&ms, silent_handler, NULL, 1) < 0) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	new_handle(&ms, "true", "1");
+
+	if (mock_send_server(rh, "test", 10) != OK_RC) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	mock_init_data(rh, &silent, "silent", 10, 0);
+	req = rc_request_new(rh, &silent, NULL, AUTH);
+	if (req == NULL || rc_request_start(req) != PENDING_RC) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	ms.drop = 1;
+	while (ms.drop)
+		usleep(10000);
+
+	/* the session fails under this request, and is restarted by
+	 * rc_check_tls() while the other is attached to it */
+	mock_send_server(rh, "test", 10);
+	if (rc_check_tls(rh) != 0) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	ret = mock_send_server(rh, "test", 10);
+	if (ret != OK_RC) {
+		fprintf(stderr, "error in %d: %d\n", __LINE__, ret);
+		exit(1);
+	}
+
+	/* the request over the old session failed with it, before it
+	 * read from the session again */
+	if (rc_request_get_timeout(req) != 0) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	ret = rc_request_on_readable(req);
+	if (ret == PENDING_RC || ret == OK_RC) {
+		fprintf(stderr, "error in %d: %d\n", __LINE__, ret);
+		exit(1);
+	}
+
+	rc_request_free(req);
+	rc_avpair_free(silent.send_pairs);
+	rc_destroy(rh);
+	mock_server_stop(&ms);
+}
+
+int main(int argc, char **argv)
+{
+	check("true", "1", THREADS);
+	check("true", "2", 1);
+	check("false", "4", 1);
+	check_spill();
+	check_restart();
+
+	return 0;
+}
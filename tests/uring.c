@@ -0,0 +1,253 @@
+/*
+ * uring.c	Checks of the io_uring transport.
+ *
+ * License:	BSD
+ *
+ */
+
+/* Runs synchronous and engine requests over the io_uring transport, and
+ * checks that a thread may exit after the handle it used was released.
+ * The test is skipped when the transport is not available. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <radcli/radcli.h>
+#include "mock-server.h"
+
+#define REQUESTS 100
+/* the reply timeout of the request waited for while another thread sends */
+#define SILENT_TIMEOUT 3
+
+static int handler(struct mock_server *ms, const uint8_t *pkt, int len,
+		   const struct sockaddr_in *from)
+{
+	if (mock_has_user(pkt, len, "silent"))
+		return MOCK_DROP;
+
+	return MOCK_REPLY;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+struct silent_arg {
+	rc_handle *rh;
+	volatile int started;
+	int result;
+};
+
+/* waits for a reply which never comes */
+static void *send_silent(void *ptr)
+{
+	struct silent_arg *arg = ptr;
+	char msg[PW_MAX_MSG_SIZE];
+	SEND_DATA sdata;
+
+	mock_init_data(arg->rh, &sdata, "silent", SILENT_TIMEOUT, 0);
+	arg->started = 1;
+	arg->result = rc_send_server(arg->rh, &sdata, msg, AUTH);
+	rc_avpair_free(sdata.send_pairs);
+	return NULL;
+}
+
+/* sends a request, then exits once the handle was released */
+struct linger_arg {
+	rc_handle *rh;
+	volatile int sent;
+	volatile int released;
+	int result;
+};
+
+static void *send_linger(void *ptr)
+{
+	struct linger_arg *arg = ptr;
+	char msg[PW_MAX_MSG_SIZE];
+	SEND_DATA sdata;
+
+	mock_init_data(arg->rh, &sdata, "test", 1, 0);
+	arg->result = rc_send_server(arg->rh, &sdata, msg, AUTH);
+	rc_avpair_free(sdata.send_pairs);
+	rc_avpair_free(sdata.receive_pairs);
+	arg->sent = 1;
+	while (!arg->released)
+		usleep(1000);
+	return NULL;
+}
+
+static rc_handle *new_handle(struct mock_server *ms)
+{
+	char server_name[64];
+	rc_handle *rh;
+
+	mock_servers(server_name, sizeof(server_name), ms, 1);
+	rh = mock_handle_config(server_name, "serv-type", "udp-uring", NULL);
+	if (rc_apply_config(rh) == -1) {
+		rc_destroy(rh);
+		return NULL;
+	}
+	return rh;
+}
+
+static void send_test(rc_handle *rh)
+{
+	int ret;
+
+	ret = mock_send_server(rh, "test", 1);
+	if (ret != OK_RC) {
+		fprintf(stderr, "error in %d: %d\n", __LINE__, ret);
+		exit(1);
+	}
+}
+
+static void completed(RC_ENGINE *engine, SEND_DATA *data, int result, void *usr)
+{
+	int *count = usr;
+
+	if (result == OK_RC)
+		(*count)++;
+	rc_avpair_free(data->receive_pairs);
+	rc_avpair_free(data->send_pairs);
+	data->receive_pairs = data->send_pairs = NULL;
+}
+
+int main(int argc, char **argv)
+{
+	static SEND_DATA data[REQUESTS];
+	struct mock_server ms;
+	char msg[PW_MAX_MSG_SIZE];
+	struct silent_arg silent;
+	struct linger_arg linger;
+	RC_ENGINE *engine;
+	SEND_DATA sdata;
+	pthread_t thread;
+	rc_handle *rh;
+	double start;
+	int i, ret, count = 0;
+
+	if (mock_server_start(&ms, handler, NULL) < 0) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	rh = new_handle(&ms);
+	if (rh == NULL) {
+		fprintf(stderr, "io_uring is not available; skipping\n");
+		mock_server_stop(&ms);
+		exit(77);
+	}
+
+	/* synchronous requests; the reply timeout is handled by the ring */
+	for (i = 0; i < 3; i++)
+		send_test(rh);
+
+	mock_init_data(rh, &sdata, "silent", 1, 0);
+	ret = rc_send_server(rh, &sdata, msg, AUTH);
+	rc_avpair_free(sdata.send_pairs);
+	if (ret != TIMEOUT_RC) {
+		fprintf(stderr, "error in %d: %d\n", __LINE__, ret);
+		exit(1);
+	}
+
+	/* a thread waiting for a reply does not hold back the others */
+	silent.rh = rh;
+	silent.started = 0;
+	if (pthread_create(&thread, NULL, send_silent, &silent) != 0) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	while (!silent.started)
+		usleep(1000);
+	usleep(100000);
+
+	start = now();
+	for (i = 0; i < 10; i++) {
+		mock_init_data(rh, &sdata, "test", 1, 0);
+		ret = rc_send_server(rh, &sdata, msg, AUTH);
+		rc_avpair_free(sdata.send_pairs);
+		rc_avpair_free(sdata.receive_pairs);
+		if (ret != OK_RC) {
+			fprintf(stderr, "error in %d: %d\n", __LINE__, ret);
+			exit(1);
+		}
+	}
+	if (now() - start > SILENT_TIMEOUT / 2.0) {
+		fprintf(stderr, "error in %d: the requests took %.1f s\n", __LINE__,
+			now() - start);
+		exit(1);
+	}
+
+	pthread_join(thread, NULL);
+	if (silent.result != TIMEOUT_RC) {
+		fprintf(stderr, "error in %d: %d\n", __LINE__, silent.result);
+		exit(1);
+	}
+
+	/* batched requests through the engine */
+	engine = rc_engine_new(rh);
+	if (engine == NULL) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	for (i = 0; i < REQUESTS; i++) {
+		mock_init_data(rh, &data[i], "test", 1, 0);
+		data[i].retries = 2;
+		if (rc_engine_submit(engine, &data[i], AUTH, completed, &count) != OK_RC) {
+			fprintf(stderr, "error in %d\n", __LINE__);
+			exit(1);
+		}
+	}
+
+	while ((ret = rc_engine_run(engine, 1000)) > 0)
+		;
+
+	if (ret < 0 || count != REQUESTS) {
+		fprintf(stderr, "error in %d: %d/%d\n", __LINE__, ret, count);
+		exit(1);
+	}
+
+	rc_engine_free(engine);
+
+	/* the handle is released while a thread which used it runs */
+	linger.rh = rh;
+	linger.sent = linger.released = 0;
+	if (pthread_create(&thread, NULL, send_linger, &linger) != 0) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	while (!linger.sent)
+		usleep(1000);
+	rc_destroy(rh);
+	linger.released = 1;
+	pthread_join(thread, NULL);
+	if (linger.result != OK_RC) {
+		fprintf(stderr, "error in %d: %d\n", __LINE__, linger.result);
+		exit(1);
+	}
+
+	/* a new handle, which may have the address of the released one,
+	 * gets rings of its own */
+	for (i = 0; i < 3; i++) {
+		rh = new_handle(&ms);
+		if (rh == NULL) {
+			fprintf(stderr, "error in %d\n", __LINE__);
+			exit(1);
+		}
+		send_test(rh);
+		rc_destroy(rh);
+	}
+
+	mock_server_stop(&ms);
+
+	return 0;
+}